@@ -0,0 +1,83 @@
+#include "pch.h"
+
+#include "Assets.h"
+#include "Mesh.h"
+
+#include <string>
+#include <vector>
+#include <string_view>
+
+AssetRegistry& getAssetRegistry()
+{
+    static AssetRegistry registry;
+    return registry;
+}
+
+AssetId AssetRegistry::intern(std::string_view name)
+{
+    if (auto id = find(name); id != AssetId::Invalid) {
+        return id;
+    }
+
+    auto id = AssetId(m_models.size());
+
+    auto& model = m_models.emplace_back();
+    model.name = name;
+    m_ids.emplace(model.name, id);
+
+    return id;
+}
+
+AssetId AssetRegistry::find(std::string_view name) const
+{
+    if (auto it = m_ids.find(std::string(name)); it != m_ids.end()) {
+        return it->second;
+    }
+
+    return AssetId::Invalid;
+}
+
+AssetId AssetRegistry::addModel(const Mesh& mesh, RenderableHandle renderable, std::string_view filename)
+{
+    auto id = intern(mesh.getName());
+
+    auto& model = m_models[u32(id)];
+    model.renderable = renderable;
+    model.loaded = true;
+    model.bounds = mesh.getBounds();
+    model.filename = filename;
+    model.collisionHull = mesh.getCollisionHull();
+    model.occluder = mesh.getOccluder();
+
+    std::vector<DirectX::XMFLOAT3> positions;
+    positions.reserve(mesh.getVertices().size());
+
+    for (const auto& v : mesh.getVertices()) {
+        positions.push_back(v.Position);
+    }
+
+    model.triangles.build(positions, mesh.getIndices());
+
+    return id;
+}
+
+void AssetRegistry::releaseRenderables(IRenderer& renderer)
+{
+    for (auto& model : m_models) {
+        if (model.renderable != RenderableHandle::Invalid) {
+            renderer.releaseRenderable(model.renderable);
+            model.renderable = RenderableHandle::Invalid;
+        }
+    }
+}
+
+const std::string& AssetRegistry::getName(AssetId id) const
+{
+    static const std::string empty;
+
+    if (!isValid(id)) {
+        return empty;
+    }
+
+    return m_models[u32(id)].name;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "Common.h"
+#include "Renderer.h"
+#include "TriangleBvh.h"
+
+#include <DirectXMath.h>
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Compact handle to a model in the asset registry. IDs are plain indices into the
+// registry's tables, so resolving one is an array lookup.
+enum class AssetId : u32
+{
+    Invalid = ~0u,
+};
+
+struct ModelAsset
+{
+    std::string name;
+    std::string filename;
+
+    // Invalid when running headless, everything else is still there
+    RenderableHandle renderable = RenderableHandle::Invalid;
+    bool loaded = false;
+    Bounds bounds{ math::Vector<math::Model>(0.0f), math::Vector<math::Model>(0.0f) };
+    std::vector<DirectX::XMFLOAT3> collisionHull;
+
+    // Model space triangle list, empty if the model isn't an occluder
+    std::vector<DirectX::XMFLOAT3> occluder;
+
+    // Model space triangles for picking
+    TriangleBvh triangles;
+};
+
+class AssetRegistry
+{
+public:
+    // Returns the ID for the name, adding an empty entry if it hasn't been seen before.
+    // Scenes can reference models that aren't loaded, this keeps their names around.
+    AssetId intern(std::string_view name);
+    AssetId find(std::string_view name) const;
+
+    // Takes over the renderable
+    AssetId addModel(const class Mesh& mesh, RenderableHandle renderable, std::string_view filename = "");
+
+    // Releases the renderables before their renderer goes away, the rest of the models stays
+    void releaseRenderables(IRenderer& renderer);
+
+    bool isLoaded(AssetId id) const
+    {
+        return isValid(id) && m_models[u32(id)].loaded;
+    }
+
+    bool isValid(AssetId id) const
+    {
+        return u32(id) < m_models.size();
+    }
+
+    const ModelAsset& get(AssetId id) const
+    {
+        return m_models[u32(id)];
+    }
+
+    const std::string& getName(AssetId id) const;
+
+    u32 size() const
+    {
+        return u32(m_models.size());
+    }
+
+private:
+    std::vector<ModelAsset> m_models;
+    std::unordered_map<std::string, AssetId> m_ids;
+};
+
+AssetRegistry& getAssetRegistry();
@@ -6,10 +6,10 @@ ByteAddressBuffer instanceBuffer : register(t1);
 
 float4 main(uint vIdx : SV_VertexID, uint iIdx : SV_InstanceID) : SV_POSITION
 {
-	matrix world = loadWorldMatrix(instanceBuffer, iIdx);
+	float3x4 world = loadWorldMatrix(instanceBuffer, iIdx);
 	float4 position = float4(loadPosition(vertexBuffer, vIdx), 1.0f);
 
-	position = mul(position, world);
+	position = float4(mul(world, position), 1.0f);
 	position = mul(position, camera.View);
 	position = mul(position, camera.Projection);
 
@@ -0,0 +1,1042 @@
+#include "pch.h"
+
+#include "Bench.h"
+#include "Common.h"
+#include "CommandLine.h"
+#include "DynamicAabbTree.h"
+#include "Geometry.h"
+#include "TriangleBvh.h"
+#include "Scene.h"
+#include "TaskScheduler.h"
+#include "Assets.h"
+#include "Camera.h"
+#include "MathBatch.h"
+#include "Mesh.h"
+#include "MemoryTracker.h"
+#include "OcclusionBuffer.h"
+#include "SceneRendering.h"
+
+#include "Components/PointLight.h"
+#include "Components/Renderable.h"
+#include "Components/Transform.h"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fmt/format.h>
+#include <numeric>
+#include <random>
+
+using namespace DirectX;
+
+namespace
+{
+
+using BenchClock = std::chrono::steady_clock;
+
+double elapsedMs(BenchClock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(BenchClock::now() - start).count();
+}
+
+struct Stats
+{
+    double mean = 0.0;
+    double median = 0.0;
+    double p90 = 0.0;
+    double p99 = 0.0;
+    double min = 0.0;
+    double max = 0.0;
+};
+
+Stats getStats(std::vector<double> samples)
+{
+    Stats stats;
+
+    if (samples.empty()) {
+        return stats;
+    }
+
+    std::sort(samples.begin(), samples.end());
+
+    stats.mean = std::accumulate(samples.begin(), samples.end(), 0.0) / double(samples.size());
+    stats.median = samples[samples.size() / 2];
+    stats.p90 = samples[samples.size() * 90 / 100];
+    stats.p99 = samples[samples.size() * 99 / 100];
+    stats.min = samples.front();
+    stats.max = samples.back();
+
+    return stats;
+}
+
+void printStats(std::string_view name, const Stats& stats)
+{
+    fmt::print("{:<24} mean {:8.3f} ms  median {:8.3f} ms  min {:8.3f} ms  max {:8.3f} ms\n",
+        name, stats.mean, stats.median, stats.min, stats.max);
+}
+
+void printPercentiles(std::string_view name, const Stats& stats)
+{
+    fmt::print("{:<24} mean {:8.3f}  p50 {:8.3f}  p90 {:8.3f}  p99 {:8.3f}  max {:8.3f} ms\n",
+        name, stats.mean, stats.median, stats.p90, stats.p99, stats.max);
+}
+
+// Returns the numbered positional argument or the default if it's missing or not a number
+u32 getArg(const std::vector<std::string_view>& args, size_t idx, u32 defaultValue)
+{
+    if (idx >= args.size()) {
+        return defaultValue;
+    }
+
+    u32 value = defaultValue;
+    auto arg = args[idx];
+
+    if (auto [_, ec] = std::from_chars(arg.data(), arg.data() + arg.size(), value); ec != std::errc{}) {
+        return defaultValue;
+    }
+
+    return value;
+}
+
+// The game is a Windows subsystem app, so there's no console unless we ask for one
+void attachConsole()
+{
+    if (GetStdHandle(STD_OUTPUT_HANDLE)) {
+        return;
+    }
+
+    if (AttachConsole(ATTACH_PARENT_PROCESS)) {
+        FILE* f = nullptr;
+        freopen_s(&f, "CONOUT$", "w", stdout);
+        freopen_s(&f, "CONOUT$", "w", stderr);
+    }
+}
+
+Stats runBoxStack(const PhysicsSettings& settings, u32 boxCount, u32 steps)
+{
+    constexpr u32 StackHeight = 16;
+    constexpr float Spacing = 1.5f;
+
+    Scene scene(settings);
+
+    auto columns = u32(std::ceil(std::sqrt(float(boxCount) / float(StackHeight))));
+    auto halfExtent = float(columns) * Spacing * 0.5f + 5.0f;
+
+    // Top of the ground is at y = 0
+    scene.physicsWorld.addBox(halfExtent, 1.0f, halfExtent, 0.0f, 0.0f, -1.0f, 0.0f);
+
+    for (u32 i = 0; i < boxCount; i++) {
+        auto column = i / StackHeight;
+        auto level = i % StackHeight;
+
+        auto e = scene.reg.create();
+
+        auto& t = scene.reg.emplace<components::Transform>(e);
+        t.position = XMFLOAT3(
+            (float(column % columns) - float(columns) * 0.5f) * Spacing,
+            0.5f + float(level),
+            (float(column / columns) - float(columns) * 0.5f) * Spacing);
+
+        scene.reg.emplace<components::Physics>(e, 1.0f);
+    }
+
+    std::vector<double> samples;
+    samples.reserve(steps);
+
+    for (u32 i = 0; i < steps; i++) {
+        auto start = BenchClock::now();
+        scene.physicsWorld.step();
+        samples.push_back(elapsedMs(start));
+
+        scene.physicsWorld.update();
+    }
+
+    return getStats(std::move(samples));
+}
+
+int physicsBenchmark(const std::vector<std::string_view>& args)
+{
+    auto boxCount = getArg(args, 3, 4096);
+    auto steps = getArg(args, 4, 300);
+
+    fmt::print("Box stack: {} boxes, {} steps, {} threads\n", boxCount, steps, getTaskScheduler().getThreadCount());
+
+    PhysicsSettings st;
+    st.multithreaded = false;
+
+    PhysicsSettings mt;
+    mt.multithreaded = true;
+
+    auto stStats = runBoxStack(st, boxCount, steps);
+    printStats("single threaded", stStats);
+
+    auto mtStats = runBoxStack(mt, boxCount, steps);
+    printStats("multithreaded", mtStats);
+
+    if (mtStats.mean > 0.0) {
+        fmt::print("speedup {:.2f}x\n", stStats.mean / mtStats.mean);
+    }
+
+    return 0;
+}
+
+// Random boxes in a cube, compared against testing every box
+int bvhBenchmark(const std::vector<std::string_view>& args)
+{
+    constexpr float WorldSize = 2000.0f;
+
+    auto count = getArg(args, 3, 1000000);
+    auto queries = getArg(args, 4, 100);
+
+    fmt::print("BVH: {} boxes, {} queries of each kind\n", count, queries);
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> position(-WorldSize * 0.5f, WorldSize * 0.5f);
+    std::uniform_real_distribution<float> extent(0.25f, 2.0f);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+    auto randomPoint = [&] {
+        return XMFLOAT3(position(rng), position(rng), position(rng));
+    };
+
+    auto randomDirection = [&] {
+        XMFLOAT3 d;
+        XMStoreFloat3(&d, XMVector3Normalize(XMVectorSet(unit(rng), unit(rng), unit(rng), 0.0f)));
+        return d;
+    };
+
+    std::vector<math::Aabb> boxes(count);
+
+    for (auto& box : boxes) {
+        auto c = randomPoint();
+        auto e = extent(rng);
+        box = math::Aabb{ { c.x - e, c.y - e, c.z - e }, { c.x + e, c.y + e, c.z + e } };
+    }
+
+    DynamicAabbTree tree;
+    std::vector<i32> proxies(count);
+
+    auto start = BenchClock::now();
+
+    for (u32 i = 0; i < count; i++) {
+        proxies[i] = tree.createProxy(boxes[i], i);
+    }
+
+    fmt::print("{:<24} {:8.3f} ms, height {}\n", "build", elapsedMs(start), tree.getHeight());
+
+    // A tenth of the boxes moving a little, like a frame of gameplay
+    {
+        u32 moved = 0;
+        u32 reinserted = 0;
+
+        start = BenchClock::now();
+
+        for (u32 i = 0; i < count; i += 10) {
+            auto& box = boxes[i];
+            auto dx = unit(rng) * 0.2f;
+
+            box.min.x += dx;
+            box.max.x += dx;
+
+            reinserted += tree.moveProxy(proxies[i], box) ? 1 : 0;
+            moved++;
+        }
+
+        fmt::print("{:<24} {:8.3f} ms, {} moved, {} reinserted\n", "refit", elapsedMs(start), moved, reinserted);
+    }
+
+    std::vector<math::Frustum> frustums(queries);
+    std::vector<XMFLOAT3> centers(queries);
+    std::vector<XMFLOAT3> directions(queries);
+
+    for (u32 i = 0; i < queries; i++) {
+        auto eye = randomPoint();
+        auto dir = randomDirection();
+
+        auto view = XMMatrixLookToLH(XMLoadFloat3(&eye), XMLoadFloat3(&dir), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+        auto projection = XMMatrixPerspectiveFovLH(XM_PIDIV2, 16.0f / 9.0f, 200.0f, 0.1f);
+
+        frustums[i] = math::Frustum::fromMatrix(XMMatrixMultiply(view, projection));
+        centers[i] = eye;
+        directions[i] = dir;
+    }
+
+    // Times both versions of a query and prints the total hits so they can be compared
+    auto compare = [&](std::string_view name, auto&& treeQuery, auto&& bruteQuery) {
+        std::vector<double> treeSamples;
+        std::vector<double> bruteSamples;
+        size_t treeHits = 0;
+        size_t bruteHits = 0;
+
+        for (u32 i = 0; i < queries; i++) {
+            start = BenchClock::now();
+            treeHits += treeQuery(i);
+            treeSamples.push_back(elapsedMs(start));
+
+            start = BenchClock::now();
+            bruteHits += bruteQuery(i);
+            bruteSamples.push_back(elapsedMs(start));
+        }
+
+        auto treeStats = getStats(std::move(treeSamples));
+        auto bruteStats = getStats(std::move(bruteSamples));
+
+        printStats(fmt::format("{} (tree)", name), treeStats);
+        printStats(fmt::format("{} (brute force)", name), bruteStats);
+
+        fmt::print("{:<24} {} vs {} hits", "", treeHits, bruteHits);
+
+        if (treeStats.mean > 0.0) {
+            fmt::print(", speedup {:.1f}x", bruteStats.mean / treeStats.mean);
+        }
+
+        fmt::print("\n");
+    };
+
+    compare("frustum",
+        [&](u32 i) {
+            size_t hits = 0;
+            tree.queryFrustum(frustums[i], [&](i32) { hits++; });
+            return hits;
+        },
+        [&](u32 i) {
+            size_t hits = 0;
+            for (const auto& box : boxes) {
+                hits += frustums[i].intersects(box) ? 1 : 0;
+            }
+            return hits;
+        });
+
+    compare("sphere r=50",
+        [&](u32 i) {
+            size_t hits = 0;
+            tree.query([&](const math::Aabb& box) { return box.overlapsSphere(centers[i], 50.0f); },
+                [&](i32) { hits++; });
+            return hits;
+        },
+        [&](u32 i) {
+            size_t hits = 0;
+            for (const auto& box : boxes) {
+                hits += box.overlapsSphere(centers[i], 50.0f) ? 1 : 0;
+            }
+            return hits;
+        });
+
+    // Closest hit, both sides test the exact boxes so the hit counts should match
+    compare("ray closest",
+        [&](u32 i) {
+            const auto& d = directions[i];
+            XMFLOAT3 invDir(1.0f / d.x, 1.0f / d.y, 1.0f / d.z);
+            float closest = WorldSize;
+            bool hit = false;
+
+            tree.raycast(centers[i], d, closest, [&](i32 proxy, float) {
+                if (auto t = boxes[tree.getUserData(proxy)].intersectRay(centers[i], invDir, closest); t >= 0.0f) {
+                    closest = t;
+                    hit = true;
+                }
+                return closest;
+            });
+
+            return size_t(hit);
+        },
+        [&](u32 i) {
+            const auto& d = directions[i];
+            XMFLOAT3 invDir(1.0f / d.x, 1.0f / d.y, 1.0f / d.z);
+            float closest = WorldSize;
+            bool hit = false;
+
+            for (const auto& box : boxes) {
+                if (auto t = box.intersectRay(centers[i], invDir, closest); t >= 0.0f) {
+                    closest = t;
+                    hit = true;
+                }
+            }
+
+            return size_t(hit);
+        });
+
+    return 0;
+}
+
+// Picking rays against a UV sphere, the tree against testing every triangle
+int meshBenchmark(const std::vector<std::string_view>& args)
+{
+    auto segments = std::clamp(getArg(args, 3, 128), 3u, 180u);
+    auto rays = getArg(args, 4, 1000);
+
+    std::vector<XMFLOAT3> positions;
+    std::vector<u16> indices;
+
+    for (u32 ring = 0; ring <= segments; ring++) {
+        auto theta = XM_PI * float(ring) / float(segments);
+
+        for (u32 s = 0; s <= segments; s++) {
+            auto phi = XM_2PI * float(s) / float(segments);
+            positions.emplace_back(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+        }
+    }
+
+    for (u32 ring = 0; ring < segments; ring++) {
+        for (u32 s = 0; s < segments; s++) {
+            auto a = u16(ring * (segments + 1) + s);
+            auto b = u16(a + segments + 1);
+
+            indices.insert(indices.end(), { a, b, u16(a + 1), u16(a + 1), b, u16(b + 1) });
+        }
+    }
+
+    TriangleBvh bvh;
+
+    auto start = BenchClock::now();
+    bvh.build(positions, indices);
+
+    fmt::print("Mesh: {} triangles, {} rays\n", bvh.getTriangleCount(), rays);
+    fmt::print("{:<24} {:8.3f} ms\n", "build", elapsedMs(start));
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+    // From outside the sphere towards a point near it, so some of them miss
+    std::vector<std::pair<XMFLOAT3, XMFLOAT3>> queries(rays);
+
+    for (auto& [origin, direction] : queries) {
+        origin = XMFLOAT3(unit(rng) * 3.0f, unit(rng) * 3.0f, -3.0f);
+        direction = XMFLOAT3(unit(rng) * 1.2f - origin.x, unit(rng) * 1.2f - origin.y, -origin.z);
+    }
+
+    std::vector<double> treeSamples;
+    std::vector<double> bruteSamples;
+    u32 treeHits = 0;
+    u32 bruteHits = 0;
+    u32 mismatches = 0;
+
+    for (const auto& [origin, direction] : queries) {
+        start = BenchClock::now();
+        auto t = bvh.raycast(origin, direction, FLT_MAX);
+        treeSamples.push_back(elapsedMs(start));
+
+        start = BenchClock::now();
+        auto closest = -1.0f;
+
+        for (size_t i = 0; i < indices.size(); i += 3) {
+            auto hit = TriangleBvh::intersectTriangle(
+                positions[indices[i]], positions[indices[i + 1]], positions[indices[i + 2]], origin, direction);
+
+            if (hit >= 0.0f && (closest < 0.0f || hit < closest)) {
+                closest = hit;
+            }
+        }
+
+        bruteSamples.push_back(elapsedMs(start));
+
+        treeHits += t >= 0.0f ? 1 : 0;
+        bruteHits += closest >= 0.0f ? 1 : 0;
+        mismatches += (t >= 0.0f) != (closest >= 0.0f) || std::fabs(t - closest) > 1e-4f ? 1 : 0;
+    }
+
+    auto treeStats = getStats(std::move(treeSamples));
+    auto bruteStats = getStats(std::move(bruteSamples));
+
+    printStats("ray (tree)", treeStats);
+    printStats("ray (brute force)", bruteStats);
+    fmt::print("{:<24} {} vs {} hits, {} mismatches\n", "", treeHits, bruteHits, mismatches);
+
+    return 0;
+}
+
+// Registers the converted models without creating any GPU resources
+std::vector<AssetId> loadModelsHeadless()
+{
+    std::vector<AssetId> models;
+
+    if (!std::filesystem::is_directory("./content")) {
+        return models;
+    }
+
+    // Sorted so the seeded model picks don't depend on the directory order
+    std::vector<std::filesystem::path> paths;
+
+    for (const auto& entry : std::filesystem::directory_iterator("./content")) {
+        if (entry.is_regular_file() && entry.path().extension() == ".mesh") {
+            paths.push_back(entry.path());
+        }
+    }
+
+    std::sort(paths.begin(), paths.end());
+
+    for (const auto& p : paths) {
+        Mesh mesh;
+        mesh.load(p);
+        models.push_back(getAssetRegistry().addModel(mesh, RenderableHandle::Invalid, p.generic_string()));
+    }
+
+    return models;
+}
+
+// Models scattered on a ground plane, lights floating above them and a rain of physics
+// bodies, all from the seed
+void generateScene(Scene& scene, const std::vector<AssetId>& models, u32 entities, u32 lights, u32 bodies, u32 seed)
+{
+    constexpr float WorldSize = 200.0f;
+
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> position(-WorldSize * 0.5f, WorldSize * 0.5f);
+    std::uniform_real_distribution<float> angle(0.0f, XM_2PI);
+    std::uniform_real_distribution<float> scale(0.5f, 2.0f);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::uniform_int_distribution<size_t> model(0, models.size() - 1);
+
+    // Top of the ground is at y = 0
+    scene.physicsWorld.addBox(WorldSize * 0.5f, 1.0f, WorldSize * 0.5f, 0.0f, 0.0f, -1.0f, 0.0f);
+
+    for (u32 i = 0; i < entities; i++) {
+        auto e = scene.reg.create();
+
+        components::Transform t;
+        t.position = XMFLOAT3(position(rng), 0.0f, position(rng));
+        t.rotationQuat = XMQuaternionRotationRollPitchYaw(0.0f, angle(rng), 0.0f);
+
+        auto s = scale(rng);
+        t.scale = XMFLOAT3(s, s, s);
+
+        scene.reg.emplace<components::Transform>(e, t);
+        scene.reg.emplace<components::Renderable>(e, models[model(rng)]);
+    }
+
+    for (u32 i = 0; i < lights; i++) {
+        auto e = scene.reg.create();
+
+        auto& t = scene.reg.emplace<components::Transform>(e);
+        t.position = XMFLOAT3(position(rng), 1.0f + unit(rng) * 9.0f, position(rng));
+
+        auto& light = scene.reg.emplace<components::PointLight>(e);
+        light.color = XMFLOAT3(unit(rng), unit(rng), unit(rng));
+        light.intensity = 1.0f + unit(rng) * 4.0f;
+        light.radius = 5.0f + unit(rng) * 15.0f;
+    }
+
+    for (u32 i = 0; i < bodies; i++) {
+        auto e = scene.reg.create();
+
+        auto& t = scene.reg.emplace<components::Transform>(e);
+        t.position = XMFLOAT3(position(rng) * 0.25f, 5.0f + unit(rng) * 45.0f, position(rng) * 0.25f);
+
+        scene.reg.emplace<components::Renderable>(e, models[model(rng)]);
+        scene.reg.emplace<components::Physics>(e, 1.0f);
+    }
+}
+
+// Triangle list of a unit cube centered on the origin
+std::vector<XMFLOAT3> cubeTriangles()
+{
+    static constexpr u8 Faces[6][4] = {
+        { 0, 2, 3, 1 }, { 4, 5, 7, 6 }, { 0, 1, 5, 4 },
+        { 2, 6, 7, 3 }, { 0, 4, 6, 2 }, { 1, 3, 7, 5 },
+    };
+
+    auto corner = [](u32 i) {
+        return XMFLOAT3(i & 1 ? 0.5f : -0.5f, i & 2 ? 0.5f : -0.5f, i & 4 ? 0.5f : -0.5f);
+    };
+
+    std::vector<XMFLOAT3> result;
+
+    for (const auto& f : Faces) {
+        for (auto i : { 0, 1, 2, 0, 2, 3 }) {
+            result.push_back(corner(f[i]));
+        }
+    }
+
+    return result;
+}
+
+// Walls between the camera and a field of boxes, doesn't need any assets
+int occlusionBenchmark(const std::vector<std::string_view>& args)
+{
+    constexpr float FieldSize = 200.0f;
+
+    auto wallCount = getArg(args, 3, 64);
+    auto boxCount = getArg(args, 4, 10000);
+    auto frames = std::max(getArg(args, 5, 100), 1u);
+
+    fmt::print("Occlusion: {} walls, {} boxes, {}x{} buffer, {} threads\n", wallCount, boxCount,
+        OcclusionBuffer::Width, OcclusionBuffer::Height, getTaskScheduler().getThreadCount());
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+    auto cube = cubeTriangles();
+
+    std::vector<XMMATRIX> walls(wallCount);
+
+    for (auto& wall : walls) {
+        auto x = (unit(rng) - 0.5f) * FieldSize * 0.5f;
+        auto z = 15.0f + unit(rng) * 30.0f;
+
+        wall = XMMatrixScaling(4.0f + unit(rng) * 8.0f, 3.0f + unit(rng) * 6.0f, 1.0f)
+            * XMMatrixRotationY((unit(rng) - 0.5f) * 0.5f)
+            * XMMatrixTranslation(x, 0.0f, z);
+    }
+
+    std::vector<math::Aabb> boxes(boxCount);
+
+    for (auto& box : boxes) {
+        auto c = XMFLOAT3((unit(rng) - 0.5f) * FieldSize, unit(rng) * 3.0f, 5.0f + unit(rng) * FieldSize);
+        auto e = 0.25f + unit(rng);
+
+        box = math::Aabb{ { c.x - e, c.y - e, c.z - e }, { c.x + e, c.y + e, c.z + e } };
+    }
+
+    auto camera = Camera::perspective({ 1920.0f, 1080.0f });
+    camera.setPosition(math::WorldVector(0.0f, 1.5f, 0.0f));
+
+    OcclusionBuffer occlusion;
+    std::vector<u8> visible(boxCount);
+
+    std::vector<double> rasterizeTimes;
+    std::vector<double> testTimes;
+    u64 hidden = 0;
+
+    for (u32 frame = 0; frame < frames; frame++) {
+        // Sway a little so every frame rasterizes something different
+        camera.setRotation(0.0f, 0.2f * std::sin(float(frame) * 0.1f));
+        camera.update();
+
+        auto start = BenchClock::now();
+
+        occlusion.begin(XMMatrixMultiply(camera.getViewMatrix().mat, camera.getProjectionMatrix().mat));
+
+        for (const auto& wall : walls) {
+            occlusion.addOccluder(cube, wall);
+        }
+
+        occlusion.rasterize();
+        rasterizeTimes.push_back(elapsedMs(start));
+
+        start = BenchClock::now();
+
+        getTaskScheduler().parallelFor(0, boxCount, 256, [&](u32 begin, u32 end) {
+            for (auto i = begin; i < end; i++) {
+                visible[i] = occlusion.isVisible(boxes[i]);
+            }
+        });
+
+        testTimes.push_back(elapsedMs(start));
+
+        hidden += u64(std::count(visible.begin(), visible.end(), u8(0)));
+    }
+
+    printPercentiles("rasterize", getStats(std::move(rasterizeTimes)));
+    printPercentiles("test", getStats(std::move(testTimes)));
+    fmt::print("{:<24} {} triangles, {:.1f}% of boxes hidden\n", "per frame", occlusion.getTriangleCount(),
+        100.0 * double(hidden) / (double(frames) * double(std::max(boxCount, 1u))));
+
+    return 0;
+}
+
+// Runs the CPU side of the frame loop without a window. Everything is driven by the frame
+// number rather than the clock, so two runs with the same arguments do the same work.
+int sceneBenchmark(const std::vector<std::string_view>& args)
+{
+    constexpr u32 WarmupFrames = 60;
+    constexpr float FrameTime = 1.0f / 60.0f;
+    constexpr float OrbitRadius = 120.0f;
+
+    auto entities = getArg(args, 3, 10000);
+    auto lights = getArg(args, 4, 256);
+    auto bodies = getArg(args, 5, 1000);
+    auto frames = std::max(getArg(args, 6, 600), 1u);
+    auto seed = getArg(args, 7, 1);
+    auto scenePath = getOption(args, "--scene");
+
+    PhysicsSettings settings;
+    settings.multithreaded = std::find(args.begin(), args.end(), "--mt-physics") != args.end();
+
+    auto occlusionCulling = std::find(args.begin(), args.end(), "--occlusion") != args.end();
+    auto staticBatching = std::find(args.begin(), args.end(), "--static") != args.end();
+
+    auto models = loadModelsHeadless();
+
+    if (models.empty() && scenePath.empty()) {
+        fmt::print("No models in ./content, convert some first\n");
+        return 1;
+    }
+
+    Scene scene(settings);
+
+    auto start = BenchClock::now();
+
+    if (!scenePath.empty()) {
+        scene.load(scenePath);
+        fmt::print("Scene: {}\n", scenePath);
+    } else {
+        generateScene(scene, models, entities, lights, bodies, seed);
+        fmt::print("Scene: {} entities, {} lights, {} bodies, {} models, seed {}\n",
+            entities, lights, bodies, models.size(), seed);
+    }
+
+    // Bakes during the first warmup frame, same as the game
+    if (staticBatching) {
+        scene.staticGeometry.requestBake();
+    }
+
+    if (auto hlod = getOption(args, "--hlod"); !hlod.empty()) {
+        float distance = 0.0f;
+        std::from_chars(hlod.data(), hlod.data() + hlod.size(), distance);
+        scene.staticGeometry.setHlodDistance(distance);
+    }
+
+    fmt::print("{:<24} {:8.3f} ms\n", "setup", elapsedMs(start));
+    fmt::print("{} frames after {} warmup, {} threads, {} physics\n", frames, WarmupFrames,
+        getTaskScheduler().getThreadCount(), settings.multithreaded ? "multithreaded" : "single threaded");
+
+    auto camera = Camera::perspective({ 1920.0f, 1080.0f });
+    auto shadowCamera = Camera::ortho({ 1024.0f, 1024.0f });
+
+    std::vector<RenderBatch> batches(getAssetRegistry().size());
+    std::vector<RenderBatch> shadowBatches(getAssetRegistry().size());
+    std::vector<const RenderBatch*> staticBatches;
+    std::vector<const RenderBatch*> staticShadowBatches;
+    std::vector<PointLight> visibleLights;
+    std::vector<entt::entity> scratch;
+    OcclusionBuffer occlusion;
+
+    enum Phase
+    {
+        Physics,
+        Transforms,
+        Bvh,
+        Lights,
+        Batches,
+        ShadowBatches,
+        Frame,
+        PhaseCount,
+    };
+
+    constexpr std::array<const char*, PhaseCount> PhaseNames{
+        "physics", "transforms", "bvh", "lights", "batches", "shadow batches", "frame",
+    };
+
+    std::array<std::vector<double>, PhaseCount> samples;
+    for (auto& s : samples) {
+        s.reserve(frames);
+    }
+
+    u64 instances = 0;
+    u64 drawnBatches = 0;
+    u64 litLights = 0;
+
+    for (u32 frame = 0; frame < WarmupFrames + frames; frame++) {
+        auto recording = frame >= WarmupFrames;
+
+        auto a = XM_2PI * float(frame) / float(WarmupFrames + frames);
+        camera.setPosition(math::WorldVector(-std::sin(a) * OrbitRadius, 30.0f, -std::cos(a) * OrbitRadius));
+        camera.setRotation(0.25f, a);
+        camera.update();
+
+        shadowCamera.setRotation(scene.directionalLight.x, scene.directionalLight.y);
+        shadowCamera.update();
+
+        std::array<double, PhaseCount> times{};
+        auto frameStart = BenchClock::now();
+
+        auto measure = [&](Phase phase, auto&& fn) {
+            auto phaseStart = BenchClock::now();
+            fn();
+            times[phase] = elapsedMs(phaseStart);
+        };
+
+        measure(Physics, [&] {
+            scene.physicsWorld.step();
+            scene.physicsWorld.update();
+        });
+        measure(Transforms, [&] { scene.transforms.update(); });
+        measure(Bvh, [&] {
+            scene.staticGeometry.update();
+            scene.bvh.update();
+        });
+        XMFLOAT3 eye;
+        XMStoreFloat3(&eye, camera.getPosition().vec);
+
+        measure(Lights, [&] { collectPointLights(scene, camera.getFrustum(), visibleLights, scratch); });
+        measure(Batches, [&] {
+            if (occlusionCulling) {
+                collectRenderBatches(scene, camera, occlusion, batches, scratch);
+            } else {
+                collectRenderBatches(scene, camera.getFrustum(), batches, scratch);
+            }
+
+            scene.staticGeometry.collectBatches(camera.getFrustum(), eye, occlusionCulling ? &occlusion : nullptr,
+                staticBatches);
+        });
+        measure(ShadowBatches, [&] {
+            collectRenderBatches(scene, shadowCamera.getFrustum(), shadowBatches, scratch);
+            scene.staticGeometry.collectBatches(shadowCamera.getFrustum(), eye, nullptr, staticShadowBatches);
+        });
+
+        times[Frame] = elapsedMs(frameStart);
+
+        if (!recording) {
+            continue;
+        }
+
+        for (u32 i = 0; i < PhaseCount; i++) {
+            samples[i].push_back(times[i]);
+        }
+
+        for (const auto& batch : batches) {
+            instances += batch.instances.size();
+            drawnBatches += batch.instances.empty() ? 0 : 1;
+        }
+
+        drawnBatches += staticBatches.size();
+
+        litLights += visibleLights.size();
+    }
+
+    for (u32 i = 0; i < PhaseCount; i++) {
+        printPercentiles(PhaseNames[i], getStats(std::move(samples[i])));
+    }
+
+    // Same numbers between two runs means the work was the same
+    fmt::print("{:<24} {:.1f} instances in {:.1f} draws, {:.1f} lights\n", "visible per frame",
+        double(instances) / double(frames), double(drawnBatches) / double(frames), double(litLights) / double(frames));
+
+    if (staticBatching) {
+        fmt::print("{:<24} {} chunks, {} entities, {} proxies past {}\n", "static geometry",
+            scene.staticGeometry.getChunkCount(), scene.staticGeometry.getEntityCount(),
+            scene.staticGeometry.getProxyCount(), scene.staticGeometry.getHlodDistance());
+    }
+
+    for (u32 i = 0; i < MemoryTracker::TagCount; i++) {
+        if (auto peak = getMemoryTracker().getStats(MemoryTag(i)).peakBytes; peak > 0) {
+            fmt::print("{:<24} {:.2f} MB\n", fmt::format("peak {}", getMemoryTagName(MemoryTag(i))),
+                double(peak) / (1024.0 * 1024.0));
+        }
+    }
+
+    return 0;
+}
+
+// Batch kernels at every level the CPU supports against the DirectXMath code they replace
+int mathBenchmark(const std::vector<std::string_view>& args)
+{
+    auto count = getArg(args, 3, 100000);
+    auto iterations = getArg(args, 4, 100);
+
+    fmt::print("Math: {} entities, {} iterations, {} supported\n", count, iterations,
+        math::getSimdLevelName(math::getSupportedSimdLevel()));
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    std::uniform_real_distribution<float> scale(0.5f, 2.0f);
+
+    std::vector<XMFLOAT3> positions(count);
+    std::vector<XMFLOAT4> rotations(count);
+    std::vector<XMFLOAT3> scales(count);
+    std::vector<XMFLOAT3> points(count);
+    std::vector<math::Aabb> boxes(count);
+
+    math::TransformArray<math::Model, math::World> trs;
+    math::PointArray<math::Model> batchPoints;
+    math::AabbArray<math::Model> batchBoxes;
+
+    trs.resize(count);
+    batchPoints.resize(count);
+    batchBoxes.resize(count);
+
+    for (u32 i = 0; i < count; i++) {
+        positions[i] = XMFLOAT3(position(rng), position(rng), position(rng));
+        XMStoreFloat4(&rotations[i], XMQuaternionNormalize(XMVectorSet(unit(rng), unit(rng), unit(rng), unit(rng))));
+        scales[i] = XMFLOAT3(scale(rng), scale(rng), scale(rng));
+        points[i] = XMFLOAT3(unit(rng), unit(rng), unit(rng));
+
+        auto e = scale(rng);
+        boxes[i] = math::Aabb{ { points[i].x - e, points[i].y - e, points[i].z - e },
+            { points[i].x + e, points[i].y + e, points[i].z + e } };
+
+        trs.set(i, positions[i], XMLoadFloat4(&rotations[i]), scales[i]);
+        batchPoints.set(i, points[i]);
+        batchBoxes.set(i, boxes[i]);
+    }
+
+    // Reference results, the same as the per entity code
+    std::vector<XMFLOAT4X4> worlds(count);
+    std::vector<XMFLOAT3> worldPoints(count);
+    std::vector<math::Aabb> worldBoxes(count);
+    std::vector<XMFLOAT4X4> normalMatrices(count);
+
+    auto compose = [&] {
+        for (u32 i = 0; i < count; i++) {
+            auto s = XMMatrixScalingFromVector(XMLoadFloat3(&scales[i]));
+            auto r = XMMatrixRotationQuaternion(XMLoadFloat4(&rotations[i]));
+            auto t = XMMatrixTranslationFromVector(XMLoadFloat3(&positions[i]));
+
+            XMStoreFloat4x4(&worlds[i], s * r * t);
+        }
+    };
+
+    auto transformPoints = [&] {
+        for (u32 i = 0; i < count; i++) {
+            XMStoreFloat3(&worldPoints[i], XMVector3Transform(XMLoadFloat3(&points[i]), XMLoadFloat4x4(&worlds[i])));
+        }
+    };
+
+    auto transformBoxes = [&] {
+        for (u32 i = 0; i < count; i++) {
+            worldBoxes[i] = boxes[i].transformed(XMLoadFloat4x4(&worlds[i]));
+        }
+    };
+
+    auto computeNormals = [&] {
+        for (u32 i = 0; i < count; i++) {
+            XMStoreFloat4x4(&normalMatrices[i], XMMatrixTranspose(XMMatrixInverse(nullptr, XMLoadFloat4x4(&worlds[i]))));
+        }
+    };
+
+    math::AffineArray<math::Model, math::World> batchWorlds;
+    math::PointArray<math::World> batchWorldPoints;
+    math::AabbArray<math::World> batchWorldBoxes;
+    math::NormalMatrixArray<math::Model, math::World> batchNormalMatrices;
+
+    auto matrixError = [](const XMFLOAT4X4& expected, const math::Matrix<math::Model, math::World>& m) {
+        XMFLOAT4X4 actual;
+        XMStoreFloat4x4(&actual, m.mat);
+
+        float error = 0.0f;
+
+        for (u32 row = 0; row < 4; row++) {
+            for (u32 column = 0; column < 3; column++) {
+                error = std::max(error, std::abs(expected.m[row][column] - actual.m[row][column]));
+            }
+        }
+
+        return error;
+    };
+
+    auto pointError = [](const XMFLOAT3& expected, const XMFLOAT3& actual) {
+        return std::max({ std::abs(expected.x - actual.x), std::abs(expected.y - actual.y), std::abs(expected.z - actual.z) });
+    };
+
+    struct Kernel
+    {
+        std::string_view name;
+        std::function<void()> reference;
+        std::function<void()> batch;
+        std::function<float(u32)> error;
+    };
+
+    Kernel kernels[] = {
+        { "compose TRS", compose,
+            [&] { math::composeTransforms(trs, batchWorlds); },
+            [&](u32 i) { return matrixError(worlds[i], batchWorlds.get(i)); } },
+        { "transform points", transformPoints,
+            [&] { math::transformPoints(batchWorlds, batchPoints, batchWorldPoints); },
+            [&](u32 i) { return pointError(worldPoints[i], batchWorldPoints.get(i)); } },
+        { "transform AABBs", transformBoxes,
+            [&] { math::transformAabbs(batchWorlds, batchBoxes, batchWorldBoxes); },
+            [&](u32 i) {
+                auto box = batchWorldBoxes.get(i);
+                return std::max(pointError(worldBoxes[i].min, box.min), pointError(worldBoxes[i].max, box.max));
+            } },
+        { "normal matrices", computeNormals,
+            [&] { math::computeNormalMatrices(batchWorlds, batchNormalMatrices); },
+            [&](u32 i) { return matrixError(normalMatrices[i], batchNormalMatrices.get(i)); } },
+    };
+
+    auto measure = [&](const std::function<void()>& fn) {
+        std::vector<double> samples;
+
+        for (u32 i = 0; i < iterations; i++) {
+            auto start = BenchClock::now();
+            fn();
+            samples.push_back(elapsedMs(start));
+        }
+
+        return getStats(std::move(samples));
+    };
+
+    auto supported = math::getSupportedSimdLevel();
+
+    for (const auto& kernel : kernels) {
+        auto referenceStats = measure(kernel.reference);
+        printStats(fmt::format("{} (DirectXMath)", kernel.name), referenceStats);
+
+        for (auto level = math::SimdLevel::Scalar; level <= supported; level = math::SimdLevel(u32(level) + 1)) {
+            math::setSimdLevel(level);
+
+            // The later kernels read the matrices from compose, so run everything up to this
+            // one at the same level first
+            for (const auto& k : kernels) {
+                k.batch();
+
+                if (&k == &kernel) {
+                    break;
+                }
+            }
+
+            auto stats = measure(kernel.batch);
+
+            float error = 0.0f;
+
+            for (u32 i = 0; i < count; i++) {
+                error = std::max(error, kernel.error(i));
+            }
+
+            printStats(fmt::format("{} ({})", kernel.name, math::getSimdLevelName(level)), stats);
+            fmt::print("{:<24} speedup {:.1f}x, max error {:.2e}\n", "",
+                stats.mean > 0.0 ? referenceStats.mean / stats.mean : 0.0, error);
+        }
+    }
+
+    math::setSimdLevel(supported);
+
+    return 0;
+}
+
+}
+
+int runBenchmark(const std::vector<std::string_view>& args)
+{
+    attachConsole();
+
+    auto name = args.size() > 2 ? args[2] : std::string_view{};
+
+    if (name == "physics") {
+        return physicsBenchmark(args);
+    }
+
+    if (name == "bvh") {
+        return bvhBenchmark(args);
+    }
+
+    if (name == "mesh") {
+        return meshBenchmark(args);
+    }
+
+    if (name == "scene") {
+        return sceneBenchmark(args);
+    }
+
+    if (name == "occlusion") {
+        return occlusionBenchmark(args);
+    }
+
+    if (name == "math") {
+        return mathBenchmark(args);
+    }
+
+    fmt::print("usage: {} bench <benchmark> [options]\n", args.empty() ? "Game.exe" : args[0]);
+    fmt::print("  physics [boxes=4096] [steps=300]\n");
+    fmt::print("  bvh [boxes=1000000] [queries=100]\n");
+    fmt::print("  mesh [segments=128] [rays=1000]\n");
+    fmt::print("  scene [entities=10000] [lights=256] [bodies=1000] [frames=600] [seed=1] [--scene path] [--mt-physics] [--occlusion] [--static [--hlod distance]]\n");
+    fmt::print("  occlusion [walls=64] [boxes=10000] [frames=100]\n");
+    fmt::print("  math [entities=100000] [iterations=100]\n");
+
+    return 1;
+}
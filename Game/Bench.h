@@ -0,0 +1,7 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+
+// Headless benchmarks, `Game.exe bench <name> [options]`. Results go to stdout.
+int runBenchmark(const std::vector<std::string_view>& args);
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "RendererHelpers.h"
+#include "RenderStats.h"
 #include "ArrayView.h"
 
 #include <d3d11_1.h>
@@ -21,6 +22,7 @@ public:
     void update(const ComPtr<ID3D11DeviceContext>& context)
     {
         context->UpdateSubresource(buffer.Get(), 0, nullptr, &data, 0, 0);
+        getRenderStats().addUpload(sizeof(T));
     }
 
     auto getBuffer() { return buffer.Get(); }
@@ -92,6 +94,7 @@ public:
 
         CD3D11_BOX box(0, 0, 0, byteSize, 1, 1);
         context->UpdateSubresource(m_buffer.Get(), 0, &box, contents.data, 0, 0);
+        getRenderStats().addUpload(u64(byteSize));
     }
 
     void setName(std::string_view name)
@@ -89,3 +89,7 @@ WorldVector Camera::pixelToWorldDirection(int x, int y) const
     return dir.normalized();
 }
 
+math::Frustum Camera::getFrustum() const
+{
+    return math::Frustum::fromMatrix(XMMatrixMultiply(m_viewMatrix.mat, m_projectionMatrix.mat));
+}
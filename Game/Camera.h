@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Math.h"
+#include "Geometry.h"
 
 #include <DirectXMath.h>
 
@@ -39,6 +40,9 @@ public:
 
     math::WorldVector pixelToWorldDirection(int x, int y) const;
 
+    // World space frustum for culling, valid after update()
+    math::Frustum getFrustum() const;
+
     float getFOV() const { return m_fov; }
 
 private:
@@ -0,0 +1,111 @@
+#include "pch.h"
+
+#include "CollisionShapes.h"
+
+#include <bullet/BulletCollision/CollisionShapes/btConvexPointCloudShape.h>
+#include <cmath>
+
+using namespace DirectX;
+
+// Scales closer than this share a shape
+constexpr float ScaleQuantization = 1.0f / 1024.0f;
+
+CollisionShapeRegistry::Key CollisionShapeRegistry::makeKey(AssetId model, const XMFLOAT3& scale)
+{
+    auto quantize = [](float f) {
+        return i32(std::lround(f / ScaleQuantization));
+    };
+
+    return Key{ model, { quantize(scale.x), quantize(scale.y), quantize(scale.z) } };
+}
+
+std::unique_ptr<btCollisionShape> CollisionShapeRegistry::createBase(AssetId model)
+{
+    const auto& assets = getAssetRegistry();
+
+    // Models without a hull get the box so there's still something to collide with
+    if (!assets.isLoaded(model) || assets.get(model).collisionHull.size() < 4) {
+        return std::make_unique<btBoxShape>(btVector3(0.5f, 0.5f, 0.5f));
+    }
+
+    // The hull was already welded and reduced when the mesh was converted
+    const auto& hull = assets.get(model).collisionHull;
+    auto shape = std::make_unique<btConvexHullShape>(&hull[0].x, int(hull.size()), int(sizeof(XMFLOAT3)));
+    shape->initializePolyhedralFeatures();
+
+    return shape;
+}
+
+std::unique_ptr<btCollisionShape> CollisionShapeRegistry::createScaled(btCollisionShape* base, const btVector3& scale)
+{
+    if (base->getShapeType() == CONVEX_HULL_SHAPE_PROXYTYPE) {
+        auto hull = static_cast<btConvexHullShape*>(base);
+
+        // Points to the hull's vertices instead of copying them
+        return std::make_unique<btConvexPointCloudShape>(
+            hull->getUnscaledPoints(), hull->getNumPoints(), scale, true);
+    }
+
+    // Boxes are small enough that sharing isn't worth it
+    auto box = static_cast<btBoxShape*>(base);
+    auto shape = std::make_unique<btBoxShape>(box->getHalfExtentsWithoutMargin());
+    shape->setLocalScaling(scale);
+
+    return shape;
+}
+
+btCollisionShape* CollisionShapeRegistry::acquire(AssetId model, const XMFLOAT3& scale)
+{
+    auto key = makeKey(model, scale);
+
+    if (auto it = m_shapes.find(key); it != m_shapes.end()) {
+        it->second.refs++;
+        return it->second.shape.get();
+    }
+
+    Entry entry;
+    entry.refs = 1;
+
+    if (key == makeKey(model, XMFLOAT3(1.0f, 1.0f, 1.0f))) {
+        entry.shape = createBase(model);
+    } else {
+        entry.base = acquire(model, XMFLOAT3(1.0f, 1.0f, 1.0f));
+        entry.shape = createScaled(entry.base, btVector3(scale.x, scale.y, scale.z));
+    }
+
+    // The editor uses this to show which model a shape came from
+    entry.shape->setUserIndex(int(model));
+
+    auto shape = entry.shape.get();
+    m_keys.emplace(shape, key);
+    m_shapes.emplace(key, std::move(entry));
+
+    return shape;
+}
+
+void CollisionShapeRegistry::release(btCollisionShape* shape, std::vector<std::unique_ptr<btCollisionShape>>& freed)
+{
+    auto keyIt = m_keys.find(shape);
+
+    if (keyIt == m_keys.end()) {
+        return;
+    }
+
+    auto it = m_shapes.find(keyIt->second);
+    auto& entry = it->second;
+
+    if (--entry.refs > 0) {
+        return;
+    }
+
+    auto base = entry.base;
+
+    // The scaled shape goes first, it points into the base shape's vertices
+    freed.push_back(std::move(entry.shape));
+    m_keys.erase(keyIt);
+    m_shapes.erase(it);
+
+    if (base) {
+        release(base, freed);
+    }
+}
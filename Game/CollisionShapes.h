@@ -0,0 +1,54 @@
+#pragma once
+
+#include "Common.h"
+#include "Assets.h"
+
+#include <DirectXMath.h>
+#include <bullet/btBulletDynamicsCommon.h>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// Refcounted collision shapes keyed by model and scale. Scaled shapes share the
+// points of the unscaled hull, so a model only keeps one copy of its hull no matter
+// how many scales it's used at. AssetId::Invalid is the unit box.
+class CollisionShapeRegistry
+{
+public:
+    btCollisionShape* acquire(AssetId model, const DirectX::XMFLOAT3& scale);
+
+    // Shapes whose last user went away are moved to `freed`, the caller decides when
+    // it's safe to delete them
+    void release(btCollisionShape* shape, std::vector<std::unique_ptr<btCollisionShape>>& freed);
+
+    size_t size() const
+    {
+        return m_shapes.size();
+    }
+
+private:
+    struct Key
+    {
+        AssetId model;
+        i32 scale[3];
+
+        auto operator<=>(const Key&) const = default;
+    };
+
+    struct Entry
+    {
+        std::unique_ptr<btCollisionShape> shape;
+        u32 refs = 0;
+
+        // Scaled shapes keep a reference to the unscaled one
+        btCollisionShape* base = nullptr;
+    };
+
+    static Key makeKey(AssetId model, const DirectX::XMFLOAT3& scale);
+    static std::unique_ptr<btCollisionShape> createBase(AssetId model);
+    static std::unique_ptr<btCollisionShape> createScaled(btCollisionShape* base, const btVector3& scale);
+
+    std::map<Key, Entry> m_shapes;
+    std::unordered_map<const btCollisionShape*, Key> m_keys;
+};
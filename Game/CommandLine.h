@@ -0,0 +1,12 @@
+#pragma once
+
+#include <algorithm>
+#include <string_view>
+#include <vector>
+
+// Value after a `--name value` pair anywhere in the arguments, empty if there is none
+inline std::string_view getOption(const std::vector<std::string_view>& args, std::string_view name)
+{
+    auto it = std::find(args.begin(), args.end(), name);
+    return it != args.end() && it + 1 != args.end() ? *(it + 1) : std::string_view{};
+}
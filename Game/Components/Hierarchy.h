@@ -0,0 +1,21 @@
+#pragma once
+
+#include <entt/entt.hpp>
+
+namespace components
+{
+
+// Parents the entity's Transform to another entity. Entities without this component
+// are roots and their Transform is in world space.
+struct Hierarchy
+{
+    entt::entity parent = entt::null;
+};
+
+template<typename Archive>
+void serialize(Archive& archive, Hierarchy& h)
+{
+    archive(h.parent);
+}
+
+}
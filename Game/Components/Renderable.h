@@ -1,26 +1,35 @@
 #pragma once
 
-#include "../Renderer.h"
+#include "../Assets.h"
+
+#include <string>
 
 namespace components
 {
 
 struct Renderable
 {
-    Renderable(std::string name, ::Renderable* renderable, const Bounds& bounds) :
-        name{ std::move(name) }, renderable{ renderable }, bounds{ bounds } {}
+    Renderable(AssetId model) :
+        model{ model } {}
 
     Renderable() = default;
 
-    std::string name;
-    ::Renderable* renderable = nullptr;
-    Bounds bounds{ math::Vector<math::Model>(), math::Vector<math::Model>() };
+    AssetId model = AssetId::Invalid;
 };
 
+// Scenes store the model name so they survive the asset list changing between runs
 template<typename Archive>
-void serialize(Archive& archive, Renderable& r)
+void save(Archive& archive, const Renderable& r)
 {
-    archive(r.name);
+    archive(getAssetRegistry().getName(r.model));
+}
+
+template<typename Archive>
+void load(Archive& archive, Renderable& r)
+{
+    std::string name;
+    archive(name);
+    r.model = getAssetRegistry().intern(name);
 }
 
 }
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "../Common.h"
+
+namespace components
+{
+
+// Added by StaticGeometry to the renderables it merged into a chunk. They're drawn as part
+// of the chunk and SceneBvh keeps them out of the Renderables layer. Never serialized,
+// scenes are baked again after loading.
+struct StaticBatched
+{
+    u32 chunk = 0;
+};
+
+}
@@ -36,4 +36,21 @@ void serialize(Archive& archive, Transform& t)
     archive(t.position, t.rotationQuat, t.scale);
 }
 
+// Cached model-to-world matrix including parent transforms, kept up to date by
+// TransformSystem. Never serialized, it's rebuilt from Transform and Hierarchy.
+struct WorldTransform
+{
+    DirectX::XMMATRIX matrix = DirectX::XMMatrixIdentity();
+
+    math::Matrix<math::Model, math::World> getMatrix2() const
+    {
+        return math::Matrix<math::Model, math::World>{ matrix };
+    }
+
+    DirectX::XMVECTOR getPosition() const
+    {
+        return matrix.r[3];
+    }
+};
+
 }
@@ -0,0 +1,144 @@
+#include "pch.h"
+
+#include "DebugDraw.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <utility>
+
+using math::Aabb;
+
+namespace
+{
+
+Aabb boundsOf(const DebugDraw::Vertex* vertices, u32 count)
+{
+    Aabb box{ { FLT_MAX, FLT_MAX, FLT_MAX }, { -FLT_MAX, -FLT_MAX, -FLT_MAX } };
+
+    for (u32 i = 0; i < count; i++) {
+        const auto& p = vertices[i].m_positionSize;
+
+        box.min.x = std::min(box.min.x, p.x);
+        box.min.y = std::min(box.min.y, p.y);
+        box.min.z = std::min(box.min.z, p.z);
+        box.max.x = std::max(box.max.x, p.x);
+        box.max.y = std::max(box.max.y, p.y);
+        box.max.z = std::max(box.max.z, p.z);
+    }
+
+    return box;
+}
+
+// Copies the primitives of `stride` vertices that touch the frustum
+void cull(const std::vector<DebugDraw::Vertex>& in, std::vector<DebugDraw::Vertex>& out, u32 stride,
+    const math::Frustum& frustum)
+{
+    out.clear();
+    out.reserve(in.size());
+
+    for (size_t i = 0; i + stride <= in.size(); i += stride) {
+        if (frustum.intersects(boundsOf(&in[i], stride))) {
+            out.insert(out.end(), in.begin() + i, in.begin() + i + stride);
+        }
+    }
+}
+
+}
+
+DebugDraw& getDebugDraw()
+{
+    static DebugDraw debugDraw;
+    return debugDraw;
+}
+
+void DebugDraw::addLines(ArrayView<Vertex> vertices)
+{
+    std::lock_guard lock(m_mutex);
+    m_lines.insert(m_lines.end(), vertices.begin(), vertices.end());
+}
+
+void DebugDraw::addTriangles(ArrayView<Vertex> vertices)
+{
+    std::lock_guard lock(m_mutex);
+    m_triangles.insert(m_triangles.end(), vertices.begin(), vertices.end());
+}
+
+DebugDraw::StaticId DebugDraw::addStatic(Primitive primitive, ArrayView<Vertex> vertices)
+{
+    std::lock_guard lock(m_mutex);
+
+    auto& group = m_staticGroups.emplace_back();
+    group.id = m_nextStaticId++;
+    group.primitive = primitive;
+    group.bounds = boundsOf(vertices.data, vertices.size);
+    group.vertices.assign(vertices.begin(), vertices.end());
+
+    m_staticDirty = true;
+
+    return group.id;
+}
+
+void DebugDraw::removeStatic(StaticId id)
+{
+    std::lock_guard lock(m_mutex);
+
+    auto erased = std::erase_if(m_staticGroups, [id](const StaticGroup& g) { return g.id == id; });
+
+    if (erased > 0) {
+        m_staticDirty = true;
+    }
+}
+
+void DebugDraw::drawStatic(StaticId id)
+{
+    std::lock_guard lock(m_mutex);
+
+    for (auto& group : m_staticGroups) {
+        if (group.id == id) {
+            group.requested = true;
+        }
+    }
+}
+
+void DebugDraw::prepare(const math::Frustum& frustum)
+{
+    {
+        std::lock_guard lock(m_mutex);
+
+        // The pending vectors keep their capacity, so this doesn't allocate in steady state
+        std::swap(m_lines, m_pendingLines);
+        std::swap(m_triangles, m_pendingTriangles);
+        m_lines.clear();
+        m_triangles.clear();
+
+        if (m_staticDirty) {
+            packStatic();
+            m_staticDirty = false;
+        }
+
+        m_visibleStaticRanges.clear();
+
+        for (auto& group : m_staticGroups) {
+            if (group.requested && !group.vertices.empty() && frustum.intersects(group.bounds)) {
+                m_visibleStaticRanges.push_back(Range{ group.primitive, group.first, u32(group.vertices.size()) });
+            }
+
+            group.requested = false;
+        }
+    }
+
+    cull(m_pendingLines, m_visibleLines, 2, frustum);
+    cull(m_pendingTriangles, m_visibleTriangles, 3, frustum);
+}
+
+void DebugDraw::packStatic()
+{
+    m_staticVertices.clear();
+
+    for (auto& group : m_staticGroups) {
+        group.first = u32(m_staticVertices.size());
+        m_staticVertices.insert(m_staticVertices.end(), group.vertices.begin(), group.vertices.end());
+    }
+
+    m_staticVersion++;
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "Common.h"
+#include "ArrayView.h"
+#include "Geometry.h"
+
+#include <im3d.h>
+#include <mutex>
+#include <vector>
+
+// Bulk debug lines and triangles that bypass Im3d's per-primitive API.
+//
+// Immediate primitives can be added from any thread and are drawn once. Retained
+// primitives such as the editor grid are uploaded once into their own vertex buffer,
+// after that drawing them is just a drawStatic() call each frame. prepare() culls both
+// against the camera, and the renderer uploads the visible immediate vertices together
+// with the Im3d draw lists.
+class DebugDraw
+{
+public:
+    using Vertex = Im3d::VertexData;
+
+    enum class Primitive
+    {
+        Lines,
+        Triangles,
+    };
+
+    // A contiguous run of retained vertices
+    struct Range
+    {
+        Primitive primitive;
+        u32 first;
+        u32 count;
+    };
+
+    using StaticId = u32;
+    static constexpr StaticId InvalidStaticId = 0;
+
+    // Pairs of vertices
+    void addLines(ArrayView<Vertex> vertices);
+
+    // Triples of vertices
+    void addTriangles(ArrayView<Vertex> vertices);
+
+    StaticId addStatic(Primitive primitive, ArrayView<Vertex> vertices);
+    void removeStatic(StaticId id);
+
+    // Draws the retained primitives this frame
+    void drawStatic(StaticId id);
+
+    // Takes everything added so far for drawing and culls it. Anything added after this
+    // goes into the next frame.
+    void prepare(const math::Frustum& frustum);
+
+    const std::vector<Vertex>& getLines() const
+    {
+        return m_visibleLines;
+    }
+
+    const std::vector<Vertex>& getTriangles() const
+    {
+        return m_visibleTriangles;
+    }
+
+    // Bumped whenever the retained vertices change so the renderer knows to upload them
+    u64 getStaticVersion() const
+    {
+        return m_staticVersion;
+    }
+
+    const std::vector<Vertex>& getStaticVertices() const
+    {
+        return m_staticVertices;
+    }
+
+    const std::vector<Range>& getVisibleStaticRanges() const
+    {
+        return m_visibleStaticRanges;
+    }
+
+private:
+    struct StaticGroup
+    {
+        StaticId id = InvalidStaticId;
+        Primitive primitive = Primitive::Lines;
+        math::Aabb bounds;
+        std::vector<Vertex> vertices;
+        bool requested = false;
+
+        // Offset into m_staticVertices
+        u32 first = 0;
+    };
+
+    void packStatic();
+
+    std::mutex m_mutex;
+    std::vector<Vertex> m_lines;
+    std::vector<Vertex> m_triangles;
+
+    std::vector<Vertex> m_pendingLines;
+    std::vector<Vertex> m_pendingTriangles;
+    std::vector<Vertex> m_visibleLines;
+    std::vector<Vertex> m_visibleTriangles;
+
+    std::vector<StaticGroup> m_staticGroups;
+    std::vector<Vertex> m_staticVertices;
+    std::vector<Range> m_visibleStaticRanges;
+    StaticId m_nextStaticId = 1;
+    u64 m_staticVersion = 0;
+    bool m_staticDirty = false;
+};
+
+DebugDraw& getDebugDraw();
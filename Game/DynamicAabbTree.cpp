@@ -0,0 +1,245 @@
+#include "pch.h"
+
+#include "DynamicAabbTree.h"
+
+#include <algorithm>
+#include <cassert>
+
+using namespace math;
+
+i32 DynamicAabbTree::allocateNode()
+{
+    if (m_freeList == Null) {
+        m_nodes.emplace_back();
+        return i32(m_nodes.size() - 1);
+    }
+
+    auto node = m_freeList;
+    m_freeList = m_nodes[node].parent;
+    m_nodes[node] = Node{};
+
+    return node;
+}
+
+void DynamicAabbTree::freeNode(i32 node)
+{
+    m_nodes[node].parent = m_freeList;
+    m_nodes[node].height = -1;
+    m_freeList = node;
+}
+
+i32 DynamicAabbTree::createProxy(const Aabb& box, u32 userData)
+{
+    auto proxy = allocateNode();
+
+    auto& node = m_nodes[proxy];
+    node.box = box.expanded(Margin);
+    node.userData = userData;
+    node.height = 0;
+
+    insertLeaf(proxy);
+    m_proxyCount++;
+
+    return proxy;
+}
+
+void DynamicAabbTree::destroyProxy(i32 proxy)
+{
+    assert(m_nodes[proxy].isLeaf());
+
+    removeLeaf(proxy);
+    freeNode(proxy);
+    m_proxyCount--;
+}
+
+bool DynamicAabbTree::moveProxy(i32 proxy, const Aabb& box)
+{
+    if (m_nodes[proxy].box.contains(box)) {
+        return false;
+    }
+
+    removeLeaf(proxy);
+    m_nodes[proxy].box = box.expanded(Margin);
+    insertLeaf(proxy);
+
+    return true;
+}
+
+void DynamicAabbTree::insertLeaf(i32 leaf)
+{
+    if (m_root == Null) {
+        m_root = leaf;
+        m_nodes[leaf].parent = Null;
+        return;
+    }
+
+    const auto leafBox = m_nodes[leaf].box;
+
+    // Walk down to the cheapest sibling
+    auto idx = m_root;
+
+    while (!m_nodes[idx].isLeaf()) {
+        const auto& node = m_nodes[idx];
+
+        auto area = node.box.area();
+        auto combinedArea = node.box.merged(leafBox).area();
+
+        // Cost of making a new parent for this node and the leaf
+        auto cost = 2.0f * combinedArea;
+
+        // Minimum cost of pushing the leaf further down
+        auto inheritanceCost = 2.0f * (combinedArea - area);
+
+        auto childCost = [&](i32 child) {
+            const auto& c = m_nodes[child];
+            auto merged = leafBox.merged(c.box).area();
+
+            return c.isLeaf() ? merged + inheritanceCost : merged - c.box.area() + inheritanceCost;
+        };
+
+        auto cost1 = childCost(node.child1);
+        auto cost2 = childCost(node.child2);
+
+        if (cost < cost1 && cost < cost2) {
+            break;
+        }
+
+        idx = cost1 < cost2 ? node.child1 : node.child2;
+    }
+
+    auto sibling = idx;
+    auto oldParent = m_nodes[sibling].parent;
+    auto newParent = allocateNode();
+
+    m_nodes[newParent].parent = oldParent;
+    m_nodes[newParent].box = leafBox.merged(m_nodes[sibling].box);
+    m_nodes[newParent].height = m_nodes[sibling].height + 1;
+    m_nodes[newParent].child1 = sibling;
+    m_nodes[newParent].child2 = leaf;
+
+    m_nodes[sibling].parent = newParent;
+    m_nodes[leaf].parent = newParent;
+
+    if (oldParent == Null) {
+        m_root = newParent;
+    } else if (m_nodes[oldParent].child1 == sibling) {
+        m_nodes[oldParent].child1 = newParent;
+    } else {
+        m_nodes[oldParent].child2 = newParent;
+    }
+
+    refitAncestors(m_nodes[leaf].parent);
+}
+
+void DynamicAabbTree::removeLeaf(i32 leaf)
+{
+    if (leaf == m_root) {
+        m_root = Null;
+        return;
+    }
+
+    auto parent = m_nodes[leaf].parent;
+    auto grandParent = m_nodes[parent].parent;
+    auto sibling = m_nodes[parent].child1 == leaf ? m_nodes[parent].child2 : m_nodes[parent].child1;
+
+    if (grandParent == Null) {
+        m_root = sibling;
+        m_nodes[sibling].parent = Null;
+        freeNode(parent);
+        return;
+    }
+
+    // The sibling takes the parent's place
+    if (m_nodes[grandParent].child1 == parent) {
+        m_nodes[grandParent].child1 = sibling;
+    } else {
+        m_nodes[grandParent].child2 = sibling;
+    }
+
+    m_nodes[sibling].parent = grandParent;
+    freeNode(parent);
+
+    refitAncestors(grandParent);
+}
+
+void DynamicAabbTree::refitAncestors(i32 idx)
+{
+    while (idx != Null) {
+        idx = balance(idx);
+
+        auto& node = m_nodes[idx];
+        const auto& c1 = m_nodes[node.child1];
+        const auto& c2 = m_nodes[node.child2];
+
+        node.height = 1 + std::max(c1.height, c2.height);
+        node.box = c1.box.merged(c2.box);
+
+        idx = node.parent;
+    }
+}
+
+// Rotates the taller child up if the node is out of balance, returns the node that's
+// now in its place
+i32 DynamicAabbTree::balance(i32 a)
+{
+    auto& A = m_nodes[a];
+
+    if (A.isLeaf() || A.height < 2) {
+        return a;
+    }
+
+    auto b = A.child1;
+    auto c = A.child2;
+
+    auto diff = m_nodes[c].height - m_nodes[b].height;
+
+    if (diff >= -1 && diff <= 1) {
+        return a;
+    }
+
+    // Rotate the taller child (up) into a's place
+    auto up = diff > 1 ? c : b;
+    auto other = diff > 1 ? b : c;
+
+    auto& U = m_nodes[up];
+    auto f = U.child1;
+    auto g = U.child2;
+
+    U.child1 = a;
+    U.parent = A.parent;
+    A.parent = up;
+
+    if (U.parent == Null) {
+        m_root = up;
+    } else if (m_nodes[U.parent].child1 == a) {
+        m_nodes[U.parent].child1 = up;
+    } else {
+        m_nodes[U.parent].child2 = up;
+    }
+
+    // The taller grandchild stays under `up`, the other one moves to `a`
+    auto keep = m_nodes[f].height > m_nodes[g].height ? f : g;
+    auto move = keep == f ? g : f;
+
+    U.child2 = keep;
+
+    if (diff > 1) {
+        A.child2 = move;
+    } else {
+        A.child1 = move;
+    }
+
+    m_nodes[move].parent = a;
+
+    const auto& O = m_nodes[other];
+    const auto& M = m_nodes[move];
+    const auto& K = m_nodes[keep];
+
+    A.box = O.box.merged(M.box);
+    A.height = 1 + std::max(O.height, M.height);
+
+    U.box = A.box.merged(K.box);
+    U.height = 1 + std::max(A.height, K.height);
+
+    return up;
+}
@@ -0,0 +1,223 @@
+#pragma once
+
+#include "Common.h"
+#include "Geometry.h"
+
+#include <array>
+#include <vector>
+
+// Incrementally updated AABB tree. Leaves store a slightly enlarged box so small
+// movements don't need to touch the tree, and inserts pick the sibling that grows
+// the total surface area the least. Rotations keep the tree balanced.
+class DynamicAabbTree
+{
+public:
+    static constexpr i32 Null = -1;
+
+    // How much leaf boxes are enlarged by
+    static constexpr float Margin = 0.1f;
+
+    i32 createProxy(const math::Aabb& box, u32 userData);
+    void destroyProxy(i32 proxy);
+
+    // Returns true if the proxy had to be reinserted
+    bool moveProxy(i32 proxy, const math::Aabb& box);
+
+    u32 getUserData(i32 proxy) const
+    {
+        return m_nodes[proxy].userData;
+    }
+
+    const math::Aabb& getFatBox(i32 proxy) const
+    {
+        return m_nodes[proxy].box;
+    }
+
+    u32 getProxyCount() const
+    {
+        return m_proxyCount;
+    }
+
+    i32 getHeight() const
+    {
+        return m_root == Null ? 0 : m_nodes[m_root].height;
+    }
+
+    // Calls callback(proxy) for every leaf whose box passes `test`
+    template<typename Test, typename Callback>
+    void query(Test&& test, Callback&& callback) const;
+
+    // Leaves completely inside the frustum are collected without testing them
+    template<typename Callback>
+    void queryFrustum(const math::Frustum& frustum, Callback&& callback) const;
+
+    // callback(proxy, entryDistance) returns the new max distance, so a closest hit
+    // search can shrink the ray as it goes
+    template<typename Callback>
+    void raycast(const DirectX::XMFLOAT3& origin, const DirectX::XMFLOAT3& direction, float maxDistance,
+        Callback&& callback) const;
+
+private:
+    struct Node
+    {
+        math::Aabb box;
+        u32 userData = 0;
+
+        // Parent for nodes in the tree, next free node otherwise
+        i32 parent = Null;
+        i32 child1 = Null;
+        i32 child2 = Null;
+
+        // Leaves are 0, free nodes -1
+        i32 height = -1;
+
+        bool isLeaf() const
+        {
+            return child1 == Null;
+        }
+    };
+
+    // Fixed size stack for the traversals, the tree is balanced so this is plenty
+    struct Stack
+    {
+        std::array<i32, 256> items;
+        u32 size = 0;
+
+        void push(i32 node)
+        {
+            items[size++] = node;
+        }
+
+        i32 pop()
+        {
+            return items[--size];
+        }
+
+        bool empty() const
+        {
+            return size == 0;
+        }
+    };
+
+    i32 allocateNode();
+    void freeNode(i32 node);
+
+    void insertLeaf(i32 leaf);
+    void removeLeaf(i32 leaf);
+    i32 balance(i32 node);
+    void refitAncestors(i32 node);
+
+    template<typename Callback>
+    void collectLeaves(i32 node, Stack& stack, Callback& callback) const;
+
+    std::vector<Node> m_nodes;
+    i32 m_root = Null;
+    i32 m_freeList = Null;
+    u32 m_proxyCount = 0;
+};
+
+template<typename Test, typename Callback>
+void DynamicAabbTree::query(Test&& test, Callback&& callback) const
+{
+    if (m_root == Null) {
+        return;
+    }
+
+    Stack stack;
+    stack.push(m_root);
+
+    while (!stack.empty()) {
+        const auto& node = m_nodes[stack.pop()];
+
+        if (!test(node.box)) {
+            continue;
+        }
+
+        if (node.isLeaf()) {
+            callback(i32(&node - m_nodes.data()));
+        } else {
+            stack.push(node.child1);
+            stack.push(node.child2);
+        }
+    }
+}
+
+template<typename Callback>
+void DynamicAabbTree::collectLeaves(i32 first, Stack& stack, Callback& callback) const
+{
+    auto base = stack.size;
+    stack.push(first);
+
+    while (stack.size > base) {
+        auto idx = stack.pop();
+        const auto& node = m_nodes[idx];
+
+        if (node.isLeaf()) {
+            callback(idx);
+        } else {
+            stack.push(node.child1);
+            stack.push(node.child2);
+        }
+    }
+}
+
+template<typename Callback>
+void DynamicAabbTree::queryFrustum(const math::Frustum& frustum, Callback&& callback) const
+{
+    if (m_root == Null) {
+        return;
+    }
+
+    Stack stack;
+    stack.push(m_root);
+
+    while (!stack.empty()) {
+        auto idx = stack.pop();
+        const auto& node = m_nodes[idx];
+
+        auto result = frustum.classify(node.box);
+
+        if (result == math::Frustum::Result::Outside) {
+            continue;
+        }
+
+        if (result == math::Frustum::Result::Inside || node.isLeaf()) {
+            collectLeaves(idx, stack, callback);
+        } else {
+            stack.push(node.child1);
+            stack.push(node.child2);
+        }
+    }
+}
+
+template<typename Callback>
+void DynamicAabbTree::raycast(const DirectX::XMFLOAT3& origin, const DirectX::XMFLOAT3& direction,
+    float maxDistance, Callback&& callback) const
+{
+    if (m_root == Null) {
+        return;
+    }
+
+    DirectX::XMFLOAT3 invDir(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+
+    Stack stack;
+    stack.push(m_root);
+
+    while (!stack.empty()) {
+        auto idx = stack.pop();
+        const auto& node = m_nodes[idx];
+
+        auto t = node.box.intersectRay(origin, invDir, maxDistance);
+
+        if (t < 0.0f) {
+            continue;
+        }
+
+        if (node.isLeaf()) {
+            maxDistance = callback(idx, t);
+        } else {
+            stack.push(node.child1);
+            stack.push(node.child2);
+        }
+    }
+}
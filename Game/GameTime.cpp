@@ -1,13 +1,188 @@
 #include "pch.h"
 #include "GameTime.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <imgui.h>
+#include <thread>
+
+namespace
+{
+
+double toSeconds(GameTime::Clock::duration d)
+{
+    return std::chrono::duration<double>(d).count();
+}
+
+// Nearest rank on an already sorted range
+float percentile(const std::vector<float>& sorted, float p)
+{
+    auto idx = size_t(std::ceil(p * float(sorted.size()))) - 1;
+    return sorted[std::min(idx, sorted.size() - 1)];
+}
+
+}
 
 float GameTime::update()
 {
-    auto t = std::chrono::high_resolution_clock::now();
+    if (m_frameLimit > 0.0f) {
+        auto start = Clock::now();
+        auto frame = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / m_frameLimit));
+
+        waitUntil(m_prev + frame);
+        m_waitedMs = float(toSeconds(Clock::now() - start) * 1000.0);
+    } else {
+        m_waitedMs = 0.0f;
+    }
+
+    auto t = Clock::now();
     auto d = std::chrono::duration_cast<std::chrono::microseconds>(t - m_prev);
+    auto measured = static_cast<float>(static_cast<double>(d.count()) / 1'000'000.0);
 
-    m_delta = static_cast<float>(static_cast<double>(d.count()) / 1'000'000.0);
+    m_delta = m_fixedDelta > 0.0f ? m_fixedDelta : measured;
     m_prev = t;
 
+    record(measured * 1000.0f);
+
     return m_delta;
 }
+
+void GameTime::waitUntil(Clock::time_point target)
+{
+    PROFILE_SCOPE("Frame limiter");
+
+    auto remaining = toSeconds(target - Clock::now());
+
+    while (remaining > m_sleepEstimate) {
+        auto start = Clock::now();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        auto observed = toSeconds(Clock::now() - start);
+
+        remaining -= observed;
+
+        // Welford's running variance, a slow sleep now and then pushes the estimate up
+        // so we stop sleeping early enough
+        m_sleepCount++;
+        auto delta = observed - m_sleepMean;
+        m_sleepMean += delta / double(m_sleepCount);
+        m_sleepM2 += delta * (observed - m_sleepMean);
+        m_sleepEstimate = m_sleepMean + std::sqrt(m_sleepM2 / double(m_sleepCount - 1));
+    }
+
+    while (Clock::now() < target) {
+        YieldProcessor();
+    }
+}
+
+void GameTime::record(float ms)
+{
+    // The first update measures loading, not a frame
+    if (m_frameCount++ == 0) {
+        return;
+    }
+
+    m_history[m_frameCount % History] = ms;
+
+    if (m_hitchThresholdMs > 0.0f && ms > m_hitchThresholdMs) {
+        m_hitches[m_totalHitches % HitchHistory] = Hitch{ m_frameCount, ms };
+        m_totalHitches++;
+
+        // Covers the slow frame, so the timeline and traces show what it spent the time on
+        auto& profiler = getProfiler();
+        auto end = profiler.now();
+        profiler.addMarker("Hitch", end - std::min(end, u64(double(ms) * 1'000'000.0)), end);
+    }
+}
+
+FrameTimeStats GameTime::getStats() const
+{
+    FrameTimeStats stats;
+
+    auto count = u32(std::min<u64>(m_frameCount > 0 ? m_frameCount - 1 : 0, History));
+
+    if (count == 0) {
+        return stats;
+    }
+
+    m_sorted.clear();
+
+    for (u32 i = 0; i < count; i++) {
+        m_sorted.push_back(m_history[(m_frameCount - i) % History]);
+    }
+
+    std::sort(m_sorted.begin(), m_sorted.end());
+
+    double sum = 0.0;
+
+    for (auto ms : m_sorted) {
+        sum += ms;
+
+        if (m_hitchThresholdMs > 0.0f && ms > m_hitchThresholdMs) {
+            stats.hitches++;
+        }
+    }
+
+    stats.average = float(sum / double(count));
+    stats.p50 = percentile(m_sorted, 0.50f);
+    stats.p95 = percentile(m_sorted, 0.95f);
+    stats.p99 = percentile(m_sorted, 0.99f);
+    stats.max = m_sorted.back();
+
+    return stats;
+}
+
+void GameTime::drawWindow(bool* open)
+{
+    ImGui::SetNextWindowBgAlpha(0.8f);
+
+    if (!ImGui::Begin("Frame time", open, ImGuiWindowFlags_AlwaysAutoResize)) {
+        ImGui::End();
+        return;
+    }
+
+    auto stats = getStats();
+    auto count = int(std::min<u64>(m_frameCount > 0 ? m_frameCount - 1 : 0, History));
+
+    ImGui::Text("avg %6.2f ms (%.0f fps)", stats.average, stats.average > 0.0f ? 1000.0f / stats.average : 0.0f);
+    ImGui::Text("p50 %6.2f  p95 %6.2f  p99 %6.2f  max %6.2f", stats.p50, stats.p95, stats.p99, stats.max);
+
+    // Oldest first
+    std::array<float, History> values;
+
+    for (int i = 0; i < count; i++) {
+        values[i] = m_history[(m_frameCount - u64(count - 1 - i)) % History];
+    }
+
+    ImGui::PlotLines("##frametime", values.data(), count, 0, nullptr, 0.0f,
+        std::max(stats.max, m_hitchThresholdMs) * 1.1f, ImVec2(400.0f, 60.0f));
+
+    ImGui::SetNextItemWidth(120.0f);
+    ImGui::DragFloat("Hitch threshold (ms)", &m_hitchThresholdMs, 0.5f, 0.0f, 1000.0f, "%.1f");
+
+    ImGui::Text("Hitches: %u in history, %llu total", stats.hitches, static_cast<unsigned long long>(m_totalHitches));
+
+    auto recent = u32(std::min<u64>(m_totalHitches, HitchHistory));
+
+    for (u32 i = 0; i < recent; i++) {
+        const auto& h = m_hitches[(m_totalHitches - 1 - i) % HitchHistory];
+        ImGui::BulletText("frame %llu: %.2f ms", static_cast<unsigned long long>(h.frame), h.ms);
+    }
+
+    ImGui::Separator();
+
+    bool limit = m_frameLimit > 0.0f;
+
+    if (ImGui::Checkbox("Limit frame rate", &limit)) {
+        m_frameLimit = limit ? 60.0f : 0.0f;
+    }
+
+    if (limit) {
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(120.0f);
+        ImGui::DragFloat("fps", &m_frameLimit, 1.0f, 10.0f, 500.0f, "%.0f");
+        ImGui::Text("Waited %.2f ms, sleep overshoot estimate %.2f ms", m_waitedMs, m_sleepEstimate * 1000.0);
+    }
+
+    ImGui::End();
+}
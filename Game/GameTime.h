@@ -1,18 +1,115 @@
 #pragma once
 
+#include "Common.h"
+
+#include <array>
 #include <chrono>
+#include <vector>
+
+// Frame time over the history, in milliseconds
+struct FrameTimeStats
+{
+    float average = 0.0f;
+    float p50 = 0.0f;
+    float p95 = 0.0f;
+    float p99 = 0.0f;
+    float max = 0.0f;
+
+    // Frames in the history over the hitch threshold
+    u32 hitches = 0;
+};
 
 class GameTime
 {
 public:
+    using Clock = std::chrono::high_resolution_clock;
+
+    static constexpr u32 History = 600;
+    static constexpr u32 HitchHistory = 16;
+
+    struct Hitch
+    {
+        u64 frame;
+        float ms;
+    };
+
+    // Waits for the frame limit if there is one, then returns the time since the last update
     float update();
 
+    // Every update returns this instead of the measured time, 0 turns it off
+    void setFixedDelta(float dt)
+    {
+        m_fixedDelta = dt;
+    }
+
     float getDelta() const
     {
         return m_delta;
     }
 
+    // Frames per second to cap at, 0 turns the limiter off
+    void setFrameLimit(float fps)
+    {
+        m_frameLimit = fps;
+    }
+
+    float getFrameLimit() const
+    {
+        return m_frameLimit;
+    }
+
+    void setHitchThreshold(float ms)
+    {
+        m_hitchThresholdMs = ms;
+    }
+
+    float getHitchThreshold() const
+    {
+        return m_hitchThresholdMs;
+    }
+
+    u64 getFrameCount() const
+    {
+        return m_frameCount;
+    }
+
+    u64 getTotalHitches() const
+    {
+        return m_totalHitches;
+    }
+
+    // Computed from the measured frame times, fixed deltas don't affect it
+    FrameTimeStats getStats() const;
+
+    void drawWindow(bool* open);
+
 private:
-    std::chrono::high_resolution_clock::time_point m_prev = std::chrono::high_resolution_clock::now();
+    // Sleeps most of the way and spins the rest, sleeping alone overshoots by up to a
+    // millisecond even with SDL's 1 ms timer resolution
+    void waitUntil(Clock::time_point target);
+
+    void record(float ms);
+
+    Clock::time_point m_prev = Clock::now();
     float m_delta = 0.0f;
+    float m_fixedDelta = 0.0f;
+
+    float m_frameLimit = 0.0f;
+    float m_waitedMs = 0.0f;
+
+    // Running estimate of how long a 1 ms sleep really takes, mean plus a standard deviation
+    double m_sleepEstimate = 0.005;
+    double m_sleepMean = 0.005;
+    double m_sleepM2 = 0.0;
+    u64 m_sleepCount = 1;
+
+    std::array<float, History> m_history{};
+    u64 m_frameCount = 0;
+
+    float m_hitchThresholdMs = 50.0f;
+    u64 m_totalHitches = 0;
+    std::array<Hitch, HitchHistory> m_hitches{};
+
+    // Scratch for the percentiles
+    mutable std::vector<float> m_sorted;
 };
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <DirectXMath.h>
+#include <algorithm>
+#include <cmath>
+
+namespace math
+{
+
+struct Aabb
+{
+    DirectX::XMFLOAT3 min{ 0.0f, 0.0f, 0.0f };
+    DirectX::XMFLOAT3 max{ 0.0f, 0.0f, 0.0f };
+
+    static Aabb fromSphere(const DirectX::XMFLOAT3& center, float radius)
+    {
+        return Aabb{
+            { center.x - radius, center.y - radius, center.z - radius },
+            { center.x + radius, center.y + radius, center.z + radius },
+        };
+    }
+
+    Aabb merged(const Aabb& o) const
+    {
+        return Aabb{
+            { std::min(min.x, o.min.x), std::min(min.y, o.min.y), std::min(min.z, o.min.z) },
+            { std::max(max.x, o.max.x), std::max(max.y, o.max.y), std::max(max.z, o.max.z) },
+        };
+    }
+
+    Aabb expanded(float margin) const
+    {
+        return Aabb{
+            { min.x - margin, min.y - margin, min.z - margin },
+            { max.x + margin, max.y + margin, max.z + margin },
+        };
+    }
+
+    // Half the surface area, only used for comparing costs
+    float area() const
+    {
+        auto dx = max.x - min.x;
+        auto dy = max.y - min.y;
+        auto dz = max.z - min.z;
+
+        return dx * dy + dy * dz + dz * dx;
+    }
+
+    bool contains(const Aabb& o) const
+    {
+        return min.x <= o.min.x && min.y <= o.min.y && min.z <= o.min.z
+            && max.x >= o.max.x && max.y >= o.max.y && max.z >= o.max.z;
+    }
+
+    bool overlaps(const Aabb& o) const
+    {
+        return min.x <= o.max.x && min.y <= o.max.y && min.z <= o.max.z
+            && max.x >= o.min.x && max.y >= o.min.y && max.z >= o.min.z;
+    }
+
+    bool overlapsSphere(const DirectX::XMFLOAT3& center, float radius) const
+    {
+        auto dx = std::max({ min.x - center.x, 0.0f, center.x - max.x });
+        auto dy = std::max({ min.y - center.y, 0.0f, center.y - max.y });
+        auto dz = std::max({ min.z - center.z, 0.0f, center.z - max.z });
+
+        return dx * dx + dy * dy + dz * dz <= radius * radius;
+    }
+
+    // Slab test, invDir is 1 / direction. Returns the entry distance or a negative value
+    // if the ray misses within maxT.
+    float intersectRay(const DirectX::XMFLOAT3& origin, const DirectX::XMFLOAT3& invDir, float maxT) const
+    {
+        auto tx1 = (min.x - origin.x) * invDir.x;
+        auto tx2 = (max.x - origin.x) * invDir.x;
+        auto ty1 = (min.y - origin.y) * invDir.y;
+        auto ty2 = (max.y - origin.y) * invDir.y;
+        auto tz1 = (min.z - origin.z) * invDir.z;
+        auto tz2 = (max.z - origin.z) * invDir.z;
+
+        auto tMin = std::max({ std::min(tx1, tx2), std::min(ty1, ty2), std::min(tz1, tz2), 0.0f });
+        auto tMax = std::min({ std::max(tx1, tx2), std::max(ty1, ty2), std::max(tz1, tz2), maxT });
+
+        return tMin <= tMax ? tMin : -1.0f;
+    }
+
+    // Bounds of the box after transforming it, using the absolute matrix trick instead of
+    // transforming all the corners
+    Aabb transformed(DirectX::FXMMATRIX m) const
+    {
+        using namespace DirectX;
+
+        auto vmin = XMLoadFloat3(&min);
+        auto vmax = XMLoadFloat3(&max);
+
+        auto center = XMVectorScale(XMVectorAdd(vmin, vmax), 0.5f);
+        auto extents = XMVectorScale(XMVectorSubtract(vmax, vmin), 0.5f);
+
+        auto newCenter = XMVector3Transform(center, m);
+        auto newExtents = XMVectorAdd(XMVectorAdd(
+            XMVectorMultiply(XMVectorSplatX(extents), XMVectorAbs(m.r[0])),
+            XMVectorMultiply(XMVectorSplatY(extents), XMVectorAbs(m.r[1]))),
+            XMVectorMultiply(XMVectorSplatZ(extents), XMVectorAbs(m.r[2])));
+
+        Aabb result;
+        XMStoreFloat3(&result.min, XMVectorSubtract(newCenter, newExtents));
+        XMStoreFloat3(&result.max, XMVectorAdd(newCenter, newExtents));
+
+        return result;
+    }
+};
+
+struct Frustum
+{
+    enum class Result
+    {
+        Outside,
+        Intersects,
+        Inside,
+    };
+
+    // a * x + b * y + c * z + d >= 0 is inside
+    DirectX::XMFLOAT4 planes[6];
+
+    // Works for both perspective and ortho, and doesn't care about reverse-Z since the
+    // near and far planes are both extracted the same way
+    static Frustum fromMatrix(DirectX::FXMMATRIX viewProjection)
+    {
+        using namespace DirectX;
+
+        // Row vectors, so the planes come from the columns
+        auto m = XMMatrixTranspose(viewProjection);
+
+        XMVECTOR p[6] = {
+            XMVectorAdd(m.r[3], m.r[0]),
+            XMVectorSubtract(m.r[3], m.r[0]),
+            XMVectorAdd(m.r[3], m.r[1]),
+            XMVectorSubtract(m.r[3], m.r[1]),
+            m.r[2],
+            XMVectorSubtract(m.r[3], m.r[2]),
+        };
+
+        Frustum f;
+
+        for (int i = 0; i < 6; i++) {
+            // An infinite far plane has no normal, it's always passing anyway
+            auto length = XMVectorGetX(XMVector3Length(p[i]));
+
+            if (length > 1e-6f) {
+                p[i] = XMVectorScale(p[i], 1.0f / length);
+            }
+
+            XMStoreFloat4(&f.planes[i], p[i]);
+        }
+
+        return f;
+    }
+
+    Result classify(const Aabb& box) const
+    {
+        auto result = Result::Inside;
+
+        for (const auto& p : planes) {
+            // Corner furthest along the plane normal, and the one opposite to it
+            auto px = p.x >= 0.0f ? box.max.x : box.min.x;
+            auto py = p.y >= 0.0f ? box.max.y : box.min.y;
+            auto pz = p.z >= 0.0f ? box.max.z : box.min.z;
+
+            if (p.x * px + p.y * py + p.z * pz + p.w < 0.0f) {
+                return Result::Outside;
+            }
+
+            auto nx = p.x >= 0.0f ? box.min.x : box.max.x;
+            auto ny = p.y >= 0.0f ? box.min.y : box.max.y;
+            auto nz = p.z >= 0.0f ? box.min.z : box.max.z;
+
+            if (p.x * nx + p.y * ny + p.z * nz + p.w < 0.0f) {
+                result = Result::Intersects;
+            }
+        }
+
+        return result;
+    }
+
+    bool intersects(const Aabb& box) const
+    {
+        return classify(box) != Result::Outside;
+    }
+};
+
+}
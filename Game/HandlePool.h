@@ -0,0 +1,106 @@
+#pragma once
+
+#include "Common.h"
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+// Objects behind generational handles, each with a single owner.
+//
+// A handle is a slot index in the low IndexBits and the slot's generation in the rest.
+// Destroying an object bumps the generation, so handles to it stop resolving instead of
+// pointing at whatever reuses the slot. Generations start at 1, a handle of 0 is never
+// valid. Handle has to be an enum class over u32.
+template<typename T, typename Handle>
+class HandlePool
+{
+public:
+    static constexpr u32 IndexBits = 20;
+    static constexpr u32 IndexMask = (1u << IndexBits) - 1;
+    static constexpr u32 GenerationMask = ~0u >> IndexBits;
+
+    Handle add(std::unique_ptr<T> value)
+    {
+        u32 index;
+
+        if (!m_free.empty()) {
+            index = m_free.back();
+            m_free.pop_back();
+        } else {
+            index = u32(m_slots.size());
+            m_slots.emplace_back();
+        }
+
+        auto& slot = m_slots[index];
+        slot.value = std::move(value);
+        m_count++;
+
+        return Handle((slot.generation << IndexBits) | index);
+    }
+
+    T* get(Handle handle)
+    {
+        auto slot = find(handle);
+        return slot ? slot->value.get() : nullptr;
+    }
+
+    const T* get(Handle handle) const
+    {
+        return const_cast<HandlePool*>(this)->get(handle);
+    }
+
+    // Destroys the object, stale handles are ignored
+    void release(Handle handle)
+    {
+        auto slot = find(handle);
+
+        if (!slot) {
+            return;
+        }
+
+        slot->value.reset();
+        slot->generation = std::max((slot->generation + 1) & GenerationMask, 1u);
+        m_free.push_back(u32(handle) & IndexMask);
+        m_count--;
+    }
+
+    // fn(Handle, T&) for every live object
+    template<typename F>
+    void forEach(F&& fn)
+    {
+        for (u32 i = 0; i < m_slots.size(); i++) {
+            if (auto& slot = m_slots[i]; slot.value) {
+                fn(Handle((slot.generation << IndexBits) | i), *slot.value);
+            }
+        }
+    }
+
+    u32 size() const
+    {
+        return m_count;
+    }
+
+private:
+    struct Slot
+    {
+        std::unique_ptr<T> value;
+        u32 generation = 1;
+    };
+
+    Slot* find(Handle handle)
+    {
+        auto index = u32(handle) & IndexMask;
+
+        if (index >= m_slots.size()) {
+            return nullptr;
+        }
+
+        auto& slot = m_slots[index];
+        return slot.value && slot.generation == u32(handle) >> IndexBits ? &slot : nullptr;
+    }
+
+    std::vector<Slot> m_slots;
+    std::vector<u32> m_free;
+    u32 m_count = 0;
+};
@@ -0,0 +1,242 @@
+#include "pch.h"
+
+#include "InputRecording.h"
+
+#include <cstring>
+#include <fmt/format.h>
+#include <iterator>
+#include <stdexcept>
+
+namespace
+{
+
+constexpr char Magic[4] = { 'F', 'Q', 'I', 'R' };
+constexpr u32 Version = 1;
+
+enum class EventKind : u8
+{
+    Quit,
+    Key,
+    MouseMotion,
+    MouseButton,
+    MouseWheel,
+    TextInput,
+};
+
+template<typename T>
+void put(std::vector<u8>& out, const T& value)
+{
+    static_assert(std::is_trivially_copyable_v<T>);
+
+    auto bytes = reinterpret_cast<const u8*>(&value);
+    out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+template<typename T>
+T get(const std::vector<u8>& data, size_t& offset)
+{
+    static_assert(std::is_trivially_copyable_v<T>);
+
+    if (offset + sizeof(T) > data.size()) {
+        throw std::runtime_error("Input recording is truncated");
+    }
+
+    T value;
+    std::memcpy(&value, data.data() + offset, sizeof(T));
+    offset += sizeof(T);
+
+    return value;
+}
+
+}
+
+InputRecorder::InputRecorder(const std::filesystem::path& path) :
+    m_output(path, std::ios::binary)
+{
+    if (!m_output) {
+        throw std::runtime_error(fmt::format("Couldn't open {} for recording", path.generic_string()));
+    }
+
+    m_output.write(Magic, sizeof(Magic));
+    m_output.write(reinterpret_cast<const char*>(&Version), sizeof(Version));
+}
+
+void InputRecorder::addEvent(const SDL_Event& event)
+{
+    switch (event.type) {
+    case SDL_QUIT:
+        put(m_events, EventKind::Quit);
+        break;
+
+    case SDL_KEYDOWN:
+    case SDL_KEYUP:
+        put(m_events, EventKind::Key);
+        put(m_events, u8(event.type == SDL_KEYDOWN));
+        put(m_events, event.key.repeat);
+        put(m_events, i32(event.key.keysym.sym));
+        put(m_events, u16(event.key.keysym.scancode));
+        put(m_events, event.key.keysym.mod);
+        break;
+
+    case SDL_MOUSEMOTION:
+        put(m_events, EventKind::MouseMotion);
+        put(m_events, event.motion.state);
+        put(m_events, event.motion.x);
+        put(m_events, event.motion.y);
+        put(m_events, event.motion.xrel);
+        put(m_events, event.motion.yrel);
+        break;
+
+    case SDL_MOUSEBUTTONDOWN:
+    case SDL_MOUSEBUTTONUP:
+        put(m_events, EventKind::MouseButton);
+        put(m_events, u8(event.type == SDL_MOUSEBUTTONDOWN));
+        put(m_events, event.button.button);
+        put(m_events, event.button.clicks);
+        put(m_events, event.button.x);
+        put(m_events, event.button.y);
+        break;
+
+    case SDL_MOUSEWHEEL:
+        put(m_events, EventKind::MouseWheel);
+        put(m_events, event.wheel.x);
+        put(m_events, event.wheel.y);
+        break;
+
+    case SDL_TEXTINPUT:
+    {
+        auto length = u8(strnlen(event.text.text, sizeof(event.text.text)));
+
+        put(m_events, EventKind::TextInput);
+        put(m_events, length);
+        m_events.insert(m_events.end(), event.text.text, event.text.text + length);
+        break;
+    }
+
+    default:
+        return;
+    }
+
+    m_eventCount++;
+}
+
+void InputRecorder::endFrame(float dt)
+{
+    m_output.write(reinterpret_cast<const char*>(&dt), sizeof(dt));
+    m_output.write(reinterpret_cast<const char*>(&m_eventCount), sizeof(m_eventCount));
+    m_output.write(reinterpret_cast<const char*>(m_events.data()), std::streamsize(m_events.size()));
+
+    m_events.clear();
+    m_eventCount = 0;
+    m_frameCount++;
+}
+
+InputReplay::InputReplay(const std::filesystem::path& path)
+{
+    std::ifstream input(path, std::ios::binary);
+
+    if (!input) {
+        throw std::runtime_error(fmt::format("Couldn't open {} for replay", path.generic_string()));
+    }
+
+    m_data.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+
+    if (m_data.size() < sizeof(Magic) + sizeof(Version) || std::memcmp(m_data.data(), Magic, sizeof(Magic)) != 0) {
+        throw std::runtime_error(fmt::format("{} isn't an input recording", path.generic_string()));
+    }
+
+    m_offset = sizeof(Magic);
+
+    if (auto version = get<u32>(m_data, m_offset); version != Version) {
+        throw std::runtime_error(fmt::format("{} is version {}, expected {}", path.generic_string(), version, Version));
+    }
+}
+
+bool InputReplay::nextFrame(std::vector<SDL_Event>& events, float& dt)
+{
+    events.clear();
+
+    if (m_offset >= m_data.size()) {
+        return false;
+    }
+
+    dt = get<float>(m_data, m_offset);
+    auto count = get<u32>(m_data, m_offset);
+
+    auto timestamp = SDL_GetTicks();
+
+    for (u32 i = 0; i < count; i++) {
+        SDL_Event event;
+        std::memset(&event, 0, sizeof(event));
+
+        switch (get<EventKind>(m_data, m_offset)) {
+        case EventKind::Quit:
+            event.type = SDL_QUIT;
+            event.quit.timestamp = timestamp;
+            break;
+
+        case EventKind::Key:
+            event.type = get<u8>(m_data, m_offset) ? SDL_KEYDOWN : SDL_KEYUP;
+            event.key.timestamp = timestamp;
+            event.key.state = event.type == SDL_KEYDOWN ? SDL_PRESSED : SDL_RELEASED;
+            event.key.repeat = get<u8>(m_data, m_offset);
+            event.key.keysym.sym = SDL_Keycode(get<i32>(m_data, m_offset));
+            event.key.keysym.scancode = SDL_Scancode(get<u16>(m_data, m_offset));
+            event.key.keysym.mod = get<u16>(m_data, m_offset);
+            break;
+
+        case EventKind::MouseMotion:
+            event.type = SDL_MOUSEMOTION;
+            event.motion.timestamp = timestamp;
+            event.motion.state = get<u32>(m_data, m_offset);
+            event.motion.x = get<i32>(m_data, m_offset);
+            event.motion.y = get<i32>(m_data, m_offset);
+            event.motion.xrel = get<i32>(m_data, m_offset);
+            event.motion.yrel = get<i32>(m_data, m_offset);
+            break;
+
+        case EventKind::MouseButton:
+            event.type = get<u8>(m_data, m_offset) ? SDL_MOUSEBUTTONDOWN : SDL_MOUSEBUTTONUP;
+            event.button.timestamp = timestamp;
+            event.button.state = event.type == SDL_MOUSEBUTTONDOWN ? SDL_PRESSED : SDL_RELEASED;
+            event.button.button = get<u8>(m_data, m_offset);
+            event.button.clicks = get<u8>(m_data, m_offset);
+            event.button.x = get<i32>(m_data, m_offset);
+            event.button.y = get<i32>(m_data, m_offset);
+            break;
+
+        case EventKind::MouseWheel:
+            event.type = SDL_MOUSEWHEEL;
+            event.wheel.timestamp = timestamp;
+            event.wheel.x = get<i32>(m_data, m_offset);
+            event.wheel.y = get<i32>(m_data, m_offset);
+            break;
+
+        case EventKind::TextInput:
+        {
+            event.type = SDL_TEXTINPUT;
+            event.text.timestamp = timestamp;
+
+            size_t length = get<u8>(m_data, m_offset);
+
+            if (m_offset + length > m_data.size()) {
+                throw std::runtime_error("Input recording is truncated");
+            }
+
+            // Keep the terminator
+            std::memcpy(event.text.text, m_data.data() + m_offset, std::min(length, sizeof(event.text.text) - 1));
+            m_offset += length;
+            break;
+        }
+
+        default:
+            throw std::runtime_error("Input recording is corrupted");
+        }
+
+        events.push_back(event);
+    }
+
+    m_frame++;
+
+    return true;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "Common.h"
+
+#include <SDL2/SDL_events.h>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+// Records the SDL events and frame deltas of a session so the exact same frames can be
+// played back later for performance comparisons. Only the event types the game and
+// ImGui react to are kept.
+//
+// The file is a small header followed by one record per frame: the delta, the number
+// of events and the events packed down to the fields that matter.
+class InputRecorder
+{
+public:
+    explicit InputRecorder(const std::filesystem::path& path);
+
+    void addEvent(const SDL_Event& event);
+
+    // Writes the events added since the last call together with the frame's delta
+    void endFrame(float dt);
+
+    u32 getFrameCount() const
+    {
+        return m_frameCount;
+    }
+
+private:
+    std::ofstream m_output;
+    std::vector<u8> m_events;
+    u32 m_eventCount = 0;
+    u32 m_frameCount = 0;
+};
+
+class InputReplay
+{
+public:
+    explicit InputReplay(const std::filesystem::path& path);
+
+    // Returns false once every recorded frame has been played
+    bool nextFrame(std::vector<SDL_Event>& events, float& dt);
+
+    u32 getFrame() const
+    {
+        return m_frame;
+    }
+
+private:
+    std::vector<u8> m_data;
+    size_t m_offset = 0;
+    u32 m_frame = 0;
+};
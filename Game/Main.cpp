@@ -12,6 +12,18 @@
 #include "GameTime.h"
 #include "SceneEditor.h"
 #include "ArrayView.h"
+#include "Assets.h"
+#include "Bench.h"
+#include "CommandLine.h"
+#include "DebugDraw.h"
+#include "Profiler.h"
+#include "RenderStats.h"
+#include "MemoryTracker.h"
+#include "SceneRendering.h"
+#include "InputRecording.h"
+#include "OcclusionBuffer.h"
+#include "TextureAtlas.h"
+#include "stb_image.h"
 
 #include "PhysicsWorld.h"
 #include "Components/Transform.h"
@@ -47,11 +59,15 @@ void reportError(const char* message, TArgs&&... args)
     MessageBoxA(nullptr, msg.c_str(), "fuck", MB_OK);
 }
 
-std::vector<ModelAsset> loadModels(IRenderer* r)
+std::vector<AssetId> loadModels(IRenderer* r)
 {
+    PROFILE_FUNC();
+    MemoryScope memoryScope(MemoryTag::Assets);
+
     std::filesystem::directory_iterator end;
 
-    std::vector<ModelAsset> models;
+    std::vector<AssetId> models;
+    auto& assets = getAssetRegistry();
 
     for (auto it = std::filesystem::directory_iterator("./content"); it != end; ++it) {
         if (!it->is_regular_file()) {
@@ -61,23 +77,61 @@ std::vector<ModelAsset> loadModels(IRenderer* r)
         const auto p = it->path();
 
         if (p.extension() == ".mesh") {
+            PROFILE_SCOPE("Load model");
+
             Mesh mesh;
             mesh.load(p);
             //auto renderable = r->createRenderable(mesh.getName(), mesh.getVertices(), mesh.getIndices());
-            auto renderable = r->createRenderable(mesh);
-            models.emplace_back(mesh.getName(), renderable, mesh.getBounds(), p.generic_string());
+            auto renderable = r->createRenderable(mesh, p);
+            models.push_back(assets.addModel(mesh, renderable, p.generic_string()));
         }
     }
 
     return models;
 }
 
+// Textures small enough for the atlas, named after the file like the materials using them
+std::vector<TextureAtlas::Image> loadAtlasImages(const std::filesystem::path& in)
+{
+    std::vector<TextureAtlas::Image> images;
+    std::filesystem::directory_iterator end;
+
+    for (auto it = std::filesystem::directory_iterator(in); it != end; ++it) {
+        const auto p = it->path();
+
+        if (!it->is_regular_file() || (p.extension() != ".png" && p.extension() != ".jpg" && p.extension() != ".tga")) {
+            continue;
+        }
+
+        int w = 0, h = 0, c = 0;
+
+        if (auto pixels = stbi_load(p.generic_string().c_str(), &w, &h, &c, 4)) {
+            if (u32(w) <= TextureAtlas::MaxTextureSize && u32(h) <= TextureAtlas::MaxTextureSize) {
+                images.push_back(TextureAtlas::Image{
+                    p.stem().generic_string(), u32(w), u32(h), std::vector<u8>(pixels, pixels + w * h * 4) });
+            }
+
+            stbi_image_free(pixels);
+        }
+    }
+
+    return images;
+}
+
 void convertAssets(const std::filesystem::path& in, const std::filesystem::path& out)
 {
     std::filesystem::directory_iterator end;
     std::filesystem::create_directories(out);
     std::unordered_set<std::string> meshNames;
 
+    // One atlas per directory, the meshes below get remapped to it
+    auto dirName = in.filename().empty() ? in.parent_path().filename() : in.filename();
+    auto atlas = TextureAtlas::build(dirName.generic_string(), loadAtlasImages(in));
+
+    if (!atlas.getPages().empty()) {
+        atlas.save(out / (dirName.generic_string() + ".atlas"));
+    }
+
     for (auto it = std::filesystem::directory_iterator(in); it != end; ++it) {
         if (!it->is_regular_file()) {
             continue;
@@ -98,6 +152,7 @@ void convertAssets(const std::filesystem::path& in, const std::filesystem::path&
 
             mesh.setName(meshName);
             meshNames.insert(meshName);
+            mesh.applyAtlas(atlas);
 
             auto pOut = p.filename();
             pOut.replace_extension(".mesh");
@@ -118,10 +173,22 @@ std::vector<std::string_view> getArgs(int argc, char* argv[])
     return args;
 }
 
+// Input recording and replay, owned by main() so they carry over scene reloads
+struct InputSession
+{
+    InputRecorder* recorder = nullptr;
+    InputReplay* replay = nullptr;
+
+    // Replaces the measured or recorded frame deltas if set
+    float fixedDelta = 0.0f;
+};
+
 class MainLoop
 {
 public:
-    MainLoop(SDL_Window* window, const std::filesystem::path& scenePath = {});
+    MainLoop(SDL_Window* window, const std::filesystem::path& scenePath = {},
+        const PhysicsSettings& physicsSettings = {}, const InputSession& inputSession = {},
+        float frameLimit = 0.0f, u64 renderableBudget = 0);
     ~MainLoop();
 
     void handleEvents();
@@ -129,15 +196,14 @@ public:
     bool isRunning() const { return m_running; }
 
 private:
-    void updateLights();
-    void updateBatches();
+    void handleEvent(const SDL_Event& event);
 
     std::vector<PointLight> m_lights;
 
     std::unique_ptr<IRenderer> m_renderer;
     InputMap m_inputs;
     bool m_running = true;
-    std::vector<ModelAsset> m_models;
+    std::vector<AssetId> m_models;
     SDL_Window* m_window = nullptr;
 
     Scene m_scene;
@@ -149,21 +215,52 @@ private:
     size_t m_gameIdx = 1;
 
     GameTime m_gameTime;
+    InputSession m_inputSession;
+    std::vector<SDL_Event> m_events;
+    float m_replayDelta = 0.0f;
     bool m_showDemo = false;
+    bool m_showProfiler = false;
+    bool m_showRenderStats = false;
+    bool m_showMemory = false;
+    bool m_showFrameTime = false;
+    bool m_occlusionCulling = true;
 
     XMFLOAT2 m_mouse{ 0.0f, 0.0f };
 
     Camera m_shadowCam = Camera::ortho({ 1024.0f, 1024.0f });
     XMFLOAT3 m_shadowDirection{ 0.0f, 0.0f, 0.0f };
-    std::unordered_map<Renderable*, RenderBatch> m_renderBatches;
+    // Indexed by AssetId
+    std::vector<RenderBatch> m_renderBatches;
+    std::vector<RenderBatch> m_shadowBatches;
+
+    // Chunks of Scene::staticGeometry
+    std::vector<const RenderBatch*> m_staticBatches;
+    std::vector<const RenderBatch*> m_staticShadowBatches;
+
+    // Scratch space for BVH queries
+    std::vector<entt::entity> m_visible;
+
+    // Only for the main camera, shadows can be cast by things the camera can't see
+    OcclusionBuffer m_occlusion;
 
     float t = 0.0f;
 };
 
-MainLoop::MainLoop(SDL_Window* window, const std::filesystem::path& scenePath) :
-    m_window(window)
+MainLoop::MainLoop(SDL_Window* window, const std::filesystem::path& scenePath,
+    const PhysicsSettings& physicsSettings, const InputSession& inputSession, float frameLimit, u64 renderableBudget) :
+    m_window(window), m_scene(physicsSettings), m_inputSession(inputSession)
 {
-    m_renderer = createRenderer(window);
+    m_gameTime.setFixedDelta(inputSession.fixedDelta);
+    m_gameTime.setFrameLimit(frameLimit);
+
+    {
+        MemoryScope memoryScope(MemoryTag::Renderer);
+        m_renderer = createRenderer(window);
+
+        if (renderableBudget > 0) {
+            m_renderer->setRenderableBudget(renderableBudget);
+        }
+    }
 
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
@@ -178,21 +275,11 @@ MainLoop::MainLoop(SDL_Window* window, const std::filesystem::path& scenePath) :
     m_models = loadModels(m_renderer.get());
 
     if (std::filesystem::exists(scenePath)) {
-        std::unordered_map<std::string, const ModelAsset*> m;
-        for (const auto& model : m_models) {
-            m[model.name] = &model;
-        }
-
         m_scene.load(scenePath);
-
-        m_scene.reg.view<components::Renderable>()
-            .each([&](components::Renderable& rc) {
-                const auto& model = m[rc.name];
-                rc.renderable = model->renderable;
-                rc.bounds = model->bounds;
-            });
     }
 
+    m_scene.staticGeometry.requestBake();
+
     game = std::make_unique<Game>(m_scene, m_inputs);
     editor = std::make_unique<SceneEditor>(m_scene, m_inputs, m_models);
     m_games[0] = game.get();
@@ -201,16 +288,28 @@ MainLoop::MainLoop(SDL_Window* window, const std::filesystem::path& scenePath) :
     m_inputs.key(SDLK_ESCAPE).up([&] { m_running = false; });
     m_inputs.key(SDLK_F1).up([&] { m_gameIdx++; m_gameIdx %= m_games.size(); });
     m_inputs.key(SDLK_HOME).up([&] { m_showDemo = !m_showDemo; });
+    m_inputs.key(SDLK_F2).up([&] { m_showProfiler = !m_showProfiler; });
+    m_inputs.key(SDLK_F3).up([&] { m_showRenderStats = !m_showRenderStats; });
+    m_inputs.key(SDLK_F4).up([&] { m_showMemory = !m_showMemory; });
+    m_inputs.key(SDLK_F5).up([&] { m_showFrameTime = !m_showFrameTime; });
+    m_inputs.key(SDLK_F6).up([&] { m_occlusionCulling = !m_occlusionCulling; });
 
     m_scene.physicsWorld.addBox(25.0f, 1.0f, 25.0f, 0.0f, 0.0f, +1.0f, 0.0f);
 
-    for (const auto& model : m_models) {
-        m_renderBatches[model.renderable].renderable = model.renderable;
+    m_renderBatches.resize(getAssetRegistry().size());
+
+    for (auto model : m_models) {
+        m_renderBatches[u32(model)].renderable = getAssetRegistry().get(model).renderable;
     }
+
+    m_shadowBatches = m_renderBatches;
 }
 
 MainLoop::~MainLoop()
 {
+    // The next scene gets a new renderer
+    getAssetRegistry().releaseRenderables(*m_renderer);
+
     ImGui_ImplDX11_Shutdown();
     ImGui_ImplSDL2_Shutdown();
     ImGui::DestroyContext();
@@ -218,48 +317,81 @@ MainLoop::~MainLoop()
 
 void MainLoop::handleEvents()
 {
-    auto& io = ImGui::GetIO();
+    PROFILE_FUNC();
+
+    auto recorder = m_inputSession.recorder;
+    auto replay = m_inputSession.replay;
+
+    m_events.clear();
     SDL_Event event;
 
     while (SDL_PollEvent(&event)) {
-        ImGui_ImplSDL2_ProcessEvent(&event);
+        // The window still needs its events pumped during a replay, but only closing it counts
+        if (replay) {
+            if (event.type == SDL_QUIT) {
+                m_running = false;
+            }
 
-        switch (event.type) {
-        case SDL_QUIT:
-            m_running = false;
-            break;
+            continue;
+        }
 
-        case SDL_KEYUP:
-        case SDL_KEYDOWN:
-            if (!io.WantCaptureKeyboard) {
-                m_inputs.handleEvent(event.key);
-            }
-            break;
+        if (recorder) {
+            recorder->addEvent(event);
+        }
 
-        case SDL_MOUSEMOTION:
-            if (!io.WantCaptureMouse) {
-                m_inputs.handleEvent(event.motion);
-                m_mouse.x = float(event.motion.x) / 1920.0f;
-                m_mouse.y = float(event.motion.y) / 1080.0f;
-            }
-            break;
+        m_events.push_back(event);
+    }
+
+    if (replay && !replay->nextFrame(m_events, m_replayDelta)) {
+        m_running = false;
+    }
 
-        case SDL_MOUSEBUTTONUP:
-        case SDL_MOUSEBUTTONDOWN:
-            if (!io.WantCaptureMouse) {
-                auto& ad = Im3d::GetAppData();
+    for (const auto& e : m_events) {
+        handleEvent(e);
+    }
+}
 
-                if (event.button.button == SDL_BUTTON_LEFT) {
-                    ad.m_keyDown[Im3d::Action_Select] = event.button.state == SDL_PRESSED;
-                }
+void MainLoop::handleEvent(const SDL_Event& event)
+{
+    auto& io = ImGui::GetIO();
+
+    ImGui_ImplSDL2_ProcessEvent(&event);
+
+    switch (event.type) {
+    case SDL_QUIT:
+        m_running = false;
+        break;
+
+    case SDL_KEYUP:
+    case SDL_KEYDOWN:
+        if (!io.WantCaptureKeyboard) {
+            m_inputs.handleEvent(event.key);
+        }
+        break;
 
-                m_inputs.handleEvent(event.button);
+    case SDL_MOUSEMOTION:
+        if (!io.WantCaptureMouse) {
+            m_inputs.handleEvent(event.motion);
+            m_mouse.x = float(event.motion.x) / 1920.0f;
+            m_mouse.y = float(event.motion.y) / 1080.0f;
+        }
+        break;
+
+    case SDL_MOUSEBUTTONUP:
+    case SDL_MOUSEBUTTONDOWN:
+        if (!io.WantCaptureMouse) {
+            auto& ad = Im3d::GetAppData();
+
+            if (event.button.button == SDL_BUTTON_LEFT) {
+                ad.m_keyDown[Im3d::Action_Select] = event.button.state == SDL_PRESSED;
             }
-            break;
 
-        default:
-            break;
+            m_inputs.handleEvent(event.button);
         }
+        break;
+
+    default:
+        break;
     }
 }
 
@@ -269,10 +401,25 @@ void MainLoop::update()
 
     auto g = m_games[m_gameIdx];
     float dt = m_gameTime.update();
+
+    if (m_inputSession.replay && m_inputSession.fixedDelta <= 0.0f) {
+        dt = m_replayDelta;
+    }
+
+    if (m_inputSession.recorder) {
+        m_inputSession.recorder->endFrame(dt);
+    }
+
     t += dt;
 
     ImGui_ImplDX11_NewFrame();
     ImGui_ImplSDL2_NewFrame(m_window);
+
+    // ImGui measures its own delta, use ours so replays animate the same way
+    if ((m_inputSession.replay || m_inputSession.fixedDelta > 0.0f) && dt > 0.0f) {
+        ImGui::GetIO().DeltaTime = dt;
+    }
+
     ImGui::NewFrame();
 
     {
@@ -296,13 +443,52 @@ void MainLoop::update()
 
     Im3d::NewFrame();
 
-    g->update(dt);
-    m_scene.physicsWorld.render();
+    {
+        MemoryScope memoryScope(MemoryTag::Scene);
+
+        m_scene.physicsWorld.advance(dt);
+
+        {
+            PROFILE_SCOPE("Game update");
+            g->update(dt);
+        }
+        {
+            PROFILE_SCOPE("Transforms");
+            m_scene.transforms.update();
+        }
+
+        m_scene.staticGeometry.update();
+
+        {
+            PROFILE_SCOPE("BVH update");
+            m_scene.bvh.update();
+        }
+    }
+
+    m_scene.physicsWorld.render(g->getCamera().getFrustum());
 
     if (m_showDemo) {
         ImGui::ShowDemoWindow(&m_showDemo);
     }
 
+    if (m_showProfiler) {
+        getProfiler().drawWindow(&m_showProfiler);
+    }
+
+    if (m_showRenderStats) {
+        getRenderStats().drawWindow(&m_showRenderStats);
+    }
+
+    getMemoryTracker().update();
+
+    if (m_showMemory) {
+        getMemoryTracker().drawWindow(&m_showMemory);
+    }
+
+    if (m_showFrameTime) {
+        m_gameTime.drawWindow(&m_showFrameTime);
+    }
+
     if constexpr (false) {
         ImGui::Begin("Post processing");
 
@@ -322,89 +508,90 @@ void MainLoop::update()
         XMStoreFloat3(&d, direction);
         m_renderer->setDirectionalLight(d, m_scene.directionalLightColor, m_scene.directionalLightIntensity);
 
-        updateLights();
+        collectPointLights(m_scene, g->getCamera().getFrustum(), m_lights, m_visible);
 
         m_renderer->setPointLights(m_lights);
     }
 
-    ImGui::Render();
-    Im3d::EndFrame();
+    {
+        PROFILE_SCOPE("UI end frame");
+        ImGui::Render();
+        Im3d::EndFrame();
+        getDebugDraw().prepare(g->getCamera().getFrustum());
+    }
 
-    updateBatches();
+    MemoryScope memoryScope(MemoryTag::Renderer);
+
+    m_scene.staticGeometry.updateRenderables(*m_renderer);
+
+    if (m_occlusionCulling) {
+        collectRenderBatches(m_scene, g->getCamera(), m_occlusion, m_renderBatches, m_visible);
+    } else {
+        collectRenderBatches(m_scene, g->getCamera().getFrustum(), m_renderBatches, m_visible);
+    }
+
+    collectRenderBatches(m_scene, m_shadowCam.getFrustum(), m_shadowBatches, m_visible);
+
+    XMFLOAT3 eye;
+    XMStoreFloat3(&eye, g->getCamera().getPosition().vec);
+
+    m_scene.staticGeometry.collectBatches(g->getCamera().getFrustum(), eye, m_occlusionCulling ? &m_occlusion : nullptr,
+        m_staticBatches);
+    m_scene.staticGeometry.collectBatches(m_shadowCam.getFrustum(), eye, nullptr, m_staticShadowBatches);
 
     m_renderer->beginShadowPass(m_shadowCam);
     {
-        for (const auto& [_, batch] : m_renderBatches) {
-            if (!batch.instances.empty()) {
+        PROFILE_SCOPE("Shadow pass");
+
+        for (const auto& batch : m_shadowBatches) {
+            // Models referenced by the scene but missing from the content directory
+            if (batch.renderable != RenderableHandle::Invalid && !batch.instances.empty()) {
                 m_renderer->drawShadow(batch);
             }
         }
+
+        for (auto batch : m_staticShadowBatches) {
+            if (batch->renderable != RenderableHandle::Invalid) {
+                m_renderer->drawShadow(*batch);
+            }
+        }
     }
     m_renderer->endShadowPass();
 
     m_renderer->beginFrame(g->getCamera());
     {
+        PROFILE_SCOPE("Main pass");
+
         m_renderer->clear(0.0f, 0.0f, 0.0f);
 
-        for (const auto& [_, batch] : m_renderBatches) {
-            if (!batch.instances.empty()) {
+        for (const auto& batch : m_renderBatches) {
+            if (batch.renderable != RenderableHandle::Invalid && !batch.instances.empty()) {
                 m_renderer->draw(batch);
             }
         }
 
+        for (auto batch : m_staticBatches) {
+            if (batch->renderable != RenderableHandle::Invalid) {
+                m_renderer->draw(*batch);
+            }
+        }
+
         g->render(m_renderer.get());
 
         params.deltaTime = dt;
         m_renderer->postProcess(params);
 
-        m_renderer->drawIm3d(g->getCamera(), ArrayView(Im3d::GetDrawLists(), Im3d::GetDrawListCount()));
+        m_renderer->drawIm3d(g->getCamera(), ArrayView(Im3d::GetDrawLists(), Im3d::GetDrawListCount()), getDebugDraw());
 
         m_renderer->drawImgui();
     }
     m_renderer->endFrame();
 }
 
-void MainLoop::updateLights()
-{
-    m_lights.clear();
-    m_scene.reg.view<components::Transform, components::PointLight>()
-        .each([&](const components::Transform& tc, const components::PointLight& plc) {
-            PointLight l;
-
-            l.Color.x = plc.color.x;
-            l.Color.y = plc.color.y;
-            l.Color.z = plc.color.z;
-            l.Color.w = plc.quadraticAttenuation;
-
-            l.Position.x = tc.position.x;
-            l.Position.y = tc.position.y;
-            l.Position.z = tc.position.z;
-            l.Position.w = plc.linearAttenuation;
-
-            l.Intensity = plc.intensity;
-            l.Radius = plc.radius;
-
-            m_lights.push_back(l);
-        });
-}
-
-void MainLoop::updateBatches()
-{
-    for (auto& [_, batch] : m_renderBatches) {
-        batch.instances.clear();
-    }
-
-    m_scene.reg.view<components::Transform, components::Renderable>()
-        .each([&](const components::Transform& t, const components::Renderable& rc) {
-            auto wm = t.getMatrix();
-            auto& instance = m_renderBatches[rc.renderable].instances.emplace_back();
-            instance.World = XMMatrixTranspose(wm);
-            instance.WorldInvTranspose = XMMatrixInverse(nullptr, wm);
-        });
-}
-
 int main(int argc, char* argv[])
 {
+    PhysicsWorld::installAllocator();
+
     auto args = getArgs(argc, argv);
 
     if (args.size() > 2 && args[1] == "convert") {
@@ -415,6 +602,55 @@ int main(int argc, char* argv[])
         return 0;
     }
 
+    if (args.size() > 1 && args[1] == "bench") {
+        return runBenchmark(args);
+    }
+
+    PhysicsSettings physicsSettings;
+    physicsSettings.multithreaded = std::find(args.begin(), args.end(), "--mt-physics") != args.end();
+
+    // Writes whatever is still in the profiler's buffers on exit
+    std::filesystem::path tracePath = getOption(args, "--trace");
+
+    // Recording and replaying both step physics from the frame deltas so they match
+    std::unique_ptr<InputRecorder> recorder;
+    std::unique_ptr<InputReplay> replay;
+    InputSession inputSession;
+
+    try {
+        if (auto path = getOption(args, "--record"); !path.empty()) {
+            recorder = std::make_unique<InputRecorder>(path);
+            physicsSettings.lockstep = true;
+        }
+
+        if (auto path = getOption(args, "--replay"); !path.empty()) {
+            replay = std::make_unique<InputReplay>(path);
+            physicsSettings.lockstep = true;
+        }
+    } catch (const std::runtime_error& e) {
+        reportError("{}", e.what());
+        return 0;
+    }
+
+    if (auto fixedDelta = getOption(args, "--fixed-dt"); !fixedDelta.empty()) {
+        inputSession.fixedDelta = std::strtof(std::string(fixedDelta).c_str(), nullptr);
+    }
+
+    // Caps the frame rate, mostly so the editor doesn't keep a shared machine busy
+    float frameLimit = 0.0f;
+    if (auto fps = getOption(args, "--fps-limit"); !fps.empty()) {
+        frameLimit = std::strtof(std::string(fps).c_str(), nullptr);
+    }
+
+    // Megabytes of mesh buffers to keep on the GPU, the renderer has its own default
+    u64 renderableBudget = 0;
+    if (auto budget = getOption(args, "--gpu-budget"); !budget.empty()) {
+        renderableBudget = std::strtoull(std::string(budget).c_str(), nullptr, 10) << 20;
+    }
+
+    inputSession.recorder = recorder.get();
+    inputSession.replay = replay.get();
+
     if (auto ret = SDL_Init(SDL_INIT_VIDEO); ret < 0) {
         reportError("SDL_Init returned {}", ret);
         return 0;
@@ -427,14 +663,17 @@ int main(int argc, char* argv[])
         return 0;
     }
 
+    getProfiler().setThreadName("Main");
+
     bool running = true;
     std::filesystem::path scenePath;
 
     while (running) {
         try {
-            MainLoop mainLoop(window, scenePath);
+            MainLoop mainLoop(window, scenePath, physicsSettings, inputSession, frameLimit, renderableBudget);
 
             do {
+                getProfiler().beginFrame();
                 mainLoop.handleEvents();
                 mainLoop.update();
                 running = mainLoop.isRunning();
@@ -444,6 +683,10 @@ int main(int argc, char* argv[])
         }
     }
 
+    if (!tracePath.empty()) {
+        getProfiler().exportChromeTrace(tracePath);
+    }
+
     SDL_DestroyWindow(window);
     SDL_Quit();
     return 0;
@@ -0,0 +1,177 @@
+#include "pch.h"
+
+#include "MathBatch.h"
+#include "MathBatchKernels.h"
+
+#include <cmath>
+#include <intrin.h>
+
+namespace math
+{
+
+namespace
+{
+
+// Reference versions, one entity at a time
+struct Scalar
+{
+    static constexpr u32 Width = 1;
+
+    float v;
+
+    static Scalar load(const float* p)
+    {
+        return { *p };
+    }
+
+    static void store(float* p, Scalar a)
+    {
+        *p = a.v;
+    }
+
+    static Scalar set1(float f)
+    {
+        return { f };
+    }
+
+    static Scalar fmadd(Scalar a, Scalar b, Scalar c)
+    {
+        return { a.v * b.v + c.v };
+    }
+
+    static Scalar abs(Scalar a)
+    {
+        return { std::abs(a.v) };
+    }
+};
+
+Scalar operator+(Scalar a, Scalar b)
+{
+    return { a.v + b.v };
+}
+
+Scalar operator-(Scalar a, Scalar b)
+{
+    return { a.v - b.v };
+}
+
+Scalar operator*(Scalar a, Scalar b)
+{
+    return { a.v * b.v };
+}
+
+Scalar operator/(Scalar a, Scalar b)
+{
+    return { a.v / b.v };
+}
+
+SimdLevel detectSimdLevel()
+{
+    int info[4];
+    __cpuid(info, 1);
+
+    bool osxsave = info[2] & (1 << 27);
+    bool avx = info[2] & (1 << 28);
+    bool fma = info[2] & (1 << 12);
+
+    // SSE2 is part of x64, the wider registers also need the OS to save them
+    if (!osxsave || !avx) {
+        return SimdLevel::Sse;
+    }
+
+    auto xcr0 = _xgetbv(0);
+    bool ymm = (xcr0 & 0x6) == 0x6;
+    bool zmm = (xcr0 & 0xe6) == 0xe6;
+
+    __cpuidex(info, 7, 0);
+    bool avx2 = info[1] & (1 << 5);
+    bool avx512 = info[1] & (1 << 16);
+
+    if (zmm && avx512) {
+        return SimdLevel::Avx512;
+    }
+
+    if (ymm && avx2 && fma) {
+        return SimdLevel::Avx2;
+    }
+
+    return SimdLevel::Sse;
+}
+
+const detail::BatchKernels& getKernelsForLevel(SimdLevel level)
+{
+    switch (level) {
+    case SimdLevel::Avx512:
+        return detail::getAvx512BatchKernels();
+    case SimdLevel::Avx2:
+        return detail::getAvx2BatchKernels();
+    case SimdLevel::Sse:
+        return detail::getSseBatchKernels();
+    default:
+        return detail::getScalarBatchKernels();
+    }
+}
+
+struct Dispatch
+{
+    SimdLevel level;
+    const detail::BatchKernels* kernels;
+};
+
+Dispatch& getDispatch()
+{
+    static Dispatch dispatch{ getSupportedSimdLevel(), &getKernelsForLevel(getSupportedSimdLevel()) };
+    return dispatch;
+}
+
+}
+
+SimdLevel getSupportedSimdLevel()
+{
+    static SimdLevel level = detectSimdLevel();
+    return level;
+}
+
+SimdLevel getSimdLevel()
+{
+    return getDispatch().level;
+}
+
+void setSimdLevel(SimdLevel level)
+{
+    level = std::min(level, getSupportedSimdLevel());
+
+    getDispatch() = { level, &getKernelsForLevel(level) };
+}
+
+const char* getSimdLevelName(SimdLevel level)
+{
+    switch (level) {
+    case SimdLevel::Sse:
+        return "SSE";
+    case SimdLevel::Avx2:
+        return "AVX2";
+    case SimdLevel::Avx512:
+        return "AVX-512";
+    default:
+        return "Scalar";
+    }
+}
+
+namespace detail
+{
+
+const BatchKernels& getBatchKernels()
+{
+    return *getDispatch().kernels;
+}
+
+const BatchKernels& getScalarBatchKernels()
+{
+    static constexpr BatchKernels kernels = makeBatchKernels<Scalar>();
+    return kernels;
+}
+
+}
+
+}
@@ -0,0 +1,255 @@
+#pragma once
+
+#include "Common.h"
+#include "Geometry.h"
+#include "Math.h"
+
+#include <DirectXMath.h>
+#include <array>
+#include <vector>
+
+// Batch versions of the hot transform operations, working on structure of arrays data
+// 4, 8 or 16 entities at a time depending on what the CPU supports.
+//
+// The containers keep one float array per component, padded so the kernels never need
+// a scalar tail. They carry the same space tags as math::Vector and math::Matrix, so a
+// kernel only accepts inputs and outputs in matching spaces.
+namespace math
+{
+
+enum class SimdLevel
+{
+    Scalar,
+    Sse,
+    Avx2,
+    Avx512,
+};
+
+// Widest level both the CPU and the OS support
+SimdLevel getSupportedSimdLevel();
+
+// What the kernels use, the supported level unless it was lowered for comparison
+SimdLevel getSimdLevel();
+
+// Clamped to the supported level
+void setSimdLevel(SimdLevel level);
+
+const char* getSimdLevelName(SimdLevel level);
+
+// Enough for the widest kernels
+constexpr u32 BatchPadding = 16;
+
+template<u32 Components>
+class SoaArray
+{
+public:
+    static constexpr u32 ComponentCount = Components;
+
+    u32 size() const
+    {
+        return m_size;
+    }
+
+    void resize(u32 size)
+    {
+        m_size = size;
+
+        for (auto& c : m_components) {
+            c.resize((size + BatchPadding - 1) / BatchPadding * BatchPadding, 0.0f);
+        }
+    }
+
+    float* component(u32 idx)
+    {
+        return m_components[idx].data();
+    }
+
+    const float* component(u32 idx) const
+    {
+        return m_components[idx].data();
+    }
+
+    std::array<float*, Components> components()
+    {
+        std::array<float*, Components> result;
+
+        for (u32 i = 0; i < Components; i++) {
+            result[i] = m_components[i].data();
+        }
+
+        return result;
+    }
+
+    std::array<const float*, Components> components() const
+    {
+        std::array<const float*, Components> result;
+
+        for (u32 i = 0; i < Components; i++) {
+            result[i] = m_components[i].data();
+        }
+
+        return result;
+    }
+
+protected:
+    std::array<std::vector<float>, Components> m_components;
+    u32 m_size = 0;
+};
+
+// x, y, z
+template<Space S>
+class PointArray : public SoaArray<3>
+{
+public:
+    void set(u32 idx, const DirectX::XMFLOAT3& p)
+    {
+        m_components[0][idx] = p.x;
+        m_components[1][idx] = p.y;
+        m_components[2][idx] = p.z;
+    }
+
+    DirectX::XMFLOAT3 get(u32 idx) const
+    {
+        return { m_components[0][idx], m_components[1][idx], m_components[2][idx] };
+    }
+};
+
+// min x, y, z, then max x, y, z
+template<Space S>
+class AabbArray : public SoaArray<6>
+{
+public:
+    void set(u32 idx, const Aabb& box)
+    {
+        m_components[0][idx] = box.min.x;
+        m_components[1][idx] = box.min.y;
+        m_components[2][idx] = box.min.z;
+        m_components[3][idx] = box.max.x;
+        m_components[4][idx] = box.max.y;
+        m_components[5][idx] = box.max.z;
+    }
+
+    Aabb get(u32 idx) const
+    {
+        return Aabb{
+            { m_components[0][idx], m_components[1][idx], m_components[2][idx] },
+            { m_components[3][idx], m_components[4][idx], m_components[5][idx] },
+        };
+    }
+};
+
+// Translation, rotation quaternion and scale, composed in the same order as
+// components::Transform::getMatrix()
+template<Space From, Space To>
+class TransformArray : public SoaArray<10>
+{
+public:
+    void set(u32 idx, const DirectX::XMFLOAT3& position, DirectX::FXMVECTOR rotation, const DirectX::XMFLOAT3& scale)
+    {
+        DirectX::XMFLOAT4 q;
+        DirectX::XMStoreFloat4(&q, rotation);
+
+        const float values[10] = { position.x, position.y, position.z, q.x, q.y, q.z, q.w, scale.x, scale.y, scale.z };
+
+        for (u32 i = 0; i < 10; i++) {
+            m_components[i][idx] = values[i];
+        }
+    }
+};
+
+// Affine row vector matrices, the first three columns of the four rows. Row 3 is the
+// translation.
+template<Space From, Space To>
+class AffineArray : public SoaArray<12>
+{
+public:
+    void set(u32 idx, const Matrix<From, To>& m)
+    {
+        for (u32 row = 0; row < 4; row++) {
+            DirectX::XMFLOAT4 r;
+            DirectX::XMStoreFloat4(&r, m.mat.r[row]);
+
+            m_components[row * 3 + 0][idx] = r.x;
+            m_components[row * 3 + 1][idx] = r.y;
+            m_components[row * 3 + 2][idx] = r.z;
+        }
+    }
+
+    Matrix<From, To> get(u32 idx) const
+    {
+        auto c = [&](u32 i) { return m_components[i][idx]; };
+
+        return Matrix<From, To>{ DirectX::XMMATRIX(
+            c(0), c(1), c(2), 0.0f,
+            c(3), c(4), c(5), 0.0f,
+            c(6), c(7), c(8), 0.0f,
+            c(9), c(10), c(11), 1.0f) };
+    }
+};
+
+// Inverse transposes of the upper 3x3 of affine matrices, for transforming normals
+template<Space From, Space To>
+class NormalMatrixArray : public SoaArray<9>
+{
+public:
+    Matrix<From, To> get(u32 idx) const
+    {
+        auto c = [&](u32 i) { return m_components[i][idx]; };
+
+        return Matrix<From, To>{ DirectX::XMMATRIX(
+            c(0), c(1), c(2), 0.0f,
+            c(3), c(4), c(5), 0.0f,
+            c(6), c(7), c(8), 0.0f,
+            0.0f, 0.0f, 0.0f, 1.0f) };
+    }
+};
+
+namespace detail
+{
+
+// One set per instruction set, the arrays are the components in the order above
+struct BatchKernels
+{
+    void (*composeTransforms)(const float* const* trs, float* const* out, u32 count);
+    void (*transformPoints)(const float* const* m, const float* const* in, float* const* out, u32 count);
+    void (*transformAabbs)(const float* const* m, const float* const* in, float* const* out, u32 count);
+    void (*computeNormalMatrices)(const float* const* m, float* const* out, u32 count);
+};
+
+const BatchKernels& getBatchKernels();
+
+}
+
+template<Space From, Space To>
+void composeTransforms(const TransformArray<From, To>& in, AffineArray<From, To>& out)
+{
+    out.resize(in.size());
+    detail::getBatchKernels().composeTransforms(in.components().data(), out.components().data(), in.size());
+}
+
+// Transforms point i by matrix i
+template<Space From, Space To>
+void transformPoints(const AffineArray<From, To>& m, const PointArray<From>& in, PointArray<To>& out)
+{
+    out.resize(in.size());
+    detail::getBatchKernels().transformPoints(m.components().data(), in.components().data(),
+        out.components().data(), in.size());
+}
+
+// Bounds of box i after transforming it by matrix i, same as Aabb::transformed()
+template<Space From, Space To>
+void transformAabbs(const AffineArray<From, To>& m, const AabbArray<From>& in, AabbArray<To>& out)
+{
+    out.resize(in.size());
+    detail::getBatchKernels().transformAabbs(m.components().data(), in.components().data(),
+        out.components().data(), in.size());
+}
+
+template<Space From, Space To>
+void computeNormalMatrices(const AffineArray<From, To>& m, NormalMatrixArray<From, To>& out)
+{
+    out.resize(m.size());
+    detail::getBatchKernels().computeNormalMatrices(m.components().data(), out.components().data(), m.size());
+}
+
+}
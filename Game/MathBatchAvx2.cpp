@@ -0,0 +1,79 @@
+#include "pch.h"
+
+#include "MathBatch.h"
+#include "MathBatchKernels.h"
+
+#include <immintrin.h>
+
+namespace math
+{
+
+namespace
+{
+
+struct Avx2
+{
+    static constexpr u32 Width = 8;
+
+    __m256 v;
+
+    static Avx2 load(const float* p)
+    {
+        return { _mm256_loadu_ps(p) };
+    }
+
+    static void store(float* p, Avx2 a)
+    {
+        _mm256_storeu_ps(p, a.v);
+    }
+
+    static Avx2 set1(float f)
+    {
+        return { _mm256_set1_ps(f) };
+    }
+
+    static Avx2 fmadd(Avx2 a, Avx2 b, Avx2 c)
+    {
+        return { _mm256_fmadd_ps(a.v, b.v, c.v) };
+    }
+
+    static Avx2 abs(Avx2 a)
+    {
+        return { _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v) };
+    }
+};
+
+Avx2 operator+(Avx2 a, Avx2 b)
+{
+    return { _mm256_add_ps(a.v, b.v) };
+}
+
+Avx2 operator-(Avx2 a, Avx2 b)
+{
+    return { _mm256_sub_ps(a.v, b.v) };
+}
+
+Avx2 operator*(Avx2 a, Avx2 b)
+{
+    return { _mm256_mul_ps(a.v, b.v) };
+}
+
+Avx2 operator/(Avx2 a, Avx2 b)
+{
+    return { _mm256_div_ps(a.v, b.v) };
+}
+
+}
+
+namespace detail
+{
+
+const BatchKernels& getAvx2BatchKernels()
+{
+    static constexpr BatchKernels kernels = makeBatchKernels<Avx2>();
+    return kernels;
+}
+
+}
+
+}
@@ -0,0 +1,79 @@
+#include "pch.h"
+
+#include "MathBatch.h"
+#include "MathBatchKernels.h"
+
+#include <immintrin.h>
+
+namespace math
+{
+
+namespace
+{
+
+struct Avx512
+{
+    static constexpr u32 Width = 16;
+
+    __m512 v;
+
+    static Avx512 load(const float* p)
+    {
+        return { _mm512_loadu_ps(p) };
+    }
+
+    static void store(float* p, Avx512 a)
+    {
+        _mm512_storeu_ps(p, a.v);
+    }
+
+    static Avx512 set1(float f)
+    {
+        return { _mm512_set1_ps(f) };
+    }
+
+    static Avx512 fmadd(Avx512 a, Avx512 b, Avx512 c)
+    {
+        return { _mm512_fmadd_ps(a.v, b.v, c.v) };
+    }
+
+    static Avx512 abs(Avx512 a)
+    {
+        return { _mm512_abs_ps(a.v) };
+    }
+};
+
+Avx512 operator+(Avx512 a, Avx512 b)
+{
+    return { _mm512_add_ps(a.v, b.v) };
+}
+
+Avx512 operator-(Avx512 a, Avx512 b)
+{
+    return { _mm512_sub_ps(a.v, b.v) };
+}
+
+Avx512 operator*(Avx512 a, Avx512 b)
+{
+    return { _mm512_mul_ps(a.v, b.v) };
+}
+
+Avx512 operator/(Avx512 a, Avx512 b)
+{
+    return { _mm512_div_ps(a.v, b.v) };
+}
+
+}
+
+namespace detail
+{
+
+const BatchKernels& getAvx512BatchKernels()
+{
+    static constexpr BatchKernels kernels = makeBatchKernels<Avx512>();
+    return kernels;
+}
+
+}
+
+}
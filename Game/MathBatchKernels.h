@@ -0,0 +1,159 @@
+#pragma once
+
+#include "MathBatch.h"
+
+// Kernel bodies shared by every instruction set, only included by the MathBatch*.cpp files.
+//
+// V is a thin wrapper around one register of floats with Width lanes, load/store on
+// unaligned pointers, set1, the arithmetic operators, fmadd(a, b, c) = a * b + c and abs.
+// Counts are rounded up to Width, the arrays are padded for it.
+namespace math::detail
+{
+
+// Each one lives in its own file so only that file has to be compiled for the
+// instruction set
+const BatchKernels& getScalarBatchKernels();
+const BatchKernels& getSseBatchKernels();
+const BatchKernels& getAvx2BatchKernels();
+const BatchKernels& getAvx512BatchKernels();
+
+template<typename V>
+void composeTransformsImpl(const float* const* trs, float* const* out, u32 count)
+{
+    auto one = V::set1(1.0f);
+    auto two = V::set1(2.0f);
+
+    for (u32 i = 0; i < count; i += V::Width) {
+        auto qx = V::load(trs[3] + i);
+        auto qy = V::load(trs[4] + i);
+        auto qz = V::load(trs[5] + i);
+        auto qw = V::load(trs[6] + i);
+
+        auto xx = qx * qx, yy = qy * qy, zz = qz * qz;
+        auto xy = qx * qy, xz = qx * qz, yz = qy * qz;
+        auto xw = qx * qw, yw = qy * qw, zw = qz * qw;
+
+        // XMMatrixRotationQuaternion, each row scaled by its scale component
+        auto sx = V::load(trs[7] + i);
+        auto sy = V::load(trs[8] + i);
+        auto sz = V::load(trs[9] + i);
+        auto sx2 = sx * two, sy2 = sy * two, sz2 = sz * two;
+
+        V::store(out[0] + i, (one - two * (yy + zz)) * sx);
+        V::store(out[1] + i, (xy + zw) * sx2);
+        V::store(out[2] + i, (xz - yw) * sx2);
+
+        V::store(out[3] + i, (xy - zw) * sy2);
+        V::store(out[4] + i, (one - two * (xx + zz)) * sy);
+        V::store(out[5] + i, (yz + xw) * sy2);
+
+        V::store(out[6] + i, (xz + yw) * sz2);
+        V::store(out[7] + i, (yz - xw) * sz2);
+        V::store(out[8] + i, (one - two * (xx + yy)) * sz);
+
+        V::store(out[9] + i, V::load(trs[0] + i));
+        V::store(out[10] + i, V::load(trs[1] + i));
+        V::store(out[11] + i, V::load(trs[2] + i));
+    }
+}
+
+template<typename V>
+void transformPointsImpl(const float* const* m, const float* const* in, float* const* out, u32 count)
+{
+    for (u32 i = 0; i < count; i += V::Width) {
+        auto x = V::load(in[0] + i);
+        auto y = V::load(in[1] + i);
+        auto z = V::load(in[2] + i);
+
+        for (u32 c = 0; c < 3; c++) {
+            auto r = V::fmadd(x, V::load(m[c] + i), V::load(m[9 + c] + i));
+            r = V::fmadd(y, V::load(m[3 + c] + i), r);
+            r = V::fmadd(z, V::load(m[6 + c] + i), r);
+
+            V::store(out[c] + i, r);
+        }
+    }
+}
+
+template<typename V>
+void transformAabbsImpl(const float* const* m, const float* const* in, float* const* out, u32 count)
+{
+    auto half = V::set1(0.5f);
+
+    for (u32 i = 0; i < count; i += V::Width) {
+        V center[3], extents[3];
+
+        for (u32 c = 0; c < 3; c++) {
+            auto vmin = V::load(in[c] + i);
+            auto vmax = V::load(in[3 + c] + i);
+
+            center[c] = (vmin + vmax) * half;
+            extents[c] = (vmax - vmin) * half;
+        }
+
+        for (u32 c = 0; c < 3; c++) {
+            auto m0 = V::load(m[c] + i);
+            auto m1 = V::load(m[3 + c] + i);
+            auto m2 = V::load(m[6 + c] + i);
+
+            auto newCenter = V::fmadd(center[0], m0, V::load(m[9 + c] + i));
+            newCenter = V::fmadd(center[1], m1, newCenter);
+            newCenter = V::fmadd(center[2], m2, newCenter);
+
+            auto newExtents = extents[0] * V::abs(m0);
+            newExtents = V::fmadd(extents[1], V::abs(m1), newExtents);
+            newExtents = V::fmadd(extents[2], V::abs(m2), newExtents);
+
+            V::store(out[c] + i, newCenter - newExtents);
+            V::store(out[3 + c] + i, newCenter + newExtents);
+        }
+    }
+}
+
+template<typename V>
+void computeNormalMatricesImpl(const float* const* m, float* const* out, u32 count)
+{
+    for (u32 i = 0; i < count; i += V::Width) {
+        V a[3][3];
+
+        for (u32 r = 0; r < 3; r++) {
+            for (u32 c = 0; c < 3; c++) {
+                a[r][c] = V::load(m[r * 3 + c] + i);
+            }
+        }
+
+        // The rows of the inverse transpose are the cross products of the other two rows
+        auto cross = [](const V* u, const V* v, V* result) {
+            result[0] = u[1] * v[2] - u[2] * v[1];
+            result[1] = u[2] * v[0] - u[0] * v[2];
+            result[2] = u[0] * v[1] - u[1] * v[0];
+        };
+
+        V rows[3][3];
+        cross(a[1], a[2], rows[0]);
+        cross(a[2], a[0], rows[1]);
+        cross(a[0], a[1], rows[2]);
+
+        auto det = a[0][0] * rows[0][0] + a[0][1] * rows[0][1] + a[0][2] * rows[0][2];
+        auto invDet = V::set1(1.0f) / det;
+
+        for (u32 r = 0; r < 3; r++) {
+            for (u32 c = 0; c < 3; c++) {
+                V::store(out[r * 3 + c] + i, rows[r][c] * invDet);
+            }
+        }
+    }
+}
+
+template<typename V>
+constexpr BatchKernels makeBatchKernels()
+{
+    return BatchKernels{
+        &composeTransformsImpl<V>,
+        &transformPointsImpl<V>,
+        &transformAabbsImpl<V>,
+        &computeNormalMatricesImpl<V>,
+    };
+}
+
+}
@@ -0,0 +1,80 @@
+#include "pch.h"
+
+#include "MathBatch.h"
+#include "MathBatchKernels.h"
+
+#include <immintrin.h>
+
+namespace math
+{
+
+namespace
+{
+
+// Nothing past SSE2 helps these kernels, so this is the baseline x64 path
+struct Sse
+{
+    static constexpr u32 Width = 4;
+
+    __m128 v;
+
+    static Sse load(const float* p)
+    {
+        return { _mm_loadu_ps(p) };
+    }
+
+    static void store(float* p, Sse a)
+    {
+        _mm_storeu_ps(p, a.v);
+    }
+
+    static Sse set1(float f)
+    {
+        return { _mm_set1_ps(f) };
+    }
+
+    static Sse fmadd(Sse a, Sse b, Sse c)
+    {
+        return { _mm_add_ps(_mm_mul_ps(a.v, b.v), c.v) };
+    }
+
+    static Sse abs(Sse a)
+    {
+        return { _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v) };
+    }
+};
+
+Sse operator+(Sse a, Sse b)
+{
+    return { _mm_add_ps(a.v, b.v) };
+}
+
+Sse operator-(Sse a, Sse b)
+{
+    return { _mm_sub_ps(a.v, b.v) };
+}
+
+Sse operator*(Sse a, Sse b)
+{
+    return { _mm_mul_ps(a.v, b.v) };
+}
+
+Sse operator/(Sse a, Sse b)
+{
+    return { _mm_div_ps(a.v, b.v) };
+}
+
+}
+
+namespace detail
+{
+
+const BatchKernels& getSseBatchKernels()
+{
+    static constexpr BatchKernels kernels = makeBatchKernels<Sse>();
+    return kernels;
+}
+
+}
+
+}
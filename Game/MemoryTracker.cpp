@@ -0,0 +1,419 @@
+#include "MemoryTracker.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cstdlib>
+#include <fmt/format.h>
+#include <imgui.h>
+#include <new>
+
+namespace
+{
+
+constinit MemoryTracker g_memoryTracker;
+thread_local MemoryTag t_memoryTag = MemoryTag::General;
+
+// Every tracked allocation is prefixed with this, the user pointer stays 16 byte aligned
+struct alignas(16) AllocationHeader
+{
+    u64 size;
+    MemoryTag tag;
+};
+
+constexpr size_t HeaderSize = sizeof(AllocationHeader);
+
+AllocationHeader* headerOf(void* p)
+{
+    return reinterpret_cast<AllocationHeader*>(static_cast<char*>(p) - HeaderSize);
+}
+
+void* track(void* raw, size_t offset, size_t size, MemoryTag tag)
+{
+    auto p = static_cast<char*>(raw) + offset;
+    *headerOf(p) = AllocationHeader{ size, tag };
+
+    g_memoryTracker.onAllocate(tag, size);
+
+    return p;
+}
+
+void untrack(void* p)
+{
+    auto header = headerOf(p);
+    g_memoryTracker.onFree(header->tag, header->size);
+}
+
+void* allocate(size_t size, MemoryTag tag)
+{
+    auto raw = std::malloc(size + HeaderSize);
+    return raw ? track(raw, HeaderSize, size, tag) : nullptr;
+}
+
+void deallocate(void* p)
+{
+    if (p) {
+        untrack(p);
+        std::free(static_cast<char*>(p) - HeaderSize);
+    }
+}
+
+// _aligned_malloc memory has to go back to _aligned_free, not free
+void* alignedMalloc(size_t size, size_t alignment)
+{
+#ifdef _WIN32
+    return _aligned_malloc(size, alignment);
+#else
+    return std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+#endif
+}
+
+void alignedFree(void* p)
+{
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+// Over-aligned allocations put the header in the padding in front
+void* allocateAligned(size_t size, size_t alignment, MemoryTag tag)
+{
+    alignment = std::max(alignment, HeaderSize);
+
+    auto raw = alignedMalloc(size + alignment, alignment);
+    return raw ? track(raw, alignment, size, tag) : nullptr;
+}
+
+void deallocateAligned(void* p, size_t alignment)
+{
+    if (p) {
+        untrack(p);
+        alignedFree(static_cast<char*>(p) - std::max(alignment, HeaderSize));
+    }
+}
+
+void* throwingAllocate(size_t size)
+{
+    if (auto p = allocate(size, t_memoryTag)) {
+        return p;
+    }
+
+    throw std::bad_alloc();
+}
+
+void* throwingAllocateAligned(size_t size, std::align_val_t alignment)
+{
+    if (auto p = allocateAligned(size, size_t(alignment), t_memoryTag)) {
+        return p;
+    }
+
+    throw std::bad_alloc();
+}
+
+std::string formatBytes(u64 bytes)
+{
+    if (bytes >= 1024 * 1024) {
+        return fmt::format("{:.2f} MB", double(bytes) / (1024.0 * 1024.0));
+    }
+
+    if (bytes >= 1024) {
+        return fmt::format("{:.2f} KB", double(bytes) / 1024.0);
+    }
+
+    return fmt::format("{} B", bytes);
+}
+
+}
+
+void* operator new(size_t size)
+{
+    return throwingAllocate(size);
+}
+
+void* operator new[](size_t size)
+{
+    return throwingAllocate(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    return allocate(size, t_memoryTag);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+    return allocate(size, t_memoryTag);
+}
+
+void* operator new(size_t size, std::align_val_t alignment)
+{
+    return throwingAllocateAligned(size, alignment);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment)
+{
+    return throwingAllocateAligned(size, alignment);
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    return allocateAligned(size, size_t(alignment), t_memoryTag);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    return allocateAligned(size, size_t(alignment), t_memoryTag);
+}
+
+void operator delete(void* p) noexcept
+{
+    deallocate(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    deallocate(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    deallocate(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    deallocate(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+    deallocate(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept
+{
+    deallocate(p);
+}
+
+void operator delete(void* p, std::align_val_t alignment) noexcept
+{
+    deallocateAligned(p, size_t(alignment));
+}
+
+void operator delete[](void* p, std::align_val_t alignment) noexcept
+{
+    deallocateAligned(p, size_t(alignment));
+}
+
+void operator delete(void* p, size_t, std::align_val_t alignment) noexcept
+{
+    deallocateAligned(p, size_t(alignment));
+}
+
+void operator delete[](void* p, size_t, std::align_val_t alignment) noexcept
+{
+    deallocateAligned(p, size_t(alignment));
+}
+
+void operator delete(void* p, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    deallocateAligned(p, size_t(alignment));
+}
+
+void operator delete[](void* p, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    deallocateAligned(p, size_t(alignment));
+}
+
+const char* getMemoryTagName(MemoryTag tag)
+{
+    switch (tag) {
+    case MemoryTag::General: return "General";
+    case MemoryTag::Scene: return "Scene";
+    case MemoryTag::Physics: return "Physics";
+    case MemoryTag::Renderer: return "Renderer";
+    case MemoryTag::Assets: return "Assets";
+    case MemoryTag::GpuBuffers: return "GPU buffers";
+    case MemoryTag::GpuTextures: return "GPU textures";
+    default: return "Unknown";
+    }
+}
+
+MemoryTracker& getMemoryTracker()
+{
+    return g_memoryTracker;
+}
+
+MemoryTag MemoryTracker::getThreadTag()
+{
+    return t_memoryTag;
+}
+
+void MemoryTracker::setThreadTag(MemoryTag tag)
+{
+    t_memoryTag = tag;
+}
+
+void* MemoryTracker::allocateTracked(size_t bytes, MemoryTag tag)
+{
+    return allocate(bytes, tag);
+}
+
+void MemoryTracker::freeTracked(void* p)
+{
+    deallocate(p);
+}
+
+void MemoryTracker::onAllocate(MemoryTag tag, u64 bytes)
+{
+    auto& c = m_counters[u32(tag)];
+
+    auto live = c.liveBytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    c.liveAllocations.fetch_add(1, std::memory_order_relaxed);
+    c.totalAllocations.fetch_add(1, std::memory_order_relaxed);
+    c.totalBytes.fetch_add(bytes, std::memory_order_relaxed);
+
+    // Plain load first so the common case doesn't write to the cache line again
+    auto peak = c.peakBytes.load(std::memory_order_relaxed);
+    while (live > peak && !c.peakBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+    }
+}
+
+void MemoryTracker::onFree(MemoryTag tag, u64 bytes)
+{
+    auto& c = m_counters[u32(tag)];
+
+    c.liveBytes.fetch_sub(bytes, std::memory_order_relaxed);
+    c.liveAllocations.fetch_sub(1, std::memory_order_relaxed);
+}
+
+MemoryStats MemoryTracker::getStats(MemoryTag tag) const
+{
+    const auto& c = m_counters[u32(tag)];
+
+    MemoryStats stats;
+    stats.liveBytes = c.liveBytes.load(std::memory_order_relaxed);
+    stats.peakBytes = c.peakBytes.load(std::memory_order_relaxed);
+    stats.liveAllocations = c.liveAllocations.load(std::memory_order_relaxed);
+    stats.totalAllocations = c.totalAllocations.load(std::memory_order_relaxed);
+    stats.totalBytes = c.totalBytes.load(std::memory_order_relaxed);
+    stats.allocationRate = m_rates[u32(tag)];
+
+    return stats;
+}
+
+void MemoryTracker::resetPeaks()
+{
+    for (auto& c : m_counters) {
+        c.peakBytes.store(c.liveBytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+}
+
+void MemoryTracker::update()
+{
+    u64 live = 0;
+
+    for (u32 i = 0; i < TagCount; i++) {
+        if (MemoryTag(i) != MemoryTag::GpuBuffers && MemoryTag(i) != MemoryTag::GpuTextures) {
+            live += m_counters[i].liveBytes.load(std::memory_order_relaxed);
+        }
+    }
+
+    m_liveHistory[m_historyCount % History] = float(double(live) / (1024.0 * 1024.0));
+    m_historyCount++;
+
+    auto now = std::chrono::steady_clock::now();
+    auto elapsed = std::chrono::duration<double>(now - m_lastSample).count();
+
+    if (elapsed < 1.0) {
+        return;
+    }
+
+    for (u32 i = 0; i < TagCount; i++) {
+        auto total = m_counters[i].totalBytes.load(std::memory_order_relaxed);
+
+        // The first sample would count everything since startup
+        m_rates[i] = m_lastSample.time_since_epoch().count() != 0
+            ? double(total - m_lastTotalBytes[i]) / elapsed
+            : 0.0;
+
+        m_lastTotalBytes[i] = total;
+    }
+
+    m_lastSample = now;
+}
+
+std::string MemoryTracker::dump() const
+{
+    auto result = fmt::format("{:<14} {:>12} {:>12} {:>10} {:>14}\n", "Tag", "Live", "Peak", "Allocs", "Rate");
+
+    for (u32 i = 0; i < TagCount; i++) {
+        auto stats = getStats(MemoryTag(i));
+
+        result += fmt::format("{:<14} {:>12} {:>12} {:>10} {:>12}/s\n",
+            getMemoryTagName(MemoryTag(i)),
+            formatBytes(stats.liveBytes),
+            formatBytes(stats.peakBytes),
+            stats.liveAllocations,
+            formatBytes(u64(stats.allocationRate)));
+    }
+
+    return result;
+}
+
+void MemoryTracker::drawWindow(bool* open)
+{
+    if (!ImGui::Begin("Memory", open)) {
+        ImGui::End();
+        return;
+    }
+
+    ImGui::Columns(5);
+    ImGui::TextUnformatted("Tag");
+    ImGui::NextColumn();
+    ImGui::TextUnformatted("Live");
+    ImGui::NextColumn();
+    ImGui::TextUnformatted("Peak");
+    ImGui::NextColumn();
+    ImGui::TextUnformatted("Allocations");
+    ImGui::NextColumn();
+    ImGui::TextUnformatted("Rate");
+    ImGui::NextColumn();
+    ImGui::Separator();
+
+    for (u32 i = 0; i < TagCount; i++) {
+        auto stats = getStats(MemoryTag(i));
+
+        ImGui::TextUnformatted(getMemoryTagName(MemoryTag(i)));
+        ImGui::NextColumn();
+        ImGui::TextUnformatted(formatBytes(stats.liveBytes).c_str());
+        ImGui::NextColumn();
+        ImGui::TextUnformatted(formatBytes(stats.peakBytes).c_str());
+        ImGui::NextColumn();
+        ImGui::Text("%llu", static_cast<unsigned long long>(stats.liveAllocations));
+        ImGui::NextColumn();
+        ImGui::Text("%s/s", formatBytes(u64(stats.allocationRate)).c_str());
+        ImGui::NextColumn();
+    }
+
+    ImGui::Columns(1);
+    ImGui::Separator();
+
+    auto count = int(std::min<u64>(m_historyCount, History));
+    auto offset = count < int(History) ? 0 : int(m_historyCount % History);
+
+    ImGui::PlotLines("CPU MB", m_liveHistory.data(), count, offset, nullptr, FLT_MAX, FLT_MAX, ImVec2(-1.0f, 60.0f));
+
+    if (ImGui::Button("Reset peaks")) {
+        resetPeaks();
+    }
+
+    ImGui::SameLine();
+
+    if (ImGui::Button("Dump to console")) {
+        fmt::print("{}", dump());
+    }
+
+    ImGui::End();
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "Common.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <string>
+
+// What an allocation is attributed to. CPU allocations go to the calling thread's
+// current tag, see MemoryScope.
+enum class MemoryTag : u8
+{
+    General,
+    Scene,
+    Physics,
+    Renderer,
+    Assets,
+    // Estimated from the resource descriptions, not what the driver really allocates
+    GpuBuffers,
+    GpuTextures,
+    Count,
+};
+
+const char* getMemoryTagName(MemoryTag tag);
+
+struct MemoryStats
+{
+    u64 liveBytes = 0;
+    u64 peakBytes = 0;
+    u64 liveAllocations = 0;
+    u64 totalAllocations = 0;
+    u64 totalBytes = 0;
+
+    // Bytes allocated per second, averaged over about a second
+    double allocationRate = 0.0;
+};
+
+// Tracks live bytes per tag. Global new/delete and Bullet's allocator feed into this,
+// GPU resources are tracked by the creation helpers in RendererHelpers.h.
+class MemoryTracker
+{
+public:
+    static constexpr u32 TagCount = u32(MemoryTag::Count);
+    static constexpr u32 History = 240;
+
+    constexpr MemoryTracker() = default;
+
+    static MemoryTag getThreadTag();
+    static void setThreadTag(MemoryTag tag);
+
+    // malloc/free for libraries with their own allocator hooks, see
+    // PhysicsWorld::installAllocator
+    static void* allocateTracked(size_t bytes, MemoryTag tag);
+    static void freeTracked(void* p);
+
+    void onAllocate(MemoryTag tag, u64 bytes);
+    void onFree(MemoryTag tag, u64 bytes);
+
+    MemoryStats getStats(MemoryTag tag) const;
+    void resetPeaks();
+
+    // Samples the allocation rates and the history graph, call once per frame
+    void update();
+
+    // Human readable table of every tag
+    std::string dump() const;
+
+    void drawWindow(bool* open);
+
+private:
+    struct alignas(64) Counters
+    {
+        std::atomic<u64> liveBytes = 0;
+        std::atomic<u64> peakBytes = 0;
+        std::atomic<u64> liveAllocations = 0;
+        std::atomic<u64> totalAllocations = 0;
+        std::atomic<u64> totalBytes = 0;
+    };
+
+    std::array<Counters, TagCount> m_counters{};
+
+    // Only touched by the thread calling update()
+    std::chrono::steady_clock::time_point m_lastSample{};
+    std::array<u64, TagCount> m_lastTotalBytes{};
+    std::array<double, TagCount> m_rates{};
+    std::array<float, History> m_liveHistory{};
+    u64 m_historyCount = 0;
+};
+
+MemoryTracker& getMemoryTracker();
+
+// Sets the calling thread's tag until the end of the scope
+class MemoryScope
+{
+public:
+    explicit MemoryScope(MemoryTag tag) :
+        m_previous(MemoryTracker::getThreadTag())
+    {
+        MemoryTracker::setThreadTag(tag);
+    }
+
+    ~MemoryScope()
+    {
+        MemoryTracker::setThreadTag(m_previous);
+    }
+
+    MemoryScope(const MemoryScope&) = delete;
+    MemoryScope& operator=(const MemoryScope&) = delete;
+
+private:
+    MemoryTag m_previous;
+};
@@ -5,12 +5,18 @@
 #include "File.h"
 #include "Serialization.h"
 #include "ShaderCommon.h"
+#include "Profiler.h"
+#include "TextureAtlas.h"
 
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 #include <algorithm>
+#include <cmath>
 #include <fstream>
+#include <tuple>
+
+#include <bullet/LinearMath/btConvexHullComputer.h>
 
 #include <cereal/types/vector.hpp>
 #include <cereal/types/string.hpp>
@@ -50,7 +56,169 @@ void serialize(Archive& archive, Vertex& v)
     archive(v.Position, v.Normal, v.Color, v.Texcoord);
 }
 
-Mesh Mesh::import(const std::filesystem::path& path)
+// Vertices are split along normals and UVs, the collision hull only cares about positions
+static std::vector<XMFLOAT3> weldPositions(const std::vector<Vertex>& vertices)
+{
+    constexpr float WeldDistance = 1.0f / 4096.0f;
+
+    using Key = std::tuple<i64, i64, i64>;
+
+    auto quantize = [](float f) {
+        return i64(std::floor(f / WeldDistance));
+    };
+
+    std::vector<std::pair<Key, u32>> keys;
+    keys.reserve(vertices.size());
+
+    for (u32 i = 0; i < u32(vertices.size()); i++) {
+        const auto& p = vertices[i].Position;
+        keys.emplace_back(Key{ quantize(p.x), quantize(p.y), quantize(p.z) }, i);
+    }
+
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<XMFLOAT3> result;
+
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (i == 0 || keys[i].first != keys[i - 1].first) {
+            result.push_back(vertices[keys[i].second].Position);
+        }
+    }
+
+    return result;
+}
+
+static std::vector<XMFLOAT3> computeHull(const std::vector<XMFLOAT3>& points)
+{
+    btConvexHullComputer computer;
+    computer.compute(&points[0].x, int(sizeof(XMFLOAT3)), int(points.size()), 0.0f, 0.0f);
+
+    std::vector<XMFLOAT3> hull;
+    hull.reserve(computer.vertices.size());
+
+    for (int i = 0; i < computer.vertices.size(); i++) {
+        const auto& v = computer.vertices[i];
+        hull.emplace_back(v.x(), v.y(), v.z());
+    }
+
+    return hull;
+}
+
+// Keeps the support point for evenly spread directions, which keeps the overall shape
+// while dropping the points on densely tessellated curved parts first
+static std::vector<XMFLOAT3> reduceHull(const std::vector<XMFLOAT3>& hull, u32 maxVertices)
+{
+    const float goldenAngle = XM_PI * (3.0f - std::sqrt(5.0f));
+
+    std::vector<bool> used(hull.size(), false);
+    std::vector<XMFLOAT3> result;
+
+    for (u32 i = 0; i < maxVertices; i++) {
+        auto y = 1.0f - 2.0f * (float(i) + 0.5f) / float(maxVertices);
+        auto r = std::sqrt(1.0f - y * y);
+        auto phi = goldenAngle * float(i);
+
+        auto dir = XMVectorSet(r * std::cos(phi), y, r * std::sin(phi), 0.0f);
+
+        size_t best = 0;
+        auto bestDot = -FLT_MAX;
+
+        for (size_t j = 0; j < hull.size(); j++) {
+            auto d = XMVectorGetX(XMVector3Dot(XMLoadFloat3(&hull[j]), dir));
+
+            if (d > bestDot) {
+                bestDot = d;
+                best = j;
+            }
+        }
+
+        if (!used[best]) {
+            used[best] = true;
+            result.push_back(hull[best]);
+        }
+    }
+
+    return result;
+}
+
+std::vector<XMFLOAT3> Mesh::buildCollisionHull(const std::vector<Vertex>& vertices, u32 maxVertices)
+{
+    auto points = weldPositions(vertices);
+
+    if (points.size() < 4) {
+        return points;
+    }
+
+    auto hull = computeHull(points);
+
+    if (hull.size() > maxVertices) {
+        hull = reduceHull(hull, maxVertices);
+    }
+
+    return hull;
+}
+
+std::vector<XMFLOAT3> Mesh::buildOccluder(const std::vector<Vertex>& vertices, const std::vector<u16>& indices,
+    const Bounds& bounds, u32 maxTriangles)
+{
+    // Foliage and other thin or sparse meshes cover too little of their bounds to hide
+    // anything, compared against half the surface area of the bounds
+    constexpr float MinCoverage = 0.25f;
+
+    struct Triangle
+    {
+        u32 first;
+        float area;
+    };
+
+    std::vector<Triangle> triangles;
+    triangles.reserve(indices.size() / 3);
+
+    for (u32 i = 0; i + 2 < u32(indices.size()); i += 3) {
+        auto a = XMLoadFloat3(&vertices[indices[i]].Position);
+        auto b = XMLoadFloat3(&vertices[indices[i + 1]].Position);
+        auto c = XMLoadFloat3(&vertices[indices[i + 2]].Position);
+
+        auto area = 0.5f * XMVectorGetX(XMVector3Length(XMVector3Cross(b - a, c - a)));
+
+        if (area > 0.0f) {
+            triangles.push_back(Triangle{ i, area });
+        }
+    }
+
+    auto count = std::min<size_t>(maxTriangles, triangles.size());
+
+    std::partial_sort(triangles.begin(), triangles.begin() + count, triangles.end(),
+        [](const Triangle& a, const Triangle& b) { return a.area > b.area; });
+
+    float covered = 0.0f;
+
+    for (size_t i = 0; i < count; i++) {
+        covered += triangles[i].area;
+    }
+
+    XMFLOAT3 size;
+    XMStoreFloat3(&size, bounds.max.vec - bounds.min.vec);
+    auto boundsArea = size.x * size.y + size.y * size.z + size.z * size.x;
+
+    std::vector<XMFLOAT3> result;
+
+    if (count == 0 || covered < MinCoverage * boundsArea) {
+        return result;
+    }
+
+    result.reserve(count * 3);
+
+    for (size_t i = 0; i < count; i++) {
+        for (u32 j = 0; j < 3; j++) {
+            result.push_back(vertices[indices[triangles[i].first + j]].Position);
+        }
+    }
+
+    return result;
+}
+
+Mesh Mesh::import(const std::filesystem::path& path, u32 maxHullVertices)
 {
     Mesh result;
 
@@ -161,13 +329,93 @@ Mesh Mesh::import(const std::filesystem::path& path)
         result.m_name = result.m_name.substr(5);
     }
 
+    result.m_collisionHull = buildCollisionHull(result.m_vertices, maxHullVertices);
+    result.m_occluder = buildOccluder(result.m_vertices, result.m_indices, result.m_bounds);
+
     g_importer.FreeScene();
 
     return result;
 }
 
+Mesh::Mesh(std::string_view name, std::vector<Vertex> vertices, std::vector<u16> indices, std::vector<SubMesh> subMeshes) :
+    m_vertices(std::move(vertices)), m_indices(std::move(indices)), m_subMeshes(std::move(subMeshes)), m_name(name)
+{
+    XMFLOAT3 aabbMin(FLT_MAX, FLT_MAX, FLT_MAX);
+    XMFLOAT3 aabbMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+    for (const auto& v : m_vertices) {
+        aabbMin = XMFLOAT3(std::min(aabbMin.x, v.Position.x), std::min(aabbMin.y, v.Position.y), std::min(aabbMin.z, v.Position.z));
+        aabbMax = XMFLOAT3(std::max(aabbMax.x, v.Position.x), std::max(aabbMax.y, v.Position.y), std::max(aabbMax.z, v.Position.z));
+    }
+
+    if (m_vertices.empty()) {
+        aabbMin = aabbMax = XMFLOAT3(0.0f, 0.0f, 0.0f);
+    }
+
+    m_bounds.min = Vector<Model>(aabbMin.x, aabbMin.y, aabbMin.z, 1.0f);
+    m_bounds.max = Vector<Model>(aabbMax.x, aabbMax.y, aabbMax.z, 1.0f);
+}
+
+void Mesh::applyAtlas(const TextureAtlas& atlas)
+{
+    constexpr float Epsilon = 1.0f / 1024.0f;
+
+    for (auto& subMesh : m_subMeshes) {
+        auto entry = atlas.find(subMesh.material);
+
+        if (!entry) {
+            continue;
+        }
+
+        // Indices are absolute, baseVertex is already part of them
+        std::vector<u32> used(m_indices.begin() + subMesh.baseIndex, m_indices.begin() + subMesh.baseIndex + subMesh.numIndices);
+
+        std::sort(used.begin(), used.end());
+        used.erase(std::unique(used.begin(), used.end()), used.end());
+
+        auto inRange = std::all_of(used.begin(), used.end(), [&](u32 v) {
+            const auto& t = m_vertices[v].Texcoord;
+            return t.x >= -Epsilon && t.x <= 1.0f + Epsilon && t.y >= -Epsilon && t.y <= 1.0f + Epsilon;
+        });
+
+        if (!inRange) {
+            continue;
+        }
+
+        const auto& so = entry->scaleOffset;
+
+        for (auto v : used) {
+            auto& t = m_vertices[v].Texcoord;
+            t.x = std::clamp(t.x, 0.0f, 1.0f) * so.x + so.z;
+            t.y = std::clamp(t.y, 0.0f, 1.0f) * so.y + so.w;
+        }
+
+        subMesh.material = atlas.getPageName(entry->page);
+    }
+
+    // Only the index ranges have to be next to each other, the indices stay as they are
+    std::vector<SubMesh> merged;
+
+    for (const auto& subMesh : m_subMeshes) {
+        if (!merged.empty()) {
+            auto& prev = merged.back();
+
+            if (prev.material == subMesh.material && prev.baseIndex + prev.numIndices == subMesh.baseIndex) {
+                prev.numIndices += subMesh.numIndices;
+                continue;
+            }
+        }
+
+        merged.push_back(subMesh);
+    }
+
+    m_subMeshes = std::move(merged);
+}
+
 void Mesh::load(const std::filesystem::path& path)
 {
+    PROFILE_FUNC();
+
     std::ifstream input(path, std::ios::binary);
     cereal::BinaryInputArchive archive(input);
     archive(*this);
@@ -8,6 +8,10 @@
 #include <vector>
 #include <string>
 #include <cereal/access.hpp>
+#include <cereal/cereal.hpp>
+#include <DirectXMath.h>
+
+class TextureAtlas;
 
 class Mesh
 {
@@ -26,8 +30,18 @@ public:
         }
     };
 
+    // Most convex hulls look fine with far fewer points than this
+    static constexpr u32 DefaultMaxHullVertices = 64;
+
+    // Occluders are rasterized on the CPU every frame, so they have to stay small
+    static constexpr u32 DefaultMaxOccluderTriangles = 128;
+
     Mesh() = default;
 
+    // For generated geometry, the bounds are computed from the vertices. There's no
+    // collision hull or occluder.
+    Mesh(std::string_view name, std::vector<Vertex> vertices, std::vector<u16> indices, std::vector<SubMesh> subMeshes);
+
     const std::vector<Vertex>& getVertices() const
     {
         return m_vertices;
@@ -58,7 +72,34 @@ public:
         return m_subMeshes;
     }
 
-    static Mesh import(const std::filesystem::path& path);
+    // Welded and reduced convex hull points, baked when the mesh is imported
+    const std::vector<DirectX::XMFLOAT3>& getCollisionHull() const
+    {
+        return m_collisionHull;
+    }
+
+    // Model space triangle list for occlusion culling, baked when the mesh is imported.
+    // Empty if the mesh doesn't hide enough to be worth rasterizing.
+    const std::vector<DirectX::XMFLOAT3>& getOccluder() const
+    {
+        return m_occluder;
+    }
+
+    static Mesh import(const std::filesystem::path& path, u32 maxHullVertices = DefaultMaxHullVertices);
+
+    // Moves the submeshes whose material is in the atlas over to its page and remaps their
+    // UVs, then merges neighbours that ended up with the same material. Submeshes with UVs
+    // outside [0, 1] keep their own texture.
+    void applyAtlas(const TextureAtlas& atlas);
+
+    // Convex hull of the welded positions, reduced to at most maxVertices
+    static std::vector<DirectX::XMFLOAT3> buildCollisionHull(const std::vector<Vertex>& vertices,
+        u32 maxVertices = DefaultMaxHullVertices);
+
+    // Keeps the largest triangles of the mesh, which makes the occluder a subset of the
+    // real surface so it never hides anything the mesh wouldn't
+    static std::vector<DirectX::XMFLOAT3> buildOccluder(const std::vector<Vertex>& vertices,
+        const std::vector<u16>& indices, const Bounds& bounds, u32 maxTriangles = DefaultMaxOccluderTriangles);
 
     void load(const std::filesystem::path& path);
     void save(const std::filesystem::path& path);
@@ -67,15 +108,34 @@ private:
     friend class cereal::access;
 
     template<typename Archive>
-    void serialize(Archive& archive)
+    void serialize(Archive& archive, const u32 version)
     {
         archive(m_name, m_indices, m_vertices, m_bounds.max.vec, m_bounds.min.vec, m_subMeshes);
+
+        // Older files get theirs built on load
+        if (version >= 1) {
+            archive(m_collisionHull);
+        } else {
+            m_collisionHull = buildCollisionHull(m_vertices);
+        }
+
+        if (version >= 2) {
+            archive(m_occluder);
+        } else {
+            m_occluder = buildOccluder(m_vertices, m_indices, m_bounds);
+        }
     }
 
     Bounds m_bounds;
     std::vector<Vertex> m_vertices;
     std::vector<u16> m_indices;
     std::vector<SubMesh> m_subMeshes;
+    std::vector<DirectX::XMFLOAT3> m_collisionHull;
+    std::vector<DirectX::XMFLOAT3> m_occluder;
     std::string m_name;
 };
 
+// 1: collision hull
+// 2: occluder
+CEREAL_CLASS_VERSION(Mesh, 2);
+
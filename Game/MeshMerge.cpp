@@ -0,0 +1,38 @@
+#include "MeshMerge.h"
+
+#include <algorithm>
+
+using namespace DirectX;
+
+VertexRange getVertexRange(const std::vector<u16>& indices, u32 baseIndex, u32 numIndices)
+{
+    u32 first = ~0u;
+    u32 last = 0;
+
+    for (u32 i = baseIndex; i < baseIndex + numIndices; i++) {
+        first = std::min<u32>(first, indices[i]);
+        last = std::max<u32>(last, indices[i]);
+    }
+
+    return first <= last ? VertexRange{ first, last - first + 1 } : VertexRange{};
+}
+
+void appendTransformed(const std::vector<Vertex>& vertices, const std::vector<u16>& indices, u32 baseIndex, u32 numIndices,
+    VertexRange range, FXMMATRIX world, std::vector<Vertex>& outVertices, std::vector<u16>& outIndices)
+{
+    auto normalMatrix = XMMatrixTranspose(XMMatrixInverse(nullptr, world));
+    auto baseVertex = u32(outVertices.size());
+
+    for (u32 i = 0; i < range.count; i++) {
+        auto v = vertices[range.first + i];
+
+        XMStoreFloat3(&v.Position, XMVector3Transform(XMLoadFloat3(&v.Position), world));
+        XMStoreFloat3(&v.Normal, XMVector3Normalize(XMVector3TransformNormal(XMLoadFloat3(&v.Normal), normalMatrix)));
+
+        outVertices.push_back(v);
+    }
+
+    for (u32 i = baseIndex; i < baseIndex + numIndices; i++) {
+        outIndices.push_back(u16(indices[i] - range.first + baseVertex));
+    }
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "Common.h"
+#include "ShaderCommon.h"
+
+#include <DirectXMath.h>
+#include <vector>
+
+// Copies parts of meshes into one larger mesh, used by the static geometry bake.
+//
+// Mesh indices are absolute, a submesh is only a range of them, so the vertices a submesh
+// uses are whatever its indices point at. The renderer draws with a base vertex of 0.
+struct VertexRange
+{
+    u32 first = 0;
+    u32 count = 0;
+};
+
+// The vertices used by indices [baseIndex, baseIndex + numIndices), empty if there are none
+VertexRange getVertexRange(const std::vector<u16>& indices, u32 baseIndex, u32 numIndices);
+
+// Appends the range's vertices moved to world space and the indices pointing at them.
+// Every index in [baseIndex, baseIndex + numIndices) has to be inside the range.
+void appendTransformed(const std::vector<Vertex>& vertices, const std::vector<u16>& indices, u32 baseIndex, u32 numIndices,
+    VertexRange range, DirectX::FXMMATRIX world, std::vector<Vertex>& outVertices, std::vector<u16>& outIndices);
+
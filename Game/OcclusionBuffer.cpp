@@ -0,0 +1,350 @@
+#include "OcclusionBuffer.h"
+#include "Profiler.h"
+#include "TaskScheduler.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+using namespace DirectX;
+
+namespace
+{
+
+// Geometry closer than this in view space is clipped away, boxes reaching it are visible
+constexpr float NearW = 0.01f;
+
+// Occluders have to be this much closer than a box to hide it, so meshes whose surface
+// touches their own bounds don't hide themselves due to rounding
+constexpr float DepthBias = 1e-3f;
+
+constexpr u32 OccludersPerTask = 4;
+
+// Clips the polygon against w >= NearW, returns the new vertex count
+u32 clipNear(const XMFLOAT4* in, u32 count, XMFLOAT4* out)
+{
+    u32 result = 0;
+
+    for (u32 i = 0; i < count; i++) {
+        const auto& a = in[i];
+        const auto& b = in[(i + 1) % count];
+
+        auto da = a.w - NearW;
+        auto db = b.w - NearW;
+
+        if (da >= 0.0f) {
+            out[result++] = a;
+        }
+
+        if ((da >= 0.0f) != (db >= 0.0f)) {
+            auto t = da / (da - db);
+            out[result++] = XMFLOAT4(
+                a.x + (b.x - a.x) * t,
+                a.y + (b.y - a.y) * t,
+                a.z + (b.z - a.z) * t,
+                a.w + (b.w - a.w) * t);
+        }
+    }
+
+    return result;
+}
+
+}
+
+void OcclusionBuffer::begin(FXMMATRIX viewProjection)
+{
+    XMStoreFloat4x4(&m_viewProjection, viewProjection);
+
+    m_occluders.clear();
+    m_triangleCount = 0;
+
+    std::fill(m_depth.begin(), m_depth.end(), 0.0f);
+    m_tiles.fill(0.0f);
+}
+
+void OcclusionBuffer::addOccluder(const std::vector<XMFLOAT3>& triangles, FXMMATRIX world)
+{
+    if (triangles.empty()) {
+        return;
+    }
+
+    auto& occluder = m_occluders.emplace_back();
+    occluder.triangles = &triangles;
+    XMStoreFloat4x4(&occluder.worldViewProjection, XMMatrixMultiply(world, XMLoadFloat4x4(&m_viewProjection)));
+}
+
+void OcclusionBuffer::rasterize()
+{
+    PROFILE_FUNC();
+
+    // Kept around between frames so the triangle vectors keep their capacity
+    if (m_triangles.size() < m_occluders.size()) {
+        m_triangles.resize(m_occluders.size());
+    }
+
+    {
+        PROFILE_SCOPE("Occluder setup");
+
+        getTaskScheduler().parallelFor(0, u32(m_occluders.size()), OccludersPerTask, [&](u32 begin, u32 end) {
+            for (auto i = begin; i < end; i++) {
+                m_triangles[i].clear();
+                setup(m_occluders[i], m_triangles[i]);
+            }
+        });
+    }
+
+    for (size_t i = 0; i < m_occluders.size(); i++) {
+        m_triangleCount += u32(m_triangles[i].size());
+    }
+
+    // Every task owns a row of tiles, so they never write to the same pixels
+    getTaskScheduler().parallelFor(0, TilesY, 1, [&](u32 begin, u32 end) {
+        PROFILE_SCOPE("Occluder rasterization");
+
+        for (auto row = begin; row < end; row++) {
+            rasterizeRows(row);
+        }
+    });
+}
+
+void OcclusionBuffer::setup(const Occluder& occluder, std::vector<ScreenTriangle>& out) const
+{
+    auto m = XMLoadFloat4x4(&occluder.worldViewProjection);
+    const auto& triangles = *occluder.triangles;
+
+    for (size_t i = 0; i + 2 < triangles.size(); i += 3) {
+        XMFLOAT4 clip[3];
+        u32 behind = 0;
+
+        for (u32 j = 0; j < 3; j++) {
+            XMStoreFloat4(&clip[j], XMVector3Transform(XMLoadFloat3(&triangles[i + j]), m));
+            behind += clip[j].w < NearW;
+        }
+
+        if (behind == 3) {
+            continue;
+        }
+
+        if (behind == 0) {
+            setupTriangle(clip, out);
+            continue;
+        }
+
+        // One vertex behind makes a quad, two make a smaller triangle
+        XMFLOAT4 clipped[4];
+        auto count = clipNear(clip, 3, clipped);
+
+        for (u32 j = 2; j < count; j++) {
+            XMFLOAT4 fan[3] = { clipped[0], clipped[j - 1], clipped[j] };
+            setupTriangle(fan, out);
+        }
+    }
+}
+
+void OcclusionBuffer::setupTriangle(const XMFLOAT4* clip, std::vector<ScreenTriangle>& out) const
+{
+    float x[3], y[3], z[3];
+
+    for (u32 i = 0; i < 3; i++) {
+        auto invW = 1.0f / clip[i].w;
+
+        x[i] = (clip[i].x * invW * 0.5f + 0.5f) * float(Width);
+        y[i] = (0.5f - clip[i].y * invW * 0.5f) * float(Height);
+        z[i] = invW;
+    }
+
+    auto area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+
+    if (std::abs(area) < 1e-6f) {
+        return;
+    }
+
+    // Occluders are drawn from both sides, flip the back facing ones around
+    if (area < 0.0f) {
+        std::swap(x[1], x[2]);
+        std::swap(y[1], y[2]);
+        std::swap(z[1], z[2]);
+        area = -area;
+    }
+
+    ScreenTriangle t;
+
+    // Pixel centers are at +0.5, anything whose center isn't inside is skipped
+    t.minX = std::max(0, i32(std::ceil(std::min({ x[0], x[1], x[2] }) - 0.5f)));
+    t.minY = std::max(0, i32(std::ceil(std::min({ y[0], y[1], y[2] }) - 0.5f)));
+    t.maxX = std::min(i32(Width) - 1, i32(std::floor(std::max({ x[0], x[1], x[2] }) - 0.5f)));
+    t.maxY = std::min(i32(Height) - 1, i32(std::floor(std::max({ y[0], y[1], y[2] }) - 0.5f)));
+
+    if (t.minX > t.maxX || t.minY > t.maxY) {
+        return;
+    }
+
+    // Edge i is opposite to vertex i and positive on the inside
+    for (u32 i = 0; i < 3; i++) {
+        auto a = (i + 1) % 3;
+        auto b = (i + 2) % 3;
+
+        t.edgeA[i] = y[a] - y[b];
+        t.edgeB[i] = x[b] - x[a];
+        t.edgeC[i] = -(t.edgeA[i] * x[a] + t.edgeB[i] * y[a]);
+    }
+
+    // 1/w is linear in screen space, so it's the barycentric blend of the corners
+    auto invArea = 1.0f / area;
+
+    t.depthA = (t.edgeA[0] * z[0] + t.edgeA[1] * z[1] + t.edgeA[2] * z[2]) * invArea;
+    t.depthB = (t.edgeB[0] * z[0] + t.edgeB[1] * z[1] + t.edgeB[2] * z[2]) * invArea;
+    t.depthC = (t.edgeC[0] * z[0] + t.edgeC[1] * z[1] + t.edgeC[2] * z[2]) * invArea;
+
+    out.push_back(t);
+}
+
+void OcclusionBuffer::rasterizeRows(u32 tileRow)
+{
+    auto rowMin = i32(tileRow * TileSize);
+    auto rowMax = rowMin + i32(TileSize) - 1;
+
+    const auto offsets = XMVectorSet(0.5f, 1.5f, 2.5f, 3.5f);
+    const auto zero = XMVectorZero();
+
+    for (size_t o = 0; o < m_occluders.size(); o++) {
+        for (const auto& t : m_triangles[o]) {
+            if (t.maxY < rowMin || t.minY > rowMax) {
+                continue;
+            }
+
+            auto startX = t.minX & ~3;
+            auto px = XMVectorAdd(XMVectorReplicate(float(startX)), offsets);
+
+            XMVECTOR edgeStep[3];
+            for (u32 i = 0; i < 3; i++) {
+                edgeStep[i] = XMVectorReplicate(t.edgeA[i] * 4.0f);
+            }
+
+            auto depthStep = XMVectorReplicate(t.depthA * 4.0f);
+
+            for (auto y = std::max(t.minY, rowMin); y <= std::min(t.maxY, rowMax); y++) {
+                auto py = float(y) + 0.5f;
+
+                XMVECTOR edge[3];
+                for (u32 i = 0; i < 3; i++) {
+                    edge[i] = XMVectorMultiplyAdd(XMVectorReplicate(t.edgeA[i]), px,
+                        XMVectorReplicate(t.edgeB[i] * py + t.edgeC[i]));
+                }
+
+                auto depth = XMVectorMultiplyAdd(XMVectorReplicate(t.depthA), px,
+                    XMVectorReplicate(t.depthB * py + t.depthC));
+
+                auto row = &m_depth[size_t(y) * Width];
+
+                // Width is a multiple of 4, so the last group never runs past the row
+                for (auto x = startX; x <= t.maxX; x += 4) {
+                    auto inside = XMVectorAndInt(XMVectorAndInt(
+                        XMVectorGreaterOrEqual(edge[0], zero),
+                        XMVectorGreaterOrEqual(edge[1], zero)),
+                        XMVectorGreaterOrEqual(edge[2], zero));
+
+                    auto old = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(row + x));
+                    XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(row + x), XMVectorSelect(old, XMVectorMax(old, depth), inside));
+
+                    for (u32 i = 0; i < 3; i++) {
+                        edge[i] = XMVectorAdd(edge[i], edgeStep[i]);
+                    }
+
+                    depth = XMVectorAdd(depth, depthStep);
+                }
+            }
+        }
+    }
+
+    for (u32 tx = 0; tx < TilesX; tx++) {
+        auto farthest = XMVectorReplicate(FLT_MAX);
+
+        for (u32 y = 0; y < TileSize; y++) {
+            auto p = &m_depth[size_t(rowMin + i32(y)) * Width + tx * TileSize];
+
+            farthest = XMVectorMin(farthest, XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(p)));
+            farthest = XMVectorMin(farthest, XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(p + 4)));
+        }
+
+        XMFLOAT4 f;
+        XMStoreFloat4(&f, farthest);
+        m_tiles[tileRow * TilesX + tx] = std::min({ f.x, f.y, f.z, f.w });
+    }
+}
+
+bool OcclusionBuffer::isVisible(const math::Aabb& box) const
+{
+    auto m = XMLoadFloat4x4(&m_viewProjection);
+
+    auto minX = FLT_MAX;
+    auto minY = FLT_MAX;
+    auto maxX = -FLT_MAX;
+    auto maxY = -FLT_MAX;
+    auto nearest = 0.0f;
+
+    for (u32 i = 0; i < 8; i++) {
+        auto corner = XMVectorSet(
+            i & 1 ? box.max.x : box.min.x,
+            i & 2 ? box.max.y : box.min.y,
+            i & 4 ? box.max.z : box.min.z,
+            1.0f);
+
+        XMFLOAT4 clip;
+        XMStoreFloat4(&clip, XMVector4Transform(corner, m));
+
+        // Reaches the camera, let the frustum decide
+        if (clip.w < NearW) {
+            return true;
+        }
+
+        auto invW = 1.0f / clip.w;
+        auto x = (clip.x * invW * 0.5f + 0.5f) * float(Width);
+        auto y = (0.5f - clip.y * invW * 0.5f) * float(Height);
+
+        minX = std::min(minX, x);
+        minY = std::min(minY, y);
+        maxX = std::max(maxX, x);
+        maxY = std::max(maxY, y);
+
+        // 1/w is largest at the corner closest to the camera
+        nearest = std::max(nearest, invW);
+    }
+
+    // Every pixel the box touches plus one more around it. Occluders cover the pixels
+    // whose centers they cover, so their edges can stick out by most of a pixel.
+    auto x0 = std::max(0, i32(std::floor(minX)) - 1);
+    auto y0 = std::max(0, i32(std::floor(minY)) - 1);
+    auto x1 = std::min(i32(Width) - 1, i32(std::floor(maxX)) + 1);
+    auto y1 = std::min(i32(Height) - 1, i32(std::floor(maxY)) + 1);
+
+    if (x0 > x1 || y0 > y1) {
+        return true;
+    }
+
+    auto threshold = nearest * (1.0f + DepthBias);
+
+    for (auto ty = y0 / i32(TileSize); ty <= y1 / i32(TileSize); ty++) {
+        for (auto tx = x0 / i32(TileSize); tx <= x1 / i32(TileSize); tx++) {
+            // The whole tile is in front of the box
+            if (m_tiles[ty * TilesX + tx] > threshold) {
+                continue;
+            }
+
+            auto px0 = std::max(x0, tx * i32(TileSize));
+            auto px1 = std::min(x1, tx * i32(TileSize) + i32(TileSize) - 1);
+            auto py0 = std::max(y0, ty * i32(TileSize));
+            auto py1 = std::min(y1, ty * i32(TileSize) + i32(TileSize) - 1);
+
+            for (auto y = py0; y <= py1; y++) {
+                for (auto x = px0; x <= px1; x++) {
+                    if (m_depth[size_t(y) * Width + x] <= threshold) {
+                        return true;
+                    }
+                }
+            }
+        }
+    }
+
+    return false;
+}
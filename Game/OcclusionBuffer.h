@@ -0,0 +1,89 @@
+#pragma once
+
+#include "Common.h"
+#include "Geometry.h"
+
+#include <DirectXMath.h>
+#include <array>
+#include <vector>
+
+// Low resolution CPU depth buffer for occlusion culling.
+//
+// Occluders are triangle lists rasterized 4 pixels at a time, after that every 8x8 tile
+// keeps the depth of its farthest pixel. Boxes are tested against the tiles first and
+// only look at individual pixels in tiles that aren't fully in front of them.
+//
+// Depth is 1/w, so it works for any perspective projection including reverse-Z, larger
+// is closer and 0 means nothing was drawn there. Only depends on DirectXMath and the
+// task scheduler, so it runs the same everywhere.
+class OcclusionBuffer
+{
+public:
+    static constexpr u32 Width = 256;
+    static constexpr u32 Height = 144;
+    static constexpr u32 TileSize = 8;
+    static constexpr u32 TilesX = Width / TileSize;
+    static constexpr u32 TilesY = Height / TileSize;
+
+    // Clears the buffer and the occluders
+    void begin(DirectX::FXMMATRIX viewProjection);
+
+    // `triangles` is a model space triangle list and has to stay alive until rasterize()
+    void addOccluder(const std::vector<DirectX::XMFLOAT3>& triangles, DirectX::FXMMATRIX world);
+
+    // Rasterizes the occluders in parallel and builds the tiles
+    void rasterize();
+
+    // False if the box is completely behind the occluders. Thread safe after rasterize().
+    bool isVisible(const math::Aabb& box) const;
+
+    u32 getOccluderCount() const
+    {
+        return u32(m_occluders.size());
+    }
+
+    u32 getTriangleCount() const
+    {
+        return m_triangleCount;
+    }
+
+    // Row major, Width * Height
+    const std::vector<float>& getDepth() const
+    {
+        return m_depth;
+    }
+
+private:
+    struct Occluder
+    {
+        const std::vector<DirectX::XMFLOAT3>* triangles;
+        DirectX::XMFLOAT4X4 worldViewProjection;
+    };
+
+    // Edge functions and depth plane in pixels, evaluated at pixel centers
+    struct ScreenTriangle
+    {
+        float edgeA[3];
+        float edgeB[3];
+        float edgeC[3];
+        float depthA, depthB, depthC;
+
+        // Inclusive pixel bounds
+        i32 minX, minY, maxX, maxY;
+    };
+
+    void setup(const Occluder& occluder, std::vector<ScreenTriangle>& out) const;
+    void setupTriangle(const DirectX::XMFLOAT4* clip, std::vector<ScreenTriangle>& out) const;
+    void rasterizeRows(u32 tileRow);
+
+    DirectX::XMFLOAT4X4 m_viewProjection;
+
+    std::vector<Occluder> m_occluders;
+    std::vector<std::vector<ScreenTriangle>> m_triangles;
+    u32 m_triangleCount = 0;
+
+    std::vector<float> m_depth = std::vector<float>(Width * Height);
+
+    // Farthest depth in each tile
+    std::array<float, TilesX * TilesY> m_tiles{};
+};
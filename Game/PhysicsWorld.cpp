@@ -6,14 +6,98 @@
 #include "Mesh.h"
 #include "Math.h"
 
+#include "TaskScheduler.h"
+#include "Profiler.h"
+#include "MemoryTracker.h"
+
 #include "Components/Transform.h"
 
 #include <im3d.h>
+#include <algorithm>
 #include <unordered_map>
 #include <bullet/btBulletDynamicsCommon.h>
+#include <bullet/BulletCollision/CollisionDispatch/btCollisionDispatcherMt.h>
+#include <bullet/BulletDynamics/ConstraintSolver/btSequentialImpulseConstraintSolverMt.h>
+#include <bullet/BulletCollision/NarrowPhaseCollision/btGjkEpa2.h>
+#include <bullet/BulletDynamics/Dynamics/btDiscreteDynamicsWorldMt.h>
+#include <bullet/LinearMath/btThreads.h>
 
 using namespace math;
 
+// Runs Bullet's parallel loops on the engine workers instead of Bullet's own thread pool
+class BulletTaskScheduler : public btITaskScheduler
+{
+public:
+    BulletTaskScheduler(TaskScheduler& scheduler) :
+        btITaskScheduler("Engine"), m_scheduler(scheduler), m_threadCount(int(scheduler.getThreadCount()))
+    {
+    }
+
+    virtual int getMaxNumThreads() const override
+    {
+        return int(m_scheduler.getThreadCount());
+    }
+
+    virtual int getNumThreads() const override
+    {
+        return m_threadCount;
+    }
+
+    virtual void setNumThreads(int numThreads) override
+    {
+        m_threadCount = std::clamp(numThreads, 1, getMaxNumThreads());
+    }
+
+    virtual void parallelFor(int iBegin, int iEnd, int grainSize, const btIParallelForBody& body) override
+    {
+        m_scheduler.parallelFor(u32(iBegin), u32(iEnd), getGrainSize(iBegin, iEnd, grainSize), [&](u32 begin, u32 end) {
+            body.forLoop(int(begin), int(end));
+        });
+    }
+
+    virtual btScalar parallelSum(int iBegin, int iEnd, int grainSize, const btIParallelSumBody& body) override
+    {
+        std::mutex mutex;
+        btScalar sum = 0.0f;
+
+        m_scheduler.parallelFor(u32(iBegin), u32(iEnd), getGrainSize(iBegin, iEnd, grainSize), [&](u32 begin, u32 end) {
+            auto partial = body.sumLoop(int(begin), int(end));
+
+            std::lock_guard lock(mutex);
+            sum += partial;
+        });
+
+        return sum;
+    }
+
+private:
+    // The workers take chunks as they free up, so the only way to keep it to fewer threads
+    // is to have no more chunks than that
+    u32 getGrainSize(int iBegin, int iEnd, int grainSize) const
+    {
+        auto grain = u32(std::max(grainSize, 1));
+
+        if (m_threadCount >= getMaxNumThreads() || iEnd <= iBegin) {
+            return grain;
+        }
+
+        auto count = u32(iEnd - iBegin);
+        return std::max(grain, (count + u32(m_threadCount) - 1) / u32(m_threadCount));
+    }
+
+    TaskScheduler& m_scheduler;
+    int m_threadCount;
+};
+
+static void initBulletTaskScheduler()
+{
+    static BulletTaskScheduler scheduler(getTaskScheduler());
+
+    if (btGetTaskScheduler() != &scheduler) {
+        btSetTaskScheduler(&scheduler);
+    }
+}
+
 static void setEntity(btCollisionObject* obj, entt::entity e)
 {
     obj->setUserIndex(int(e));
@@ -28,25 +112,47 @@ static entt::entity getEntity(const btCollisionObject* obj)
     return entt::null;
 }
 
-PhysicsWorld::PhysicsWorld(Scene& scene) :
-    m_scene(scene)
+void PhysicsWorld::installAllocator()
+{
+    btAlignedAllocSetCustom([](size_t size) { return MemoryTracker::allocateTracked(size, MemoryTag::Physics); },
+        MemoryTracker::freeTracked);
+}
+
+PhysicsWorld::PhysicsWorld(Scene& scene, const PhysicsSettings& settings) :
+    m_scene(scene), m_lockstep(settings.lockstep)
 {
-    m_collisionConfiguration = std::make_unique<btDefaultCollisionConfiguration>();
-    m_dispatcher = std::make_unique<btCollisionDispatcher>(m_collisionConfiguration.get());
     m_overlappingPairCache = std::make_unique<btDbvtBroadphase>();
-    m_solver = std::make_unique<btSequentialImpulseConstraintSolver>();
-    m_dynamicsWorld = std::make_unique<btDiscreteDynamicsWorld>(
-        m_dispatcher.get(), m_overlappingPairCache.get(), m_solver.get(), m_collisionConfiguration.get());
+
+    if (settings.multithreaded) {
+        initBulletTaskScheduler();
+
+        // The default pool sizes are tiny, the worker threads would all end up in the allocator
+        btDefaultCollisionConstructionInfo cci;
+        cci.m_defaultMaxPersistentManifoldPoolSize = 80000;
+        cci.m_defaultMaxCollisionAlgorithmPoolSize = 80000;
+
+        m_collisionConfiguration = std::make_unique<btDefaultCollisionConfiguration>(cci);
+        m_dispatcher = std::make_unique<btCollisionDispatcherMt>(m_collisionConfiguration.get());
+        m_solverPool = std::make_unique<btConstraintSolverPoolMt>(btGetTaskScheduler()->getNumThreads());
+        m_solver = std::make_unique<btSequentialImpulseConstraintSolverMt>();
+        m_dynamicsWorld = std::make_unique<btDiscreteDynamicsWorldMt>(m_dispatcher.get(),
+            m_overlappingPairCache.get(), m_solverPool.get(), m_solver.get(), m_collisionConfiguration.get());
+    } else {
+        m_collisionConfiguration = std::make_unique<btDefaultCollisionConfiguration>();
+        m_dispatcher = std::make_unique<btCollisionDispatcher>(m_collisionConfiguration.get());
+        m_solver = std::make_unique<btSequentialImpulseConstraintSolver>();
+        m_dynamicsWorld = std::make_unique<btDiscreteDynamicsWorld>(
+            m_dispatcher.get(), m_overlappingPairCache.get(), m_solver.get(), m_collisionConfiguration.get());
+    }
 
     m_dynamicsWorld->setGravity(btVector3(0.0f, -10.0f, 0.0f));
     m_dynamicsWorld->setDebugDrawer(&m_debugDraw);
-
-    auto shape = m_collisionShapes.emplace_back(std::make_unique<btBoxShape>(btVector3(0.5f, 0.5f, 0.5f))).get();
-    m_collisionMeshes["basic_box"] = shape;
 }
 
 PhysicsWorld::~PhysicsWorld()
 {
+    stop();
+
     for (auto&& obj : m_collisionObjects) {
         m_dynamicsWorld->removeCollisionObject(obj.get());
     }
@@ -58,36 +164,44 @@ void PhysicsWorld::onCreatePhysicsComponent(entt::registry& reg, entt::entity en
     // and this should just add the component to the simulation
     auto [tc, pc] = reg.get<components::Transform, components::Physics>(entity);
 
-    pc.collisionShape = getCollisionMesh("basic_box");
+    pc.collisionShape = acquireShape(AssetId::Invalid, tc.scale);
 
-    btTransform transform;
-    transform.setIdentity();
-    transform.setOrigin(btVector3(tc.position.x, tc.position.y, tc.position.z));
-
-    btQuaternion rot;
-    rot.set128(tc.rotationQuat);
-    transform.setRotation(rot);
+    auto transform = getWorldPose(entity);
 
     btVector3 localInertia(0.0f, 0.0f, 0.0f);
     if (pc.mass != 0.0f) {
         pc.collisionShape->calculateLocalInertia(pc.mass, localInertia);
     }
 
-    auto motionState = std::make_unique<btDefaultMotionState>(transform);
+    auto motionState = std::make_unique<EntityMotionState>(reg.entity(entity), transform, m_movedBodies);
     btRigidBody::btRigidBodyConstructionInfo info(pc.mass, motionState.get(), pc.collisionShape, localInertia);
     auto body = std::make_unique<btRigidBody>(info);
 
     setEntity(body.get(), reg.entity(entity));
 
-    m_dynamicsWorld->addRigidBody(body.get());
+    enqueue([this, body = body.get()] {
+        m_dynamicsWorld->addRigidBody(body);
+    });
+
     pc.collisionObject = std::move(body);
     pc.motionState = std::move(motionState);
+    pc.previousTransform = transform;
+    pc.currentTransform = transform;
 }
 
 void PhysicsWorld::onDestroyPhysicsComponent(entt::registry& reg, entt::entity entity)
 {
     auto& pc = reg.get<components::Physics>(entity);
-    m_dynamicsWorld->removeCollisionObject(pc.collisionObject.get());
+
+    // The physics thread might still be using these, so they're deleted there
+    enqueue([this, obj = pc.collisionObject.release(), motionState = pc.motionState.release()] {
+        m_dynamicsWorld->removeCollisionObject(obj);
+        delete obj;
+        delete motionState;
+    });
+
+    releaseShape(pc.collisionShape);
+    pc.collisionShape = nullptr;
 }
 
 void PhysicsWorld::onCreateCollisionComponent(entt::registry& reg, entt::entity entity)
@@ -96,30 +210,32 @@ void PhysicsWorld::onCreateCollisionComponent(entt::registry& reg, entt::entity
     // and this should just add the component to the simulation
     auto [tc, cc] = reg.get<components::Transform, components::Collision>(entity);
 
-    cc.collisionShape = getCollisionMesh("basic_box");
-
-    btQuaternion rot;
-    rot.set128(tc.rotationQuat);
-
-    btTransform transform;
-    transform.setIdentity();
-    transform.setOrigin(btVector3(tc.position.x, tc.position.y, tc.position.z));
-    transform.setRotation(rot);
+    cc.collisionShape = acquireShape(AssetId::Invalid, tc.scale);
 
     auto obj = std::make_unique<btCollisionObject>();
-    //obj->setWorldTransform(transform);
-    obj->setWorldTransform(btTransform(rot, btVector3(tc.position.x, tc.position.y, tc.position.z)));
+    obj->setWorldTransform(getWorldPose(entity));
     obj->setCollisionShape(cc.collisionShape);
 
     setEntity(obj.get(), reg.entity(entity));
-    m_dynamicsWorld->addCollisionObject(obj.get());
+
+    enqueue([this, obj = obj.get()] {
+        m_dynamicsWorld->addCollisionObject(obj);
+    });
+
     cc.collisionObject = std::move(obj);
 }
 
 void PhysicsWorld::onDestroyCollisionComponent(entt::registry& reg, entt::entity entity)
 {
     auto& cc = reg.get<components::Collision>(entity);
-    m_dynamicsWorld->removeCollisionObject(cc.collisionObject.get());
+
+    enqueue([this, obj = cc.collisionObject.release()] {
+        m_dynamicsWorld->removeCollisionObject(obj);
+        delete obj;
+    });
+
+    releaseShape(cc.collisionShape);
+    cc.collisionShape = nullptr;
 }
 
 void PhysicsWorld::addBox(float hw, float hh, float hd, float mass, float x, float y, float z)
@@ -136,7 +252,10 @@ void PhysicsWorld::addBox(float hw, float hh, float hd, float mass, float x, flo
     auto body = std::make_unique<btRigidBody>(info);
     body->setUserPointer(nullptr);
 
-    m_dynamicsWorld->addRigidBody(body.get());
+    enqueue([this, body = body.get()] {
+        m_dynamicsWorld->addRigidBody(body);
+    });
+
     m_collisionObjects.emplace_back(std::move(body));
     m_motionStates.emplace_back(std::move(motionState));
 }
@@ -157,71 +276,329 @@ void PhysicsWorld::addSphere(float radius, float mass, float x, float y, float z
     auto body = std::make_unique<btRigidBody>(info);
     body->setUserPointer(nullptr);
 
-    m_dynamicsWorld->addRigidBody(body.get());
+    enqueue([this, body = body.get()] {
+        m_dynamicsWorld->addRigidBody(body);
+    });
+
     m_collisionObjects.emplace_back(std::move(body));
     m_motionStates.emplace_back(std::move(motionState));
 }
 
-btCollisionShape* PhysicsWorld::createCollisionMesh(const std::string& name, const Mesh& mesh)
+btCollisionShape* PhysicsWorld::acquireShape(AssetId model, const XMFLOAT3& scale)
 {
-    assert(!m_collisionMeshes.contains(name));
+    return m_shapes.acquire(model, scale);
+}
+
+void PhysicsWorld::releaseShape(btCollisionShape* shape)
+{
+    std::vector<std::unique_ptr<btCollisionShape>> freed;
+    m_shapes.release(shape, freed);
+
+    if (freed.empty()) {
+        return;
+    }
+
+    // Objects using the shape are removed by commands queued before this one
+    enqueue([freed = std::make_shared<decltype(freed)>(std::move(freed))] {
+        freed->clear();
+    });
+}
+
+void PhysicsWorld::setShape(btCollisionObject* obj, btCollisionShape*& shape, AssetId model, const XMFLOAT3& scale)
+{
+    auto newShape = acquireShape(model, scale);
+
+    if (newShape == shape) {
+        releaseShape(newShape);
+        return;
+    }
 
-    const auto& indices = mesh.getIndices();
-    const auto& vIn = mesh.getVertices();
+    enqueue([obj, newShape] {
+        obj->setCollisionShape(newShape);
+    });
 
-    std::vector<XMFLOAT3> vOut(indices.size());
+    releaseShape(shape);
+    shape = newShape;
+}
 
-    for (size_t i = 0; i < indices.size(); i++) {
-        vOut[i] = vIn[indices[i]].Position;
+void PhysicsWorld::start()
+{
+    if (m_running) {
+        return;
     }
 
-    auto shape = std::make_unique<btConvexHullShape>(&vOut[0].x, int(vOut.size()),
-        int(sizeof(XMFLOAT3)));
+    // The editor can move bodies around while the simulation is stopped
+    m_scene.reg.view<components::Physics>()
+        .each([&](components::Physics& pc) {
+            pc.previousTransform = pc.collisionObject->getWorldTransform();
+            pc.currentTransform = pc.previousTransform;
+            pc.lastStep = 0;
+        });
 
-    shape->optimizeConvexHull();
-    shape->initializePolyhedralFeatures();
+    m_step = 0;
+    m_interpolating.clear();
+    m_lastStepTime = std::chrono::steady_clock::now();
+    m_lockstepTime = 0.0f;
 
-    m_collisionMeshes[name] = shape.get();
+    m_running = true;
 
-    return m_collisionShapes.emplace_back(std::move(shape)).get();
+    if (!m_lockstep) {
+        m_thread = std::thread(&PhysicsWorld::physicsThread, this);
+    }
 }
 
-btCollisionShape* PhysicsWorld::getCollisionMesh(const std::string& name)
+void PhysicsWorld::stop()
 {
-    if (auto it = m_collisionMeshes.find(name); it != m_collisionMeshes.end()) {
-        return it->second;
+    if (!m_running) {
+        return;
     }
 
-    return nullptr;
+    m_running = false;
+
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+
+    // Anything queued after the last step, then snap to the final state
+    runCommands();
+    update();
 }
 
-void PhysicsWorld::editorUpdate()
+void PhysicsWorld::enqueue(Command command)
 {
-    m_dynamicsWorld->updateAabbs();
-    m_dynamicsWorld->computeOverlappingPairs();
+    if (!m_running) {
+        command();
+        return;
+    }
+
+    std::lock_guard lock(m_commandMutex);
+    m_commands.push_back(std::move(command));
 }
 
-void PhysicsWorld::update(float dt)
+void PhysicsWorld::setWorldTransform(btCollisionObject* obj, const btTransform& transform)
 {
-    m_dynamicsWorld->stepSimulation(dt, 10);
+    enqueue([obj, transform] {
+        obj->setWorldTransform(transform);
+    });
+}
 
-    m_scene.reg.view<components::Transform, components::Physics>()
-        .each([&](entt::entity entity, const components::Transform&, const components::Physics& pc) {
-            btTransform ft;
+void PhysicsWorld::runCommands()
+{
+    {
+        std::lock_guard lock(m_commandMutex);
+        std::swap(m_commands, m_runningCommands);
+    }
 
-            if (pc.motionState) {
-                pc.motionState->getWorldTransform(ft);
-            } else {
-                ft = pc.collisionObject->getWorldTransform();
-            }
+    for (auto& command : m_runningCommands) {
+        command();
+    }
+
+    m_runningCommands.clear();
+}
+
+void PhysicsWorld::physicsThread()
+{
+    using clock = std::chrono::steady_clock;
+
+    // Don't try to catch up after a long stall, just drop the time
+    constexpr int MaxCatchUpSteps = 5;
+
+    const auto stepDuration = std::chrono::duration_cast<clock::duration>(
+        std::chrono::duration<float>(FixedTimeStep));
+
+    getProfiler().setThreadName("Physics");
+
+    auto nextStep = clock::now();
+
+    while (m_running) {
+        step();
+
+        nextStep += stepDuration;
+
+        if (auto now = clock::now(); now - nextStep > stepDuration * MaxCatchUpSteps) {
+            nextStep = now;
+        }
+
+        std::this_thread::sleep_until(nextStep);
+    }
+}
+
+void PhysicsWorld::advance(float dt)
+{
+    if (!m_lockstep || !m_running) {
+        return;
+    }
+
+    // Same catch up limit as the physics thread
+    constexpr int MaxSteps = 5;
+
+    m_lockstepTime += dt;
+
+    for (int i = 0; m_lockstepTime >= FixedTimeStep; i++) {
+        if (i == MaxSteps) {
+            m_lockstepTime = 0.0f;
+            break;
+        }
+
+        step();
+        m_lockstepTime -= FixedTimeStep;
+    }
+}
+
+void PhysicsWorld::step()
+{
+    PROFILE_FUNC();
+    MemoryScope memoryScope(MemoryTag::Physics);
+
+    {
+        std::lock_guard lock(m_worldMutex);
+        runCommands();
+
+        // No substeps, the thread already runs at the fixed rate
+        m_dynamicsWorld->stepSimulation(FixedTimeStep, 0);
+    }
+
+    StepResult result;
+    result.step = ++m_step;
+    result.time = std::chrono::steady_clock::now();
+    result.bodies.reserve(m_movedBodies.size());
+
+    // Sleeping bodies never end up in the list, so this only touches what actually moved
+    for (auto motionState : m_movedBodies) {
+        result.bodies.push_back(BodyState{ motionState->getEntity(), motionState->getTransform() });
+    }
+
+    m_movedBodies.clear();
+
+    {
+        std::lock_guard lock(m_resultMutex);
+        m_results.push_back(std::move(result));
+    }
+}
+
+void PhysicsWorld::applyStep(const StepResult& result)
+{
+    m_interpolatingNext.clear();
+
+    for (const auto& body : result.bodies) {
+        if (!m_scene.reg.valid(body.entity)) {
+            continue;
+        }
+
+        if (auto pc = m_scene.reg.try_get<components::Physics>(body.entity)) {
+            pc->previousTransform = pc->currentTransform;
+            pc->currentTransform = body.transform;
+            pc->lastStep = result.step;
+            m_interpolatingNext.push_back(body.entity);
+        }
+    }
+
+    // Bodies that stopped moving get one more update to land on their final state
+    for (auto entity : m_interpolating) {
+        if (!m_scene.reg.valid(entity)) {
+            continue;
+        }
+
+        if (auto pc = m_scene.reg.try_get<components::Physics>(entity); pc && pc->lastStep + 1 == result.step) {
+            pc->previousTransform = pc->currentTransform;
+            m_interpolatingNext.push_back(entity);
+        }
+    }
+
+    std::swap(m_interpolating, m_interpolatingNext);
+    m_lastStepTime = result.time;
+}
+
+void PhysicsWorld::update()
+{
+    PROFILE_SCOPE("PhysicsWorld::update");
+    MemoryScope memoryScope(MemoryTag::Physics);
+
+    {
+        std::lock_guard lock(m_resultMutex);
+        std::swap(m_results, m_appliedResults);
+    }
+
+    for (const auto& result : m_appliedResults) {
+        applyStep(result);
+    }
+
+    m_appliedResults.clear();
+
+    auto alpha = 1.0f;
+
+    if (m_running && m_lockstep) {
+        alpha = std::clamp(m_lockstepTime / FixedTimeStep, 0.0f, 1.0f);
+    } else if (m_running) {
+        auto sinceStep = std::chrono::duration<float>(std::chrono::steady_clock::now() - m_lastStepTime);
+        alpha = std::clamp(sinceStep.count() / FixedTimeStep, 0.0f, 1.0f);
+    }
 
-            const auto& origin = ft.getOrigin();
+    for (auto entity : m_interpolating) {
+        if (!m_scene.reg.valid(entity)) {
+            continue;
+        }
 
-            m_scene.reg.patch<components::Transform>(entity, [&](components::Transform& tc) {
-                tc.position = XMFLOAT3(origin.x(), origin.y(), origin.z());
-                tc.rotationQuat = ft.getRotation().get128();
-            });
+        auto pc = m_scene.reg.try_get<components::Physics>(entity);
+
+        if (!pc) {
+            continue;
+        }
+
+        const auto& prev = pc->previousTransform;
+        const auto& cur = pc->currentTransform;
+
+        auto origin = prev.getOrigin().lerp(cur.getOrigin(), alpha);
+        auto rotation = prev.getRotation().slerp(cur.getRotation(), alpha);
+
+        XMVECTOR position = XMVectorSet(origin.x(), origin.y(), origin.z(), 1.0f);
+        XMVECTOR rotationQuat = rotation.get128();
+
+        // The body is in world space, a child's Transform is relative to its parent
+        if (m_scene.transforms.getParent(entity) != entt::null) {
+            auto world = XMMatrixRotationQuaternion(rotationQuat) * XMMatrixTranslationFromVector(position);
+
+            XMVECTOR scale;
+            XMMatrixDecompose(&scale, &rotationQuat, &position, m_scene.transforms.worldToLocal(entity, world));
+        }
+
+        m_scene.reg.patch<components::Transform>(entity, [&](components::Transform& tc) {
+            XMStoreFloat3(&tc.position, position);
+            tc.rotationQuat = rotationQuat;
         });
+    }
+}
+
+btTransform PhysicsWorld::getWorldPose(entt::entity entity) const
+{
+    const auto& tc = m_scene.reg.get<components::Transform>(entity);
+
+    XMVECTOR position = XMLoadFloat3(&tc.position);
+    XMVECTOR rotationQuat = tc.rotationQuat;
+
+    // Scale isn't part of the pose, only the parent's rotation and translation carry over
+    if (auto parent = m_scene.transforms.getParent(entity); parent != entt::null) {
+        auto world = XMMatrixRotationQuaternion(rotationQuat) * XMMatrixTranslationFromVector(position)
+            * m_scene.reg.get<components::WorldTransform>(parent).matrix;
+
+        XMVECTOR scale;
+        XMMatrixDecompose(&scale, &rotationQuat, &position, world);
+    }
+
+    btQuaternion rot;
+    rot.set128(rotationQuat);
+
+    return btTransform(rot, btVector3(XMVectorGetX(position), XMVectorGetY(position), XMVectorGetZ(position)));
+}
+
+void PhysicsWorld::editorUpdate()
+{
+    if (m_running) {
+        return;
+    }
+
+    m_dynamicsWorld->updateAabbs();
+    m_dynamicsWorld->computeOverlappingPairs();
 }
 
 void PhysicsWorld::setDebugDrawMode(int mode)
@@ -229,11 +606,57 @@ void PhysicsWorld::setDebugDrawMode(int mode)
     m_debugDraw.setDebugMode(mode);
 }
 
-void PhysicsWorld::render()
+void PhysicsWorld::render(const math::Frustum& frustum)
 {
-    Im3d::PushMatrix(Im3d::Mat4(1.0f));
-    m_dynamicsWorld->debugDrawWorld();
-    Im3d::PopMatrix();
+    if (m_debugDraw.getDebugMode() == 0) {
+        return;
+    }
+
+    PROFILE_SCOPE("PhysicsWorld::render");
+
+    // Debug drawing walks the whole world, it has to wait for the current step
+    std::lock_guard lock(m_worldMutex);
+
+    // Same as btCollisionWorld::debugDrawWorld but skips anything off screen, wireframes
+    // of big scenes are mostly spent on objects nobody can see
+    const auto colors = m_debugDraw.getDefaultColors();
+    const auto& objects = m_dynamicsWorld->getCollisionObjectArray();
+
+    for (int i = 0; i < objects.size(); i++) {
+        const auto obj = objects[i];
+
+        if (obj->getCollisionFlags() & btCollisionObject::CF_DISABLE_VISUALIZE_OBJECT) {
+            continue;
+        }
+
+        btVector3 aabbMin, aabbMax;
+        obj->getCollisionShape()->getAabb(obj->getWorldTransform(), aabbMin, aabbMax);
+
+        math::Aabb box{
+            { aabbMin.x(), aabbMin.y(), aabbMin.z() },
+            { aabbMax.x(), aabbMax.y(), aabbMax.z() },
+        };
+
+        if (!frustum.intersects(box)) {
+            continue;
+        }
+
+        btVector3 color;
+
+        switch (obj->getActivationState()) {
+        case ACTIVE_TAG: color = colors.m_activeObject; break;
+        case ISLAND_SLEEPING: color = colors.m_deactivatedObject; break;
+        case WANTS_DEACTIVATION: color = colors.m_wantsDeactivationObject; break;
+        case DISABLE_DEACTIVATION: color = colors.m_disabledDeactivationObject; break;
+        case DISABLE_SIMULATION: color = colors.m_disabledSimulationObject; break;
+        default: color = btVector3(1.0f, 0.0f, 0.0f); break;
+        }
+
+        obj->getCustomDebugColor(color);
+        m_dynamicsWorld->debugDrawObject(obj->getWorldTransform(), obj->getCollisionShape(), color);
+    }
+
+    m_debugDraw.flushLines();
 }
 
 RaycastHit PhysicsWorld::raycast(math::WorldVector from0, math::WorldVector to0)
@@ -243,7 +666,12 @@ RaycastHit PhysicsWorld::raycast(math::WorldVector from0, math::WorldVector to0)
     to.set128(to0.vec);
 
     btCollisionWorld::ClosestRayResultCallback result(from, to);
-    m_dynamicsWorld->rayTest(from, to, result);
+
+    {
+        // Only used for picking in the editor, waiting for the step is fine there
+        std::lock_guard lock(m_worldMutex);
+        m_dynamicsWorld->rayTest(from, to, result);
+    }
 
     if (result.hasHit()) {
         RaycastHit hit;
@@ -253,6 +681,7 @@ RaycastHit PhysicsWorld::raycast(math::WorldVector from0, math::WorldVector to0)
         hit.entity = getEntity(result.m_collisionObject);
         hit.position.vec = XMVectorSetW(result.m_hitPointWorld.get128(), 1.0f);
         hit.normal.vec = XMVectorSetW(result.m_hitNormalWorld.get128(), 0.0f);
+        hit.fraction = result.m_closestHitFraction;
 
         return hit;
     }
@@ -260,6 +689,239 @@ RaycastHit PhysicsWorld::raycast(math::WorldVector from0, math::WorldVector to0)
     return RaycastHit{};
 }
 
+namespace
+{
+
+// Collects the objects whose broadphase bounds a query touches
+template<typename Func>
+struct LeafCollector : btDbvt::ICollide
+{
+    explicit LeafCollector(Func func) :
+        func(std::move(func))
+    {
+    }
+
+    virtual void Process(const btDbvtNode* leaf) override
+    {
+        func(static_cast<btBroadphaseProxy*>(leaf->data));
+    }
+
+    Func func;
+};
+
+// Only exists for the duration of a single query
+struct TempShape
+{
+    explicit TempShape(const QueryShape& shape) :
+        sphere(shape.size.x),
+        box(btVector3(shape.size.x, shape.size.y, shape.size.z))
+    {
+    }
+
+    btConvexShape* get(const QueryShape& shape)
+    {
+        if (shape.type == QueryShape::Type::Box) {
+            return &box;
+        }
+
+        return &sphere;
+    }
+
+    btSphereShape sphere;
+    btBoxShape box;
+};
+
+btTransform makeTransform(const QueryShape& shape, const math::WorldVector& position)
+{
+    btVector3 origin;
+    origin.set128(position.vec);
+
+    return btTransform(btQuaternion(shape.rotation.x, shape.rotation.y, shape.rotation.z, shape.rotation.w), origin);
+}
+
+template<typename Callback>
+RaycastHit toRaycastHit(const Callback& result, const btCollisionObject* obj)
+{
+    RaycastHit hit;
+
+    if (obj) {
+        hit.entity = getEntity(obj);
+        hit.position.vec = XMVectorSetW(result.m_hitPointWorld.get128(), 1.0f);
+        hit.normal.vec = XMVectorSetW(result.m_hitNormalWorld.get128(), 0.0f);
+        hit.fraction = result.m_closestHitFraction;
+    }
+
+    return hit;
+}
+
+}
+
+// Grain size for the batched queries
+constexpr u32 QueriesPerTask = 16;
+
+void PhysicsWorld::raycast(ArrayView<RayQuery> queries, std::vector<RaycastHit>& hits)
+{
+    PROFILE_SCOPE("PhysicsWorld::raycast batch");
+    hits.resize(queries.size);
+
+    std::lock_guard lock(m_worldMutex);
+
+    getTaskScheduler().parallelFor(0, queries.size, QueriesPerTask, [&](u32 begin, u32 end) {
+        for (u32 i = begin; i < end; i++) {
+            hits[i] = raycastSingle(queries.data[i]);
+        }
+    });
+}
+
+void PhysicsWorld::sweep(ArrayView<SweepQuery> queries, std::vector<RaycastHit>& hits)
+{
+    PROFILE_SCOPE("PhysicsWorld::sweep batch");
+    hits.resize(queries.size);
+
+    std::lock_guard lock(m_worldMutex);
+
+    getTaskScheduler().parallelFor(0, queries.size, QueriesPerTask, [&](u32 begin, u32 end) {
+        for (u32 i = begin; i < end; i++) {
+            hits[i] = sweepSingle(queries.data[i]);
+        }
+    });
+}
+
+void PhysicsWorld::overlap(ArrayView<OverlapQuery> queries, u32 maxHitsPerQuery,
+    std::vector<entt::entity>& hits, std::vector<u32>& hitCounts)
+{
+    PROFILE_SCOPE("PhysicsWorld::overlap batch");
+    hits.resize(size_t(queries.size) * maxHitsPerQuery);
+    hitCounts.resize(queries.size);
+
+    std::lock_guard lock(m_worldMutex);
+
+    getTaskScheduler().parallelFor(0, queries.size, QueriesPerTask, [&](u32 begin, u32 end) {
+        for (u32 i = begin; i < end; i++) {
+            auto first = hits.data() + size_t(i) * maxHitsPerQuery;
+            hitCounts[i] = overlapSingle(queries.data[i], first, maxHitsPerQuery);
+        }
+    });
+}
+
+// The btCollisionWorld queries go through the broadphase's shared ray test stack, these
+// walk the broadphase trees directly with their own stacks so they can run on any thread
+RaycastHit PhysicsWorld::raycastSingle(const RayQuery& query) const
+{
+    btVector3 from, to;
+    from.set128(query.from.vec);
+    to.set128(query.to.vec);
+
+    btTransform fromTransform(btQuaternion::getIdentity(), from);
+    btTransform toTransform(btQuaternion::getIdentity(), to);
+
+    btCollisionWorld::ClosestRayResultCallback result(from, to);
+
+    LeafCollector collector([&](btBroadphaseProxy* proxy) {
+        if (!result.needsCollision(proxy)) {
+            return;
+        }
+
+        auto obj = static_cast<const btCollisionObject*>(proxy->m_clientObject);
+        btCollisionWorld::rayTestSingle(fromTransform, toTransform, const_cast<btCollisionObject*>(obj),
+            obj->getCollisionShape(), obj->getWorldTransform(), result);
+    });
+
+    auto broadphase = static_cast<const btDbvtBroadphase*>(m_overlappingPairCache.get());
+
+    for (const auto& tree : broadphase->m_sets) {
+        if (tree.m_root) {
+            btDbvt::rayTest(tree.m_root, from, to, collector);
+        }
+    }
+
+    return toRaycastHit(result, result.m_collisionObject);
+}
+
+RaycastHit PhysicsWorld::sweepSingle(const SweepQuery& query) const
+{
+    TempShape temp(query.shape);
+    auto shape = temp.get(query.shape);
+
+    auto fromTransform = makeTransform(query.shape, query.from);
+    auto toTransform = makeTransform(query.shape, query.to);
+
+    btCollisionWorld::ClosestConvexResultCallback result(fromTransform.getOrigin(), toTransform.getOrigin());
+
+    LeafCollector collector([&](btBroadphaseProxy* proxy) {
+        if (!result.needsCollision(proxy)) {
+            return;
+        }
+
+        auto obj = static_cast<const btCollisionObject*>(proxy->m_clientObject);
+        btCollisionWorld::objectQuerySingle(shape, fromTransform, toTransform, const_cast<btCollisionObject*>(obj),
+            obj->getCollisionShape(), obj->getWorldTransform(), result, 0.0f);
+    });
+
+    btVector3 fromMin, fromMax, toMin, toMax;
+    shape->getAabb(fromTransform, fromMin, fromMax);
+    shape->getAabb(toTransform, toMin, toMax);
+
+    fromMin.setMin(toMin);
+    fromMax.setMax(toMax);
+
+    auto volume = btDbvtVolume::FromMM(fromMin, fromMax);
+    auto broadphase = static_cast<const btDbvtBroadphase*>(m_overlappingPairCache.get());
+
+    for (const auto& tree : broadphase->m_sets) {
+        tree.collideTV(tree.m_root, volume, collector);
+    }
+
+    return toRaycastHit(result, result.m_hitCollisionObject);
+}
+
+u32 PhysicsWorld::overlapSingle(const OverlapQuery& query, entt::entity* hits, u32 maxHits) const
+{
+    TempShape temp(query.shape);
+    auto shape = temp.get(query.shape);
+    auto transform = makeTransform(query.shape, query.position);
+
+    u32 count = 0;
+
+    LeafCollector collector([&](btBroadphaseProxy* proxy) {
+        auto obj = static_cast<const btCollisionObject*>(proxy->m_clientObject);
+        auto entity = getEntity(obj);
+
+        // Overlaps are for finding entities, skip the static level geometry
+        if (entity == entt::null) {
+            return;
+        }
+
+        if (auto other = obj->getCollisionShape(); other->isConvex()) {
+            btGjkEpaSolver2::sResults results;
+
+            // Distance fails when the shapes intersect
+            if (btGjkEpaSolver2::Distance(shape, transform, static_cast<const btConvexShape*>(other),
+                obj->getWorldTransform(), btVector3(1.0f, 0.0f, 0.0f), results)) {
+                return;
+            }
+        }
+
+        if (count < maxHits) {
+            hits[count] = entity;
+        }
+
+        count++;
+    });
+
+    btVector3 aabbMin, aabbMax;
+    shape->getAabb(transform, aabbMin, aabbMax);
+
+    auto volume = btDbvtVolume::FromMM(aabbMin, aabbMax);
+    auto broadphase = static_cast<const btDbvtBroadphase*>(m_overlappingPairCache.get());
+
+    for (const auto& tree : broadphase->m_sets) {
+        tree.collideTV(tree.m_root, volume, collector);
+    }
+
+    return count;
+}
+
 void PhysicsDebugDraw::drawLine(const btVector3& from, const btVector3& to, const btVector3& color)
 {
     u32 c2 = 0x00'00'00'ff;
@@ -267,11 +929,16 @@ void PhysicsDebugDraw::drawLine(const btVector3& from, const btVector3& to, cons
     c2 |= (u32(color.y() * 255.0f) << 16);
     c2 |= (u32(color.z() * 255.0f) << 8);
 
-    Im3d::DrawLine(
-        Im3d::Vec3(from.x(), from.y(), from.z()),
-        Im3d::Vec3(to.x(), to.y(), to.z()),
-        2.0f, c2
-    );
+    m_lines.emplace_back(Im3d::Vec3(from.x(), from.y(), from.z()), 2.0f, c2);
+    m_lines.emplace_back(Im3d::Vec3(to.x(), to.y(), to.z()), 2.0f, c2);
+}
+
+void PhysicsDebugDraw::flushLines()
+{
+    if (!m_lines.empty()) {
+        getDebugDraw().addLines(m_lines);
+        m_lines.clear();
+    }
 }
 
 void PhysicsDebugDraw::drawContactPoint(const btVector3& PointOnB, const btVector3& normalOnB, btScalar distance, int lifeTime, const btVector3& color)
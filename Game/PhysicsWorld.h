@@ -1,6 +1,12 @@
 #pragma once
 
+#include "Common.h"
 #include "Math.h"
+#include "ArrayView.h"
+#include "Assets.h"
+#include "CollisionShapes.h"
+#include "DebugDraw.h"
+#include "Geometry.h"
 
 #include <vector>
 #include <memory>
@@ -8,6 +14,11 @@
 #include <entt/entt.hpp>
 #include <string_view>
 #include <string>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <thread>
 
 #include <unordered_map>
 
@@ -25,6 +36,11 @@ namespace components
         std::unique_ptr<btCollisionObject> collisionObject;
         std::unique_ptr<btMotionState> motionState;
         btCollisionShape* collisionShape = nullptr;
+
+        // The two latest physics states, Transform is interpolated between these
+        btTransform previousTransform = btTransform::getIdentity();
+        btTransform currentTransform = btTransform::getIdentity();
+        u64 lastStep = 0;
     };
 
     struct Collision
@@ -35,10 +51,22 @@ namespace components
 }
 
 // TODO: use Im3d for a lot of these
+struct PhysicsSettings
+{
+    // Use Bullet's multithreaded world, running on the engine task scheduler
+    bool multithreaded = false;
+
+    // Step from the frame deltas passed to advance() instead of a wall clock thread, so
+    // replaying the same deltas runs the same steps
+    bool lockstep = false;
+};
+
 class PhysicsDebugDraw : public btIDebugDraw
 {
 public:
+    // Lines are collected and handed to DebugDraw in one go by flushLines()
     virtual void drawLine(const btVector3& from, const btVector3& to, const btVector3& color) override;
+    virtual void flushLines() override;
     virtual void drawContactPoint(const btVector3& PointOnB, const btVector3& normalOnB,
         btScalar distance, int lifeTime, const btVector3& color) override;
 
@@ -49,6 +77,46 @@ public:
 
 private:
     int m_debugMode = 0;
+    std::vector<DebugDraw::Vertex> m_lines;
+};
+
+// Bullet only calls setWorldTransform for bodies that are active and moved during the
+// step, so queueing the motion state there gives a list of exactly the bodies whose
+// Transform component needs updating.
+class EntityMotionState : public btMotionState
+{
+public:
+    EntityMotionState(entt::entity entity, const btTransform& transform,
+        std::vector<EntityMotionState*>& dirtyList) :
+        m_entity(entity), m_transform(transform), m_dirtyList(dirtyList)
+    {
+    }
+
+    virtual void getWorldTransform(btTransform& worldTrans) const override
+    {
+        worldTrans = m_transform;
+    }
+
+    virtual void setWorldTransform(const btTransform& worldTrans) override
+    {
+        m_transform = worldTrans;
+        m_dirtyList.push_back(this);
+    }
+
+    entt::entity getEntity() const
+    {
+        return m_entity;
+    }
+
+    const btTransform& getTransform() const
+    {
+        return m_transform;
+    }
+
+private:
+    entt::entity m_entity;
+    btTransform m_transform;
+    std::vector<EntityMotionState*>& m_dirtyList;
 };
 
 struct RaycastHit
@@ -57,18 +125,79 @@ struct RaycastHit
     math::WorldVector normal;
     entt::entity entity = entt::null;
 
+    // Below 1 if anything was hit, including static geometry that has no entity
+    float fraction = 1.0f;
+
     explicit operator bool() const
     {
         return entity != entt::null;
     }
 };
 
+struct QueryShape
+{
+    enum class Type
+    {
+        Sphere,
+        Box,
+    };
+
+    Type type = Type::Sphere;
+
+    // Radius for spheres, half extents for boxes
+    DirectX::XMFLOAT3 size{ 0.5f, 0.5f, 0.5f };
+    DirectX::XMFLOAT4 rotation{ 0.0f, 0.0f, 0.0f, 1.0f };
+};
+
+struct RayQuery
+{
+    math::WorldVector from;
+    math::WorldVector to;
+};
+
+struct SweepQuery
+{
+    QueryShape shape;
+    math::WorldVector from;
+    math::WorldVector to;
+};
+
+struct OverlapQuery
+{
+    QueryShape shape;
+    math::WorldVector position;
+};
+
+// The simulation runs on its own thread at a fixed rate while started. Anything that
+// touches the Bullet world from the main thread has to go through enqueue(), the
+// commands are run on the physics thread between steps.
 class PhysicsWorld
 {
 public:
-    PhysicsWorld(struct Scene& scene);
+    static constexpr float FixedTimeStep = 1.0f / 60.0f;
+
+    using Command = std::function<void()>;
+
+    // Routes Bullet's allocations through the memory tracker, has to be called before
+    // anything in Bullet allocates
+    static void installAllocator();
+
+    PhysicsWorld(struct Scene& scene, const PhysicsSettings& settings = {});
     ~PhysicsWorld();
 
+    void start();
+    void stop();
+
+    bool isRunning() const
+    {
+        return m_running;
+    }
+
+    // Runs the command before the next step, or immediately if the simulation isn't running
+    void enqueue(Command command);
+
+    void setWorldTransform(btCollisionObject* obj, const btTransform& transform);
+
     void onCreatePhysicsComponent(entt::registry&, entt::entity);
     void onDestroyPhysicsComponent(entt::registry&, entt::entity);
 
@@ -78,31 +207,119 @@ public:
     void addBox(float hw, float hh, float hd, float mass, float x, float y, float z);
     void addSphere(float radius, float mass, float x, float y, float z);
 
-    btCollisionShape* createCollisionMesh(const std::string& name, const class Mesh& mesh);
-    btCollisionShape* getCollisionMesh(const std::string& name);
+    // Shapes are shared between everything using the same model at the same scale.
+    // Every acquireShape needs a matching releaseShape.
+    btCollisionShape* acquireShape(AssetId model, const DirectX::XMFLOAT3& scale);
+    void releaseShape(btCollisionShape* shape);
+
+    // Swaps the object's shape for the model at the given scale and releases the old one
+    void setShape(btCollisionObject* obj, btCollisionShape*& shape, AssetId model, const DirectX::XMFLOAT3& scale);
+
+    size_t getShapeCount() const
+    {
+        return m_shapes.size();
+    }
 
     void editorUpdate();
-    void update(float dt);
+
+    // Runs the fixed steps that fit into the accumulated time on the calling thread. Only
+    // does anything in lockstep mode while the simulation is running.
+    void advance(float dt);
+
+    // Runs queued commands and a single fixed step on the calling thread. Only for
+    // when the simulation thread isn't running, e.g. benchmarks.
+    void step();
+
+    // Applies the latest physics results to the Transform components, interpolated
+    // between the last two steps. Never waits for the physics thread.
+    void update();
 
     void setDebugDrawMode(int mode);
-    void render();
+    // Debug draws the objects touching the frustum
+    void render(const math::Frustum& frustum);
 
     RaycastHit raycast(math::WorldVector from, math::WorldVector to);
 
+    // Batched queries, run in parallel on the task scheduler. Results are written to the
+    // caller's arrays in query order, reusing them across frames avoids allocations.
+    // These wait for the current physics step to finish.
+    void raycast(ArrayView<RayQuery> queries, std::vector<RaycastHit>& hits);
+    void sweep(ArrayView<SweepQuery> queries, std::vector<RaycastHit>& hits);
+
+    // Entities overlapping each query go to hits[i * maxHitsPerQuery], up to maxHitsPerQuery
+    // of them. hitCounts[i] can be larger than that if some were dropped.
+    void overlap(ArrayView<OverlapQuery> queries, u32 maxHitsPerQuery,
+        std::vector<entt::entity>& hits, std::vector<u32>& hitCounts);
+
 private:
+    struct BodyState
+    {
+        entt::entity entity;
+        btTransform transform;
+    };
+
+    struct StepResult
+    {
+        u64 step;
+        std::chrono::steady_clock::time_point time;
+        std::vector<BodyState> bodies;
+    };
+
+    void physicsThread();
+
+    // None of these touch shared state, they're safe to run in parallel
+    RaycastHit raycastSingle(const RayQuery& query) const;
+    RaycastHit sweepSingle(const SweepQuery& query) const;
+    u32 overlapSingle(const OverlapQuery& query, entt::entity* hits, u32 maxHits) const;
+    void runCommands();
+    void applyStep(const StepResult& result);
+
+    // Bodies are in world space, Transform is relative to the parent if there is one
+    btTransform getWorldPose(entt::entity entity) const;
+
     struct Scene& m_scene;
 
     std::unique_ptr<btDefaultCollisionConfiguration> m_collisionConfiguration;
     std::unique_ptr<btCollisionDispatcher> m_dispatcher;
     std::unique_ptr<btBroadphaseInterface> m_overlappingPairCache;
-    std::unique_ptr<btSequentialImpulseConstraintSolver> m_solver;
+    std::unique_ptr<btConstraintSolver> m_solver;
+    std::unique_ptr<class btConstraintSolverPoolMt> m_solverPool;
     std::unique_ptr<btDiscreteDynamicsWorld> m_dynamicsWorld;
 
-    std::unordered_map<std::string, btCollisionShape*> m_collisionMeshes;
+    CollisionShapeRegistry m_shapes;
 
     std::vector<std::unique_ptr<btCollisionShape>> m_collisionShapes;
     std::vector<std::unique_ptr<btCollisionObject>> m_collisionObjects;
     std::vector<std::unique_ptr<btMotionState>> m_motionStates;
 
+    // Motion states that moved during the last step, filled in by Bullet
+    std::vector<EntityMotionState*> m_movedBodies;
+
+    std::thread m_thread;
+    std::atomic<bool> m_running = false;
+
+    // Held by the physics thread while stepping
+    std::mutex m_worldMutex;
+
+    std::mutex m_commandMutex;
+    std::vector<Command> m_commands;
+    std::vector<Command> m_runningCommands;
+
+    // Written by the physics thread, picked up by update()
+    std::mutex m_resultMutex;
+    std::vector<StepResult> m_results;
+
+    // Main thread only
+    std::vector<StepResult> m_appliedResults;
+    std::vector<entt::entity> m_interpolating;
+    std::vector<entt::entity> m_interpolatingNext;
+    std::chrono::steady_clock::time_point m_lastStepTime;
+
+    bool m_lockstep = false;
+    float m_lockstepTime = 0.0f;
+
+    // Physics thread only
+    u64 m_step = 0;
+
     PhysicsDebugDraw m_debugDraw;
 };
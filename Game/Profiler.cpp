@@ -0,0 +1,469 @@
+#include "Profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fmt/format.h>
+#include <fstream>
+#include <imgui.h>
+#include <limits>
+#include <optional>
+
+namespace
+{
+
+u64 clockNs()
+{
+    using namespace std::chrono;
+    return u64(duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count());
+}
+
+double toMs(u64 ns)
+{
+    return double(ns) / 1'000'000.0;
+}
+
+// Stable color per event name, names are literals so the pointer is good enough
+ImU32 nameColor(const char* name)
+{
+    auto h = u32(reinterpret_cast<uintptr_t>(name) * 2654435761u >> 8);
+    auto hue = float(h % 360) / 360.0f;
+
+    float r, g, b;
+    ImGui::ColorConvertHSVtoRGB(hue, 0.5f, 0.8f, r, g, b);
+
+    return ImGui::GetColorU32(ImVec4(r, g, b, 1.0f));
+}
+
+std::string escapeJson(std::string_view s)
+{
+    std::string result;
+    result.reserve(s.size());
+
+    for (auto c : s) {
+        if (c == '"' || c == '\\') {
+            result.push_back('\\');
+        }
+
+        result.push_back(c);
+    }
+
+    return result;
+}
+
+// Markers go on their own row in traces, after every thread
+constexpr u32 MarkerTid = ~0u;
+
+thread_local void* t_threadBuffer = nullptr;
+
+}
+
+Profiler& getProfiler()
+{
+    static Profiler profiler;
+    return profiler;
+}
+
+Profiler::Profiler() :
+    m_epoch(clockNs())
+{
+}
+
+u64 Profiler::now() const
+{
+    return clockNs() - m_epoch;
+}
+
+void Profiler::setThreadName(std::string_view name)
+{
+    auto& buffer = getThreadBuffer();
+
+    std::lock_guard lock(m_threadsMutex);
+
+    // A restarted thread (physics on every toggle) goes back to its old row
+    auto it = std::find_if(m_threads.begin(), m_threads.end(),
+        [&](const auto& t) { return !t->active && t->name == name; });
+
+    if (it == m_threads.end()) {
+        buffer.name = name;
+        return;
+    }
+
+    auto& named = **it;
+    named.active = true;
+    named.depth = buffer.depth;
+    buffer.active = false;
+
+    getThreadOwner().buffer = &named;
+    t_threadBuffer = &named;
+}
+
+void Profiler::beginFrame()
+{
+    auto time = now();
+
+    if (!isRecording()) {
+        m_frameStarted = false;
+        return;
+    }
+
+    if (m_frameStarted) {
+        m_frames[m_frameCount % FrameHistory] = Frame{ m_frameStart, time };
+        m_frameCount++;
+
+        // Freeze everything so the spike can be looked at before it's overwritten
+        if (m_pauseOnSpike && toMs(time - m_frameStart) > m_spikeThresholdMs) {
+            setRecording(false);
+            m_selectedFrame = 0;
+            m_frameStarted = false;
+            return;
+        }
+    }
+
+    m_frameStart = time;
+    m_frameStarted = true;
+}
+
+void Profiler::addMarker(const char* name, u64 start, u64 end)
+{
+    if (!isRecording()) {
+        return;
+    }
+
+    m_markers[m_markerCount % MarkerHistory] = Event{ name, start, end, 0 };
+    m_markerCount++;
+}
+
+u32 Profiler::enter()
+{
+    return getThreadBuffer().depth++;
+}
+
+void Profiler::leave(const char* name, u64 start, u32 depth)
+{
+    auto& buffer = getThreadBuffer();
+    buffer.depth = depth;
+
+    // Only this thread writes, readers check `written` again after copying to throw
+    // away anything that got overwritten in the meantime
+    auto idx = buffer.written.load(std::memory_order_relaxed);
+    auto& slot = buffer.events[idx % RingSize];
+
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.start.store(start, std::memory_order_relaxed);
+    slot.end.store(now(), std::memory_order_relaxed);
+    slot.depth.store(depth, std::memory_order_relaxed);
+
+    buffer.written.store(idx + 1, std::memory_order_release);
+}
+
+Profiler::ThreadBuffer& Profiler::getThreadBuffer()
+{
+    if (!t_threadBuffer) {
+        std::lock_guard lock(m_threadsMutex);
+
+        // Reuse the ring of a thread that exited, otherwise every short lived thread
+        // would keep another MB around
+        auto it = std::find_if(m_threads.begin(), m_threads.end(), [](const auto& t) { return !t->active; });
+        auto buffer = it != m_threads.end() ? it->get() : m_threads.emplace_back(std::make_unique<ThreadBuffer>()).get();
+
+        if (buffer->id == 0) {
+            buffer->id = u32(m_threads.size());
+        }
+
+        buffer->name = fmt::format("Thread {}", buffer->id);
+        buffer->depth = 0;
+        buffer->active = true;
+
+        getThreadOwner().buffer = buffer;
+        t_threadBuffer = buffer;
+    }
+
+    return *static_cast<ThreadBuffer*>(t_threadBuffer);
+}
+
+Profiler::ThreadOwner& Profiler::getThreadOwner()
+{
+    thread_local ThreadOwner owner;
+    return owner;
+}
+
+Profiler::ThreadOwner::~ThreadOwner()
+{
+    if (buffer) {
+        auto& profiler = getProfiler();
+
+        std::lock_guard lock(profiler.m_threadsMutex);
+        buffer->active = false;
+    }
+}
+
+void Profiler::collect(u64 from, u64 to, std::vector<CollectedEvent>& out)
+{
+    std::vector<const ThreadBuffer*> threads;
+    {
+        std::lock_guard lock(m_threadsMutex);
+
+        for (const auto& t : m_threads) {
+            threads.push_back(t.get());
+        }
+    }
+
+    for (auto thread : threads) {
+        auto first = out.size();
+
+        auto end = thread->written.load(std::memory_order_acquire);
+        auto begin = end > RingSize ? end - RingSize : 0;
+
+        for (auto i = begin; i < end; i++) {
+            const auto& slot = thread->events[i % RingSize];
+
+            Event e{
+                slot.name.load(std::memory_order_relaxed),
+                slot.start.load(std::memory_order_relaxed),
+                slot.end.load(std::memory_order_relaxed),
+                slot.depth.load(std::memory_order_relaxed),
+            };
+
+            if (e.end > from && e.start < to) {
+                out.push_back(CollectedEvent{ thread, e, i });
+            }
+        }
+
+        // Anything the writer got to while we were copying may be torn, those are the
+        // oldest slots so it's a prefix of what was just added
+        std::atomic_thread_fence(std::memory_order_acquire);
+        auto written = thread->written.load(std::memory_order_relaxed);
+        auto validFrom = written >= RingSize ? written - RingSize + 1 : 0;
+
+        auto valid = std::find_if(out.begin() + first, out.end(),
+            [&](const CollectedEvent& e) { return e.index >= validFrom; });
+
+        out.erase(out.begin() + first, valid);
+    }
+}
+
+void Profiler::exportChromeTrace(const std::filesystem::path& path)
+{
+    std::vector<CollectedEvent> events;
+    collect(0, std::numeric_limits<u64>::max(), events);
+
+    std::ofstream output(path);
+
+    if (!output) {
+        m_exportStatus = fmt::format("Couldn't open {}", path.generic_string());
+        return;
+    }
+
+    output << "{\"traceEvents\":[\n";
+
+    // Thread names first so the viewer labels the rows
+    output << R"({"name":"thread_name","ph":"M","pid":0,"tid":0,"args":{"name":"Frames"}})";
+    output << fmt::format(",\n{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":{},\"args\":{{\"name\":\"Markers\"}}}}", MarkerTid);
+
+    {
+        std::lock_guard lock(m_threadsMutex);
+
+        for (const auto& t : m_threads) {
+            output << fmt::format(",\n{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":{},\"args\":{{\"name\":\"{}\"}}}}",
+                t->id, escapeJson(t->name));
+        }
+    }
+
+    auto frames = std::min<u64>(m_frameCount, FrameHistory);
+
+    for (u64 i = m_frameCount - frames; i < m_frameCount; i++) {
+        const auto& f = m_frames[i % FrameHistory];
+        output << fmt::format(",\n{{\"name\":\"Frame {}\",\"ph\":\"X\",\"pid\":0,\"tid\":0,\"ts\":{:.3f},\"dur\":{:.3f}}}",
+            i, double(f.start) / 1000.0, double(f.end - f.start) / 1000.0);
+    }
+
+    auto markers = std::min<u64>(m_markerCount, MarkerHistory);
+
+    for (u64 i = m_markerCount - markers; i < m_markerCount; i++) {
+        const auto& m = m_markers[i % MarkerHistory];
+        output << fmt::format(",\n{{\"name\":\"{}\",\"ph\":\"X\",\"pid\":0,\"tid\":{},\"ts\":{:.3f},\"dur\":{:.3f}}}",
+            escapeJson(m.name), MarkerTid, double(m.start) / 1000.0, double(m.end - m.start) / 1000.0);
+    }
+
+    for (const auto& [thread, e, _] : events) {
+        output << fmt::format(",\n{{\"name\":\"{}\",\"ph\":\"X\",\"pid\":0,\"tid\":{},\"ts\":{:.3f},\"dur\":{:.3f}}}",
+            escapeJson(e.name), thread->id, double(e.start) / 1000.0, double(e.end - e.start) / 1000.0);
+    }
+
+    output << "\n]}\n";
+
+    m_exportStatus = fmt::format("Wrote {} events to {}", events.size(), path.generic_string());
+}
+
+void Profiler::drawWindow(bool* open)
+{
+    if (!ImGui::Begin("Profiler", open)) {
+        ImGui::End();
+        return;
+    }
+
+    bool recording = isRecording();
+    if (ImGui::Checkbox("Recording", &recording)) {
+        setRecording(recording);
+    }
+
+    ImGui::SameLine();
+    ImGui::Checkbox("Pause on spike over", &m_pauseOnSpike);
+    ImGui::SameLine();
+    ImGui::SetNextItemWidth(80.0f);
+    ImGui::DragFloat("ms", &m_spikeThresholdMs, 0.1f, 1.0f, 1000.0f, "%.1f");
+
+    auto count = int(std::min<u64>(m_frameCount, FrameHistory));
+
+    if (count == 0) {
+        ImGui::TextUnformatted("No frames recorded");
+        ImGui::End();
+        return;
+    }
+
+    // Oldest first for the graph, the slider counts back from the latest frame
+    auto frameAt = [&](int age) -> const Frame& {
+        return m_frames[(m_frameCount - 1 - u64(age)) % FrameHistory];
+    };
+
+    std::array<float, FrameHistory> times;
+    float maxTime = 0.0f;
+    int worst = 0;
+
+    for (int age = 0; age < count; age++) {
+        const auto& f = frameAt(age);
+        auto ms = float(toMs(f.end - f.start));
+
+        times[count - 1 - age] = ms;
+
+        if (ms > maxTime) {
+            maxTime = ms;
+            worst = age;
+        }
+    }
+
+    ImGui::PlotHistogram("##frames", times.data(), count, 0, nullptr, 0.0f, maxTime, ImVec2(-1.0f, 60.0f));
+
+    m_selectedFrame = std::clamp(m_selectedFrame, 0, count - 1);
+
+    ImGui::SetNextItemWidth(200.0f);
+    ImGui::SliderInt("Frames ago", &m_selectedFrame, 0, count - 1);
+    ImGui::SameLine();
+
+    if (ImGui::Button("Worst")) {
+        m_selectedFrame = worst;
+    }
+
+    ImGui::SameLine();
+
+    if (ImGui::Button("Export Chrome trace")) {
+        exportChromeTrace("profile.json");
+    }
+
+    if (!m_exportStatus.empty()) {
+        ImGui::SameLine();
+        ImGui::TextUnformatted(m_exportStatus.c_str());
+    }
+
+    const auto& frame = frameAt(m_selectedFrame);
+    ImGui::Text("Frame: %.3f ms", toMs(frame.end - frame.start));
+
+    drawTimeline(frame);
+
+    ImGui::End();
+}
+
+void Profiler::drawTimeline(const Frame& frame)
+{
+    m_collected.clear();
+    collect(frame.start, frame.end, m_collected);
+
+    if (m_collected.empty()) {
+        ImGui::TextUnformatted("No events left for this frame");
+        return;
+    }
+
+    std::sort(m_collected.begin(), m_collected.end(), [](const CollectedEvent& a, const CollectedEvent& b) {
+        return a.thread->id != b.thread->id ? a.thread->id < b.thread->id : a.event.start < b.event.start;
+    });
+
+    ImGui::BeginChild("timeline", ImVec2(0.0f, 0.0f), false, ImGuiWindowFlags_HorizontalScrollbar);
+
+    auto drawList = ImGui::GetWindowDrawList();
+    auto width = std::max(ImGui::GetContentRegionAvail().x, 100.0f);
+    auto rowHeight = ImGui::GetTextLineHeightWithSpacing();
+    auto scale = double(width) / double(std::max<u64>(frame.end - frame.start, 1));
+
+    auto drawEvent = [&](const Event& e, ImVec2 origin) {
+        auto start = e.start > frame.start ? double(e.start - frame.start) : 0.0;
+        auto end = double(std::min(e.end, frame.end) - frame.start);
+
+        ImVec2 min(origin.x + float(start * scale), origin.y + float(e.depth) * rowHeight);
+        ImVec2 max(std::max(origin.x + float(end * scale), min.x + 1.0f), min.y + rowHeight - 1.0f);
+
+        drawList->AddRectFilled(min, max, nameColor(e.name));
+
+        if (max.x - min.x > ImGui::CalcTextSize(e.name).x + 4.0f) {
+            drawList->PushClipRect(min, max, true);
+            drawList->AddText(ImVec2(min.x + 2.0f, min.y), IM_COL32_BLACK, e.name);
+            drawList->PopClipRect();
+        }
+
+        if (ImGui::IsMouseHoveringRect(min, max)) {
+            ImGui::SetTooltip("%s\n%.3f ms", e.name, toMs(e.end - e.start));
+        }
+    };
+
+    // Only shown when one overlaps the frame
+    auto markers = std::min<u64>(m_markerCount, MarkerHistory);
+    std::optional<ImVec2> markerOrigin;
+
+    for (u64 i = m_markerCount - markers; i < m_markerCount; i++) {
+        const auto& m = m_markers[i % MarkerHistory];
+
+        if (m.end <= frame.start || m.start >= frame.end) {
+            continue;
+        }
+
+        if (!markerOrigin) {
+            ImGui::TextUnformatted("Markers");
+            markerOrigin = ImGui::GetCursorScreenPos();
+        }
+
+        drawEvent(m, *markerOrigin);
+    }
+
+    if (markerOrigin) {
+        ImGui::Dummy(ImVec2(width, rowHeight));
+    }
+
+    for (size_t first = 0; first < m_collected.size();) {
+        auto thread = m_collected[first].thread;
+
+        auto last = first;
+        u32 maxDepth = 0;
+
+        while (last < m_collected.size() && m_collected[last].thread == thread) {
+            maxDepth = std::max(maxDepth, m_collected[last].event.depth);
+            last++;
+        }
+
+        {
+            // setThreadName can rename it at any time
+            std::lock_guard lock(m_threadsMutex);
+            ImGui::TextUnformatted(thread->name.c_str());
+        }
+
+        auto origin = ImGui::GetCursorScreenPos();
+
+        for (auto i = first; i < last; i++) {
+            drawEvent(m_collected[i].event, origin);
+        }
+
+        ImGui::Dummy(ImVec2(width, float(maxDepth + 1) * rowHeight));
+
+        first = last;
+    }
+
+    ImGui::EndChild();
+}
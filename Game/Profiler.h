@@ -0,0 +1,183 @@
+#pragma once
+
+#include "Common.h"
+
+#include <array>
+#include <atomic>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Scoped CPU profiler. Every thread records into its own ring buffer, so recording an
+// event is two clock reads and a store with no locking. Old events are overwritten,
+// the UI and the trace export look at whatever is still in the rings.
+//
+// Event names aren't copied, they have to be string literals or otherwise live forever.
+class Profiler
+{
+public:
+    struct Event
+    {
+        const char* name = nullptr;
+        u64 start = 0;
+        u64 end = 0;
+        u32 depth = 0;
+    };
+
+    // Per thread, a bit over 1 MB each
+    static constexpr u32 RingSize = 1 << 15;
+    static constexpr u32 FrameHistory = 512;
+    static constexpr u32 MarkerHistory = 64;
+
+    Profiler();
+
+    // Nanoseconds since the profiler was created
+    u64 now() const;
+
+    // Names the calling thread in the UI and traces
+    void setThreadName(std::string_view name);
+
+    // Marks the end of the previous frame and the start of a new one
+    void beginFrame();
+
+    // A span on a row of its own, for things like frames that took too long. Only from
+    // the thread calling beginFrame(), the name has to be a literal like event names.
+    void addMarker(const char* name, u64 start, u64 end);
+
+    bool isRecording() const
+    {
+        return m_recording.load(std::memory_order_relaxed);
+    }
+
+    void setRecording(bool recording)
+    {
+        m_recording.store(recording, std::memory_order_relaxed);
+    }
+
+    // Chrome trace event JSON, opens in chrome://tracing or ui.perfetto.dev
+    void exportChromeTrace(const std::filesystem::path& path);
+
+    void drawWindow(bool* open);
+
+    // Used by ProfileScope
+    u32 enter();
+    void leave(const char* name, u64 start, u32 depth);
+
+private:
+    // Slots are atomics so reading one while it's overwritten is only stale, not a
+    // data race. Relaxed stores are plain moves on x86.
+    struct Slot
+    {
+        std::atomic<const char*> name = nullptr;
+        std::atomic<u64> start = 0;
+        std::atomic<u64> end = 0;
+        std::atomic<u32> depth = 0;
+    };
+
+    struct ThreadBuffer
+    {
+        std::string name;
+        u32 id = 0;
+        u32 depth = 0;
+
+        // False once the thread exits, the next new thread takes the buffer over
+        bool active = false;
+
+        std::atomic<u64> written = 0;
+        std::array<Slot, RingSize> events;
+    };
+
+    struct Frame
+    {
+        u64 start = 0;
+        u64 end = 0;
+    };
+
+    struct CollectedEvent
+    {
+        const ThreadBuffer* thread;
+        Event event;
+
+        // Position in the thread's ring
+        u64 index;
+    };
+
+    // Hands the buffer back when its thread exits
+    struct ThreadOwner
+    {
+        ThreadBuffer* buffer = nullptr;
+
+        ~ThreadOwner();
+    };
+
+    ThreadBuffer& getThreadBuffer();
+    static ThreadOwner& getThreadOwner();
+
+    // Copies the events overlapping [from, to) that are still in the rings
+    void collect(u64 from, u64 to, std::vector<CollectedEvent>& out);
+
+    void drawTimeline(const Frame& frame);
+
+    u64 m_epoch = 0;
+    std::atomic<bool> m_recording = true;
+
+    std::mutex m_threadsMutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> m_threads;
+
+    // Only touched by the thread calling beginFrame()
+    std::array<Frame, FrameHistory> m_frames;
+    u64 m_frameCount = 0;
+    u64 m_frameStart = 0;
+    bool m_frameStarted = false;
+    std::array<Event, MarkerHistory> m_markers;
+    u64 m_markerCount = 0;
+
+    // UI state
+    std::vector<CollectedEvent> m_collected;
+    int m_selectedFrame = 0;
+    bool m_pauseOnSpike = false;
+    float m_spikeThresholdMs = 33.0f;
+    std::string m_exportStatus;
+};
+
+Profiler& getProfiler();
+
+class ProfileScope
+{
+public:
+    explicit ProfileScope(const char* name) :
+        m_name(name)
+    {
+        auto& profiler = getProfiler();
+
+        if (profiler.isRecording()) {
+            m_depth = profiler.enter();
+            m_start = profiler.now();
+        } else {
+            m_name = nullptr;
+        }
+    }
+
+    ~ProfileScope()
+    {
+        if (m_name) {
+            getProfiler().leave(m_name, m_start, m_depth);
+        }
+    }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+    const char* m_name;
+    u64 m_start = 0;
+    u32 m_depth = 0;
+};
+
+#define PROFILE_TOKENPASTE2(a, b) a##b
+#define PROFILE_TOKENPASTE(a, b) PROFILE_TOKENPASTE2(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_TOKENPASTE(_profileScope_, __COUNTER__)(name)
+#define PROFILE_FUNC() PROFILE_SCOPE(__func__)
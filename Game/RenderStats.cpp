@@ -0,0 +1,105 @@
+#include "pch.h"
+
+#include "RenderStats.h"
+
+#include <algorithm>
+#include <imgui.h>
+
+namespace
+{
+
+// The counters in the order they're listed in the window
+constexpr std::array<std::pair<const char*, u64 RenderCounters::*>, 8> Counters{ {
+    { "Draw calls", &RenderCounters::drawCalls },
+    { "Dispatches", &RenderCounters::dispatches },
+    { "Instances", &RenderCounters::instances },
+    { "Triangles", &RenderCounters::triangles },
+    { "State changes", &RenderCounters::stateChanges },
+    { "Bytes uploaded", &RenderCounters::bytesUploaded },
+    { "Resources created", &RenderCounters::resourcesCreated },
+    { "Resources evicted", &RenderCounters::resourcesEvicted },
+} };
+
+}
+
+RenderStats& getRenderStats()
+{
+    static RenderStats stats;
+    return stats;
+}
+
+void RenderStats::endFrame()
+{
+    for (auto [name, counter] : Counters) {
+        m_total.*counter += m_current.*counter;
+    }
+
+    m_history[m_frameCount % History] = m_current;
+    m_frameCount++;
+
+    m_current = RenderCounters{};
+}
+
+RenderCounters RenderStats::getAverage() const
+{
+    RenderCounters average;
+
+    auto count = std::min<u64>(m_frameCount, History);
+
+    if (count == 0) {
+        return average;
+    }
+
+    for (u64 i = 0; i < count; i++) {
+        for (auto [name, counter] : Counters) {
+            average.*counter += m_history[i].*counter;
+        }
+    }
+
+    for (auto [name, counter] : Counters) {
+        average.*counter /= count;
+    }
+
+    return average;
+}
+
+void RenderStats::drawWindow(bool* open)
+{
+    ImGui::SetNextWindowBgAlpha(0.8f);
+
+    if (!ImGui::Begin("Render stats", open, ImGuiWindowFlags_AlwaysAutoResize)) {
+        ImGui::End();
+        return;
+    }
+
+    auto count = int(std::min<u64>(m_frameCount, History));
+    auto oldest = m_frameCount - u64(count);
+
+    const auto& last = getLastFrame();
+    auto average = getAverage();
+
+    std::array<float, History> values;
+
+    for (auto [name, counter] : Counters) {
+        float maxValue = 0.0f;
+
+        for (int i = 0; i < count; i++) {
+            values[i] = float(m_history[(oldest + u64(i)) % History].*counter);
+            maxValue = std::max(maxValue, values[i]);
+        }
+
+        ImGui::Text("%-18s %10llu  avg %10llu  max %10.0f", name,
+            static_cast<unsigned long long>(last.*counter),
+            static_cast<unsigned long long>(average.*counter),
+            maxValue);
+
+        ImGui::PushID(name);
+        ImGui::PlotLines("", values.data(), count, 0, nullptr, 0.0f, std::max(maxValue, 1.0f), ImVec2(400.0f, 30.0f));
+        ImGui::PopID();
+    }
+
+    ImGui::Text("Resources created since startup: %llu", static_cast<unsigned long long>(m_total.resourcesCreated));
+    ImGui::Text("Resources evicted since startup: %llu", static_cast<unsigned long long>(m_total.resourcesEvicted));
+
+    ImGui::End();
+}
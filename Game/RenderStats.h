@@ -0,0 +1,95 @@
+#pragma once
+
+#include "Common.h"
+
+#include <array>
+
+// What a frame submitted to the GPU
+struct RenderCounters
+{
+    u64 drawCalls = 0;
+    u64 dispatches = 0;
+    u64 instances = 0;
+    u64 triangles = 0;
+    u64 stateChanges = 0;
+    u64 bytesUploaded = 0;
+    u64 resourcesCreated = 0;
+    u64 resourcesEvicted = 0;
+};
+
+// Counters maintained by the renderer and RenderContext. Recording happens on the render
+// thread only, so they're plain integers. Resource creation is counted too because an
+// allocation in the middle of a frame is usually the cause of a hitch.
+class RenderStats
+{
+public:
+    static constexpr u32 History = 240;
+
+    void addDraw(u32 vertexCount, u32 instanceCount, bool triangleList)
+    {
+        m_current.drawCalls++;
+        m_current.instances += instanceCount;
+
+        if (triangleList) {
+            m_current.triangles += u64(vertexCount / 3) * instanceCount;
+        }
+    }
+
+    void addDispatch()
+    {
+        m_current.dispatches++;
+    }
+
+    void addStateChanges(u32 count)
+    {
+        m_current.stateChanges += count;
+    }
+
+    void addUpload(u64 bytes)
+    {
+        m_current.bytesUploaded += bytes;
+    }
+
+    void addResource()
+    {
+        m_current.resourcesCreated++;
+    }
+
+    void addEviction()
+    {
+        m_current.resourcesEvicted++;
+    }
+
+    // Called after present, moves the current counters into the history
+    void endFrame();
+
+    const RenderCounters& getLastFrame() const
+    {
+        return m_history[(m_frameCount + History - 1) % History];
+    }
+
+    // Mean over the history, or fewer frames if not that many have been rendered
+    RenderCounters getAverage() const;
+
+    // Everything since startup, including loading
+    const RenderCounters& getTotal() const
+    {
+        return m_total;
+    }
+
+    u64 getFrameCount() const
+    {
+        return m_frameCount;
+    }
+
+    void drawWindow(bool* open);
+
+private:
+    RenderCounters m_current;
+    RenderCounters m_total;
+
+    std::array<RenderCounters, History> m_history{};
+    u64 m_frameCount = 0;
+};
+
+RenderStats& getRenderStats();
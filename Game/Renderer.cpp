@@ -12,6 +12,11 @@
 #include "Shader.h"
 #include "stb_image.h"
 #include "Mesh.h"
+#include "DebugDraw.h"
+#include "Profiler.h"
+#include "RenderStats.h"
+#include "TextureAtlas.h"
+#include "HandlePool.h"
 
 #include "Rendering/RenderContext.h"
 
@@ -26,6 +31,7 @@
 #include <d3dcompiler.h>
 #include <wrl.h>
 #include <stdexcept>
+#include <future>
 #include <array>
 #include <dxgi.h>
 #include <string_view>
@@ -36,15 +42,36 @@
 
 static constexpr auto NUM_BLUR_PASSES = 5;
 
+// Read with raw loads in VertexHelpers.hlsli
+static_assert(sizeof(RenderableConstants) == 48, "RenderableConstants has to match INSTANCE_STRIDE");
+
 class Renderable
 {
 public:
+    // Mesh::SubMesh with the material resolved when the renderable is created
+    struct SubMesh
+    {
+        u32 baseVertex = 0;
+        u32 baseIndex = 0;
+        u32 numIndices = 0;
+        u16 material = 0;
+    };
+
     VertexBuffer<Vertex> m_vertexBuffer;
     ComPtr<ID3D11ShaderResourceView> m_vbSRV;
     IndexBuffer<u16> m_indexBuffer;
     ConstantBuffer<RenderableConstants> m_constantBuffer;
-    std::vector<Mesh::SubMesh> m_submeshes;
+    std::vector<SubMesh> m_submeshes;
     std::string m_name;
+
+    // The mesh to load the buffers from after they were evicted, empty if they can't be
+    std::filesystem::path m_source;
+    u64 m_bytes = 0;
+    u64 m_lastUsedFrame = 0;
+    bool m_resident = false;
+
+    // Loading on a worker thread while evicted, the buffers get created in endFrame()
+    std::future<Mesh> m_reload;
 };
 
 CB_STRUCT LuminanceHistogramConstants
@@ -63,17 +90,25 @@ struct Texture
     ComPtr<ID3D11ShaderResourceView> srv;
 };
 
+struct Material
+{
+    std::string name;
+    Texture diffuse;
+};
+
 class Renderer : public IRenderer
 {
 public:
     Renderer(SDL_Window* window);
 
-    virtual Renderable* createRenderable(std::string_view name, ArrayView<Vertex> vertices, ArrayView<u16> indices) override;
-    virtual Renderable* createRenderable(const class Mesh&) override;
+    virtual RenderableHandle createRenderable(std::string_view name, ArrayView<Vertex> vertices, ArrayView<u16> indices) override;
+    virtual RenderableHandle createRenderable(const class Mesh&, const std::filesystem::path& source) override;
+    virtual void releaseRenderable(RenderableHandle) override;
+    virtual void setRenderableBudget(u64 bytes) override;
 
     virtual void setDirectionalLight(const XMFLOAT3& pos, const XMFLOAT3& color, float intensity) override;
     virtual void setPointLights(ArrayView<PointLight> lights) override;
-    virtual void drawIm3d(const Camera&, ArrayView<Im3d::DrawList>) override;
+    virtual void drawIm3d(const Camera&, ArrayView<Im3d::DrawList>, const DebugDraw&) override;
     virtual void clear(float r, float g, float b) override;
 
     virtual void postProcess(const PostProcessParams&) override;
@@ -92,6 +127,18 @@ public:
 private:
     void loadShaders();
 
+    void uploadBuffers(Renderable& renderable, std::string_view name, ArrayView<Vertex> vertices, ArrayView<u16> indices);
+
+    // Null for stale handles and evicted renderables, those start loading in the background.
+    // Marks the renderable as used this frame.
+    Renderable* acquire(RenderableHandle handle);
+
+    // Creates the buffers of the reloads that are done, without waiting on the rest
+    void finishReloads();
+
+    // Least recently drawn first, never the ones drawn this frame
+    void evictRenderables();
+
     std::unique_ptr<RenderContext> m_renderContext;
 
     ID3D11ShaderResourceView* computeBloom();
@@ -105,7 +152,10 @@ private:
     UINT m_shadowWidth = 1024;
     UINT m_shadowHeight = 1024;
 
-    std::vector<std::unique_ptr<Renderable>> m_renderables;
+    HandlePool<Renderable, RenderableHandle> m_renderables;
+    u64 m_renderableBudget = 256ull << 20;
+    u64 m_frame = 1;
+    std::vector<RenderableHandle> m_reloading;
 
     ComPtr<IDXGISwapChain1> m_swapChain;
 
@@ -125,6 +175,9 @@ private:
     ComPtr<ID3D11VertexShader> m_im3dTriangleVS;
     ComPtr<ID3D11PixelShader> m_im3dTrianglePS;
     VertexBuffer<Im3d::VertexData> m_im3dVertexBuffer;
+    std::vector<Im3d::VertexData> m_im3dVertices;
+    VertexBuffer<Im3d::VertexData> m_debugStaticBuffer;
+    u64 m_debugStaticVersion = 0;
     ComPtr<ID3D11RasterizerState> m_im3dRasterizerState;
     ComPtr<ID3D11BlendState> m_im3dBlendState;
     ComPtr<ID3D11DepthStencilState> m_im3dDepthStencilState;
@@ -157,8 +210,13 @@ private:
         ConstantBuffer<GaussianConstants> constants;
     } m_blur;
 
-    //std::vector<Texture> m_textures;
-    std::unordered_map<std::string, Texture> m_textures;
+    // Indexed by Renderable::SubMesh::material. 0 is the default material, the names are
+    // only looked up when a renderable is created.
+    std::vector<Material> m_materials{ Material{ "default" } };
+    std::unordered_map<std::string, u16> m_materialIds;
+
+    u16 addMaterial(std::string_view name, const Texture& diffuse);
+    u16 getMaterialId(const std::string& name) const;
 
     ComPtr<ID3D11SamplerState> m_testTextureSampler;
 
@@ -407,39 +465,70 @@ Renderer::Renderer(SDL_Window* window)
             0.0f, 0, D3D11_COMPARISON_NEVER, nullptr, 0.0f, D3D11_FLOAT32_MAX);
         SET_OBJECT_NAME(m_testTextureSampler);
 
-        auto loadTexture = [&](const char* path) {
-            int w = 0, h = 0, c = 0;
+        // 0 mip levels is the full chain
+        auto createTexture = [&](const u8* pixels, u32 w, u32 h, u32 mipLevels) {
             Texture t;
 
-            if (auto pixels = stbi_load(path, &w, &h, &c, 4)) {
-                D3D11_SUBRESOURCE_DATA sd = {};
-                sd.pSysMem = pixels;
-                sd.SysMemPitch = w * 4;
+            auto format = DXGI_FORMAT_R8G8B8A8_UNORM_SRGB;
 
-                auto format = DXGI_FORMAT_R8G8B8A8_UNORM_SRGB;
+            CD3D11_TEXTURE2D_DESC td(format, UINT(w), UINT(h), 1, mipLevels, D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE);
+            td.MiscFlags |= D3D11_RESOURCE_MISC_GENERATE_MIPS;
 
-                CD3D11_TEXTURE2D_DESC td(format, UINT(w), UINT(h), 1, 0, D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE);
-                td.MiscFlags |= D3D11_RESOURCE_MISC_GENERATE_MIPS;
+            Hresult hr = m_device->CreateTexture2D(&td, nullptr, &t.texture);
+            hr = m_device->CreateShaderResourceView(t.texture.Get(),
+                &CD3D11_SHADER_RESOURCE_VIEW_DESC(t.texture.Get(), D3D11_SRV_DIMENSION_TEXTURE2D), &t.srv);
+            m_context->UpdateSubresource(t.texture.Get(), 0, nullptr, pixels, w * 4, 0);
+            m_context->GenerateMips(t.srv.Get());
+
+            t.texture->GetDesc(&td);
+            trackGpuMemory(t.texture.Get(), MemoryTag::GpuTextures, estimateTextureSize(td));
+
+            auto& stats = getRenderStats();
+            stats.addResource();
+            stats.addResource();
+            stats.addUpload(u64(w) * u64(h) * 4);
+
+            return t;
+        };
 
+        auto loadTexture = [&](const char* path) {
+            int w = 0, h = 0, c = 0;
+            Texture t;
+
+            if (auto pixels = stbi_load(path, &w, &h, &c, 4)) {
                 try {
-                    //Hresult hr = m_device->CreateTexture2D(&td, &sd, &t.texture);
-                    Hresult hr = m_device->CreateTexture2D(&td, nullptr, &t.texture);
-                    hr = m_device->CreateShaderResourceView(t.texture.Get(),
-                        &CD3D11_SHADER_RESOURCE_VIEW_DESC(t.texture.Get(), D3D11_SRV_DIMENSION_TEXTURE2D), &t.srv);
-                    m_context->UpdateSubresource(t.texture.Get(), 0, nullptr, pixels, w * 4, 0);
-                    m_context->GenerateMips(t.srv.Get());
+                    t = createTexture(pixels, u32(w), u32(h), 0);
                 } catch (const std::runtime_error&) {
                     stbi_image_free(pixels);
                     throw;
                 }
+
+                stbi_image_free(pixels);
             }
 
             return t;
         };
 
-        m_textures["grass"] = loadTexture("content/aerial_grass_rock_diff_1k.png");
-        m_textures["dirt"] = loadTexture("content/rock_04_diff_1k.png");
-        m_textures["dirtDark"] = m_textures["dirt"];
+        addMaterial("grass", loadTexture("content/aerial_grass_rock_diff_1k.png"));
+        m_materialIds["dirtDark"] = addMaterial("dirt", loadTexture("content/rock_04_diff_1k.png"));
+
+        // Every page is a material of its own, converted meshes already point at them
+        if (std::filesystem::exists("content")) {
+            for (const auto& file : std::filesystem::directory_iterator("content")) {
+                if (file.path().extension() != ".atlas") {
+                    continue;
+                }
+
+                TextureAtlas atlas;
+                atlas.load(file.path());
+
+                for (u32 i = 0; i < atlas.getPages().size(); i++) {
+                    const auto& page = atlas.getPages()[i];
+                    addMaterial(atlas.getPageName(i), createTexture(page.pixels.data(), page.width, page.height,
+                        TextureAtlas::MipLevels));
+                }
+            }
+        }
     }
 
     {
@@ -447,52 +536,204 @@ Renderer::Renderer(SDL_Window* window)
     }
 }
 
-Renderable* Renderer::createRenderable(std::string_view name, ArrayView<Vertex> vertices, ArrayView<u16> indices)
+void Renderer::uploadBuffers(Renderable& renderable, std::string_view name, ArrayView<Vertex> vertices, ArrayView<u16> indices)
 {
-    auto renderable = std::make_unique<Renderable>();
-    
-    renderable->m_vertexBuffer.init(m_device, vertices);
+    renderable.m_vertexBuffer.init(m_device, vertices);
 
-    const auto sizeU32 = (renderable->m_vertexBuffer.getSize() * sizeof(Vertex)) / 4;
+    const auto sizeU32 = (renderable.m_vertexBuffer.getSize() * sizeof(Vertex)) / 4;
 
-    renderable->m_vbSRV = createShaderResourceView(m_device, renderable->m_vertexBuffer.getBuffer(),
-        renderable->m_vertexBuffer.getBuffer(), DXGI_FORMAT_R32_TYPELESS, 0, sizeU32, D3D11_BUFFEREX_SRV_FLAG_RAW);
-    renderable->m_indexBuffer.init(m_device, indices);
-    renderable->m_constantBuffer.init(m_device);
+    renderable.m_vbSRV = createShaderResourceView(m_device, renderable.m_vertexBuffer.getBuffer(),
+        renderable.m_vertexBuffer.getBuffer(), DXGI_FORMAT_R32_TYPELESS, 0, sizeU32, D3D11_BUFFEREX_SRV_FLAG_RAW);
+    renderable.m_indexBuffer.init(m_device, indices);
 
-    renderable->m_vertexBuffer.setName(fmt::format("{}_vb", name));
-    renderable->m_indexBuffer.setName(fmt::format("{}_ib", name));
-    renderable->m_constantBuffer.setName(fmt::format("{}_cb", name));
-    renderable->m_name = name;
+    renderable.m_vertexBuffer.setName(fmt::format("{}_vb", name));
+    renderable.m_indexBuffer.setName(fmt::format("{}_ib", name));
 
-    return m_renderables.emplace_back(std::move(renderable)).get();
+    renderable.m_bytes = u64(vertices.size) * sizeof(Vertex) + u64(indices.size) * sizeof(u16);
+    renderable.m_resident = true;
 }
 
-Renderable* Renderer::createRenderable(const Mesh& mesh)
+RenderableHandle Renderer::createRenderable(std::string_view name, ArrayView<Vertex> vertices, ArrayView<u16> indices)
 {
     auto renderable = std::make_unique<Renderable>();
 
-    renderable->m_vertexBuffer.init(m_device, mesh.getVertices());
+    uploadBuffers(*renderable, name, vertices, indices);
+    renderable->m_constantBuffer.init(m_device);
+    renderable->m_constantBuffer.setName(fmt::format("{}_cb", name));
+    renderable->m_name = name;
+    renderable->m_lastUsedFrame = m_frame;
+
+    return m_renderables.add(std::move(renderable));
+}
 
-    const auto sizeU32 = (renderable->m_vertexBuffer.getSize() * sizeof(Vertex)) / 4;
+RenderableHandle Renderer::createRenderable(const Mesh& mesh, const std::filesystem::path& source)
+{
+    auto renderable = std::make_unique<Renderable>();
 
-    renderable->m_vbSRV = createShaderResourceView(m_device, renderable->m_vertexBuffer.getBuffer(),
-        renderable->m_vertexBuffer.getBuffer(), DXGI_FORMAT_R32_TYPELESS, 0, sizeU32, D3D11_BUFFEREX_SRV_FLAG_RAW);
-    renderable->m_indexBuffer.init(m_device, mesh.getIndices());
+    uploadBuffers(*renderable, mesh.getName(), mesh.getVertices(), mesh.getIndices());
     renderable->m_constantBuffer.init(m_device);
-
-    renderable->m_vertexBuffer.setName(fmt::format("{}_vb", mesh.getName()));
-    renderable->m_indexBuffer.setName(fmt::format("{}_ib", mesh.getName()));
     renderable->m_constantBuffer.setName(fmt::format("{}_cb", mesh.getName()));
     renderable->m_name = mesh.getName();
-    renderable->m_submeshes = mesh.getSubMeshes();
+    renderable->m_source = source;
+    renderable->m_lastUsedFrame = m_frame;
+
+    for (const auto& subMesh : mesh.getSubMeshes()) {
+        auto material = getMaterialId(subMesh.material);
+        auto& submeshes = renderable->m_submeshes;
+
+        // Materials without a texture of their own end up the same, so neighbours often merge.
+        // Indices are absolute and drawn with a base vertex of 0, so only the index ranges
+        // have to be next to each other.
+        if (!submeshes.empty() && submeshes.back().material == material
+            && submeshes.back().baseIndex + submeshes.back().numIndices == subMesh.baseIndex) {
+            submeshes.back().numIndices += subMesh.numIndices;
+            continue;
+        }
+
+        submeshes.push_back(Renderable::SubMesh{ subMesh.baseVertex, subMesh.baseIndex, subMesh.numIndices, material });
+    }
+
+    return m_renderables.add(std::move(renderable));
+}
+
+void Renderer::releaseRenderable(RenderableHandle handle)
+{
+    m_renderables.release(handle);
+}
+
+void Renderer::setRenderableBudget(u64 bytes)
+{
+    m_renderableBudget = bytes;
+}
+
+Renderable* Renderer::acquire(RenderableHandle handle)
+{
+    auto renderable = m_renderables.get(handle);
+
+    if (!renderable) {
+        return nullptr;
+    }
+
+    // Only the buffers were evicted, the submeshes and materials are still there. Skip it until
+    // they're back instead of hitching on the disk in the middle of the frame.
+    if (!renderable->m_resident) {
+        // Its file failed to load before, there's nothing to draw
+        if (!renderable->m_source.empty() && !renderable->m_reload.valid()) {
+            renderable->m_reload = std::async(std::launch::async, [source = renderable->m_source] {
+                Mesh mesh;
+                mesh.load(source);
+                return mesh;
+            });
+
+            m_reloading.push_back(handle);
+        }
+
+        return nullptr;
+    }
+
+    renderable->m_lastUsedFrame = m_frame;
+
+    return renderable;
+}
+
+void Renderer::finishReloads()
+{
+    std::erase_if(m_reloading, [this](RenderableHandle handle) {
+        auto renderable = m_renderables.get(handle);
+
+        // Released while loading
+        if (!renderable) {
+            return true;
+        }
+
+        if (renderable->m_reload.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            return false;
+        }
+
+        PROFILE_SCOPE("Upload reloaded renderable");
+
+        try {
+            auto mesh = renderable->m_reload.get();
+            uploadBuffers(*renderable, renderable->m_name, mesh.getVertices(), mesh.getIndices());
+
+            // Was wanted this frame, don't evict it again right away
+            renderable->m_lastUsedFrame = m_frame;
+        } catch (const std::exception& e) {
+            fmt::print(stderr, "Couldn't reload {} from {}: {}\n", renderable->m_name, renderable->m_source.generic_string(), e.what());
+            renderable->m_source.clear();
+        }
+
+        return true;
+    });
+}
+
+void Renderer::evictRenderables()
+{
+    if (m_renderableBudget == 0) {
+        return;
+    }
+
+    u64 residentBytes = 0;
+    std::vector<Renderable*> evictable;
 
-    return m_renderables.emplace_back(std::move(renderable)).get();
+    m_renderables.forEach([&](RenderableHandle, Renderable& renderable) {
+        if (!renderable.m_resident) {
+            return;
+        }
+
+        residentBytes += renderable.m_bytes;
+
+        if (!renderable.m_source.empty() && renderable.m_lastUsedFrame < m_frame) {
+            evictable.push_back(&renderable);
+        }
+    });
+
+    if (residentBytes <= m_renderableBudget) {
+        return;
+    }
+
+    PROFILE_FUNC();
+
+    std::sort(evictable.begin(), evictable.end(), [](const Renderable* a, const Renderable* b) {
+        return a->m_lastUsedFrame < b->m_lastUsedFrame;
+    });
+
+    for (auto renderable : evictable) {
+        if (residentBytes <= m_renderableBudget) {
+            break;
+        }
+
+        residentBytes -= renderable->m_bytes;
+
+        renderable->m_vbSRV.Reset();
+        renderable->m_vertexBuffer = {};
+        renderable->m_indexBuffer = {};
+        renderable->m_resident = false;
+
+        getRenderStats().addEviction();
+    }
+}
+
+u16 Renderer::addMaterial(std::string_view name, const Texture& diffuse)
+{
+    auto id = u16(m_materials.size());
+
+    m_materials.push_back(Material{ std::string(name), diffuse });
+    m_materialIds[std::string(name)] = id;
+
+    return id;
+}
+
+u16 Renderer::getMaterialId(const std::string& name) const
+{
+    auto it = m_materialIds.find(name);
+    return it != m_materialIds.end() ? it->second : 0;
 }
 
 void Renderer::setDirectionalLight(const XMFLOAT3& pos, const XMFLOAT3& color, float intensity)
 {
     EVENT_SCOPE_FUNC();
+    PROFILE_FUNC();
 
     auto dir = XMVector3Normalize(XMLoadFloat3(&pos));
     XMStoreFloat3(&m_psConstants.data.LightDir, dir);
@@ -506,6 +747,7 @@ void Renderer::setDirectionalLight(const XMFLOAT3& pos, const XMFLOAT3& color, f
 void Renderer::setPointLights(ArrayView<PointLight> lights)
 {
     EVENT_SCOPE_FUNC();
+    PROFILE_FUNC();
 
     if (lights.size > m_pointLights.getCapacity()) {
         m_pointLights.init(m_device, lights.size);
@@ -521,9 +763,59 @@ void Renderer::setPointLights(ArrayView<PointLight> lights)
     m_psConstants.update(m_context);
 }
 
-void Renderer::drawIm3d(const Camera& camera, ArrayView<Im3d::DrawList> drawLists)
+void Renderer::drawIm3d(const Camera& camera, ArrayView<Im3d::DrawList> drawLists, const DebugDraw& debugDraw)
 {
     EVENT_SCOPE_FUNC();
+    PROFILE_FUNC();
+
+    struct Draw
+    {
+        Im3d::DrawPrimitiveType primitive;
+        bool gizmo;
+        u32 first;
+        u32 count;
+    };
+
+    // Everything immediate goes into one buffer so there's a single upload per frame
+    std::vector<Draw> draws;
+    m_im3dVertices.clear();
+
+    auto append = [&](Im3d::DrawPrimitiveType primitive, bool gizmo, const Im3d::VertexData* data, u32 count) {
+        if (count > 0) {
+            draws.push_back(Draw{ primitive, gizmo, u32(m_im3dVertices.size()), count });
+            m_im3dVertices.insert(m_im3dVertices.end(), data, data + count);
+        }
+    };
+
+    append(Im3d::DrawPrimitive_Lines, false, debugDraw.getLines().data(), u32(debugDraw.getLines().size()));
+    append(Im3d::DrawPrimitive_Triangles, false, debugDraw.getTriangles().data(), u32(debugDraw.getTriangles().size()));
+
+    const auto gizmoLayerId = Im3d::MakeId("currentEntity");
+    for (const auto& drawList : drawLists) {
+        append(drawList.m_primType, drawList.m_layerId == gizmoLayerId, drawList.m_vertexData, drawList.m_vertexCount);
+    }
+
+    if (!m_im3dVertices.empty()) {
+        if (m_im3dVertices.size() > m_im3dVertexBuffer.getCapacity()) {
+            // Grow geometrically so a slowly growing scene doesn't recreate it every frame
+            auto capacity = std::max(u32(m_im3dVertices.size()), 2 * m_im3dVertexBuffer.getCapacity());
+            m_im3dVertexBuffer.init(m_device, capacity);
+            m_im3dVertexBuffer.setName("Im3d vertices");
+        }
+
+        m_im3dVertexBuffer.update(m_context, m_im3dVertices);
+    }
+
+    const auto& staticVertices = debugDraw.getStaticVertices();
+
+    if (m_debugStaticVersion != debugDraw.getStaticVersion()) {
+        if (!staticVertices.empty()) {
+            m_debugStaticBuffer.init(m_device, staticVertices);
+            m_debugStaticBuffer.setName("Debug static vertices");
+        }
+
+        m_debugStaticVersion = debugDraw.getStaticVersion();
+    }
 
     {
         m_cameraConstantBuffer.data.View = camera.getViewMatrix().transposed();
@@ -543,26 +835,18 @@ void Renderer::drawIm3d(const Camera& camera, ArrayView<Im3d::DrawList> drawList
 
     m_context->VSSetConstantBuffers(0, static_cast<UINT>(vsConstantBuffers.size()), vsConstantBuffers.data());
 
-    const auto gizmoLayerId = Im3d::MakeId("currentEntity");
-    for (const auto& drawList : drawLists) {
-        if (drawList.m_layerId == gizmoLayerId) {
-            // Disable depth testing for the entity gizmo so it won't be hidden by geometry
-            m_context->OMSetDepthStencilState(m_im3dGizmoDepthStencilState.Get(), 0);
-        } else {
-            m_context->OMSetDepthStencilState(m_im3dDepthStencilState.Get(), 0);
-        }
-
-        if (drawList.m_primType == Im3d::DrawPrimitive_Lines) {
+    auto setPrimitive = [&](Im3d::DrawPrimitiveType primitive) {
+        if (primitive == Im3d::DrawPrimitive_Lines) {
             m_context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_LINELIST);
             m_context->VSSetShader(m_im3dLineVS.Get(), nullptr, 0);
             m_context->GSSetShader(m_im3dLineGS.Get(), nullptr, 0);
             m_context->PSSetShader(m_im3dLinePS.Get(), nullptr, 0);
-        } else if (drawList.m_primType == Im3d::DrawPrimitive_Points) {
+        } else if (primitive == Im3d::DrawPrimitive_Points) {
             m_context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_POINTLIST);
             m_context->VSSetShader(m_im3dLineVS.Get(), nullptr, 0);
             m_context->GSSetShader(nullptr, nullptr, 0);
             m_context->PSSetShader(m_im3dLinePS.Get(), nullptr, 0);
-        } else if (drawList.m_primType == Im3d::DrawPrimitive_Triangles) {
+        } else if (primitive == Im3d::DrawPrimitive_Triangles) {
             m_context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
             m_context->VSSetShader(m_im3dTriangleVS.Get(), nullptr, 0);
             m_context->GSSetShader(nullptr, nullptr, 0);
@@ -571,29 +855,61 @@ void Renderer::drawIm3d(const Camera& camera, ArrayView<Im3d::DrawList> drawList
             assert(false);
         }
 
-        if (drawList.m_vertexCount > m_im3dVertexBuffer.getCapacity()) {
-            m_im3dVertexBuffer.init(m_device, ArrayView(drawList.m_vertexData, drawList.m_vertexCount));
-        } else {
-            m_im3dVertexBuffer.update(m_context, ArrayView(drawList.m_vertexData, drawList.m_vertexCount));
-        }
+        getRenderStats().addStateChanges(4);
+    };
 
-        std::array vertexBuffers{ m_im3dVertexBuffer.getBuffer(), };
+    auto setVertexBuffer = [&](ID3D11Buffer* buffer) {
+        std::array vertexBuffers{ buffer, };
         std::array strides{ static_cast<UINT>(sizeof(Im3d::VertexData)) };
         std::array offsets{ UINT(0) };
 
         m_context->IASetVertexBuffers(0, static_cast<UINT>(vertexBuffers.size()), vertexBuffers.data(), strides.data(), offsets.data());
-        m_context->Draw(drawList.m_vertexCount, 0);
+    };
+
+    m_context->OMSetDepthStencilState(m_im3dDepthStencilState.Get(), 0);
+
+    if (const auto& ranges = debugDraw.getVisibleStaticRanges(); !ranges.empty() && !staticVertices.empty()) {
+        setVertexBuffer(m_debugStaticBuffer.getBuffer());
+
+        for (const auto& range : ranges) {
+            setPrimitive(range.primitive == DebugDraw::Primitive::Lines
+                ? Im3d::DrawPrimitive_Lines
+                : Im3d::DrawPrimitive_Triangles);
+
+            m_context->Draw(range.count, range.first);
+            getRenderStats().addDraw(range.count, 1, range.primitive == DebugDraw::Primitive::Triangles);
+        }
+    }
+
+    if (!draws.empty()) {
+        setVertexBuffer(m_im3dVertexBuffer.getBuffer());
+
+        for (const auto& draw : draws) {
+            // Disable depth testing for the entity gizmo so it won't be hidden by geometry
+            m_context->OMSetDepthStencilState(draw.gizmo
+                ? m_im3dGizmoDepthStencilState.Get()
+                : m_im3dDepthStencilState.Get(), 0);
+
+            setPrimitive(draw.primitive);
+            m_context->Draw(draw.count, draw.first);
+
+            getRenderStats().addStateChanges(1);
+            getRenderStats().addDraw(draw.count, 1, draw.primitive == Im3d::DrawPrimitive_Triangles);
+        }
     }
 
     m_context->GSSetShader(nullptr, nullptr, 0);
     m_context->RSSetState(nullptr);
     m_context->OMSetBlendState(nullptr, nullptr, 0xffffffff);
     m_context->OMSetDepthStencilState(m_depthStencilState.Get(), 0);
+
+    m_renderContext->invalidateState();
 }
 
 void Renderer::clear(float r, float g, float b)
 {
     EVENT_SCOPE_FUNC();
+    PROFILE_FUNC();
 
     float color[4] = { r, g, b, 1.0f };
     m_context->ClearRenderTargetView(m_mainRT.m_framebufferRTV.Get(), color);
@@ -604,11 +920,18 @@ void Renderer::endFrame()
 {
     m_annotation->EndEvent();
     m_swapChain->Present(1, 0);
+
+    finishReloads();
+    evictRenderables();
+    m_frame++;
+
+    getRenderStats().endFrame();
 }
 
 ID3D11ShaderResourceView* Renderer::computeBloom()
 {
     EVENT_SCOPE_FUNC();
+    PROFILE_FUNC();
 
     auto sampler = m_framebufferSampler.Get();
     m_context->CSSetSamplers(0, 1, &sampler);
@@ -635,6 +958,9 @@ ID3D11ShaderResourceView* Renderer::computeBloom()
         auto y = UINT(std::ceil(float(output.m_height) / float(TILE_SIZE)));
 
         m_context->Dispatch(x, y, 1);
+
+        getRenderStats().addStateChanges(2);
+        getRenderStats().addDispatch();
     };
 
     {
@@ -669,8 +995,10 @@ ID3D11ShaderResourceView* Renderer::computeBloom()
 void Renderer::postProcess(const PostProcessParams& params)
 {
     EVENT_SCOPE_FUNC();
+    PROFILE_FUNC();
 
     m_context->OMSetRenderTargets(0, nullptr, nullptr);
+    m_renderContext->invalidateState();
 
     {
         {
@@ -707,6 +1035,9 @@ void Renderer::postProcess(const PostProcessParams& params)
         ID3D11ShaderResourceView* tempSRV = nullptr;
         m_context->CSSetUnorderedAccessViews(0, 2, tempUAV, nullptr);
         m_context->CSSetShaderResources(0, 1, &tempSRV);
+
+        // The bloom passes bound their own shader and views too
+        m_renderContext->invalidateState();
     }
 
     {
@@ -742,6 +1073,7 @@ void Renderer::postProcess(const PostProcessParams& params)
 
     auto rtv = m_backbufferRTV.Get();
     m_context->OMSetRenderTargets(1, &rtv, nullptr);
+    m_renderContext->invalidateState();
 }
 
 void Renderer::beginShadowPass(const Camera& camera)
@@ -765,23 +1097,32 @@ void Renderer::beginShadowPass(const Camera& camera)
     m_shadowCameraConstantBuffer.data.View = camera.getViewMatrix().transposed();
     m_shadowCameraConstantBuffer.data.Projection = camera.getProjectionMatrix().transposed();
     m_shadowCameraConstantBuffer.update(m_context);
+
+    m_renderContext->invalidateState();
 }
 
 void Renderer::drawShadow(const RenderBatch& batch)
 {
-    EVENT_SCOPE("Batch {} x{}", batch.renderable->m_name, batch.instances.size());
+    auto renderable = acquire(batch.renderable);
+
+    if (!renderable) {
+        return;
+    }
+
+    EVENT_SCOPE("Batch {} x{}", renderable->m_name, batch.instances.size());
+    PROFILE_SCOPE("Renderer::drawShadow");
 
     m_batchInstanceBuffer.update(m_context, batch.instances);
 
     DrawParams p{
-        .indexBuffer = batch.renderable->m_indexBuffer.getBuffer(),
-        .numIndices = batch.renderable->m_indexBuffer.getSize(),
+        .indexBuffer = renderable->m_indexBuffer.getBuffer(),
+        .numIndices = renderable->m_indexBuffer.getSize(),
         .numInstances = u32(batch.instances.size()),
         .vs{
             .shader = m_shadowBatchVS.Get(),
             .inputLayout = nullptr,
             .constants{ m_shadowCameraConstantBuffer.getBuffer(), },
-            .resources{ batch.renderable->m_vbSRV.Get(), m_batchInstanceBufferSRV.Get(), },
+            .resources{ renderable->m_vbSRV.Get(), m_batchInstanceBufferSRV.Get(), },
         },
     };
 
@@ -792,24 +1133,32 @@ void Renderer::endShadowPass()
 {
     m_context->OMSetRenderTargets(0, nullptr, nullptr);
     m_context->RSSetState(nullptr);
+    m_renderContext->invalidateState();
     
     m_annotation->EndEvent();
 }
 
 void Renderer::draw(const RenderBatch& batch)
 {
-    EVENT_SCOPE("Batch {} x{}", batch.renderable->m_name, batch.instances.size());
+    auto renderable = acquire(batch.renderable);
+
+    if (!renderable) {
+        return;
+    }
+
+    EVENT_SCOPE("Batch {} x{}", renderable->m_name, batch.instances.size());
+    PROFILE_SCOPE("Renderer::draw");
 
     m_batchInstanceBuffer.update(m_context, batch.instances);
 
     DrawParams p{
-        .indexBuffer = batch.renderable->m_indexBuffer.getBuffer(),
+        .indexBuffer = renderable->m_indexBuffer.getBuffer(),
         .numInstances = u32(batch.instances.size()),
         .vs{
             .shader = m_batchVS.Get(),
             .inputLayout = nullptr,
             .constants{ m_cameraConstantBuffer.getBuffer(), m_shadowCameraConstantBuffer.getBuffer(), },
-            .resources{ batch.renderable->m_vbSRV.Get(), m_batchInstanceBufferSRV.Get(), },
+            .resources{ renderable->m_vbSRV.Get(), m_batchInstanceBufferSRV.Get(), },
         },
         .ps{
             .shader = m_ps.Get(),
@@ -820,14 +1169,8 @@ void Renderer::draw(const RenderBatch& batch)
 
     };
 
-    for (const auto& submesh : batch.renderable->m_submeshes) {
-        ID3D11ShaderResourceView* texture = nullptr;
-
-        if (auto it = m_textures.find(submesh.material); it != m_textures.end()) {
-            texture = it->second.srv.Get();
-        }
-
-        p.ps.resources[2] = texture;
+    for (const auto& submesh : renderable->m_submeshes) {
+        p.ps.resources[2] = m_materials[submesh.material].diffuse.srv.Get();
         p.numIndices = submesh.numIndices;
         p.baseIndex = submesh.baseIndex;
         p.baseVertex = submesh.baseVertex;
@@ -848,6 +1191,8 @@ void Renderer::beginFrame(const Camera& camera)
     m_cameraConstantBuffer.data.View = camera.getViewMatrix().transposed();
     m_cameraConstantBuffer.data.Projection = camera.getProjectionMatrix().transposed();
     m_cameraConstantBuffer.update(m_context);
+
+    m_renderContext->invalidateState();
 }
 
 void Renderer::initImgui()
@@ -858,9 +1203,21 @@ void Renderer::initImgui()
 void Renderer::drawImgui()
 {
     EVENT_SCOPE_FUNC();
+    PROFILE_FUNC();
 
     if (auto drawData = ImGui::GetDrawData()) {
         ImGui_ImplDX11_RenderDrawData(drawData);
+        m_renderContext->invalidateState();
+
+        auto& stats = getRenderStats();
+
+        for (int i = 0; i < drawData->CmdListsCount; i++) {
+            for (const auto& cmd : drawData->CmdLists[i]->CmdBuffer) {
+                if (!cmd.UserCallback) {
+                    stats.addDraw(cmd.ElemCount, 1, true);
+                }
+            }
+        }
     }
 }
 
@@ -19,6 +19,7 @@
 #include <memory>
 #include <tuple>
 #include <functional>
+#include <filesystem>
 #include <string_view>
 
 using Microsoft::WRL::ComPtr;
@@ -32,12 +33,18 @@ struct Bounds
     math::Vector<math::Model> max;
 };
 
-class Renderable;
 struct Transform;
 
+// Generational handle to a renderable owned by the renderer. Handles that outlive the
+// renderable resolve to nothing, so drawing one is skipped instead of crashing.
+enum class RenderableHandle : u32
+{
+    Invalid = 0,
+};
+
 struct RenderBatch
 {
-    Renderable* renderable;
+    RenderableHandle renderable = RenderableHandle::Invalid;
     std::vector<RenderableConstants> instances;
 };
 
@@ -55,7 +62,7 @@ public:
 
     virtual void setDirectionalLight(const XMFLOAT3& pos, const XMFLOAT3& color, float intensity) = 0;
     virtual void setPointLights(ArrayView<PointLight> lights) = 0;
-    virtual void drawIm3d(const Camera&, ArrayView<Im3d::DrawList>) = 0;
+    virtual void drawIm3d(const Camera&, ArrayView<Im3d::DrawList>, const class DebugDraw&) = 0;
     virtual void clear(float r, float g, float b) = 0;
 
     virtual void beginFrame(const Camera&) = 0;
@@ -68,8 +75,18 @@ public:
 
     virtual void postProcess(const PostProcessParams&) = 0;
 
-    virtual Renderable* createRenderable(std::string_view name, ArrayView<Vertex> vertices, ArrayView<u16> indices) = 0;
-    virtual Renderable* createRenderable(const class Mesh&) = 0;
+    // Renderables belong to whoever created them. The ones with a source file can have their GPU
+    // buffers evicted when over the budget, they're loaded again in the background the next time
+    // they're drawn and skipped until then.
+    virtual RenderableHandle createRenderable(std::string_view name, ArrayView<Vertex> vertices, ArrayView<u16> indices) = 0;
+    virtual RenderableHandle createRenderable(const class Mesh&, const std::filesystem::path& source = {}) = 0;
+
+    // Destroys the renderable, its handle stops resolving
+    virtual void releaseRenderable(RenderableHandle) = 0;
+
+    // GPU memory for renderables, past it the least recently drawn evictable ones are
+    // evicted at the end of the frame. 0 is no limit.
+    virtual void setRenderableBudget(u64 bytes) = 0;
 
     virtual void initImgui() = 0;
     virtual void drawImgui() = 0;
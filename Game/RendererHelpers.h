@@ -2,17 +2,115 @@
 
 #include "ArrayView.h"
 #include "Hresult.h"
+#include "RenderStats.h"
+#include "MemoryTracker.h"
 
 #include <wrl.h>
 #include <d3d11_1.h>
+#include <atomic>
 #include <string_view>
 
+// Attached to a resource as private data, D3D releases it when the resource is destroyed
+// which is the only way to find out when that happens
+class GpuMemoryToken final : public IUnknown
+{
+public:
+    GpuMemoryToken(MemoryTag tag, u64 bytes) :
+        m_tag(tag), m_bytes(bytes)
+    {
+        getMemoryTracker().onAllocate(m_tag, m_bytes);
+    }
+
+    ~GpuMemoryToken()
+    {
+        getMemoryTracker().onFree(m_tag, m_bytes);
+    }
+
+    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** object) override
+    {
+        if (riid == __uuidof(IUnknown)) {
+            *object = static_cast<IUnknown*>(this);
+            AddRef();
+            return S_OK;
+        }
+
+        *object = nullptr;
+        return E_NOINTERFACE;
+    }
+
+    ULONG STDMETHODCALLTYPE AddRef() override
+    {
+        return ++m_refs;
+    }
+
+    ULONG STDMETHODCALLTYPE Release() override
+    {
+        auto refs = --m_refs;
+
+        if (refs == 0) {
+            delete this;
+        }
+
+        return refs;
+    }
+
+private:
+    std::atomic<ULONG> m_refs = 1;
+    MemoryTag m_tag;
+    u64 m_bytes;
+};
+
+// {6F4C2A9E-3B1D-4E57-9A0C-8D2E5F71B3A4}
+inline constexpr GUID GpuMemoryTokenGuid = { 0x6f4c2a9e, 0x3b1d, 0x4e57, { 0x9a, 0x0c, 0x8d, 0x2e, 0x5f, 0x71, 0xb3, 0xa4 } };
+
+inline void trackGpuMemory(ID3D11DeviceChild* resource, MemoryTag tag, u64 bytes)
+{
+    Microsoft::WRL::ComPtr<IUnknown> token;
+    token.Attach(new GpuMemoryToken(tag, bytes));
+
+    resource->SetPrivateDataInterface(GpuMemoryTokenGuid, token.Get());
+}
+
+// Only the formats the renderer uses, anything else is assumed to be 4 bytes
+inline u32 getFormatSize(DXGI_FORMAT format)
+{
+    switch (format) {
+    case DXGI_FORMAT_R32G32B32A32_FLOAT:
+        return 16;
+    case DXGI_FORMAT_R16G16B16A16_FLOAT:
+        return 8;
+    case DXGI_FORMAT_R16_UINT:
+        return 2;
+    default:
+        return 4;
+    }
+}
+
+inline u64 estimateTextureSize(const D3D11_TEXTURE2D_DESC& desc)
+{
+    u64 bytes = 0;
+
+    for (UINT mip = 0; mip < desc.MipLevels; mip++) {
+        auto w = std::max(desc.Width >> mip, 1u);
+        auto h = std::max(desc.Height >> mip, 1u);
+        bytes += u64(w) * u64(h) * getFormatSize(desc.Format);
+    }
+
+    return bytes * desc.ArraySize * std::max(desc.SampleDesc.Count, 1u);
+}
+
 template<typename... Args>
 inline auto createTexture2D(const Microsoft::WRL::ComPtr<ID3D11Device>& m_device, Args... args)
 {
     CD3D11_TEXTURE2D_DESC desc(args...);
     Microsoft::WRL::ComPtr<ID3D11Texture2D> texture;
     Hresult hr = m_device->CreateTexture2D(&desc, nullptr, &texture);
+    getRenderStats().addResource();
+
+    // The real mip count, the one passed in may be 0 for a full chain
+    texture->GetDesc(&desc);
+    trackGpuMemory(texture.Get(), MemoryTag::GpuTextures, estimateTextureSize(desc));
+
     return texture;
 }
 
@@ -22,6 +120,8 @@ inline auto createBuffer(const Microsoft::WRL::ComPtr<ID3D11Device>& m_device, A
     CD3D11_BUFFER_DESC desc(args...);
     Microsoft::WRL::ComPtr<ID3D11Buffer> buffer;
     Hresult hr = m_device->CreateBuffer(&desc, nullptr, &buffer);
+    getRenderStats().addResource();
+    trackGpuMemory(buffer.Get(), MemoryTag::GpuBuffers, desc.ByteWidth);
     return buffer;
 }
 
@@ -34,6 +134,8 @@ inline auto createBufferWithData(const Microsoft::WRL::ComPtr<ID3D11Device>& m_d
 
     Microsoft::WRL::ComPtr<ID3D11Buffer> buffer;
     Hresult hr = m_device->CreateBuffer(&desc, &sd, &buffer);
+    getRenderStats().addResource();
+    trackGpuMemory(buffer.Get(), MemoryTag::GpuBuffers, desc.ByteWidth);
     return buffer;
 }
 
@@ -43,6 +145,7 @@ inline auto createRenderTargetView(const Microsoft::WRL::ComPtr<ID3D11Device>& m
     CD3D11_RENDER_TARGET_VIEW_DESC desc(args...);
     Microsoft::WRL::ComPtr<ID3D11RenderTargetView> rtv;
     Hresult hr = m_device->CreateRenderTargetView(resource, &desc, &rtv);
+    getRenderStats().addResource();
     return rtv;
 }
 
@@ -50,6 +153,7 @@ inline auto createRenderTargetView(const Microsoft::WRL::ComPtr<ID3D11Device>& m
 {
     Microsoft::WRL::ComPtr<ID3D11RenderTargetView> rtv;
     Hresult hr = m_device->CreateRenderTargetView(resource, nullptr, &rtv);
+    getRenderStats().addResource();
     return rtv;
 }
 
@@ -59,6 +163,7 @@ inline auto createShaderResourceView(const Microsoft::WRL::ComPtr<ID3D11Device>&
     CD3D11_SHADER_RESOURCE_VIEW_DESC desc(args...);
     Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> srv;
     Hresult hr = m_device->CreateShaderResourceView(resource, &desc, &srv);
+    getRenderStats().addResource();
     return srv;
 }
 
@@ -68,6 +173,7 @@ inline auto createDepthStencilView(const Microsoft::WRL::ComPtr<ID3D11Device>& m
     CD3D11_DEPTH_STENCIL_VIEW_DESC desc(args...);
     Microsoft::WRL::ComPtr<ID3D11DepthStencilView> dsv;
     Hresult hr = m_device->CreateDepthStencilView(resource, &desc, &dsv);
+    getRenderStats().addResource();
     return dsv;
 }
 
@@ -77,6 +183,7 @@ inline auto createDepthStencilState(const Microsoft::WRL::ComPtr<ID3D11Device>&
     CD3D11_DEPTH_STENCIL_DESC desc(args...);
     Microsoft::WRL::ComPtr<ID3D11DepthStencilState> dss;
     Hresult hr = m_device->CreateDepthStencilState(&desc, &dss);
+    getRenderStats().addResource();
     return dss;
 }
 
@@ -86,6 +193,7 @@ inline auto createSamplerState(const Microsoft::WRL::ComPtr<ID3D11Device>& m_dev
     CD3D11_SAMPLER_DESC desc(args...);
     Microsoft::WRL::ComPtr<ID3D11SamplerState> ss;
     Hresult hr = m_device->CreateSamplerState(&desc, &ss);
+    getRenderStats().addResource();
     return ss;
 }
 
@@ -95,6 +203,7 @@ inline auto createRasterizerState(const Microsoft::WRL::ComPtr<ID3D11Device>& m_
     CD3D11_RASTERIZER_DESC desc(args...);
     Microsoft::WRL::ComPtr<ID3D11RasterizerState> rs;
     Hresult hr = m_device->CreateRasterizerState(&desc, &rs);
+    getRenderStats().addResource();
     return rs;
 }
 
@@ -104,6 +213,7 @@ inline auto createBlendState(const Microsoft::WRL::ComPtr<ID3D11Device>& m_devic
     CD3D11_BLEND_DESC desc(args...);
     Microsoft::WRL::ComPtr<ID3D11BlendState> bs;
     Hresult hr = m_device->CreateBlendState(&desc, &bs);
+    getRenderStats().addResource();
     return bs;
 }
 
@@ -116,8 +226,10 @@ inline auto createUnorderedAccessView(const Microsoft::WRL::ComPtr<ID3D11Device>
     if constexpr (sizeof...(args) > 0) {
         CD3D11_UNORDERED_ACCESS_VIEW_DESC desc(args...);
         hr = m_device->CreateUnorderedAccessView(resource, &desc, &uav);
+        getRenderStats().addResource();
     } else {
         hr = m_device->CreateUnorderedAccessView(resource, nullptr, &uav);
+        getRenderStats().addResource();
     }
 
     return uav;
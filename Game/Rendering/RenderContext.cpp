@@ -2,10 +2,49 @@
 
 #include "RenderContext.h"
 #include "../RenderTarget.h"
+#include "../RenderStats.h"
 
 #include <d3d11_4.h>
+#include <algorithm>
 #include <cassert>
 
+namespace
+{
+
+// True if the value changed, it's bound from then on
+template<typename T>
+bool updateBound(std::optional<T>& bound, T value)
+{
+    if (bound == value) {
+        return false;
+    }
+
+    bound = value;
+    return true;
+}
+
+// Same for slots starting at 0, the ones past `values` stay bound
+template<typename T>
+bool updateBound(std::vector<T>& bound, const std::vector<T>& values)
+{
+    if (values.empty()) {
+        return false;
+    }
+
+    if (bound.size() >= values.size() && std::equal(values.begin(), values.end(), bound.begin())) {
+        return false;
+    }
+
+    if (bound.size() < values.size()) {
+        bound.resize(values.size());
+    }
+
+    std::copy(values.begin(), values.end(), bound.begin());
+    return true;
+}
+
+}
+
 void RenderContext::clearRenderTarget(RenderTarget* rt, const DirectX::XMFLOAT4& clearColor, float depth)
 {
     if (auto rtv = rt->m_framebufferRTV.Get()) {
@@ -22,6 +61,9 @@ void RenderContext::bindRenderTarget(RenderTarget* rt)
     auto rtv = rt->m_framebufferRTV.Get();
     m_context->OMSetRenderTargets(1, &rtv, rt->m_dsv.Get());
 
+    // Any SRV of the same texture just got unbound
+    invalidateState();
+
     CD3D11_VIEWPORT vp(0.0f, 0.0f, float(rt->m_width), float(rt->m_height), 0.0f, 1.0f);
     m_context->RSSetViewports(1, &vp);
 }
@@ -30,6 +72,7 @@ void RenderContext::bindBackbuffer()
 {
     auto rtv = m_backbufferRTV.Get();
     m_context->OMSetRenderTargets(1, &rtv, nullptr);
+    invalidateState();
 
     CD3D11_VIEWPORT vp(0.0f, 0.0f, float(m_backbufferSize.x), float(m_backbufferSize.y), 0.0f, 1.0f);
     m_context->RSSetViewports(1, &vp);
@@ -40,21 +83,37 @@ void RenderContext::draw(const DrawParams& p)
     assert(p.vs.shader);
     assert(p.indexBuffer);
 
-    m_context->VSSetShader(p.vs.shader, nullptr, 0);
-    if (!p.vs.constants.empty()) {
+    u32 changes = 0;
+
+    if (updateBound(m_bound.vs.shader, p.vs.shader)) {
+        m_context->VSSetShader(p.vs.shader, nullptr, 0);
+        changes++;
+    }
+
+    if (updateBound(m_bound.vs.constants, p.vs.constants)) {
         m_context->VSSetConstantBuffers(0, u32(p.vs.constants.size()), p.vs.constants.data());
+        changes++;
     }
 
-    if (!p.vs.resources.empty()) {
+    if (updateBound(m_bound.vs.resources, p.vs.resources)) {
         m_context->VSSetShaderResources(0, u32(p.vs.resources.size()), p.vs.resources.data());
+        changes++;
     }
 
-    if (!p.vs.samplers.empty()) {
+    if (updateBound(m_bound.vs.samplers, p.vs.samplers)) {
         m_context->VSSetSamplers(0, u32(p.vs.samplers.size()), p.vs.samplers.data());
+        changes++;
+    }
+
+    if (updateBound(m_bound.inputLayout, p.vs.inputLayout)) {
+        m_context->IASetInputLayout(p.vs.inputLayout);
+        changes++;
     }
 
-    m_context->IASetInputLayout(p.vs.inputLayout);
-    m_context->IASetPrimitiveTopology(p.primitiveTopology);
+    if (updateBound(m_bound.primitiveTopology, p.primitiveTopology)) {
+        m_context->IASetPrimitiveTopology(p.primitiveTopology);
+        changes++;
+    }
 
     if (!p.vertexBuffers.buffers.empty()) {
         const auto& v = p.vertexBuffers.buffers;
@@ -64,41 +123,71 @@ void RenderContext::draw(const DrawParams& p)
         assert(v.size() == s.size());
         assert(v.size() == o.size());
 
-        m_context->IASetVertexBuffers(0, u32(v.size()), v.data(), s.data(), o.data());
+        // Not short-circuited, all three have to be remembered
+        auto changed = updateBound(m_bound.vertexBuffers.buffers, v);
+        changed |= updateBound(m_bound.vertexBuffers.strides, s);
+        changed |= updateBound(m_bound.vertexBuffers.offsets, o);
+
+        if (changed) {
+            m_context->IASetVertexBuffers(0, u32(v.size()), v.data(), s.data(), o.data());
+            changes++;
+        }
+    }
+
+    if (updateBound(m_bound.ps.shader, p.ps.shader)) {
+        m_context->PSSetShader(p.ps.shader, nullptr, 0);
+        changes++;
     }
 
-    m_context->PSSetShader(p.ps.shader, nullptr, 0);
     if (p.ps.shader) {
-        if (!p.ps.constants.empty()) {
+        if (updateBound(m_bound.ps.constants, p.ps.constants)) {
             m_context->PSSetConstantBuffers(0, u32(p.ps.constants.size()), p.ps.constants.data());
+            changes++;
         }
 
-        if (!p.ps.resources.empty()) {
+        if (updateBound(m_bound.ps.resources, p.ps.resources)) {
             m_context->PSSetShaderResources(0, u32(p.ps.resources.size()), p.ps.resources.data());
+            changes++;
         }
 
-        if (!p.ps.samplers.empty()) {
+        if (updateBound(m_bound.ps.samplers, p.ps.samplers)) {
             m_context->PSSetSamplers(0, u32(p.ps.samplers.size()), p.ps.samplers.data());
+            changes++;
         }
     }
 
-    m_context->GSSetShader(p.gs.shader, nullptr, 0);
+    if (updateBound(m_bound.gs.shader, p.gs.shader)) {
+        m_context->GSSetShader(p.gs.shader, nullptr, 0);
+        changes++;
+    }
+
     if (p.gs.shader) {
-        if (!p.gs.constants.empty()) {
+        if (updateBound(m_bound.gs.constants, p.gs.constants)) {
             m_context->GSSetConstantBuffers(0, u32(p.gs.constants.size()), p.gs.constants.data());
+            changes++;
         }
 
-        if (!p.gs.resources.empty()) {
+        if (updateBound(m_bound.gs.resources, p.gs.resources)) {
             m_context->GSSetShaderResources(0, u32(p.gs.resources.size()), p.gs.resources.data());
+            changes++;
         }
 
-        if (!p.gs.samplers.empty()) {
+        if (updateBound(m_bound.gs.samplers, p.gs.samplers)) {
             m_context->GSSetSamplers(0, u32(p.gs.samplers.size()), p.gs.samplers.data());
+            changes++;
         }
     }
 
-    m_context->IASetIndexBuffer(p.indexBuffer, DXGI_FORMAT_R16_UINT, 0);
+    if (updateBound(m_bound.indexBuffer, p.indexBuffer)) {
+        m_context->IASetIndexBuffer(p.indexBuffer, DXGI_FORMAT_R16_UINT, 0);
+        changes++;
+    }
+
     m_context->DrawIndexedInstanced(p.numIndices, p.numInstances, p.baseIndex, 0, 0);
+
+    auto& stats = getRenderStats();
+    stats.addStateChanges(changes);
+    stats.addDraw(p.numIndices, p.numInstances, p.primitiveTopology == D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 }
 
 void RenderContext::compute(const ComputeParams& p)
@@ -106,23 +195,44 @@ void RenderContext::compute(const ComputeParams& p)
     assert(p.shader);
     assert(p.threads.x > 0 && p.threads.y > 0 && p.threads.z > 0);
 
-    m_context->CSSetShader(p.shader, nullptr, 0);
+    u32 changes = 0;
+
+    if (updateBound(m_bound.cs.shader, p.shader)) {
+        m_context->CSSetShader(p.shader, nullptr, 0);
+        changes++;
+    }
 
-    if (!p.constants.empty()) {
+    if (updateBound(m_bound.cs.constants, p.constants)) {
         m_context->CSSetConstantBuffers(0, u32(p.constants.size()), p.constants.data());
+        changes++;
     }
 
-    if (!p.resources.empty()) {
-        m_context->CSSetShaderResources(0, u32(p.resources.size()), p.resources.data());
+    // Binding a UAV unbinds any SRV of the same resource behind our back, so these are
+    // always set and the SRVs are set again after them
+    if (!p.uavs.empty()) {
+        m_context->CSSetUnorderedAccessViews(0, u32(p.uavs.size()), p.uavs.data(), nullptr);
+        m_bound.cs.resources.clear();
+        changes++;
     }
 
-    if (!p.samplers.empty()) {
-        m_context->CSSetSamplers(0, u32(p.samplers.size()), p.samplers.data());
+    if (updateBound(m_bound.cs.resources, p.resources)) {
+        m_context->CSSetShaderResources(0, u32(p.resources.size()), p.resources.data());
+        changes++;
     }
 
-    if (!p.uavs.empty()) {
-        m_context->CSSetUnorderedAccessViews(0, u32(p.uavs.size()), p.uavs.data(), nullptr);
+    if (updateBound(m_bound.cs.samplers, p.samplers)) {
+        m_context->CSSetSamplers(0, u32(p.samplers.size()), p.samplers.data());
+        changes++;
     }
 
     m_context->Dispatch(p.threads.x, p.threads.y, p.threads.z);
+
+    auto& stats = getRenderStats();
+    stats.addStateChanges(changes);
+    stats.addDispatch();
+}
+
+void RenderContext::invalidateState()
+{
+    m_bound = BoundState{};
 }
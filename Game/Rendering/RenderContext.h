@@ -7,6 +7,7 @@
 #include <DirectXMath.h>
 #include <d3d11_4.h>
 #include <wrl.h>
+#include <optional>
 #include <vector>
 
 using Microsoft::WRL::ComPtr;
@@ -84,8 +85,37 @@ public:
     void draw(const DrawParams&);
     void compute(const ComputeParams&);
 
+    // Forgets what draw() and compute() bound, call it after binding shaders or resources
+    // without the context so the next call sets everything again
+    void invalidateState();
+
 private:
+    template<typename TShader>
+    struct BoundStage
+    {
+        std::optional<TShader*> shader;
+
+        std::vector<ID3D11Buffer*> constants;
+        std::vector<ID3D11ShaderResourceView*> resources;
+        std::vector<ID3D11SamplerState*> samplers;
+    };
+
+    // What's bound right now, so only the changes get set and counted
+    struct BoundState
+    {
+        BoundStage<ID3D11VertexShader> vs;
+        BoundStage<ID3D11GeometryShader> gs;
+        BoundStage<ID3D11PixelShader> ps;
+        BoundStage<ID3D11ComputeShader> cs;
+
+        std::optional<ID3D11InputLayout*> inputLayout;
+        std::optional<D3D11_PRIMITIVE_TOPOLOGY> primitiveTopology;
+        std::optional<ID3D11Buffer*> indexBuffer;
+        VertexBufferSet vertexBuffers;
+    };
+
     ComPtr<ID3D11DeviceContext1> m_context;
+    BoundState m_bound;
 
     DirectX::XMUINT2 m_backbufferSize{ 0, 0 };
     ComPtr<ID3D11RenderTargetView> m_backbufferRTV;
@@ -8,7 +8,11 @@
 #include "Components/Transform.h"
 #include "Components/Renderable.h"
 #include "Components/PointLight.h"
+#include "Components/Hierarchy.h"
+#include "Components/StaticBatched.h"
 #include "Serialization.h"
+#include "Profiler.h"
+#include "MemoryTracker.h"
 
 #include <filesystem>
 #include <fstream>
@@ -27,9 +31,85 @@ void serialize(Archive& archive, Scene& s)
     archive(s.name);
 }
 
-Scene::Scene() :
-    physicsWorld(*this)
+Scene::Scene(const PhysicsSettings& physicsSettings) :
+    transforms(reg), bvh(reg, transforms), physicsWorld(*this, physicsSettings), staticGeometry(reg, transforms)
 {
+    reg
+        .on_construct<components::Transform>()
+        .connect<&TransformSystem::onTransformConstructed>(transforms);
+
+    reg
+        .on_update<components::Transform>()
+        .connect<&TransformSystem::onTransformUpdated>(transforms);
+
+    reg
+        .on_destroy<components::Transform>()
+        .connect<&TransformSystem::onTransformDestroyed>(transforms);
+
+    reg
+        .on_destroy<components::Transform>()
+        .connect<&SceneBvh::onTransformDestroyed>(bvh);
+
+    reg
+        .on_construct<components::Hierarchy>()
+        .connect<&TransformSystem::onHierarchyChanged>(transforms);
+
+    reg
+        .on_update<components::Hierarchy>()
+        .connect<&TransformSystem::onHierarchyChanged>(transforms);
+
+    reg
+        .on_destroy<components::Hierarchy>()
+        .connect<&TransformSystem::onHierarchyChanged>(transforms);
+
+    reg
+        .on_construct<components::Renderable>()
+        .connect<&SceneBvh::onRenderableChanged>(bvh);
+
+    reg
+        .on_update<components::Renderable>()
+        .connect<&SceneBvh::onRenderableChanged>(bvh);
+
+    reg
+        .on_destroy<components::Renderable>()
+        .connect<&SceneBvh::onRenderableDestroyed>(bvh);
+
+    reg
+        .on_construct<components::StaticBatched>()
+        .connect<&SceneBvh::onRenderableChanged>(bvh);
+
+    reg
+        .on_destroy<components::StaticBatched>()
+        .connect<&SceneBvh::onRenderableChanged>(bvh);
+
+    reg
+        .on_destroy<components::StaticBatched>()
+        .connect<&StaticGeometry::onStaticBatchedDestroyed>(staticGeometry);
+
+    reg
+        .on_update<components::Renderable>()
+        .connect<&StaticGeometry::onEntityChanged>(staticGeometry);
+
+    reg
+        .on_destroy<components::Renderable>()
+        .connect<&StaticGeometry::onEntityChanged>(staticGeometry);
+
+    reg
+        .on_construct<components::Physics>()
+        .connect<&StaticGeometry::onEntityChanged>(staticGeometry);
+
+    reg
+        .on_construct<components::PointLight>()
+        .connect<&SceneBvh::onLightChanged>(bvh);
+
+    reg
+        .on_update<components::PointLight>()
+        .connect<&SceneBvh::onLightChanged>(bvh);
+
+    reg
+        .on_destroy<components::PointLight>()
+        .connect<&SceneBvh::onLightDestroyed>(bvh);
+
     reg
         .on_construct<components::Physics>()
         .connect<&PhysicsWorld::onCreatePhysicsComponent>(physicsWorld);
@@ -49,14 +129,24 @@ Scene::Scene() :
 
 void Scene::load(const std::filesystem::path& path)
 {
+    PROFILE_FUNC();
+    MemoryScope memoryScope(MemoryTag::Scene);
+
     std::ifstream input(path);
     cereal::JSONInputArchive archive(input);
 
-    entt::snapshot_loader(reg)
+    entt::snapshot_loader loader(reg);
+
+    loader
         .entities(archive)
         .component<components::Misc, components::Transform, components::Renderable, components::PointLight>(archive);
 
     archive(*this);
+
+    // Scenes saved before the hierarchy existed end here
+    if (archive.getNodeName()) {
+        loader.component<components::Hierarchy>(archive);
+    }
 }
 
 void Scene::save(const std::filesystem::path& path)
@@ -64,9 +154,13 @@ void Scene::save(const std::filesystem::path& path)
     std::ofstream o(path);
     cereal::JSONOutputArchive archive(o);
 
-    entt::snapshot(reg)
+    entt::snapshot snap(reg);
+
+    snap
         .entities(archive)
         .component<components::Misc, components::Transform, components::Renderable, components::PointLight>(archive);
 
     archive(*this);
+
+    snap.component<components::Hierarchy>(archive);
 }
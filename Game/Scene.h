@@ -6,10 +6,13 @@
 #include <entt/entt.hpp>
 
 #include "PhysicsWorld.h"
+#include "SceneBvh.h"
+#include "StaticGeometry.h"
+#include "TransformSystem.h"
 
 struct Scene
 {
-    Scene();
+    Scene(const PhysicsSettings& physicsSettings = {});
 
     void load(const std::filesystem::path& path);
     void save(const std::filesystem::path& path);
@@ -21,5 +24,8 @@ struct Scene
 
     std::string name{ "scene" };
     entt::registry reg;
+    TransformSystem transforms;
+    SceneBvh bvh;
     PhysicsWorld physicsWorld;
+    StaticGeometry staticGeometry;
 };
@@ -0,0 +1,311 @@
+#include "pch.h"
+
+#include "SceneBvh.h"
+#include "Assets.h"
+#include "TransformSystem.h"
+
+#include "Components/Transform.h"
+#include "Components/Renderable.h"
+#include "Components/PointLight.h"
+#include "Components/StaticBatched.h"
+
+#include <cmath>
+
+using namespace DirectX;
+
+static u32 entityIndex(entt::entity e)
+{
+    return u32(entt::to_integral(entt::registry::entity(e)));
+}
+
+SceneBvh::SceneBvh(entt::registry& reg, TransformSystem& transforms) :
+    m_reg(reg), m_transforms(transforms)
+{
+}
+
+// Also called when StaticGeometry tags or untags the entity, it moves between the trees
+void SceneBvh::onRenderableChanged(entt::registry&, entt::entity e)
+{
+    m_trees[0].dirty.push_back(e);
+    m_trees[2].dirty.push_back(e);
+}
+
+void SceneBvh::onRenderableDestroyed(entt::registry&, entt::entity e)
+{
+    removeProxy(m_trees[0], e);
+    removeProxy(m_trees[2], e);
+}
+
+void SceneBvh::onLightChanged(entt::registry&, entt::entity e)
+{
+    m_trees[1].dirty.push_back(e);
+}
+
+void SceneBvh::onLightDestroyed(entt::registry&, entt::entity e)
+{
+    removeProxy(m_trees[1], e);
+}
+
+void SceneBvh::onTransformDestroyed(entt::registry&, entt::entity e)
+{
+    for (auto& tree : m_trees) {
+        removeProxy(tree, e);
+    }
+}
+
+void SceneBvh::update()
+{
+    for (auto& tree : m_trees) {
+        for (auto e : tree.dirty) {
+            if (m_reg.valid(e)) {
+                refresh(tree, e);
+            }
+        }
+
+        tree.dirty.clear();
+    }
+
+    // Moved renderables are refit in one batch, their tree doesn't change with the transform
+    const auto& updated = m_transforms.getUpdated();
+
+    m_refitEntities.clear();
+    m_refitTrees.clear();
+    m_refitBounds.resize(u32(updated.size()));
+    m_refitWorlds.resize(u32(updated.size()));
+
+    for (auto e : updated) {
+        if (m_reg.has<components::Renderable>(e)) {
+            auto layer = m_reg.has<components::StaticBatched>(e) ? StaticRenderables : Renderables;
+            auto& tree = m_trees[layer == Renderables ? 0 : 2];
+
+            math::Aabb local;
+
+            if (getModelBounds(layer, e, local)) {
+                m_refitBounds.set(u32(m_refitEntities.size()), local);
+                m_refitWorlds.set(u32(m_refitEntities.size()), m_reg.get<components::WorldTransform>(e).getMatrix2());
+
+                m_refitEntities.push_back(e);
+                m_refitTrees.push_back(&tree);
+            } else {
+                removeProxy(tree, e);
+            }
+        }
+
+        if (m_reg.has<components::PointLight>(e)) {
+            refresh(m_trees[1], e);
+        }
+    }
+
+    m_refitBounds.resize(u32(m_refitEntities.size()));
+    m_refitWorlds.resize(u32(m_refitEntities.size()));
+    math::transformAabbs(m_refitWorlds, m_refitBounds, m_refitWorldBounds);
+
+    for (u32 i = 0; i < u32(m_refitEntities.size()); i++) {
+        placeProxy(*m_refitTrees[i], m_refitEntities[i], m_refitWorldBounds.get(i));
+    }
+}
+
+void SceneBvh::queryFrustum(const math::Frustum& frustum, u32 layers, std::vector<entt::entity>& out) const
+{
+    for (const auto& tree : m_trees) {
+        if (!(layers & tree.layer)) {
+            continue;
+        }
+
+        tree.tree.queryFrustum(frustum, [&](i32 proxy) {
+            out.push_back(entt::entity(tree.tree.getUserData(proxy)));
+        });
+    }
+}
+
+void SceneBvh::querySphere(const XMFLOAT3& center, float radius, u32 layers, std::vector<entt::entity>& out) const
+{
+    for (const auto& tree : m_trees) {
+        if (!(layers & tree.layer)) {
+            continue;
+        }
+
+        tree.tree.query(
+            [&](const math::Aabb& box) { return box.overlapsSphere(center, radius); },
+            [&](i32 proxy) { out.push_back(entt::entity(tree.tree.getUserData(proxy))); });
+    }
+}
+
+entt::entity SceneBvh::raycast(const XMFLOAT3& origin, const XMFLOAT3& direction, float maxDistance,
+    u32 layers, float* distance) const
+{
+    XMFLOAT3 invDir(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+
+    entt::entity closest = entt::null;
+    auto closestDistance = maxDistance;
+
+    for (const auto& tree : m_trees) {
+        if (!(layers & tree.layer)) {
+            continue;
+        }
+
+        tree.tree.raycast(origin, direction, closestDistance, [&](i32 proxy, float) {
+            auto e = entt::entity(tree.tree.getUserData(proxy));
+
+            // The tree only has the enlarged boxes, check the real bounds
+            math::Aabb box;
+            if (!computeBounds(tree.layer, e, box) || box.intersectRay(origin, invDir, closestDistance) < 0.0f) {
+                return closestDistance;
+            }
+
+            auto t = tree.layer == Lights
+                ? box.intersectRay(origin, invDir, closestDistance)
+                : raycastMesh(e, origin, direction, closestDistance);
+
+            if (t >= 0.0f) {
+                closest = e;
+                closestDistance = t;
+            }
+
+            return closestDistance;
+        });
+    }
+
+    if (distance && closest != entt::null) {
+        *distance = closestDistance;
+    }
+
+    return closest;
+}
+
+u32 SceneBvh::getProxyCount(u32 layers) const
+{
+    u32 count = 0;
+
+    for (const auto& tree : m_trees) {
+        if (layers & tree.layer) {
+            count += tree.tree.getProxyCount();
+        }
+    }
+
+    return count;
+}
+
+i32 SceneBvh::getHeight(u32 layers) const
+{
+    i32 height = 0;
+
+    for (const auto& tree : m_trees) {
+        if (layers & tree.layer) {
+            height = std::max(height, tree.tree.getHeight());
+        }
+    }
+
+    return height;
+}
+
+// The ray is moved into model space instead of transforming the triangles. The direction
+// isn't normalized so distances along it stay the same in both spaces.
+float SceneBvh::raycastMesh(entt::entity e, const XMFLOAT3& origin, const XMFLOAT3& direction, float maxDistance) const
+{
+    const auto& model = getAssetRegistry().get(m_reg.get<components::Renderable>(e).model);
+    const auto& world = m_reg.get<components::WorldTransform>(e).matrix;
+
+    XMVECTOR determinant;
+    auto worldToModel = XMMatrixInverse(&determinant, world);
+
+    // Squashed flat by a zero scale, nothing to hit
+    if (std::fabs(XMVectorGetX(determinant)) < 1e-12f) {
+        return -1.0f;
+    }
+
+    XMFLOAT3 localOrigin;
+    XMFLOAT3 localDirection;
+    XMStoreFloat3(&localOrigin, XMVector3TransformCoord(XMLoadFloat3(&origin), worldToModel));
+    XMStoreFloat3(&localDirection, XMVector3TransformNormal(XMLoadFloat3(&direction), worldToModel));
+
+    return model.triangles.raycast(localOrigin, localDirection, maxDistance);
+}
+
+bool SceneBvh::computeBounds(Layer layer, entt::entity e, math::Aabb& box) const
+{
+    const auto wt = m_reg.try_get<components::WorldTransform>(e);
+
+    if (!wt) {
+        return false;
+    }
+
+    if (layer == Lights) {
+        XMFLOAT3 position;
+        XMStoreFloat3(&position, wt->getPosition());
+
+        box = math::Aabb::fromSphere(position, m_reg.get<components::PointLight>(e).radius);
+        return true;
+    }
+
+    math::Aabb local;
+
+    if (!getModelBounds(layer, e, local)) {
+        return false;
+    }
+
+    box = local.transformed(wt->matrix);
+    return true;
+}
+
+bool SceneBvh::getModelBounds(Layer layer, entt::entity e, math::Aabb& box) const
+{
+    if (m_reg.has<components::StaticBatched>(e) != (layer == StaticRenderables)) {
+        return false;
+    }
+
+    const auto& assets = getAssetRegistry();
+    auto model = m_reg.get<components::Renderable>(e).model;
+
+    // Models that aren't loaded can't be drawn or picked anyway
+    if (!assets.isLoaded(model)) {
+        return false;
+    }
+
+    const auto& bounds = assets.get(model).bounds;
+
+    XMStoreFloat3(&box.min, bounds.min.vec);
+    XMStoreFloat3(&box.max, bounds.max.vec);
+    return true;
+}
+
+void SceneBvh::refresh(Tree& tree, entt::entity e)
+{
+    math::Aabb box;
+
+    if (!computeBounds(tree.layer, e, box)) {
+        removeProxy(tree, e);
+        return;
+    }
+
+    placeProxy(tree, e, box);
+}
+
+void SceneBvh::placeProxy(Tree& tree, entt::entity e, const math::Aabb& box)
+{
+    auto idx = entityIndex(e);
+
+    if (idx >= tree.proxies.size()) {
+        tree.proxies.resize(idx + 1, DynamicAabbTree::Null);
+    }
+
+    auto& proxy = tree.proxies[idx];
+
+    if (proxy == DynamicAabbTree::Null) {
+        proxy = tree.tree.createProxy(box, u32(entt::to_integral(e)));
+    } else {
+        tree.tree.moveProxy(proxy, box);
+    }
+}
+
+void SceneBvh::removeProxy(Tree& tree, entt::entity e)
+{
+    auto idx = entityIndex(e);
+
+    if (idx >= tree.proxies.size() || tree.proxies[idx] == DynamicAabbTree::Null) {
+        return;
+    }
+
+    tree.tree.destroyProxy(tree.proxies[idx]);
+    tree.proxies[idx] = DynamicAabbTree::Null;
+}
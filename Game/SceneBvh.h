@@ -0,0 +1,87 @@
+#pragma once
+
+#include "Common.h"
+#include "DynamicAabbTree.h"
+#include "Geometry.h"
+#include "MathBatch.h"
+
+#include <DirectXMath.h>
+#include <entt/entt.hpp>
+#include <vector>
+
+class TransformSystem;
+
+// World space bounds of renderables and point lights for culling and picking.
+//
+// Proxies are refit in update() for the entities TransformSystem recomputed, so it has
+// to run after TransformSystem::update(). Renderables and lights live in separate trees
+// so culling one doesn't have to walk the other. Renderables merged by StaticGeometry
+// get their own tree too, they're drawn per chunk but still picked and used as occluders
+// one at a time.
+class SceneBvh
+{
+public:
+    enum Layer : u32
+    {
+        Renderables = 1 << 0,
+        Lights = 1 << 1,
+        StaticRenderables = 1 << 2,
+        All = Renderables | Lights | StaticRenderables,
+    };
+
+    SceneBvh(entt::registry& reg, TransformSystem& transforms);
+
+    void onRenderableChanged(entt::registry&, entt::entity);
+    void onRenderableDestroyed(entt::registry&, entt::entity);
+    void onLightChanged(entt::registry&, entt::entity);
+    void onLightDestroyed(entt::registry&, entt::entity);
+    void onTransformDestroyed(entt::registry&, entt::entity);
+
+    void update();
+
+    // Results are appended to `out`
+    void queryFrustum(const math::Frustum& frustum, u32 layers, std::vector<entt::entity>& out) const;
+    void querySphere(const DirectX::XMFLOAT3& center, float radius, u32 layers, std::vector<entt::entity>& out) const;
+
+    // Closest entity hit by the ray, entt::null if none. Renderables are tested against
+    // their triangles, lights against their bounds. `direction` doesn't need to be
+    // normalized, distances are in units of its length.
+    entt::entity raycast(const DirectX::XMFLOAT3& origin, const DirectX::XMFLOAT3& direction, float maxDistance,
+        u32 layers, float* distance = nullptr) const;
+
+    u32 getProxyCount(u32 layers = All) const;
+    i32 getHeight(u32 layers = All) const;
+
+private:
+    struct Tree
+    {
+        Layer layer;
+        DynamicAabbTree tree;
+
+        // Entity index -> proxy
+        std::vector<i32> proxies;
+        std::vector<entt::entity> dirty;
+    };
+
+    bool computeBounds(Layer layer, entt::entity e, math::Aabb& box) const;
+
+    // Model space bounds of a renderable, false if it isn't in the layer's tree
+    bool getModelBounds(Layer layer, entt::entity e, math::Aabb& box) const;
+    float raycastMesh(entt::entity e, const DirectX::XMFLOAT3& origin, const DirectX::XMFLOAT3& direction,
+        float maxDistance) const;
+    void refresh(Tree& tree, entt::entity e);
+    void placeProxy(Tree& tree, entt::entity e, const math::Aabb& box);
+    void removeProxy(Tree& tree, entt::entity e);
+
+    entt::registry& m_reg;
+    TransformSystem& m_transforms;
+
+    Tree m_trees[3] = { { Renderables }, { Lights }, { StaticRenderables } };
+
+    // Scratch for refitting the moved renderables in update()
+    std::vector<entt::entity> m_refitEntities;
+    std::vector<Tree*> m_refitTrees;
+    math::AabbArray<math::Model> m_refitBounds;
+    math::AffineArray<math::Model, math::World> m_refitWorlds;
+    math::AabbArray<math::World> m_refitWorldBounds;
+};
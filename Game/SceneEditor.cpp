@@ -11,6 +11,7 @@
 #include "Components/Transform.h"
 #include "Components/Renderable.h"
 #include "Components/PointLight.h"
+#include "Components/Hierarchy.h"
 
 #include <im3d.h>
 #include <im3d_math.h>
@@ -45,7 +46,7 @@ static WorldVector screenToWorldDirection(const Camera& camera, int x, int y, co
     return dir.normalized();
 }
 
-SceneEditor::SceneEditor(Scene& scene, InputMap& inputs, const std::vector<ModelAsset>& models) :
+SceneEditor::SceneEditor(Scene& scene, InputMap& inputs, const std::vector<AssetId>& models) :
     GameBase(inputs), m_scene(scene), m_models(models), m_nextId(int(scene.reg.size()))
 {
     auto doBind = [this](SDL_Keycode k, float& target, float value) {
@@ -75,10 +76,18 @@ SceneEditor::SceneEditor(Scene& scene, InputMap& inputs, const std::vector<Model
         auto from = m_camera.getPosition();
         auto to = from + (100.0f * m_camera.pixelToWorldDirection(x, y));
 
-        if (auto hit = m_scene.physicsWorld.raycast(from, to)) {
+        XMFLOAT3 origin, direction;
+        XMStoreFloat3(&origin, from.vec);
+        XMStoreFloat3(&direction, (to - from).vec);
+
+        // Both distances are fractions of the ray, physics still catches collision
+        // shapes that have nothing to render
+        float distance = 1.0f;
+        m_currentEntity = m_scene.bvh.raycast(origin, direction, 1.0f,
+            SceneBvh::Renderables | SceneBvh::StaticRenderables, &distance);
+
+        if (auto hit = m_scene.physicsWorld.raycast(from, to); hit && hit.fraction < distance) {
             m_currentEntity = hit.entity;
-        } else {
-            m_currentEntity = entt::null;
         }
     });
 
@@ -90,9 +99,11 @@ SceneEditor::SceneEditor(Scene& scene, InputMap& inputs, const std::vector<Model
         }
     });
 
+    const auto& assets = getAssetRegistry();
+
     std::sort(m_models.begin(), m_models.end(),
-        [](const auto& a, const auto& b) {
-            return a.name < b.name;
+        [&](AssetId a, AssetId b) {
+            return assets.getName(a) < assets.getName(b);
         });
 
     m_camera.setPosition({ 0.0f, 5.0f, -5.0f });
@@ -103,6 +114,11 @@ SceneEditor::SceneEditor(Scene& scene, InputMap& inputs, const std::vector<Model
     m_componentEditors[entt::type_info<components::Physics>::id()] = &SceneEditor::physicsComponentEditor;
 }
 
+SceneEditor::~SceneEditor()
+{
+    getDebugDraw().removeStatic(m_grid);
+}
+
 static_assert(sizeof(XMFLOAT4X4A) == sizeof(Im3d::Mat4));
 
 bool SceneEditor::update(float dt)
@@ -116,19 +132,24 @@ bool SceneEditor::update(float dt)
     float a = angle * dt;
 
     if (entitySelected()) {
-        const auto& t = m_scene.reg.get<components::Transform>(m_currentEntity);
+        const auto& wt = m_scene.reg.get<components::WorldTransform>(m_currentEntity);
 
-        Im3d::Mat4 transform = t.getMatrix();
+        Im3d::Mat4 transform = wt.matrix;
 
         Im3d::PushLayerId("currentEntity");
         if (Im3d::Gizmo("gizmo", transform) && !m_physicsEnabled) {
             auto pos = transform.getTranslation();
             auto rotationQuat = XMQuaternionRotationMatrix(transform);
 
+            // The gizmo works in world space, children store their transform relative to the parent
+            XMVECTOR localScale, localRotation, localPosition;
+            XMMatrixDecompose(&localScale, &localRotation, &localPosition,
+                m_scene.transforms.worldToLocal(m_currentEntity, transform));
+
             m_scene.reg.patch<components::Transform>(m_currentEntity, [&](components::Transform& tc) {
-                tc.position = pos;
-                tc.rotationQuat = rotationQuat;
-                tc.scale = transform.getScale();
+                XMStoreFloat3(&tc.position, localPosition);
+                tc.rotationQuat = localRotation;
+                XMStoreFloat3(&tc.scale, localScale);
             });
 
             btQuaternion rot;
@@ -138,10 +159,12 @@ bool SceneEditor::update(float dt)
 
             // TODO: use patch here
             if (auto pc = m_scene.reg.try_get<components::Physics>(m_currentEntity)) {
-                pc->collisionObject->setWorldTransform(pt);
+                m_scene.physicsWorld.setWorldTransform(pc->collisionObject.get(), pt);
             } else if (auto cc = m_scene.reg.try_get<components::Collision>(m_currentEntity)) {
-                cc->collisionObject->setWorldTransform(pt);
+                m_scene.physicsWorld.setWorldTransform(cc->collisionObject.get(), pt);
             }
+
+            updateCollisionScale(m_currentEntity);
         }
         Im3d::PopLayerId();
 
@@ -161,7 +184,7 @@ bool SceneEditor::update(float dt)
     mainMenu();
     
     if (m_physicsEnabled) {
-        m_scene.physicsWorld.update(dt);
+        m_scene.physicsWorld.update();
     } else {
         m_scene.physicsWorld.editorUpdate();
     }
@@ -185,17 +208,21 @@ bool SceneEditor::entitySelected() const
 
 void SceneEditor::modelList()
 {
+    const auto& assets = getAssetRegistry();
+
     struct ModelPrefixComparison
     {
-        bool operator()(const ModelAsset& m, std::string_view p) const { return getPrefix(m.name) < p; }
-        bool operator()(std::string_view p, const ModelAsset& m) const { return p < getPrefix(m.name); }
+        const AssetRegistry& assets;
+
+        bool operator()(AssetId m, std::string_view p) const { return getPrefix(assets.getName(m)) < p; }
+        bool operator()(std::string_view p, AssetId m) const { return p < getPrefix(assets.getName(m)); }
     };
 
     if (ImGui::Begin("Models")) {
         int i = 0;
         int selection = -1;
 
-        auto modelListEntry = [&](const ModelAsset& model) {
+        auto modelListEntry = [&](AssetId model) {
             ImGuiTreeNodeFlags nodeFlags = ImGuiTreeNodeFlags_Leaf 
                 | ImGuiTreeNodeFlags_NoTreePushOnOpen
                 | ImGuiTreeNodeFlags_OpenOnDoubleClick
@@ -205,7 +232,7 @@ void SceneEditor::modelList()
                 nodeFlags |= ImGuiTreeNodeFlags_Selected;
             }
 
-            ImGui::TreeNodeEx(model.name.c_str(), nodeFlags);
+            ImGui::TreeNodeEx(assets.getName(model).c_str(), nodeFlags);
 
             if (i == m_currentModelIdx) {
                 if (ImGui::IsItemHovered()) {
@@ -227,8 +254,8 @@ void SceneEditor::modelList()
 
         auto it = m_models.cbegin();
         while (it != m_models.cend()) {
-            auto prefix = getPrefix(it->name);
-            auto [begin, end] = std::equal_range(it, m_models.cend(), prefix, ModelPrefixComparison{});
+            auto prefix = getPrefix(assets.getName(*it));
+            auto [begin, end] = std::equal_range(it, m_models.cend(), prefix, ModelPrefixComparison{ assets });
 
             if (begin != it) {
                 modelListEntry(*it);
@@ -330,6 +357,8 @@ void SceneEditor::entityPropertiesWindow()
             changed |= ImGui::SliderAngle("Z", &t.rotation.z, -180.0f, 180.0f);
             changed |= ImGui::InputFloat3("Scale", &t.scale.x);
 
+            parentSelector(m_currentEntity);
+
             if (changed) {
                 auto rotationQuat = XMQuaternionRotationRollPitchYaw(t.rotation.x, t.rotation.y, t.rotation.z);
 
@@ -344,10 +373,12 @@ void SceneEditor::entityPropertiesWindow()
 
                 // TODO: physics and collision components should have a common interface
                 if (auto pc = m_scene.reg.try_get<components::Physics>(m_currentEntity)) {
-                    pc->collisionObject->setWorldTransform(pt);
+                    m_scene.physicsWorld.setWorldTransform(pc->collisionObject.get(), pt);
                 } else if (auto cc = m_scene.reg.try_get<components::Collision>(m_currentEntity)) {
-                    cc->collisionObject->setWorldTransform(pt);
+                    m_scene.physicsWorld.setWorldTransform(cc->collisionObject.get(), pt);
                 }
+
+                updateCollisionScale(m_currentEntity);
             }
         }
 
@@ -372,9 +403,7 @@ void SceneEditor::renderableComponentEditor(entt::entity e)
             m_scene.reg.remove_if_exists<components::Renderable>(e);
             rc = nullptr;
         } else if (render && !rc) {
-            const auto& model = m_models.front();
-            auto& rc = m_scene.reg.emplace<components::Renderable>(e,
-                model.name, model.renderable, model.bounds);
+            m_scene.reg.emplace<components::Renderable>(e, m_models.front());
         }
     }
 
@@ -382,7 +411,7 @@ void SceneEditor::renderableComponentEditor(entt::entity e)
         int selected = 0;
 
         for (size_t i = 0; i < m_models.size(); i++) {
-            if (rc->name == m_models[i].name) {
+            if (rc->model == m_models[i]) {
                 selected = int(i);
                 break;
             }
@@ -393,7 +422,7 @@ void SceneEditor::renderableComponentEditor(entt::entity e)
         auto getter = [](void* data, int idx, const char** out) {
             const auto& items = *reinterpret_cast<const decltype(m_models)*>(data);
 
-            *out = items[idx].name.c_str();
+            *out = getAssetRegistry().getName(items[idx]).c_str();
 
             return true;
         };
@@ -407,10 +436,7 @@ void SceneEditor::renderableComponentEditor(entt::entity e)
         if (newSelection != selected) {
             m_scene.reg.patch<components::Renderable>(e,
                 [&](components::Renderable& r) {
-                    const auto& model = m_models[newSelection];
-                    r.name = model.name;
-                    r.renderable = model.renderable;
-                    r.bounds = model.bounds;
+                    r.model = m_models[newSelection];
                 });
         }
     }
@@ -432,8 +458,8 @@ void SceneEditor::physicsComponentEditor(entt::entity e)
 
     if (auto pc = m_scene.reg.try_get<components::Physics>(e); hasPhysics && pc) {
         if (const auto* rc = m_scene.reg.try_get<components::Renderable>(e); rc && created) {
-            pc->collisionShape = getCollisionMesh(rc->name);
-            pc->collisionObject->setCollisionShape(pc->collisionShape);
+            const auto& scale = m_scene.reg.get<components::Transform>(e).scale;
+            m_scene.physicsWorld.setShape(pc->collisionObject.get(), pc->collisionShape, rc->model, scale);
         }
 
         bool changed = false;
@@ -446,24 +472,24 @@ void SceneEditor::physicsComponentEditor(entt::entity e)
                     pc->collisionShape->calculateLocalInertia(pc->mass, inertia);
                 }
 
-                rb->setMassProps(pc->mass, inertia);
+                m_scene.physicsWorld.enqueue([rb, mass = pc->mass, inertia] {
+                    rb->setMassProps(mass, inertia);
+                });
             }
         }
 
-        int idx = pc->collisionShape->getUserIndex();
+        auto id = AssetId(pc->collisionShape->getUserIndex());
         auto previewText = "(null)";
-        if (idx >= 0 && idx < int(m_models.size())) {
-            previewText = m_models[idx].name.c_str();
+        if (getAssetRegistry().isValid(id)) {
+            previewText = getAssetRegistry().getName(id).c_str();
         }
 
         if (ImGui::BeginCombo("Collision mesh", previewText)) {
-            for (int i = 0; const auto& model : m_models) {
-                if (ImGui::Selectable(model.name.c_str(), i == idx)) {
-                    pc->collisionShape = getCollisionMesh(model.name);
-                    pc->collisionObject->setCollisionShape(pc->collisionShape);
+            for (auto model : m_models) {
+                if (ImGui::Selectable(getAssetRegistry().getName(model).c_str(), model == id)) {
+                    const auto& scale = m_scene.reg.get<components::Transform>(e).scale;
+                    m_scene.physicsWorld.setShape(pc->collisionObject.get(), pc->collisionShape, model, scale);
                 }
-
-                i++;
             }
 
             ImGui::EndCombo();
@@ -487,26 +513,24 @@ void SceneEditor::collisionComponentEditor(entt::entity e)
 
     if (auto cc = m_scene.reg.try_get<components::Collision>(e); hasCollision && cc) {
         if (const auto* rc = m_scene.reg.try_get<components::Renderable>(e); rc && created) {
-            cc->collisionShape = getCollisionMesh(rc->name);
-            cc->collisionObject->setCollisionShape(cc->collisionShape);
+            const auto& scale = m_scene.reg.get<components::Transform>(e).scale;
+            m_scene.physicsWorld.setShape(cc->collisionObject.get(), cc->collisionShape, rc->model, scale);
         }
 
         bool changed = false;
 
-        int idx = cc->collisionShape->getUserIndex();
+        auto id = AssetId(cc->collisionShape->getUserIndex());
         auto previewText = "(null)";
-        if (idx >= 0 && idx < int(m_models.size())) {
-            previewText = m_models[idx].name.c_str();
+        if (getAssetRegistry().isValid(id)) {
+            previewText = getAssetRegistry().getName(id).c_str();
         }
 
         if (ImGui::BeginCombo("Collision mesh", previewText)) {
-            for (int i = 0; const auto& model : m_models) {
-                if (ImGui::Selectable(model.name.c_str(), i == idx)) {
-                    cc->collisionShape = getCollisionMesh(model.name);
-                    cc->collisionObject->setCollisionShape(cc->collisionShape);
+            for (auto model : m_models) {
+                if (ImGui::Selectable(getAssetRegistry().getName(model).c_str(), model == id)) {
+                    const auto& scale = m_scene.reg.get<components::Transform>(e).scale;
+                    m_scene.physicsWorld.setShape(cc->collisionObject.get(), cc->collisionShape, model, scale);
                 }
-
-                i++;
             }
 
             ImGui::EndCombo();
@@ -542,32 +566,59 @@ void SceneEditor::pointLightComponentEditor(entt::entity e)
             if (std::fabs(plc->radius) <= FLT_EPSILON) {
                 plc->radius = 1.0f;
             }
+
+            // Lets the BVH know the radius might have changed
+            m_scene.reg.patch<components::PointLight>(e);
         }
     }
 }
 
-btCollisionShape* SceneEditor::getCollisionMesh(const std::string& name)
+void SceneEditor::parentSelector(entt::entity e)
 {
-    if (auto collisionMesh = m_scene.physicsWorld.getCollisionMesh(name)) {
-        return collisionMesh;
+    auto parent = m_scene.transforms.getParent(e);
+
+    auto previewText = "(none)";
+    if (const auto m = m_scene.reg.try_get<components::Misc>(parent); m && parent != entt::null) {
+        previewText = m->name.c_str();
     }
 
-    auto it = std::find_if(m_models.cbegin(), m_models.cend(), [&](const ModelAsset& m) {
-        return m.name == name;
-    });
+    if (ImGui::BeginCombo("Parent", previewText)) {
+        if (ImGui::Selectable("(none)", parent == entt::null) && parent != entt::null) {
+            m_scene.transforms.setParent(e, entt::null);
+        }
+
+        m_scene.reg.view<components::Misc, components::Transform>()
+            .each([&](entt::entity candidate, const components::Misc& m, const components::Transform&) {
+                // Can't parent to itself or anything below it
+                if (m_scene.transforms.isAncestor(e, candidate)) {
+                    return;
+                }
+
+                ImGui::PushID(int(entt::to_integral(candidate)));
+                if (ImGui::Selectable(m.name.c_str(), candidate == parent) && candidate != parent) {
+                    m_scene.transforms.setParent(e, candidate);
+                }
+                ImGui::PopID();
+            });
 
-    if (it != m_models.cend()) {
-        int idx = int(std::distance(m_models.cbegin(), it));
-        Mesh mesh;
-        mesh.load(it->filename);
+        ImGui::EndCombo();
+    }
+}
 
-        auto collisionShape = m_scene.physicsWorld.createCollisionMesh(mesh.getName(), mesh);
-        collisionShape->setUserIndex(idx);
+void SceneEditor::updateCollisionScale(entt::entity e)
+{
+    const auto& scale = m_scene.reg.get<components::Transform>(e).scale;
 
-        return collisionShape;
+    // Shapes remember which model they were made from
+    if (auto pc = m_scene.reg.try_get<components::Physics>(e)) {
+        auto model = AssetId(pc->collisionShape->getUserIndex());
+        m_scene.physicsWorld.setShape(pc->collisionObject.get(), pc->collisionShape, model, scale);
     }
 
-    return nullptr;
+    if (auto cc = m_scene.reg.try_get<components::Collision>(e)) {
+        auto model = AssetId(cc->collisionShape->getUserIndex());
+        m_scene.physicsWorld.setShape(cc->collisionObject.get(), cc->collisionShape, model, scale);
+    }
 }
 
 void SceneEditor::sceneWindow()
@@ -575,12 +626,42 @@ void SceneEditor::sceneWindow()
     if (ImGui::Begin("Scene")) {
         ImGui::InputText("Name", &m_scene.name);
         ImGui::Separator();
-        ImGui::Checkbox("Simulate physics", &m_physicsEnabled);
+        if (ImGui::Checkbox("Simulate physics", &m_physicsEnabled)) {
+            if (m_physicsEnabled) {
+                m_scene.physicsWorld.start();
+            } else {
+                m_scene.physicsWorld.stop();
+            }
+        }
 
         if (ImGui::Checkbox("Draw physics models", &m_drawPhysics)) {
             m_scene.physicsWorld.setDebugDrawMode(m_drawPhysics ? btIDebugDraw::DBG_DrawWireframe : 0);
         }
 
+        ImGui::Text("Collision shapes: %zu", m_scene.physicsWorld.getShapeCount());
+        ImGui::Text("BVH proxies: %u (height %d)", m_scene.bvh.getProxyCount(), m_scene.bvh.getHeight());
+
+        // Moving a static entity releases its chunk, baking again picks it back up
+        ImGui::Text("Static chunks: %u (%u entities)", m_scene.staticGeometry.getChunkCount(),
+            m_scene.staticGeometry.getEntityCount());
+        ImGui::Text("HLOD proxies: %u", m_scene.staticGeometry.getProxyCount());
+
+        auto hlodDistance = m_scene.staticGeometry.getHlodDistance();
+
+        if (ImGui::SliderFloat("HLOD distance", &hlodDistance, 0.0f, 500.0f)) {
+            m_scene.staticGeometry.setHlodDistance(hlodDistance);
+        }
+
+        if (ImGui::Button("Bake static geometry")) {
+            m_scene.staticGeometry.requestBake();
+        }
+
+        ImGui::SameLine();
+
+        if (ImGui::Button("Clear static geometry")) {
+            m_scene.staticGeometry.clear();
+        }
+
         ImGui::Separator();
 
         if (ImGui::Button("New entity")) {
@@ -622,11 +703,11 @@ entt::entity SceneEditor::createEntity()
         t = m_scene.reg.get<components::Transform>(m_currentEntity);
     }
 
-    const auto& model = m_models[m_currentModelIdx];
+    auto model = m_models[m_currentModelIdx];
 
-    m_scene.reg.emplace<components::Misc>(e, fmt::format("{}:{}", model.name, m_nextId++));
+    m_scene.reg.emplace<components::Misc>(e, fmt::format("{}:{}", getAssetRegistry().getName(model), m_nextId++));
     m_scene.reg.emplace<components::Transform>(e, t);
-    m_scene.reg.emplace<components::Renderable>(e, model.name, model.renderable, model.bounds);
+    m_scene.reg.emplace<components::Renderable>(e, model);
     //m_scene.reg.emplace<components::Physics>(e);
 
     return e;
@@ -680,23 +761,32 @@ void SceneEditor::mainMenu()
 
 void SceneEditor::drawGrid()
 {
-    Im3d::PushDrawState();
+    // The grid never changes, so it's built once and kept in the retained debug buffer
+    if (m_grid == DebugDraw::InvalidStaticId) {
+        constexpr float size = 1.5f;
+        constexpr u32 gridColor2 = 0x808080ff;
 
-    float size = 1.5f;
-    Im3d::SetSize(size);
-    Im3d::DrawLine({ -100.0f, 0.0f, 0.0f }, { 100.0f, 0.0f, 0.0f }, size, Im3d::Color_White);
-    Im3d::DrawLine({ 0.0f, 0.0f, -100.0f }, { 0.0f, 0.0f, 100.0f }, size, Im3d::Color_White);
+        std::vector<DebugDraw::Vertex> lines;
 
-    constexpr u32 gridColor2 = 0x808080ff;
+        auto line = [&](const Im3d::Vec3& from, const Im3d::Vec3& to, Im3d::Color color) {
+            lines.emplace_back(from, size, color);
+            lines.emplace_back(to, size, color);
+        };
+
+        line({ -100.0f, 0.0f, 0.0f }, { 100.0f, 0.0f, 0.0f }, Im3d::Color_White);
+        line({ 0.0f, 0.0f, -100.0f }, { 0.0f, 0.0f, 100.0f }, Im3d::Color_White);
+
+        for (auto i = 1; i <= 20; i++) {
+            line({ float(i) *  5.0f, 0.0f, 100.0f }, { float(i) *  5.0f, 0.0f, -100.0f }, gridColor2);
+            line({ float(i) * -5.0f, 0.0f, 100.0f }, { float(i) * -5.0f, 0.0f, -100.0f }, gridColor2);
+            line({ 100.0f, 0.0f, float(i) *  5.0f }, { -100.0f, 0.0f, float(i) *  5.0f }, gridColor2);
+            line({ 100.0f, 0.0f, float(i) * -5.0f }, { -100.0f, 0.0f, float(i) * -5.0f }, gridColor2);
+        }
 
-    for (auto i = 1; i <= 20; i++) {
-        Im3d::DrawLine({ float(i) *  5.0f, 0.0f, 100.0f }, { float(i) *  5.0f, 0.0f, -100.0f }, size, gridColor2);
-        Im3d::DrawLine({ float(i) * -5.0f, 0.0f, 100.0f }, { float(i) * -5.0f, 0.0f, -100.0f }, size, gridColor2);
-        Im3d::DrawLine({ 100.0f, 0.0f, float(i) *  5.0f }, { -100.0f, 0.0f, float(i) *  5.0f }, size, gridColor2);
-        Im3d::DrawLine({ 100.0f, 0.0f, float(i) * -5.0f }, { -100.0f, 0.0f, float(i) * -5.0f }, size, gridColor2);
+        m_grid = getDebugDraw().addStatic(DebugDraw::Primitive::Lines, lines);
     }
 
-    Im3d::PopDrawState();
+    getDebugDraw().drawStatic(m_grid);
 }
 
 void SceneEditor::drawEntityBounds(entt::entity e)
@@ -705,21 +795,24 @@ void SceneEditor::drawEntityBounds(entt::entity e)
         return;
     }
 
-    const auto t = std::as_const(m_scene.reg).try_get<components::Transform>(e);
+    const auto wt = std::as_const(m_scene.reg).try_get<components::WorldTransform>(e);
 
-    if (!t) {
+    if (!wt) {
         return;
     }
 
     Im3d::PushDrawState();
     Im3d::PushMatrix();
-    Im3d::SetMatrix(t->getMatrix());
+    Im3d::SetMatrix(wt->matrix);
     Im3d::SetSize(3.0f);
 
-    if (const auto rc = std::as_const(m_scene.reg).try_get<components::Renderable>(e)) {
+    if (const auto rc = std::as_const(m_scene.reg).try_get<components::Renderable>(e);
+        rc && getAssetRegistry().isValid(rc->model)) {
+        const auto& bounds = getAssetRegistry().get(rc->model).bounds;
+
         XMFLOAT3 bMin, bMax;
-        XMStoreFloat3(&bMin, rc->bounds.min.vec);
-        XMStoreFloat3(&bMax, rc->bounds.max.vec);
+        XMStoreFloat3(&bMin, bounds.min.vec);
+        XMStoreFloat3(&bMax, bounds.max.vec);
 
         Im3d::DrawAlignedBox(Im3d::Vec3(bMin.x, bMin.y, bMin.z), Im3d::Vec3(bMax.x, bMax.y, bMax.z));
     } else if (const auto plc = std::as_const(m_scene.reg).try_get<components::PointLight>(e)) {
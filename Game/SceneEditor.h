@@ -2,6 +2,8 @@
 
 #include "Game.h"
 #include "Renderer.h"
+#include "Assets.h"
+#include "DebugDraw.h"
 
 #include <entt/entt.hpp>
 #include <string>
@@ -13,19 +15,6 @@
 
 struct Scene;
 
-struct ModelAsset
-{
-    ModelAsset(const std::string& name, Renderable* renderable, Bounds bounds, const std::string_view filename = "") :
-        name(name), renderable(renderable), bounds(bounds), filename(filename) {}
-
-    ModelAsset() = default;
-
-    std::string name;
-    std::string filename;
-    Renderable* renderable = nullptr;
-    Bounds bounds;
-};
-
 // HACK: This exception is thrown when we want to load a new scene, so we catch the
 // exception and destroy/rebuild everything
 struct LoadSceneException
@@ -36,7 +25,8 @@ struct LoadSceneException
 class SceneEditor : public GameBase
 {
 public:
-    SceneEditor(Scene& scene, InputMap& inputs, const std::vector<ModelAsset>& models);
+    SceneEditor(Scene& scene, InputMap& inputs, const std::vector<AssetId>& models);
+    ~SceneEditor();
 
     virtual bool update(float dt) override;
     virtual void render(class IRenderer*) override;
@@ -53,7 +43,7 @@ private:
     using ComponentEditorFunc = void (SceneEditor::*)(entt::entity);
     std::unordered_map<entt::id_type, ComponentEditorFunc> m_componentEditors;
 
-    std::vector<ModelAsset> m_models;
+    std::vector<AssetId> m_models;
 
     int m_currentModelIdx = -1;
 
@@ -66,6 +56,8 @@ private:
     bool m_physicsEnabled = false;
     bool m_drawPhysics = false;
 
+    DebugDraw::StaticId m_grid = DebugDraw::InvalidStaticId;
+
     XMFLOAT3 velocity{ 0.0f, 0.0f, 0.0f };
 
     bool entitySelected() const;
@@ -83,7 +75,9 @@ private:
     void collisionComponentEditor(entt::entity);
     void pointLightComponentEditor(entt::entity);
 
-    class btCollisionShape* getCollisionMesh(const std::string&);
+    void parentSelector(entt::entity);
+
+    void updateCollisionScale(entt::entity);
 
     void sceneWindow();
 
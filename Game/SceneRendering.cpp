@@ -0,0 +1,221 @@
+#include "pch.h"
+
+#include "SceneRendering.h"
+#include "Assets.h"
+#include "Camera.h"
+#include "OcclusionBuffer.h"
+#include "Scene.h"
+#include "Profiler.h"
+#include "TaskScheduler.h"
+
+#include "Components/PointLight.h"
+#include "Components/Renderable.h"
+#include "Components/Transform.h"
+
+using namespace DirectX;
+
+namespace
+{
+
+// Occluders smaller than this on screen, roughly radius over distance, hide too little
+// to be worth rasterizing
+constexpr float MinOccluderSize = 0.05f;
+constexpr u32 MaxOccluders = 64;
+
+constexpr u32 OcclusionTestsPerTask = 256;
+
+void addInstances(const Scene& scene, const std::vector<entt::entity>& entities, std::vector<RenderBatch>& batches)
+{
+    for (auto& batch : batches) {
+        batch.instances.clear();
+    }
+
+    for (auto e : entities) {
+        const auto& wt = scene.reg.get<components::WorldTransform>(e);
+        const auto& rc = scene.reg.get<components::Renderable>(e);
+
+        if (u32(rc.model) >= batches.size()) {
+            continue;
+        }
+
+        // The shader works out the normal matrix, so this is just a transpose
+        auto world = XMMatrixTranspose(wt.matrix);
+        auto& instance = batches[u32(rc.model)].instances.emplace_back();
+        XMStoreFloat4(&instance.World[0], world.r[0]);
+        XMStoreFloat4(&instance.World[1], world.r[1]);
+        XMStoreFloat4(&instance.World[2], world.r[2]);
+    }
+}
+
+math::Aabb worldBounds(const ModelAsset& model, const components::WorldTransform& wt)
+{
+    math::Aabb local;
+    XMStoreFloat3(&local.min, model.bounds.min.vec);
+    XMStoreFloat3(&local.max, model.bounds.max.vec);
+
+    return local.transformed(wt.matrix);
+}
+
+// Starts a new occlusion frame with the largest occluders among the entities
+void rasterizeOccluders(const Scene& scene, const Camera& camera, OcclusionBuffer& occlusion,
+    const std::vector<entt::entity>& entities)
+{
+    const auto& assets = getAssetRegistry();
+
+    XMFLOAT3 eye;
+    XMStoreFloat3(&eye, camera.getPosition().vec);
+
+    struct Candidate
+    {
+        entt::entity entity;
+        float size;
+    };
+
+    std::vector<Candidate> candidates;
+
+    for (auto e : entities) {
+        auto model = scene.reg.get<components::Renderable>(e).model;
+
+        if (!assets.isLoaded(model) || assets.get(model).occluder.empty()) {
+            continue;
+        }
+
+        auto box = worldBounds(assets.get(model), scene.reg.get<components::WorldTransform>(e));
+
+        auto dx = (box.max.x - box.min.x) * 0.5f;
+        auto dy = (box.max.y - box.min.y) * 0.5f;
+        auto dz = (box.max.z - box.min.z) * 0.5f;
+        auto cx = (box.max.x + box.min.x) * 0.5f - eye.x;
+        auto cy = (box.max.y + box.min.y) * 0.5f - eye.y;
+        auto cz = (box.max.z + box.min.z) * 0.5f - eye.z;
+
+        auto size = std::sqrt((dx * dx + dy * dy + dz * dz) / std::max(cx * cx + cy * cy + cz * cz, 1e-6f));
+
+        if (size >= MinOccluderSize) {
+            candidates.push_back(Candidate{ e, size });
+        }
+    }
+
+    auto count = std::min<size_t>(candidates.size(), MaxOccluders);
+
+    std::partial_sort(candidates.begin(), candidates.begin() + count, candidates.end(),
+        [](const Candidate& a, const Candidate& b) { return a.size > b.size; });
+
+    occlusion.begin(XMMatrixMultiply(camera.getViewMatrix().mat, camera.getProjectionMatrix().mat));
+
+    for (size_t i = 0; i < count; i++) {
+        auto e = candidates[i].entity;
+        const auto& model = assets.get(scene.reg.get<components::Renderable>(e).model);
+
+        occlusion.addOccluder(model.occluder, scene.reg.get<components::WorldTransform>(e).matrix);
+    }
+
+    occlusion.rasterize();
+}
+
+void removeOccluded(const Scene& scene, const OcclusionBuffer& occlusion, std::vector<entt::entity>& entities)
+{
+    const auto& assets = getAssetRegistry();
+
+    // Tested in parallel, then compacted in order so the result is the same every run
+    std::vector<u8> visible(entities.size());
+
+    getTaskScheduler().parallelFor(0, u32(entities.size()), OcclusionTestsPerTask, [&](u32 begin, u32 end) {
+        for (auto i = begin; i < end; i++) {
+            auto e = entities[i];
+            auto model = scene.reg.get<components::Renderable>(e).model;
+
+            visible[i] = !assets.isLoaded(model)
+                || occlusion.isVisible(worldBounds(assets.get(model), scene.reg.get<components::WorldTransform>(e)));
+        }
+    });
+
+    size_t kept = 0;
+
+    for (size_t i = 0; i < entities.size(); i++) {
+        if (visible[i]) {
+            entities[kept++] = entities[i];
+        }
+    }
+
+    entities.resize(kept);
+}
+
+}
+
+void collectRenderBatches(const Scene& scene, const math::Frustum& frustum,
+    std::vector<RenderBatch>& batches, std::vector<entt::entity>& scratch)
+{
+    PROFILE_FUNC();
+
+    scratch.clear();
+    scene.bvh.queryFrustum(frustum, SceneBvh::Renderables, scratch);
+
+    addInstances(scene, scratch, batches);
+}
+
+void collectRenderBatches(const Scene& scene, const Camera& camera, OcclusionBuffer& occlusion,
+    std::vector<RenderBatch>& batches, std::vector<entt::entity>& scratch)
+{
+    PROFILE_FUNC();
+
+    // Static entities are drawn with their chunks, but the walls and floors among them
+    // are the best occluders
+    scratch.clear();
+    scene.bvh.queryFrustum(camera.getFrustum(), SceneBvh::StaticRenderables, scratch);
+    auto staticCount = scratch.size();
+
+    scene.bvh.queryFrustum(camera.getFrustum(), SceneBvh::Renderables, scratch);
+
+    rasterizeOccluders(scene, camera, occlusion, scratch);
+
+    scratch.erase(scratch.begin(), scratch.begin() + staticCount);
+    removeOccluded(scene, occlusion, scratch);
+
+    addInstances(scene, scratch, batches);
+}
+
+void cullOccluded(const Scene& scene, const Camera& camera, OcclusionBuffer& occlusion,
+    std::vector<entt::entity>& entities)
+{
+    PROFILE_FUNC();
+
+    rasterizeOccluders(scene, camera, occlusion, entities);
+    removeOccluded(scene, occlusion, entities);
+}
+
+void collectPointLights(const Scene& scene, const math::Frustum& frustum,
+    std::vector<PointLight>& lights, std::vector<entt::entity>& scratch)
+{
+    PROFILE_FUNC();
+
+    lights.clear();
+
+    scratch.clear();
+    scene.bvh.queryFrustum(frustum, SceneBvh::Lights, scratch);
+
+    for (auto e : scratch) {
+        const auto& wt = scene.reg.get<components::WorldTransform>(e);
+        const auto& plc = scene.reg.get<components::PointLight>(e);
+
+        PointLight l;
+
+        XMFLOAT3 position;
+        XMStoreFloat3(&position, wt.getPosition());
+
+        l.Color.x = plc.color.x;
+        l.Color.y = plc.color.y;
+        l.Color.z = plc.color.z;
+        l.Color.w = plc.quadraticAttenuation;
+
+        l.Position.x = position.x;
+        l.Position.y = position.y;
+        l.Position.z = position.z;
+        l.Position.w = plc.linearAttenuation;
+
+        l.Intensity = plc.intensity;
+        l.Radius = plc.radius;
+
+        lights.push_back(l);
+    }
+}
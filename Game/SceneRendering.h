@@ -0,0 +1,33 @@
+#pragma once
+
+#include "Common.h"
+#include "Geometry.h"
+#include "Renderer.h"
+
+#include <entt/entt.hpp>
+#include <vector>
+
+struct Scene;
+class Camera;
+class OcclusionBuffer;
+
+// The CPU side of building a frame, shared by the main loop and the benchmarks.
+// `scratch` holds the BVH query results so it doesn't have to be reallocated every frame.
+
+// Clears the batches and adds an instance for every renderable in the frustum. Batches
+// are indexed by AssetId, models outside of the list are skipped. Entities merged by
+// StaticGeometry are left out, their chunks are collected from there.
+void collectRenderBatches(const Scene& scene, const math::Frustum& frustum,
+    std::vector<RenderBatch>& batches, std::vector<entt::entity>& scratch);
+
+// Same for a perspective camera, but also rasterizes the largest occluders in view,
+// static ones included, and skips the instances hidden behind them
+void collectRenderBatches(const Scene& scene, const Camera& camera, OcclusionBuffer& occlusion,
+    std::vector<RenderBatch>& batches, std::vector<entt::entity>& scratch);
+
+// Removes the entities hidden by the occluders among them
+void cullOccluded(const Scene& scene, const Camera& camera, OcclusionBuffer& occlusion,
+    std::vector<entt::entity>& entities);
+
+void collectPointLights(const Scene& scene, const math::Frustum& frustum,
+    std::vector<PointLight>& lights, std::vector<entt::entity>& scratch);
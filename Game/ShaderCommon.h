@@ -10,7 +10,7 @@ using float3 = DirectX::XMFLOAT3;
 using float4 = DirectX::XMFLOAT4;
 using matrix = DirectX::XMMATRIX;
 
-using uint = UINT;
+using uint = unsigned int;
 using uint2 = DirectX::XMUINT2;
 
 #define CB_STRUCT		struct alignas(16)
@@ -32,10 +32,11 @@ CB_STRUCT CameraConstants
 	matrix Projection;
 };
 
+// Per instance data. The world matrix is affine, so only the first three columns are
+// stored, as rows. The shader derives the normal matrix from them.
 CB_STRUCT RenderableConstants
 {
-    matrix World;
-    matrix WorldInvTranspose;
+    float4 World[3];
 };
 
 CB_STRUCT PSConstants
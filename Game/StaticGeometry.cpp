@@ -0,0 +1,522 @@
+#include "pch.h"
+
+#include "StaticGeometry.h"
+#include "Assets.h"
+#include "Mesh.h"
+#include "MeshMerge.h"
+#include "OcclusionBuffer.h"
+#include "PhysicsWorld.h"
+#include "Profiler.h"
+#include "TransformSystem.h"
+
+#include "Components/Renderable.h"
+#include "Components/StaticBatched.h"
+#include "Components/Transform.h"
+
+#include <cmath>
+#include <fmt/format.h>
+#include <map>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+
+using namespace DirectX;
+
+namespace
+{
+
+// One submesh of one entity
+struct Piece
+{
+    entt::entity entity;
+    const Mesh* mesh;
+    const Mesh::SubMesh* subMesh;
+    VertexRange vertices;
+};
+
+// Rounds towards negative infinity, so cells on both sides of 0 are the same size
+i32 floorDiv(i32 a, i32 b)
+{
+    return a / b - (a % b != 0 && (a < 0) != (b < 0) ? 1 : 0);
+}
+
+RenderableConstants identityInstance()
+{
+    RenderableConstants instance;
+    instance.World[0] = XMFLOAT4(1.0f, 0.0f, 0.0f, 0.0f);
+    instance.World[1] = XMFLOAT4(0.0f, 1.0f, 0.0f, 0.0f);
+    instance.World[2] = XMFLOAT4(0.0f, 0.0f, 1.0f, 0.0f);
+
+    return instance;
+}
+
+}
+
+StaticGeometry::StaticGeometry(entt::registry& reg, TransformSystem& transforms) :
+    m_reg(reg), m_transforms(transforms)
+{
+}
+
+StaticGeometry::~StaticGeometry() = default;
+
+void StaticGeometry::onEntityChanged(entt::registry&, entt::entity e)
+{
+    // The entity might be on its way out, so only remember the chunk for now
+    if (auto sb = m_reg.try_get<components::StaticBatched>(e)) {
+        m_released.push_back(sb->chunk);
+    }
+}
+
+void StaticGeometry::onStaticBatchedDestroyed(entt::registry&, entt::entity e)
+{
+    if (!m_releasing) {
+        m_released.push_back(m_reg.get<components::StaticBatched>(e).chunk);
+    }
+}
+
+void StaticGeometry::requestBake()
+{
+    m_bakeRequested = true;
+}
+
+void StaticGeometry::clear()
+{
+    for (u32 i = 0; i < m_chunks.size(); i++) {
+        releaseChunk(i);
+    }
+
+    m_chunks.clear();
+    m_proxies.clear();
+    m_released.clear();
+}
+
+void StaticGeometry::update()
+{
+    PROFILE_FUNC();
+
+    for (auto e : m_transforms.getUpdated()) {
+        onEntityChanged(m_reg, e);
+    }
+
+    for (auto idx : m_released) {
+        releaseChunk(idx);
+    }
+
+    m_released.clear();
+
+    if (m_bakeRequested) {
+        m_bakeRequested = false;
+        bake();
+    }
+}
+
+void StaticGeometry::updateRenderables(IRenderer& renderer)
+{
+    for (auto renderable : m_retired) {
+        renderer.releaseRenderable(renderable);
+    }
+
+    m_retired.clear();
+
+    for (auto& chunk : m_chunks) {
+        if (chunk.active && chunk.mesh) {
+            chunk.batch.renderable = renderer.createRenderable(*chunk.mesh);
+            chunk.mesh.reset();
+        }
+    }
+
+    for (auto& proxy : m_proxies) {
+        if (proxy.active && proxy.mesh) {
+            proxy.batch.renderable = renderer.createRenderable(*proxy.mesh);
+            proxy.mesh.reset();
+        }
+    }
+}
+
+void StaticGeometry::collectBatches(const math::Frustum& frustum, const XMFLOAT3& viewer,
+    const OcclusionBuffer* occlusion, std::vector<const RenderBatch*>& out) const
+{
+    PROFILE_FUNC();
+
+    out.clear();
+
+    auto isVisible = [&](const math::Aabb& bounds) {
+        return frustum.intersects(bounds) && (!occlusion || occlusion->isVisible(bounds));
+    };
+
+    for (const auto& proxy : m_proxies) {
+        if (!frustum.intersects(proxy.bounds)) {
+            continue;
+        }
+
+        if (proxy.active && m_hlodDistance > 0.0f && !proxy.bounds.overlapsSphere(viewer, m_hlodDistance)) {
+            if (!occlusion || occlusion->isVisible(proxy.bounds)) {
+                out.push_back(&proxy.batch);
+            }
+
+            continue;
+        }
+
+        for (auto idx : proxy.chunks) {
+            const auto& chunk = m_chunks[idx];
+
+            if (chunk.active && isVisible(chunk.bounds)) {
+                out.push_back(&chunk.batch);
+            }
+        }
+    }
+}
+
+u32 StaticGeometry::getChunkCount() const
+{
+    return u32(std::count_if(m_chunks.begin(), m_chunks.end(), [](const Chunk& c) { return c.active; }));
+}
+
+u32 StaticGeometry::getEntityCount() const
+{
+    u32 count = 0;
+
+    for (const auto& chunk : m_chunks) {
+        count += chunk.active ? u32(chunk.entities.size()) : 0;
+    }
+
+    return count;
+}
+
+u32 StaticGeometry::getProxyCount() const
+{
+    return u32(std::count_if(m_proxies.begin(), m_proxies.end(), [](const Proxy& p) { return p.active; }));
+}
+
+void StaticGeometry::bake()
+{
+    PROFILE_FUNC();
+
+    clear();
+
+    const auto& assets = getAssetRegistry();
+
+    // The meshes are only needed during the bake, so they're loaded again instead of
+    // keeping every model's vertices around
+    std::unordered_map<AssetId, Mesh> meshes;
+
+    auto getMesh = [&](AssetId id) -> const Mesh* {
+        if (auto it = meshes.find(id); it != meshes.end()) {
+            return &it->second;
+        }
+
+        auto& mesh = meshes[id];
+        const auto& filename = assets.get(id).filename;
+
+        if (!filename.empty() && std::filesystem::exists(filename)) {
+            mesh.load(filename);
+        }
+
+        return &mesh;
+    };
+
+    // Ordered so the same scene always gives the same chunks
+    using Cell = std::tuple<i32, i32, i32>;
+    std::map<Cell, std::vector<entt::entity>> cells;
+
+    for (auto e : m_reg.view<components::Renderable, components::WorldTransform>()) {
+        auto model = m_reg.get<components::Renderable>(e).model;
+
+        if (!assets.isLoaded(model) || !isStatic(e)) {
+            continue;
+        }
+
+        auto center = XMVector3Transform(
+            XMVectorScale(XMVectorAdd(assets.get(model).bounds.min.vec, assets.get(model).bounds.max.vec), 0.5f),
+            m_reg.get<components::WorldTransform>(e).matrix);
+
+        XMFLOAT3 c;
+        XMStoreFloat3(&c, XMVectorFloor(XMVectorScale(center, 1.0f / ChunkSize)));
+
+        cells[{ i32(c.x), i32(c.y), i32(c.z) }].push_back(e);
+    }
+
+    std::vector<Piece> pieces;
+    std::vector<Vertex> vertices;
+    std::vector<u16> indices;
+    std::vector<Mesh::SubMesh> subMeshes;
+    std::vector<Cell> chunkCells;
+
+    // Pieces sorted by material, so each material is one contiguous submesh
+    auto addChunk = [&](const Cell& cell, u32 part) {
+        std::stable_sort(pieces.begin(), pieces.end(), [](const Piece& a, const Piece& b) {
+            return a.subMesh->material < b.subMesh->material;
+        });
+
+        vertices.clear();
+        indices.clear();
+        subMeshes.clear();
+
+        auto& chunk = m_chunks.emplace_back();
+        auto chunkIdx = u32(m_chunks.size() - 1);
+        chunkCells.push_back(cell);
+
+        for (const auto& piece : pieces) {
+            if (subMeshes.empty() || subMeshes.back().material != piece.subMesh->material) {
+                auto& subMesh = subMeshes.emplace_back();
+                subMesh.baseIndex = u32(indices.size());
+                subMesh.material = piece.subMesh->material;
+            }
+
+            appendTransformed(piece.mesh->getVertices(), piece.mesh->getIndices(), piece.subMesh->baseIndex,
+                piece.subMesh->numIndices, piece.vertices, m_reg.get<components::WorldTransform>(piece.entity).matrix,
+                vertices, indices);
+
+            subMeshes.back().numIndices += piece.subMesh->numIndices;
+
+            if (chunk.entities.empty() || chunk.entities.back() != piece.entity) {
+                chunk.entities.push_back(piece.entity);
+            }
+        }
+
+        // Pieces of the same entity aren't next to each other after sorting
+        std::sort(chunk.entities.begin(), chunk.entities.end());
+        chunk.entities.erase(std::unique(chunk.entities.begin(), chunk.entities.end()), chunk.entities.end());
+
+        auto [x, y, z] = cell;
+        chunk.mesh = std::make_unique<Mesh>(fmt::format("static_{}_{}_{}#{}", x, y, z, part),
+            std::move(vertices), std::move(indices), std::move(subMeshes));
+
+        XMStoreFloat3(&chunk.bounds.min, chunk.mesh->getBounds().min.vec);
+        XMStoreFloat3(&chunk.bounds.max, chunk.mesh->getBounds().max.vec);
+
+        chunk.batch.instances.push_back(identityInstance());
+        chunk.active = true;
+
+        for (auto e : chunk.entities) {
+            m_reg.emplace_or_replace<components::StaticBatched>(e, chunkIdx);
+        }
+
+        pieces.clear();
+    };
+
+    for (const auto& [cell, entities] : cells) {
+        u32 part = 0;
+        u32 vertexCount = 0;
+
+        for (auto e : entities) {
+            const auto* mesh = getMesh(m_reg.get<components::Renderable>(e).model);
+
+            // Whole entities go into a chunk, so releasing the chunk releases all of it
+            auto first = pieces.size();
+            u32 entityVertices = 0;
+
+            for (const auto& subMesh : mesh->getSubMeshes()) {
+                auto range = getVertexRange(mesh->getIndices(), subMesh.baseIndex, subMesh.numIndices);
+
+                if (range.count > 0) {
+                    pieces.push_back(Piece{ e, mesh, &subMesh, range });
+                    entityVertices += range.count;
+                }
+            }
+
+            // Too big to share a chunk with anything, it's drawn on its own instead
+            if (entityVertices == 0 || entityVertices > MaxChunkVertices) {
+                pieces.resize(first);
+                continue;
+            }
+
+            if (vertexCount + entityVertices > MaxChunkVertices) {
+                std::vector<Piece> rest(pieces.begin() + first, pieces.end());
+                pieces.resize(first);
+
+                addChunk(cell, part++);
+
+                pieces = std::move(rest);
+                vertexCount = 0;
+            }
+
+            vertexCount += entityVertices;
+        }
+
+        if (!pieces.empty()) {
+            addChunk(cell, part);
+        }
+    }
+
+    // The chunk cells are ordered, so are the proxy cells
+    constexpr auto ChunksPerCell = i32(HlodCellSize / ChunkSize);
+    std::map<Cell, u32> proxyCells;
+
+    for (auto [x, y, z] : chunkCells) {
+        proxyCells.try_emplace({ floorDiv(x, ChunksPerCell), floorDiv(y, ChunksPerCell), floorDiv(z, ChunksPerCell) }, 0);
+    }
+
+    for (auto& [cell, idx] : proxyCells) {
+        idx = u32(m_proxies.size());
+        m_proxies.emplace_back();
+    }
+
+    for (u32 i = 0; i < m_chunks.size(); i++) {
+        auto& chunk = m_chunks[i];
+        auto [x, y, z] = chunkCells[i];
+
+        chunk.proxy = proxyCells[{ floorDiv(x, ChunksPerCell), floorDiv(y, ChunksPerCell), floorDiv(z, ChunksPerCell) }];
+
+        auto& proxy = m_proxies[chunk.proxy];
+        proxy.bounds = proxy.chunks.empty() ? chunk.bounds : proxy.bounds.merged(chunk.bounds);
+        proxy.chunks.push_back(i);
+    }
+
+    for (auto& proxy : m_proxies) {
+        buildProxy(proxy);
+    }
+}
+
+// Vertex clustering, every vertex moves to the average of the vertices in its grid cell
+// and the triangles that collapse are dropped. Crude, but proxies are only seen from far
+// away and it's fast enough to run on every bake.
+void StaticGeometry::buildProxy(Proxy& proxy)
+{
+    PROFILE_FUNC();
+
+    const auto& bounds = proxy.bounds;
+    auto extent = std::max({ bounds.max.x - bounds.min.x, bounds.max.y - bounds.min.y, bounds.max.z - bounds.min.z });
+    auto invCellSize = float(ProxyResolution) / std::max(extent, 0.001f);
+
+    auto getCell = [&](float value, float min) {
+        return u32(std::clamp(i32((value - min) * invCellSize), 0, i32(ProxyResolution) - 1));
+    };
+
+    std::vector<Vertex> vertices;
+    std::vector<u16> indices;
+    std::vector<u32> counts;
+
+    std::unordered_map<u32, u16> clusters;
+    std::unordered_set<u64> triangles;
+    std::vector<u16> remap;
+
+    for (auto idx : proxy.chunks) {
+        const auto& mesh = *m_chunks[idx].mesh;
+        remap.clear();
+
+        for (const auto& v : mesh.getVertices()) {
+            auto key = (getCell(v.Position.x, bounds.min.x) * ProxyResolution + getCell(v.Position.y, bounds.min.y))
+                * ProxyResolution + getCell(v.Position.z, bounds.min.z);
+
+            auto [it, inserted] = clusters.try_emplace(key, u16(vertices.size()));
+
+            if (inserted) {
+                vertices.push_back(Vertex{});
+                counts.push_back(0);
+            }
+
+            auto& cluster = vertices[it->second];
+            XMStoreFloat3(&cluster.Position, XMVectorAdd(XMLoadFloat3(&cluster.Position), XMLoadFloat3(&v.Position)));
+            XMStoreFloat3(&cluster.Normal, XMVectorAdd(XMLoadFloat3(&cluster.Normal), XMLoadFloat3(&v.Normal)));
+            XMStoreFloat4(&cluster.Color, XMVectorAdd(XMLoadFloat4(&cluster.Color), XMLoadFloat4(&v.Color)));
+            counts[it->second]++;
+
+            remap.push_back(it->second);
+        }
+
+        const auto& meshIndices = mesh.getIndices();
+
+        for (u32 i = 0; i + 2 < meshIndices.size(); i += 3) {
+            auto a = remap[meshIndices[i]];
+            auto b = remap[meshIndices[i + 1]];
+            auto c = remap[meshIndices[i + 2]];
+
+            if (a == b || b == c || a == c) {
+                continue;
+            }
+
+            // Many triangles collapse onto the same three clusters, keep one of them
+            auto lo = std::min({ a, b, c });
+            auto hi = std::max({ a, b, c });
+            auto mid = u32(a) + b + c - lo - hi;
+
+            if (triangles.insert((u64(lo) << 32) | (u64(mid) << 16) | hi).second) {
+                indices.insert(indices.end(), { a, b, c });
+            }
+        }
+    }
+
+    for (u32 i = 0; i < vertices.size(); i++) {
+        auto& v = vertices[i];
+        auto scale = 1.0f / float(counts[i]);
+
+        XMStoreFloat3(&v.Position, XMVectorScale(XMLoadFloat3(&v.Position), scale));
+        XMStoreFloat4(&v.Color, XMVectorScale(XMLoadFloat4(&v.Color), scale));
+
+        // Opposite sides of thin walls cancel out
+        auto normal = XMLoadFloat3(&v.Normal);
+        XMStoreFloat3(&v.Normal, XMVectorGetX(XMVector3LengthSq(normal)) > 1e-6f
+            ? XMVector3Normalize(normal)
+            : XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+    }
+
+    if (indices.empty()) {
+        return;
+    }
+
+    Mesh::SubMesh subMesh;
+    subMesh.numIndices = u32(indices.size());
+
+    proxy.mesh = std::make_unique<Mesh>(fmt::format("hlod_{}", proxy.chunks.front()),
+        std::move(vertices), std::move(indices), std::vector{ subMesh });
+
+    proxy.batch.instances.push_back(identityInstance());
+    proxy.active = true;
+}
+
+bool StaticGeometry::isStatic(entt::entity e) const
+{
+    for (auto p = e; p != entt::null; p = m_transforms.getParent(p)) {
+        if (m_reg.has<components::Physics>(p)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void StaticGeometry::releaseChunk(u32 idx)
+{
+    if (idx >= m_chunks.size() || !m_chunks[idx].active) {
+        return;
+    }
+
+    auto& chunk = m_chunks[idx];
+
+    m_releasing = true;
+
+    for (auto e : chunk.entities) {
+        if (m_reg.valid(e)) {
+            m_reg.remove_if_exists<components::StaticBatched>(e);
+        }
+    }
+
+    m_releasing = false;
+
+    if (chunk.batch.renderable != RenderableHandle::Invalid) {
+        m_retired.push_back(chunk.batch.renderable);
+    }
+
+    auto proxy = chunk.proxy;
+    chunk = Chunk{};
+
+    releaseProxy(proxy);
+}
+
+void StaticGeometry::releaseProxy(u32 idx)
+{
+    if (idx >= m_proxies.size() || !m_proxies[idx].active) {
+        return;
+    }
+
+    auto& proxy = m_proxies[idx];
+
+    if (proxy.batch.renderable != RenderableHandle::Invalid) {
+        m_retired.push_back(proxy.batch.renderable);
+    }
+
+    proxy.mesh.reset();
+    proxy.batch = RenderBatch{};
+    proxy.active = false;
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include "Common.h"
+#include "Geometry.h"
+#include "Renderer.h"
+
+#include <entt/entt.hpp>
+#include <memory>
+#include <vector>
+
+class Mesh;
+class OcclusionBuffer;
+class TransformSystem;
+
+// Merges renderables that can never move into a few large world space meshes.
+//
+// Anything without physics on itself or a parent is static. The bake sorts them into
+// ChunkSize cells, and every cell becomes one or more chunks with a submesh per material,
+// so drawing a chunk is one draw per material and culling only looks at chunk bounds.
+//
+// Chunks are grouped again into HlodCellSize cells with one simplified proxy mesh each.
+// Past the HLOD distance a cell draws its proxy instead of its chunks, so the far field
+// costs one draw per visible cell no matter what's in it.
+//
+// The scene can still change, so a chunk is released as soon as one of its entities moves
+// or changes model, and the proxy it belongs to with it. Its entities go back to being
+// drawn one instance at a time until the next bake.
+class StaticGeometry
+{
+public:
+    static constexpr float ChunkSize = 32.0f;
+    static constexpr float HlodCellSize = 128.0f;
+
+    // Proxies are simplified on a grid with this many cells along the longest side, which
+    // also keeps them under 65536 vertices
+    static constexpr u32 ProxyResolution = 32;
+
+    // Indices are 16 bits and the shadow pass draws the whole index buffer at once
+    static constexpr u32 MaxChunkVertices = 65536;
+
+    StaticGeometry(entt::registry& reg, TransformSystem& transforms);
+    ~StaticGeometry();
+
+    void onEntityChanged(entt::registry&, entt::entity);
+
+    // Destroying an entity removes StaticBatched before Renderable, so this is where its
+    // chunk is found
+    void onStaticBatchedDestroyed(entt::registry&, entt::entity);
+
+    // Bakes on the next update(), when the world transforms are up to date
+    void requestBake();
+
+    // Draws everything one instance at a time again
+    void clear();
+
+    // Releases the chunks whose entities changed and bakes if requested. Has to run after
+    // TransformSystem::update() and before SceneBvh::update().
+    void update();
+
+    // Creates the GPU buffers for new chunks and proxies and destroys the released ones.
+    // Chunks without a renderer are still culled, they just have nothing to draw.
+    void updateRenderables(IRenderer& renderer);
+
+    // Clears `out` and adds the chunks in the frustum, or the proxies of the cells farther
+    // than the HLOD distance from `viewer`. Skips the ones hidden behind the occluders if
+    // `occlusion` is set. The shadow pass should pass the main camera as the viewer, so
+    // the shadows match what's drawn.
+    void collectBatches(const math::Frustum& frustum, const DirectX::XMFLOAT3& viewer,
+        const OcclusionBuffer* occlusion, std::vector<const RenderBatch*>& out) const;
+
+    float getHlodDistance() const
+    {
+        return m_hlodDistance;
+    }
+
+    // Proxies are never used if this is 0
+    void setHlodDistance(float distance)
+    {
+        m_hlodDistance = distance;
+    }
+
+    u32 getChunkCount() const;
+    u32 getEntityCount() const;
+    u32 getProxyCount() const;
+
+private:
+    struct Chunk
+    {
+        math::Aabb bounds;
+        std::vector<entt::entity> entities;
+
+        // World space geometry, only kept until the renderable is created
+        std::unique_ptr<Mesh> mesh;
+
+        // One identity instance
+        RenderBatch batch;
+        u32 proxy = ~0u;
+        bool active = false;
+    };
+
+    // Released proxies keep their bounds and chunks, the chunks are just always drawn
+    struct Proxy
+    {
+        math::Aabb bounds;
+        std::vector<u32> chunks;
+        std::unique_ptr<Mesh> mesh;
+        RenderBatch batch;
+        bool active = false;
+    };
+
+    void bake();
+    void buildProxy(Proxy& proxy);
+    bool isStatic(entt::entity e) const;
+    void releaseChunk(u32 idx);
+    void releaseProxy(u32 idx);
+
+    entt::registry& m_reg;
+    TransformSystem& m_transforms;
+
+    std::vector<Chunk> m_chunks;
+    std::vector<Proxy> m_proxies;
+    std::vector<u32> m_released;
+    std::vector<RenderableHandle> m_retired;
+    float m_hlodDistance = 160.0f;
+    bool m_bakeRequested = false;
+
+    // releaseChunk removes StaticBatched itself, those removals aren't changes
+    bool m_releasing = false;
+};
@@ -0,0 +1,119 @@
+#include "TaskScheduler.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <fmt/format.h>
+
+TaskScheduler& getTaskScheduler()
+{
+    // Bullet gives every thread that calls into it an index and only has room for 64,
+    // leave space for the main and physics threads
+    constexpr u32 MaxWorkers = 62;
+
+    static TaskScheduler scheduler(std::clamp(std::thread::hardware_concurrency(), 1u, MaxWorkers + 1) - 1);
+    return scheduler;
+}
+
+TaskScheduler::TaskScheduler(u32 workerCount)
+{
+    m_workers.reserve(workerCount);
+
+    for (u32 i = 0; i < workerCount; i++) {
+        m_workers.emplace_back(&TaskScheduler::workerThread, this, i);
+    }
+}
+
+TaskScheduler::~TaskScheduler()
+{
+    {
+        std::lock_guard lock(m_mutex);
+        m_stopping = true;
+    }
+
+    m_wakeCv.notify_all();
+
+    for (auto& worker : m_workers) {
+        worker.join();
+    }
+}
+
+void TaskScheduler::parallelFor(u32 begin, u32 end, u32 grainSize, const Body& body)
+{
+    if (begin >= end) {
+        return;
+    }
+
+    grainSize = std::max(grainSize, 1u);
+
+    // Not worth waking anyone up
+    if (m_workers.empty() || end - begin <= grainSize) {
+        body(begin, end);
+        return;
+    }
+
+    Job job;
+    job.body = &body;
+    job.end = end;
+    job.grainSize = grainSize;
+    job.next = begin;
+    job.memoryTag = MemoryTracker::getThreadTag();
+
+    {
+        std::lock_guard lock(m_mutex);
+        m_jobs.push_back(&job);
+    }
+
+    m_wakeCv.notify_all();
+
+    runChunks(job);
+
+    // Every chunk has been claimed at this point, wait for the ones still running
+    std::unique_lock lock(m_mutex);
+    std::erase(m_jobs, &job);
+    m_doneCv.wait(lock, [&] { return job.workers == 0; });
+}
+
+void TaskScheduler::runChunks(Job& job)
+{
+    for (;;) {
+        auto first = job.next.fetch_add(job.grainSize);
+
+        if (first >= job.end) {
+            break;
+        }
+
+        (*job.body)(first, std::min(first + job.grainSize, job.end));
+    }
+}
+
+void TaskScheduler::workerThread(u32 index)
+{
+    getProfiler().setThreadName(fmt::format("Worker {}", index));
+
+    std::unique_lock lock(m_mutex);
+
+    for (;;) {
+        m_wakeCv.wait(lock, [&] { return m_stopping || !m_jobs.empty(); });
+
+        if (m_stopping) {
+            return;
+        }
+
+        auto job = m_jobs.front();
+        job->workers++;
+
+        lock.unlock();
+        {
+            PROFILE_SCOPE("TaskScheduler job");
+            MemoryScope memoryScope(job->memoryTag);
+            runChunks(*job);
+        }
+        lock.lock();
+
+        std::erase(m_jobs, job);
+
+        if (--job->workers == 0) {
+            m_doneCv.notify_all();
+        }
+    }
+}
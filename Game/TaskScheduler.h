@@ -0,0 +1,62 @@
+#pragma once
+
+#include "Common.h"
+#include "MemoryTracker.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed pool of worker threads for data parallel loops. The calling thread works on
+// its own loop too, so nested or concurrent parallelFor calls can't deadlock.
+class TaskScheduler
+{
+public:
+    // Called with [begin, end) chunks of at most grainSize items
+    using Body = std::function<void(u32 begin, u32 end)>;
+
+    explicit TaskScheduler(u32 workerCount);
+    ~TaskScheduler();
+
+    TaskScheduler(const TaskScheduler&) = delete;
+    TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+    void parallelFor(u32 begin, u32 end, u32 grainSize, const Body& body);
+
+    // Workers plus the calling thread
+    u32 getThreadCount() const
+    {
+        return u32(m_workers.size()) + 1;
+    }
+
+private:
+    struct Job
+    {
+        const Body* body = nullptr;
+        u32 end = 0;
+        u32 grainSize = 1;
+        std::atomic<u32> next = 0;
+
+        // Allocations in the workers are attributed to whoever started the job
+        MemoryTag memoryTag = MemoryTag::General;
+
+        // Workers currently inside this job, protected by m_mutex
+        u32 workers = 0;
+    };
+
+    static void runChunks(Job& job);
+    void workerThread(u32 index);
+
+    std::vector<std::thread> m_workers;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wakeCv;
+    std::condition_variable m_doneCv;
+    std::vector<Job*> m_jobs;
+    bool m_stopping = false;
+};
+
+TaskScheduler& getTaskScheduler();
@@ -0,0 +1,126 @@
+#include "MeshMerge.h"
+
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+using namespace DirectX;
+
+namespace
+{
+
+int g_failures = 0;
+
+void check(bool condition, const char* what)
+{
+    std::printf("%s %s\n", condition ? "ok  " : "FAIL", what);
+    g_failures += !condition;
+}
+
+struct SubMesh
+{
+    u32 baseVertex;
+    u32 baseIndex;
+    u32 numIndices;
+};
+
+// Laid out like Mesh::import writes a model with two materials: every submesh has its own
+// vertices and indices, and the indices already include the submesh's baseVertex
+struct TwoMaterialMesh
+{
+    std::vector<Vertex> vertices;
+    std::vector<u16> indices;
+    std::vector<SubMesh> subMeshes;
+};
+
+TwoMaterialMesh makeTwoMaterialMesh()
+{
+    TwoMaterialMesh mesh;
+
+    for (u32 s = 0; s < 2; s++) {
+        auto baseVertex = u32(mesh.vertices.size());
+        auto baseIndex = u32(mesh.indices.size());
+
+        // A quad at height s
+        for (u32 i = 0; i < 4; i++) {
+            Vertex v{};
+            v.Position = XMFLOAT3(i & 1 ? 1.0f : 0.0f, float(s), i & 2 ? 1.0f : 0.0f);
+            v.Normal = XMFLOAT3(0.0f, 1.0f, 0.0f);
+            mesh.vertices.push_back(v);
+        }
+
+        for (auto i : { 0, 1, 2, 2, 1, 3 }) {
+            mesh.indices.push_back(u16(baseVertex + i));
+        }
+
+        mesh.subMeshes.push_back(SubMesh{ baseVertex, baseIndex, 6 });
+    }
+
+    return mesh;
+}
+
+bool near(const XMFLOAT3& a, const XMFLOAT3& b)
+{
+    return std::abs(a.x - b.x) < 1e-4f && std::abs(a.y - b.y) < 1e-4f && std::abs(a.z - b.z) < 1e-4f;
+}
+
+// Bakes two copies of the mesh into one chunk the way StaticGeometry does, a piece per submesh
+void testBakeTwoSubmeshes()
+{
+    auto mesh = makeTwoMaterialMesh();
+
+    auto second = getVertexRange(mesh.indices, mesh.subMeshes[1].baseIndex, mesh.subMeshes[1].numIndices);
+    check(second.first == 4 && second.count == 4, "second submesh uses its own four vertices");
+
+    const XMMATRIX worlds[] = { XMMatrixTranslation(10.0f, 0.0f, 0.0f), XMMatrixTranslation(0.0f, 0.0f, -20.0f) };
+
+    std::vector<Vertex> vertices;
+    std::vector<u16> indices;
+
+    // Source vertex of every baked index, to compare against
+    std::vector<XMFLOAT3> expected;
+
+    for (const auto& world : worlds) {
+        for (const auto& subMesh : mesh.subMeshes) {
+            auto range = getVertexRange(mesh.indices, subMesh.baseIndex, subMesh.numIndices);
+            appendTransformed(mesh.vertices, mesh.indices, subMesh.baseIndex, subMesh.numIndices, range, world, vertices, indices);
+
+            for (u32 i = subMesh.baseIndex; i < subMesh.baseIndex + subMesh.numIndices; i++) {
+                XMFLOAT3 p;
+                XMStoreFloat3(&p, XMVector3Transform(XMLoadFloat3(&mesh.vertices[mesh.indices[i]].Position), world));
+                expected.push_back(p);
+            }
+        }
+    }
+
+    check(vertices.size() == 16, "every vertex is copied once per entity");
+    check(indices.size() == 24, "every index is copied once per entity");
+
+    bool inRange = true;
+    bool matches = true;
+
+    for (u32 i = 0; i < indices.size(); i++) {
+        if (indices[i] >= vertices.size()) {
+            inRange = false;
+            continue;
+        }
+
+        matches &= near(vertices[indices[i]].Position, expected[i]);
+    }
+
+    check(inRange, "baked indices stay inside the baked vertices");
+    check(matches, "baked triangles have the world space positions of the source triangles");
+}
+
+}
+
+int main()
+{
+    testBakeTwoSubmeshes();
+
+    if (g_failures > 0) {
+        std::printf("%d checks failed\n", g_failures);
+    }
+
+    return g_failures > 0 ? 1 : 0;
+}
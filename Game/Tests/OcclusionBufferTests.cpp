@@ -0,0 +1,98 @@
+#include "OcclusionBuffer.h"
+
+#include <cstdio>
+#include <vector>
+
+using namespace DirectX;
+
+namespace
+{
+
+int g_failures = 0;
+
+void check(bool condition, const char* what)
+{
+    std::printf("%s %s\n", condition ? "ok  " : "FAIL", what);
+    g_failures += !condition;
+}
+
+// Unit cube centered on the origin as a triangle list
+std::vector<XMFLOAT3> makeCube()
+{
+    static constexpr u8 Faces[6][4] = {
+        { 0, 2, 3, 1 }, { 4, 5, 7, 6 }, { 0, 1, 5, 4 },
+        { 2, 6, 7, 3 }, { 0, 4, 6, 2 }, { 1, 3, 7, 5 },
+    };
+
+    std::vector<XMFLOAT3> triangles;
+
+    for (const auto& face : Faces) {
+        for (auto i : { 0, 1, 2, 0, 2, 3 }) {
+            auto corner = face[i];
+            triangles.emplace_back(corner & 1 ? 0.5f : -0.5f, corner & 2 ? 0.5f : -0.5f, corner & 4 ? 0.5f : -0.5f);
+        }
+    }
+
+    return triangles;
+}
+
+math::Aabb makeBox(float x, float y, float z, float extent)
+{
+    return math::Aabb{ { x - extent, y - extent, z - extent }, { x + extent, y + extent, z + extent } };
+}
+
+// Eye height looking down +Z, with the same reverse-Z projection as the game camera
+XMMATRIX makeViewProjection()
+{
+    auto view = XMMatrixLookToLH(XMVectorSet(0.0f, 1.5f, 0.0f, 0.0f), XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+    auto projection = XMMatrixPerspectiveFovLH(1.0f, 16.0f / 9.0f, 1000.0f, 0.1f);
+
+    return XMMatrixMultiply(view, projection);
+}
+
+void testWall(const std::vector<XMFLOAT3>& cube)
+{
+    OcclusionBuffer buffer;
+    buffer.begin(makeViewProjection());
+
+    // 10 wide, 6 high and 1 deep, covering x in [-5, 5] at z = 10
+    buffer.addOccluder(cube, XMMatrixScaling(10.0f, 6.0f, 1.0f) * XMMatrixTranslation(0.0f, 1.5f, 10.0f));
+    buffer.rasterize();
+
+    check(!buffer.isVisible(makeBox(0.0f, 1.5f, 20.0f, 1.0f)), "box behind the wall is hidden");
+    check(buffer.isVisible(makeBox(0.0f, 1.5f, 5.0f, 1.0f)), "box in front of the wall is visible");
+
+    // The wall's edge is at x = 10.5 this far back, the box covers [10, 12]
+    check(buffer.isVisible(makeBox(11.0f, 1.5f, 20.0f, 1.0f)), "box peeking past the wall's edge is visible");
+
+    check(buffer.isVisible(math::Aabb{ { -5.0f, -1.5f, 9.5f }, { 5.0f, 4.5f, 10.5f } }), "wall doesn't hide its own bounds");
+}
+
+void testNearClippedGround(const std::vector<XMFLOAT3>& cube)
+{
+    OcclusionBuffer buffer;
+    buffer.begin(makeViewProjection());
+
+    // Runs under and behind the camera, so most of its triangles get clipped
+    buffer.addOccluder(cube, XMMatrixScaling(200.0f, 1.0f, 200.0f) * XMMatrixTranslation(0.0f, -0.5f, 0.0f));
+    buffer.rasterize();
+
+    check(!buffer.isVisible(makeBox(0.0f, -5.0f, 30.0f, 1.0f)), "box below a near clipped ground is hidden");
+    check(buffer.isVisible(makeBox(0.0f, 1.0f, 30.0f, 0.5f)), "box on top of the ground is visible");
+}
+
+}
+
+int main()
+{
+    auto cube = makeCube();
+
+    testWall(cube);
+    testNearClippedGround(cube);
+
+    if (g_failures > 0) {
+        std::printf("%d checks failed\n", g_failures);
+    }
+
+    return g_failures > 0 ? 1 : 0;
+}
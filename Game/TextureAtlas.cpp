@@ -0,0 +1,132 @@
+#include "pch.h"
+#include "TextureAtlas.h"
+
+#include <algorithm>
+#include <fmt/format.h>
+#include <fstream>
+#include <stdexcept>
+
+#include <cereal/types/string.hpp>
+#include <cereal/types/vector.hpp>
+#include <cereal/archives/binary.hpp>
+
+// imgui_draw.cpp keeps its copy static as well
+#define STB_RECT_PACK_IMPLEMENTATION
+#define STBRP_STATIC
+#include <imstb_rectpack.h>
+
+namespace
+{
+
+u32 alignUp(u32 value, u32 alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// Fills the whole packed rectangle, the padding repeats the closest edge texel
+void copyPadded(const TextureAtlas::Image& image, const stbrp_rect& rect, TextureAtlas::Page& page)
+{
+    for (u32 y = 0; y < rect.h; y++) {
+        auto srcY = u32(std::clamp(i32(y) - i32(TextureAtlas::Padding), 0, i32(image.height) - 1));
+
+        for (u32 x = 0; x < rect.w; x++) {
+            auto srcX = u32(std::clamp(i32(x) - i32(TextureAtlas::Padding), 0, i32(image.width) - 1));
+
+            const auto* src = &image.pixels[(srcY * image.width + srcX) * 4];
+            auto* dst = &page.pixels[((rect.y + y) * page.width + rect.x + x) * 4];
+
+            std::copy(src, src + 4, dst);
+        }
+    }
+}
+
+}
+
+TextureAtlas TextureAtlas::build(std::string_view name, std::vector<Image> images)
+{
+    TextureAtlas atlas;
+    atlas.m_name = name;
+
+    std::vector<stbrp_rect> rects;
+
+    for (u32 i = 0; i < images.size(); i++) {
+        const auto& image = images[i];
+
+        if (image.width == 0 || image.height == 0 || image.width > MaxTextureSize || image.height > MaxTextureSize) {
+            throw std::runtime_error(fmt::format("Texture {} is {}x{}, atlas textures have to be at most {}x{}",
+                image.name, image.width, image.height, MaxTextureSize, MaxTextureSize));
+        }
+
+        // Multiples of the padding keep every position aligned to it as well
+        stbrp_rect rect{};
+        rect.id = i32(i);
+        rect.w = stbrp_coord(alignUp(image.width + Padding * 2, Padding));
+        rect.h = stbrp_coord(alignUp(image.height + Padding * 2, Padding));
+        rects.push_back(rect);
+    }
+
+    std::vector<stbrp_node> nodes(PageSize);
+
+    // Whatever doesn't fit goes to the next page
+    while (!rects.empty()) {
+        stbrp_context context;
+        stbrp_init_target(&context, PageSize, PageSize, nodes.data(), i32(nodes.size()));
+        stbrp_pack_rects(&context, rects.data(), i32(rects.size()));
+
+        auto packed = std::stable_partition(rects.begin(), rects.end(), [](const stbrp_rect& r) { return r.was_packed != 0; });
+
+        auto pageIdx = u32(atlas.m_pages.size());
+        auto& page = atlas.m_pages.emplace_back();
+        page.width = PageSize;
+
+        // The last page is usually mostly empty
+        for (auto it = rects.begin(); it != packed; ++it) {
+            page.height = std::max(page.height, u32(it->y + it->h));
+        }
+
+        page.pixels.resize(size_t(page.width) * page.height * 4);
+
+        for (auto it = rects.begin(); it != packed; ++it) {
+            const auto& image = images[it->id];
+            copyPadded(image, *it, page);
+
+            auto& entry = atlas.m_entries.emplace_back();
+            entry.name = image.name;
+            entry.page = pageIdx;
+            entry.scaleOffset = DirectX::XMFLOAT4(
+                float(image.width) / float(page.width),
+                float(image.height) / float(page.height),
+                float(it->x + Padding) / float(page.width),
+                float(it->y + Padding) / float(page.height));
+        }
+
+        rects.erase(rects.begin(), packed);
+    }
+
+    return atlas;
+}
+
+const TextureAtlas::Entry* TextureAtlas::find(std::string_view name) const
+{
+    auto it = std::find_if(m_entries.begin(), m_entries.end(), [&](const Entry& e) { return e.name == name; });
+    return it != m_entries.end() ? &*it : nullptr;
+}
+
+std::string TextureAtlas::getPageName(u32 page) const
+{
+    return fmt::format("{}#atlas{}", m_name, page);
+}
+
+void TextureAtlas::load(const std::filesystem::path& path)
+{
+    std::ifstream input(path, std::ios::binary);
+    cereal::BinaryInputArchive archive(input);
+    archive(*this);
+}
+
+void TextureAtlas::save(const std::filesystem::path& path)
+{
+    std::ofstream output(path, std::ios::binary);
+    cereal::BinaryOutputArchive archive(output);
+    archive(*this);
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "Common.h"
+
+#include <DirectXMath.h>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Small textures packed into a few large pages, so props with different textures can
+// share one binding and merge into fewer draws.
+//
+// Every texture is surrounded by copies of its edge texels and starts on a multiple of
+// Padding, so the first MipLevels mips never blend two textures together. Only works for
+// UVs inside [0, 1], a texture that wraps would sample its neighbours.
+class TextureAtlas
+{
+public:
+    static constexpr u32 PageSize = 2048;
+    static constexpr u32 MaxTextureSize = 256;
+    static constexpr u32 Padding = 8;
+
+    // Past this a texel covers more than the padding
+    static constexpr u32 MipLevels = 4;
+
+    // RGBA8
+    struct Image
+    {
+        std::string name;
+        u32 width = 0;
+        u32 height = 0;
+        std::vector<u8> pixels;
+    };
+
+    struct Page
+    {
+        u32 width = 0;
+        u32 height = 0;
+        std::vector<u8> pixels;
+
+        template<typename Archive>
+        void serialize(Archive& archive)
+        {
+            archive(width, height, pixels);
+        }
+    };
+
+    struct Entry
+    {
+        std::string name;
+        u32 page = 0;
+
+        // uv * xy + zw
+        DirectX::XMFLOAT4 scaleOffset{ 1.0f, 1.0f, 0.0f, 0.0f };
+
+        template<typename Archive>
+        void serialize(Archive& archive)
+        {
+            archive(name, page, scaleOffset.x, scaleOffset.y, scaleOffset.z, scaleOffset.w);
+        }
+    };
+
+    // Throws if an image is larger than MaxTextureSize
+    static TextureAtlas build(std::string_view name, std::vector<Image> images);
+
+    const Entry* find(std::string_view name) const;
+
+    // The material name meshes use for the page
+    std::string getPageName(u32 page) const;
+
+    const std::vector<Page>& getPages() const
+    {
+        return m_pages;
+    }
+
+    const std::vector<Entry>& getEntries() const
+    {
+        return m_entries;
+    }
+
+    void load(const std::filesystem::path& path);
+    void save(const std::filesystem::path& path);
+
+private:
+    template<typename Archive>
+    friend void serialize(Archive& archive, TextureAtlas& atlas)
+    {
+        archive(atlas.m_name, atlas.m_pages, atlas.m_entries);
+    }
+
+    std::string m_name;
+    std::vector<Page> m_pages;
+    std::vector<Entry> m_entries;
+};
@@ -0,0 +1,248 @@
+#include "pch.h"
+
+#include "TransformSystem.h"
+
+#include "Components/Transform.h"
+#include "Components/Hierarchy.h"
+
+#include <algorithm>
+#include <utility>
+
+using namespace DirectX;
+
+static u32 entityIndex(entt::entity e)
+{
+    return u32(entt::to_integral(entt::registry::entity(e)));
+}
+
+// (parent, child)
+using Link = std::pair<entt::entity, entt::entity>;
+
+struct LinkParentComparison
+{
+    bool operator()(const Link& l, entt::entity e) const { return l.first < e; }
+    bool operator()(entt::entity e, const Link& l) const { return e < l.first; }
+};
+
+TransformSystem::TransformSystem(entt::registry& reg) :
+    m_reg(reg)
+{
+}
+
+void TransformSystem::onTransformConstructed(entt::registry& reg, entt::entity e)
+{
+    reg.emplace_or_replace<components::WorldTransform>(e);
+    m_orderDirty = true;
+}
+
+void TransformSystem::onTransformUpdated(entt::registry&, entt::entity e)
+{
+    m_changed.push_back(e);
+}
+
+void TransformSystem::onTransformDestroyed(entt::registry& reg, entt::entity e)
+{
+    reg.remove_if_exists<components::WorldTransform>(e);
+    m_orderDirty = true;
+}
+
+void TransformSystem::onHierarchyChanged(entt::registry&, entt::entity)
+{
+    m_orderDirty = true;
+}
+
+void TransformSystem::update()
+{
+    if (m_orderDirty) {
+        rebuildOrder();
+        m_dirty.assign(m_nodes.size(), 1);
+        m_orderDirty = false;
+    } else {
+        for (auto e : m_changed) {
+            if (auto node = findNode(e); node != InvalidNode) {
+                m_dirty[node] = 1;
+            }
+        }
+    }
+
+    m_changed.clear();
+    m_updated.clear();
+    m_dirtyNodes.clear();
+
+    for (u32 i = 0; i < u32(m_nodes.size()); i++) {
+        const auto& node = m_nodes[i];
+
+        if (node.parent != NoParent) {
+            m_dirty[i] |= m_dirty[node.parent];
+        }
+
+        if (m_dirty[i]) {
+            m_dirtyNodes.push_back(i);
+        }
+    }
+
+    // The local matrices don't depend on each other, only the parent multiply has to go in order
+    m_locals.resize(u32(m_dirtyNodes.size()));
+
+    for (u32 i = 0; i < u32(m_dirtyNodes.size()); i++) {
+        const auto& t = m_reg.get<components::Transform>(m_nodes[m_dirtyNodes[i]].entity);
+        m_locals.set(i, t.position, t.rotationQuat, t.scale);
+    }
+
+    math::composeTransforms(m_locals, m_localMatrices);
+
+    for (u32 i = 0; i < u32(m_dirtyNodes.size()); i++) {
+        const auto& node = m_nodes[m_dirtyNodes[i]];
+
+        auto world = m_localMatrices.get(i).mat;
+
+        if (node.parent != NoParent) {
+            const auto& parent = m_reg.get<components::WorldTransform>(m_nodes[node.parent].entity);
+            world = XMMatrixMultiply(world, parent.matrix);
+        }
+
+        m_reg.get<components::WorldTransform>(node.entity).matrix = world;
+        m_updated.push_back(node.entity);
+    }
+
+    std::fill(m_dirty.begin(), m_dirty.end(), u8(0));
+}
+
+void TransformSystem::setParent(entt::entity child, entt::entity parent)
+{
+    if (parent != entt::null && isAncestor(child, parent)) {
+        return;
+    }
+
+    auto parentWorld = XMMatrixIdentity();
+
+    if (parent != entt::null) {
+        parentWorld = m_reg.get<components::WorldTransform>(parent).matrix;
+    }
+
+    const auto& world = m_reg.get<components::WorldTransform>(child).matrix;
+    auto local = XMMatrixMultiply(world, XMMatrixInverse(nullptr, parentWorld));
+
+    XMVECTOR scale, rotation, translation;
+    if (XMMatrixDecompose(&scale, &rotation, &translation, local)) {
+        m_reg.patch<components::Transform>(child, [&](components::Transform& t) {
+            XMStoreFloat3(&t.position, translation);
+            XMStoreFloat3(&t.scale, scale);
+            t.rotationQuat = rotation;
+        });
+    }
+
+    if (parent == entt::null) {
+        m_reg.remove_if_exists<components::Hierarchy>(child);
+    } else {
+        m_reg.emplace_or_replace<components::Hierarchy>(child, components::Hierarchy{ parent });
+    }
+}
+
+entt::entity TransformSystem::getParent(entt::entity e) const
+{
+    if (const auto h = m_reg.try_get<components::Hierarchy>(e)) {
+        if (m_reg.valid(h->parent) && m_reg.has<components::Transform>(h->parent)) {
+            return h->parent;
+        }
+    }
+
+    return entt::null;
+}
+
+bool TransformSystem::isAncestor(entt::entity ancestor, entt::entity e) const
+{
+    // The depth limit guards against cycles in hand-edited scene files
+    for (size_t depth = 0; e != entt::null && depth <= m_reg.size(); depth++) {
+        if (e == ancestor) {
+            return true;
+        }
+
+        e = getParent(e);
+    }
+
+    return false;
+}
+
+XMMATRIX TransformSystem::worldToLocal(entt::entity e, FXMMATRIX world) const
+{
+    if (auto parent = getParent(e); parent != entt::null) {
+        const auto& parentWorld = m_reg.get<components::WorldTransform>(parent).matrix;
+        return XMMatrixMultiply(world, XMMatrixInverse(nullptr, parentWorld));
+    }
+
+    return world;
+}
+
+void TransformSystem::rebuildOrder()
+{
+    m_nodes.clear();
+    std::fill(m_nodeIndex.begin(), m_nodeIndex.end(), InvalidNode);
+
+    // Sorted so the children of a node are contiguous
+    std::vector<Link> links;
+
+    auto place = [&](entt::entity e, u32 parent) {
+        auto idx = entityIndex(e);
+
+        if (idx >= m_nodeIndex.size()) {
+            m_nodeIndex.resize(idx + 1, InvalidNode);
+        }
+
+        if (m_nodeIndex[idx] == InvalidNode) {
+            m_nodeIndex[idx] = u32(m_nodes.size());
+            m_nodes.push_back(Node{ e, parent });
+        }
+    };
+
+    auto placeChildren = [&](u32 first) {
+        for (u32 i = first; i < u32(m_nodes.size()); i++) {
+            auto parent = m_nodes[i].entity;
+
+            auto [begin, end] = std::equal_range(links.cbegin(), links.cend(), parent, LinkParentComparison{});
+
+            for (auto it = begin; it != end; ++it) {
+                place(it->second, i);
+            }
+        }
+    };
+
+    m_reg.view<components::Transform>()
+        .each([&](entt::entity e, const components::Transform&) {
+            if (auto parent = getParent(e); parent != entt::null) {
+                links.emplace_back(parent, e);
+            } else {
+                place(e, NoParent);
+            }
+        });
+
+    std::sort(links.begin(), links.end());
+
+    placeChildren(0);
+
+    // Anything left over is part of a cycle, break it by treating the entity as a root
+    for (const auto& [_, child] : links) {
+        if (findNode(child) == InvalidNode) {
+            auto first = u32(m_nodes.size());
+            place(child, NoParent);
+            placeChildren(first);
+        }
+    }
+}
+
+u32 TransformSystem::findNode(entt::entity e) const
+{
+    auto idx = entityIndex(e);
+
+    if (idx >= m_nodeIndex.size()) {
+        return InvalidNode;
+    }
+
+    auto node = m_nodeIndex[idx];
+
+    if (node == InvalidNode || m_nodes[node].entity != e) {
+        return InvalidNode;
+    }
+
+    return node;
+}
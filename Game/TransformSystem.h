@@ -0,0 +1,74 @@
+#pragma once
+
+#include "Common.h"
+#include "MathBatch.h"
+
+#include <DirectXMath.h>
+#include <entt/entt.hpp>
+#include <vector>
+
+// Keeps components::WorldTransform in sync with Transform and Hierarchy.
+//
+// Entities are stored in breadth-first order so parents are always updated before
+// their children. Changing a Transform only flags that entity, the flag is pushed
+// down to the children during update() so only the changed subtrees get recomputed.
+class TransformSystem
+{
+public:
+    TransformSystem(entt::registry& reg);
+
+    void onTransformConstructed(entt::registry&, entt::entity);
+    void onTransformUpdated(entt::registry&, entt::entity);
+    void onTransformDestroyed(entt::registry&, entt::entity);
+    void onHierarchyChanged(entt::registry&, entt::entity);
+
+    void update();
+
+    // Entities whose WorldTransform was recomputed by the last update()
+    const std::vector<entt::entity>& getUpdated() const
+    {
+        return m_updated;
+    }
+
+    // Reparents the entity while keeping its world transform. Passing entt::null
+    // makes it a root again. Does nothing if the parent is a descendant of the child.
+    void setParent(entt::entity child, entt::entity parent);
+    entt::entity getParent(entt::entity) const;
+
+    // True if `ancestor` is `e` or any of its parents
+    bool isAncestor(entt::entity ancestor, entt::entity e) const;
+
+    // Converts a world space matrix into the space of the entity's parent
+    DirectX::XMMATRIX worldToLocal(entt::entity e, DirectX::FXMMATRIX world) const;
+
+private:
+    static constexpr u32 NoParent = ~0u;
+    static constexpr u32 InvalidNode = ~0u;
+
+    struct Node
+    {
+        entt::entity entity = entt::null;
+        u32 parent = NoParent;
+    };
+
+    void rebuildOrder();
+    u32 findNode(entt::entity) const;
+
+    entt::registry& m_reg;
+
+    // Breadth-first, a node's parent index is always smaller than its own
+    std::vector<Node> m_nodes;
+    std::vector<u8> m_dirty;
+
+    // Entity index -> node index
+    std::vector<u32> m_nodeIndex;
+
+    std::vector<entt::entity> m_changed;
+    std::vector<entt::entity> m_updated;
+    bool m_orderDirty = true;
+
+    // Scratch for update(), the dirty nodes in order and their composed local matrices
+    std::vector<u32> m_dirtyNodes;
+    math::TransformArray<math::Model, math::World> m_locals;
+    math::AffineArray<math::Model, math::World> m_localMatrices;
+};
@@ -0,0 +1,315 @@
+#include "pch.h"
+
+#include "TriangleBvh.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <utility>
+
+using namespace DirectX;
+using math::Aabb;
+
+namespace
+{
+
+constexpr u32 BinCount = 16;
+
+XMFLOAT3 sub(const XMFLOAT3& a, const XMFLOAT3& b)
+{
+    return XMFLOAT3(a.x - b.x, a.y - b.y, a.z - b.z);
+}
+
+XMFLOAT3 cross(const XMFLOAT3& a, const XMFLOAT3& b)
+{
+    return XMFLOAT3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+}
+
+float dot(const XMFLOAT3& a, const XMFLOAT3& b)
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+float component(const XMFLOAT3& v, int axis)
+{
+    return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+Aabb pointBox(const XMFLOAT3& p)
+{
+    return Aabb{ p, p };
+}
+
+Aabb emptyBox()
+{
+    return Aabb{ { FLT_MAX, FLT_MAX, FLT_MAX }, { -FLT_MAX, -FLT_MAX, -FLT_MAX } };
+}
+
+}
+
+void TriangleBvh::build(const std::vector<XMFLOAT3>& positions, const std::vector<u16>& indices)
+{
+    m_nodes.clear();
+    m_triangles.clear();
+
+    m_triangles.reserve(indices.size() / 3);
+
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        auto i0 = indices[i + 0];
+        auto i1 = indices[i + 1];
+        auto i2 = indices[i + 2];
+
+        if (i0 >= positions.size() || i1 >= positions.size() || i2 >= positions.size()) {
+            continue;
+        }
+
+        m_triangles.push_back(Triangle{ positions[i0], positions[i1], positions[i2] });
+    }
+
+    if (m_triangles.empty()) {
+        return;
+    }
+
+    std::vector<XMFLOAT3> centroids;
+    centroids.reserve(m_triangles.size());
+
+    for (const auto& t : m_triangles) {
+        centroids.emplace_back(
+            (t.v0.x + t.v1.x + t.v2.x) / 3.0f,
+            (t.v0.y + t.v1.y + t.v2.y) / 3.0f,
+            (t.v0.z + t.v1.z + t.v2.z) / 3.0f);
+    }
+
+    m_nodes.reserve(2 * m_triangles.size() / MaxLeafSize + 1);
+    m_nodes.push_back(Node{ {}, 0, u32(m_triangles.size()) });
+
+    // (node, depth)
+    std::vector<std::pair<u32, u32>> pending{ { 0, 0 } };
+
+    while (!pending.empty()) {
+        auto [node, depth] = pending.back();
+        pending.pop_back();
+
+        split(node, depth, centroids);
+
+        if (!m_nodes[node].isLeaf()) {
+            pending.emplace_back(m_nodes[node].first, depth + 1);
+            pending.emplace_back(m_nodes[node].first + 1, depth + 1);
+        }
+    }
+}
+
+// Computes the node's bounds and splits it with a binned surface area heuristic if
+// that's cheaper than keeping it as a leaf
+void TriangleBvh::split(u32 nodeIdx, u32 depth, std::vector<XMFLOAT3>& centroids)
+{
+    auto first = m_nodes[nodeIdx].first;
+    auto count = m_nodes[nodeIdx].count;
+
+    auto box = emptyBox();
+    auto centroidBox = emptyBox();
+
+    for (u32 i = first; i < first + count; i++) {
+        const auto& t = m_triangles[i];
+        box = box.merged(pointBox(t.v0)).merged(pointBox(t.v1)).merged(pointBox(t.v2));
+        centroidBox = centroidBox.merged(pointBox(centroids[i]));
+    }
+
+    m_nodes[nodeIdx].box = box;
+
+    if (count <= MaxLeafSize || depth >= MaxDepth) {
+        return;
+    }
+
+    auto extent = sub(centroidBox.max, centroidBox.min);
+
+    int axis = 0;
+    if (extent.y > component(extent, axis)) axis = 1;
+    if (extent.z > component(extent, axis)) axis = 2;
+
+    auto axisMin = component(centroidBox.min, axis);
+    auto axisExtent = component(extent, axis);
+
+    // All the centroids are in the same spot, nothing to split
+    if (axisExtent <= 0.0f) {
+        return;
+    }
+
+    auto scale = float(BinCount) / axisExtent;
+
+    auto binOf = [&](u32 i) {
+        return std::min(BinCount - 1, u32((component(centroids[i], axis) - axisMin) * scale));
+    };
+
+    struct Bin
+    {
+        Aabb box = emptyBox();
+        u32 count = 0;
+    };
+
+    std::array<Bin, BinCount> bins;
+
+    for (u32 i = first; i < first + count; i++) {
+        const auto& t = m_triangles[i];
+        auto& bin = bins[binOf(i)];
+
+        bin.box = bin.box.merged(pointBox(t.v0)).merged(pointBox(t.v1)).merged(pointBox(t.v2));
+        bin.count++;
+    }
+
+    // Sweep from the right to get the cost of everything after each plane
+    std::array<float, BinCount> rightCost{};
+    {
+        auto right = emptyBox();
+        u32 rightCount = 0;
+
+        for (u32 i = BinCount - 1; i > 0; i--) {
+            right = right.merged(bins[i].box);
+            rightCount += bins[i].count;
+            rightCost[i] = rightCount ? right.area() * float(rightCount) : 0.0f;
+        }
+    }
+
+    auto bestCost = FLT_MAX;
+    u32 bestPlane = 0;
+    {
+        auto left = emptyBox();
+        u32 leftCount = 0;
+
+        for (u32 plane = 1; plane < BinCount; plane++) {
+            left = left.merged(bins[plane - 1].box);
+            leftCount += bins[plane - 1].count;
+
+            if (leftCount == 0 || leftCount == count) {
+                continue;
+            }
+
+            auto cost = left.area() * float(leftCount) + rightCost[plane];
+
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestPlane = plane;
+            }
+        }
+    }
+
+    if (bestPlane == 0 || bestCost >= box.area() * float(count)) {
+        return;
+    }
+
+    // Partition the triangles and their centroids together
+    auto i = first;
+    auto j = first + count;
+
+    while (i < j) {
+        if (binOf(i) < bestPlane) {
+            i++;
+        } else {
+            j--;
+            std::swap(m_triangles[i], m_triangles[j]);
+            std::swap(centroids[i], centroids[j]);
+        }
+    }
+
+    auto leftCount = i - first;
+    auto children = u32(m_nodes.size());
+
+    m_nodes.push_back(Node{ {}, first, leftCount });
+    m_nodes.push_back(Node{ {}, i, count - leftCount });
+
+    m_nodes[nodeIdx].first = children;
+    m_nodes[nodeIdx].count = 0;
+}
+
+float TriangleBvh::intersectTriangle(const XMFLOAT3& v0, const XMFLOAT3& v1, const XMFLOAT3& v2,
+    const XMFLOAT3& origin, const XMFLOAT3& direction)
+{
+    auto e1 = sub(v1, v0);
+    auto e2 = sub(v2, v0);
+    auto p = cross(direction, e2);
+    auto det = dot(e1, p);
+
+    // Parallel to the triangle, both sides count so the sign doesn't matter
+    if (std::fabs(det) < 1e-12f) {
+        return -1.0f;
+    }
+
+    auto invDet = 1.0f / det;
+    auto s = sub(origin, v0);
+    auto u = dot(s, p) * invDet;
+
+    if (u < 0.0f || u > 1.0f) {
+        return -1.0f;
+    }
+
+    auto q = cross(s, e1);
+    auto v = dot(direction, q) * invDet;
+
+    if (v < 0.0f || u + v > 1.0f) {
+        return -1.0f;
+    }
+
+    return dot(e2, q) * invDet;
+}
+
+float TriangleBvh::raycast(const XMFLOAT3& origin, const XMFLOAT3& direction, float maxDistance) const
+{
+    if (m_nodes.empty()) {
+        return -1.0f;
+    }
+
+    XMFLOAT3 invDir(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+
+    auto closest = maxDistance;
+    bool hit = false;
+
+    // Every level adds at most one pending node
+    std::array<u32, MaxDepth + 2> stack;
+    u32 size = 0;
+
+    if (m_nodes[0].box.intersectRay(origin, invDir, closest) < 0.0f) {
+        return -1.0f;
+    }
+
+    stack[size++] = 0;
+
+    while (size > 0) {
+        const auto& node = m_nodes[stack[--size]];
+
+        if (node.isLeaf()) {
+            for (u32 i = node.first; i < node.first + node.count; i++) {
+                const auto& tri = m_triangles[i];
+                auto t = intersectTriangle(tri.v0, tri.v1, tri.v2, origin, direction);
+
+                if (t >= 0.0f && t <= closest) {
+                    closest = t;
+                    hit = true;
+                }
+            }
+
+            continue;
+        }
+
+        auto left = node.first;
+        auto right = node.first + 1;
+
+        auto tLeft = m_nodes[left].box.intersectRay(origin, invDir, closest);
+        auto tRight = m_nodes[right].box.intersectRay(origin, invDir, closest);
+
+        // Push the far child first so the near one is visited first and shrinks the ray
+        if (tLeft >= 0.0f && tRight >= 0.0f) {
+            if (tLeft < tRight) {
+                std::swap(left, right);
+            }
+
+            stack[size++] = left;
+            stack[size++] = right;
+        } else if (tLeft >= 0.0f) {
+            stack[size++] = left;
+        } else if (tRight >= 0.0f) {
+            stack[size++] = right;
+        }
+    }
+
+    return hit ? closest : -1.0f;
+}
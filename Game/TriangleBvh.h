@@ -0,0 +1,70 @@
+#pragma once
+
+#include "Common.h"
+#include "Geometry.h"
+
+#include <DirectXMath.h>
+#include <vector>
+
+// Static BVH over the triangles of a mesh for exact ray picking. Built once when
+// the model is added to the asset registry, everything is in model space.
+class TriangleBvh
+{
+public:
+    // Triangles per leaf
+    static constexpr u32 MaxLeafSize = 4;
+
+    // Deeper nodes are kept as leaves, this bounds the traversal stack
+    static constexpr u32 MaxDepth = 64;
+
+    TriangleBvh() = default;
+
+    // `indices` is a triangle list into `positions`
+    void build(const std::vector<DirectX::XMFLOAT3>& positions, const std::vector<u16>& indices);
+
+    // Distance to the closest triangle along the ray in units of the direction's length,
+    // negative if nothing was hit within maxDistance. Both sides of the triangles count.
+    float raycast(const DirectX::XMFLOAT3& origin, const DirectX::XMFLOAT3& direction, float maxDistance) const;
+
+    // Moller-Trumbore, returns the distance along the ray or a negative value on a miss
+    static float intersectTriangle(const DirectX::XMFLOAT3& v0, const DirectX::XMFLOAT3& v1,
+        const DirectX::XMFLOAT3& v2, const DirectX::XMFLOAT3& origin, const DirectX::XMFLOAT3& direction);
+
+    u32 getTriangleCount() const
+    {
+        return u32(m_triangles.size());
+    }
+
+    bool empty() const
+    {
+        return m_nodes.empty();
+    }
+
+private:
+    struct Node
+    {
+        math::Aabb box;
+
+        // Leaves have the first triangle in `first`, inner nodes have their
+        // left child there and the right one right after it
+        u32 first = 0;
+        u32 count = 0;
+
+        bool isLeaf() const
+        {
+            return count > 0;
+        }
+    };
+
+    struct Triangle
+    {
+        DirectX::XMFLOAT3 v0;
+        DirectX::XMFLOAT3 v1;
+        DirectX::XMFLOAT3 v2;
+    };
+
+    void split(u32 node, u32 depth, std::vector<DirectX::XMFLOAT3>& centroids);
+
+    std::vector<Node> m_nodes;
+    std::vector<Triangle> m_triangles;
+};
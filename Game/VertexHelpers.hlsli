@@ -7,9 +7,8 @@
 #define OFFSET_COLOR	24
 #define OFFSET_TEXCOORD	40
 
-#define INSTANCE_STRIDE				128
+#define INSTANCE_STRIDE				48
 #define OFFSET_WORLD				0
-#define OFFSET_WORLD_INV_TRANSPOSE	64
 
 float3 loadPosition(ByteAddressBuffer vb, uint idx)
 {
@@ -41,14 +40,30 @@ matrix loadMatrix(ByteAddressBuffer vb, uint offset)
 	return transpose(matrix(c0, c1, c2, c3));
 }
 
-matrix loadWorldMatrix(ByteAddressBuffer ib, uint idx)
+// Transposed 3x4 world matrix, mul(world, float4(p, 1.0f)) gives the world position
+float3x4 loadWorldMatrix(ByteAddressBuffer ib, uint idx)
 {
-	return loadMatrix(ib, idx * INSTANCE_STRIDE + OFFSET_WORLD);
+	uint offset = idx * INSTANCE_STRIDE + OFFSET_WORLD;
+
+	float4 r0 = asfloat(ib.Load4(offset + 0));
+	float4 r1 = asfloat(ib.Load4(offset + 16));
+	float4 r2 = asfloat(ib.Load4(offset + 32));
+
+	return float3x4(r0, r1, r2);
 }
 
-matrix loadWorldInvTranspose(ByteAddressBuffer ib, uint idx)
+// Inverse transpose of the world matrix times its determinant, which is just the cross
+// products of its axes. The scale doesn't matter since normals get normalized anyway,
+// the sign of the determinant keeps mirrored instances facing the right way.
+float3 transformNormal(float3x4 world, float3 n)
 {
-	return loadMatrix(ib, idx * INSTANCE_STRIDE + OFFSET_WORLD_INV_TRANSPOSE);
+	float3 x = float3(world[0].x, world[1].x, world[2].x);
+	float3 y = float3(world[0].y, world[1].y, world[2].y);
+	float3 z = float3(world[0].z, world[1].z, world[2].z);
+
+	float3 result = n.x * cross(y, z) + n.y * cross(z, x) + n.z * cross(x, y);
+
+	return dot(x, cross(y, z)) < 0.0f ? -result : result;
 }
 
 #endif